@@ -9,10 +9,18 @@ using namespace std;
 using namespace envire::icp;
 using namespace Eigen;
 
+ICPLocalization::ICPLocalization()
+    : windowPoints( 1 << 12 ), droppedPoints( 0 )
+{
+}
+
 void ICPLocalization::initializePointCloud(ICPPointCloudConfiguration conf_point_cloud){
   
     this->conf_point_cloud = conf_point_cloud; 
     scansWithTransforms.clear();
+    windowPoints.clear();
+    scanStarts.clear();
+    droppedPoints = 0;
         
     lastScanIndex = 0;
     scanCount = 0; 
@@ -38,8 +46,24 @@ void ICPLocalization::addLaserScan(Eigen::Affine3d body2Odo, Eigen::Affine3d bod
     lat.body2World = body2World;
     lat.laser2Body = laser2Body;
     scansWithTransforms.push_back(lat);
+
+    scanStarts.push_back( droppedPoints + windowPoints.size() );
+    std::vector<Eigen::Vector3d> line = scan_reading.convertScanToPointCloud( body2Odo * laser2Body );
+    windowPoints.append( line.begin(), line.end() );
+
     while( scansWithTransforms.size() > static_cast<unsigned long>(conf_point_cloud.lines_per_point_cloud) )
+    {
 	scansWithTransforms.pop_front();
+	scanStarts.pop_front();
+    }
+
+    // drop the chunks which only hold points of scans that left the window
+    while( windowPoints.getChunkCount() > 0
+	    && (scanStarts.empty() || droppedPoints + windowPoints.getChunkFill( 0 ) <= scanStarts.front()) )
+    {
+	droppedPoints += windowPoints.getChunkFill( 0 );
+	windowPoints.dropFront();
+    }
     
     scanCount++;
   
@@ -133,7 +157,6 @@ ICPInputData ICPLocalization::generatePointcloud()
 {
     envire::Pointcloud *pc = new envire::Pointcloud();
 
-    Eigen::Affine3d odo2World;
     base::Time pointCloudTime; 
     base::Time lastLSTime; 
 
@@ -141,18 +164,17 @@ ICPInputData ICPLocalization::generatePointcloud()
 	
 	const LaserAndTransform &lastScan = scansWithTransforms.back();
 	curBody2World = lastScan.body2World;
-	odo2World = curBody2World * lastScan.body2Odo.inverse();
 	pointCloudTime = lastScan.scan.time;
 
-	for(std::deque<LaserAndTransform >::const_iterator it = scansWithTransforms.begin(); it != scansWithTransforms.end(); it++) {
-	    // transform in vector is body2Odo
-	    //(odo2World * it->transform) == body2World
-	    const Eigen::Affine3d laser2World( (odo2World * it->body2Odo)  * it->laser2Body );
-	    const Eigen::Affine3d laser2CurBody( curBody2World.inverse() * laser2World );
-
-	    std::vector<Eigen::Vector3d> line = it->scan.convertScanToPointCloud( laser2CurBody ); 
-	    std::copy( line.begin(), line.end(), std::back_inserter( pc->vertices ) );
-	}
+	// the points are stored in the odometry frame. With
+	// odo2World = curBody2World * lastScan.body2Odo.inverse(), the
+	// transformation into the current body frame is
+	// curBody2World.inverse() * odo2World == lastScan.body2Odo.inverse()
+	const Eigen::Affine3d odo2CurBody( lastScan.body2Odo.inverse() );
+	const size_t first = scanStarts.front() - droppedPoints;
+	pc->vertices.resize( windowPoints.size() - first );
+	for( size_t i = first; i < windowPoints.size(); i++ )
+	    pc->vertices[i - first] = odo2CurBody * windowPoints[i];
     }
   
     ICPInputData newData;
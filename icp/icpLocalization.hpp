@@ -16,6 +16,7 @@
 #include "icp.hpp"
 #include <envire/Core.hpp>
 #include <envire/maps/TriMesh.hpp>
+#include <envire/tools/ChunkedBuffer.hpp>
 
 #include "icpConfigurationTypes.hpp"
 
@@ -86,6 +87,14 @@ class ICPLocalization
 	int scanCount;
 		 
 	std::deque<LaserAndTransform, Eigen::aligned_allocator<LaserAndTransform> > scansWithTransforms;
+
+	// the points of the scans in scansWithTransforms, in the odometry
+	// frame, so that each scan is only converted once
+	envire::ChunkedBuffer<Eigen::Vector3d> windowPoints;
+	// number of points added before the first point of each scan in
+	// scansWithTransforms, and before the first point in windowPoints
+	std::deque<size_t> scanStarts;
+	size_t droppedPoints;
 	
 	void addLaserScan(Eigen::Affine3d body2Odo, Eigen::Affine3d body2World, Eigen::Affine3d laser2Body, const ::base::samples::LaserScan &scan_reading);
 	
@@ -95,7 +104,8 @@ class ICPLocalization
 	
 	envire::FrameNode *fn;
     public: 
-  
+	ICPLocalization();
+
 	void removeLastSavedPointCloud();
 	
 	void loadIcpConfiguration(ICPConfiguration conf){ this->conf = conf; }  
@@ -5,6 +5,8 @@
 #include <envire/core/Serialization.hpp>
 #include <base/samples/Frame.hpp>
 #include <envire/maps/GridBase.hpp>
+#include <envire/tools/GdalBandReader.hpp>
+#include <envire/tools/MappedFile.hpp>
 
 #include <boost/tuple/tuple.hpp>
 #include <Eigen/Core>
@@ -12,6 +14,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <stdint.h>
 
 //#include "cpl_string.h"
@@ -23,9 +26,38 @@
 #include <vector>
 #include <stdexcept>
 #include <base-logging/Logging.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 
 namespace envire 
 {
+    namespace detail
+    {
+        inline bool& gridLazyLoading()
+        {
+            static bool lazy = false;
+            return lazy;
+        }
+
+        inline size_t& gridGdalTileSize()
+        {
+            static size_t size = 0;
+            return size;
+        }
+
+        inline bool& gridRawBandFiles()
+        {
+            static bool raw = false;
+            return raw;
+        }
+
+        inline MappedFile::Mode& gridRawBandMapping()
+        {
+            static MappedFile::Mode mode = MappedFile::READ_ONLY;
+            return mode;
+        }
+    }
+
     /** Tests if a path points to an existing file or not
      *
      * It uses directly boost::filesystem, but avoids including
@@ -53,6 +85,49 @@ namespace envire
 	    : GridBase( cellSizeX, cellSizeY, scalex, scaley, offsetx, offsety, id ) {}
 	virtual void createBand( const std::string& key ) = 0;
         virtual ~BandedGrid(){};
+
+        /** Enables or disables lazy loading of grid bands
+         *
+         * If enabled, grids which get unserialized from files only remember
+         * where their bands are stored, and read a band when it is accessed
+         * for the first time. Until then, the band can also be accessed
+         * window by window through Grid::openBandReader. This is a global
+         * setting, and disabled by default.
+         *
+         * Loading on first access is serialized per grid, so the const
+         * accessors of a grid can be called from several threads.
+         */
+        static void setLazyLoading(bool enable) { detail::gridLazyLoading() = enable; }
+        static bool isLazyLoading() { return detail::gridLazyLoading(); }
+
+        /** Sets the size of the tiles of the GeoTIFF files written during
+         * serialization
+         *
+         * Tiled files allow efficient windowed reads (see GdalBandReader).
+         * GDAL requires the size to be a multiple of 16. 0, the default,
+         * writes the files in strips.
+         */
+        static void setGdalTileSize(size_t size) { detail::gridGdalTileSize() = size; }
+        static size_t getGdalTileSize() { return detail::gridGdalTileSize(); }
+
+        /** Enables or disables writing the bands as raw files during file
+         * serialization, instead of GeoTIFF files
+         *
+         * Raw band files contain the band data in the memory layout of the
+         * grid and in host byte order. When a grid gets unserialized, its raw
+         * band files are memory-mapped instead of being read (see
+         * Grid::getMappedGridData), so that opening the scene does not depend
+         * on the size of the bands and the page cache is shared between the
+         * processes which load the same scene. This is a global setting, and
+         * disabled by default.
+         */
+        static void setRawBandFiles(bool enable) { detail::gridRawBandFiles() = enable; }
+        static bool useRawBandFiles() { return detail::gridRawBandFiles(); }
+
+        /** Sets how raw band files are mapped during unserialization. The
+         * default is MappedFile::READ_ONLY */
+        static void setRawBandMapping(MappedFile::Mode mode) { detail::gridRawBandMapping() = mode; }
+        static MappedFile::Mode getRawBandMapping() { return detail::gridRawBandMapping(); }
     };
 
     /** Generic handling of a multi-layer grid
@@ -69,6 +144,10 @@ namespace envire
      * <code>
      * getGridData().data()[y * cellSizeX + x]
      * </code>
+     *
+     * Loops over the cells should therefore have y as the outer and x as the
+     * inner index. GridBase::parallelForEachCell and GridBase::forEachTile
+     * iterate over the grid in this order, distributed over several threads.
      */
     template <typename T>
     class Grid : public BandedGrid
@@ -83,6 +162,69 @@ namespace envire
 	const static std::vector<std::string> &bands;
         std::map<std::string, T> nodata;
 
+        /** Bands which have not been loaded yet (see
+         * BandedGrid::setLazyLoading), with the file and the band index in
+         * that file to load them from */
+        std::map<std::string, std::pair<std::string, int> > lazyBands;
+
+        /** Bands which are backed by a memory-mapped raw band file (see
+         * BandedGrid::setRawBandFiles) */
+        std::map<std::string, boost::shared_ptr<MappedFile> > mappedBands;
+
+        /** Serializes the loading of bands on their first access, so that
+         * the const accessors can be used from several threads. Copies of
+         * the grid get their own mutex. */
+        struct LoadMutex
+        {
+            LoadMutex() {}
+            LoadMutex(const LoadMutex&) {}
+            LoadMutex& operator=(const LoadMutex&) { return *this; }
+            boost::recursive_mutex mutex;
+        };
+        mutable LoadMutex loadMutex;
+
+        /** Makes sure that the band \c key is stored in memory, reading it
+         * if it has been registered for lazy loading, or copying it out of
+         * its file mapping */
+        void loadBand(std::string const& key) const
+        {
+            boost::recursive_mutex::scoped_lock lock(loadMutex.mutex);
+            Grid<T>* self = const_cast<Grid<T>*>(this);
+
+            typename std::map<std::string, boost::shared_ptr<MappedFile> >::iterator mapped =
+                self->mappedBands.find(key);
+            if (mapped != mappedBands.end())
+            {
+                boost::shared_ptr<MappedFile> file = mapped->second;
+                self->mappedBands.erase(mapped);
+                ArrayType& data( self->getGridData(key) );
+                const T* source = static_cast<const T*>(file->getData());
+                std::copy(source, source + data.num_elements(), data.data());
+                return;
+            }
+
+            typename std::map<std::string, std::pair<std::string, int> >::iterator it =
+                self->lazyBands.find(key);
+            if (it == lazyBands.end())
+                return;
+
+            // remove the entry first, as readGridData accesses the band
+            std::pair<std::string, int> source = it->second;
+            self->lazyBands.erase(it);
+            self->readGridData(key, source.first, source.second);
+        }
+
+        /** Maps the raw band file at \c path as band \c key */
+        void mapBand(std::string const& key, std::string const& path)
+        {
+            boost::shared_ptr<MappedFile> file(new MappedFile(path, getRawBandMapping()));
+            if (file->getSize() != sizeof(T) * cellSizeX * cellSizeY)
+                throw std::runtime_error("size of raw band file " + path + " does not match the grid size");
+            removeData(key);
+            lazyBands.erase(key);
+            mappedBands[key] = file;
+        }
+
     protected:	
         /** @deprecated
          *
@@ -114,7 +256,96 @@ namespace envire
         /** Returns true if there is band information for the given key */
         bool hasBand(std::string const& key) const
         {
-            return hasData<ArrayType>(key);
+            return hasData<ArrayType>(key) || lazyBands.count(key) || mappedBands.count(key);
+        }
+
+        /** Returns true if the given band has been loaded into memory, and
+         * false if it is still waiting to be loaded lazily or is backed by
+         * a file mapping
+         */
+        bool isBandLoaded(std::string const& key) const
+        {
+            return !lazyBands.count(key) && !mappedBands.count(key);
+        }
+
+        /** Returns true if the given band is backed by a memory-mapped raw
+         * band file
+         *
+         * The band stays mapped until it gets accessed through
+         * getGridData(), which copies it into memory.
+         */
+        bool isBandMapped(std::string const& key) const
+        {
+            return mappedBands.count(key);
+        }
+
+        /** Returns a read-only view on the mapped data of the given band,
+         * without copying it
+         *
+         * @throw std::runtime_error if the band is not mapped
+         */
+        boost::const_multi_array_ref<T,2> getMappedGridData(std::string const& key) const
+        {
+            typename std::map<std::string, boost::shared_ptr<MappedFile> >::const_iterator it =
+                mappedBands.find(key);
+            if (it == mappedBands.end())
+                throw std::runtime_error("band " + key + " is not mapped");
+            return boost::const_multi_array_ref<T,2>(
+                    static_cast<const T*>(it->second->getData()),
+                    boost::extents[cellSizeY][cellSizeX]);
+        }
+
+        /** Returns a read-only view on the data of the given band
+         *
+         * Unlike the const getGridData(), a mapped band is not copied into
+         * memory but accessed through its mapping. Other bands are loaded
+         * if necessary.
+         */
+        boost::const_multi_array_ref<T,2> getConstGridData(std::string const& key) const
+        {
+            boost::recursive_mutex::scoped_lock lock(loadMutex.mutex);
+            if (isBandMapped(key))
+                return getMappedGridData(key);
+            const ArrayType& data( getGridData(key) );
+            return boost::const_multi_array_ref<T,2>(data.data(), boost::extents[cellSizeY][cellSizeX]);
+        }
+
+        /** Returns a view on the mapped data of the given band, without
+         * copying it. Modifications are private to this grid and are not
+         * written back to the file.
+         *
+         * @throw std::runtime_error if the band is not mapped, and
+         * std::logic_error if it is mapped read-only
+         */
+        boost::multi_array_ref<T,2> getWritableMappedGridData(std::string const& key)
+        {
+            typename std::map<std::string, boost::shared_ptr<MappedFile> >::iterator it =
+                mappedBands.find(key);
+            if (it == mappedBands.end())
+                throw std::runtime_error("band " + key + " is not mapped");
+            T* data = static_cast<T*>(it->second->getWritableData());
+            if (!data)
+                throw std::logic_error("band " + key + " is mapped read-only");
+            return boost::multi_array_ref<T,2>(data, boost::extents[cellSizeY][cellSizeX]);
+        }
+
+        /** Opens a reader giving windowed access to a band which has not
+         * been loaded yet, without loading the whole band into memory
+         *
+         * The reader accesses the file the band would be loaded from, so
+         * that the data is in raster order of the file.
+         *
+         * @throw std::runtime_error if the band is not waiting to be loaded
+         * lazily
+         */
+        boost::shared_ptr< GdalBandReader<T> > openBandReader(std::string const& key, size_t cacheSize = 64) const
+        {
+            typename std::map<std::string, std::pair<std::string, int> >::const_iterator it =
+                lazyBands.find(key);
+            if (it == lazyBands.end())
+                throw std::runtime_error("band " + key + " is not backed by a file");
+            return boost::shared_ptr< GdalBandReader<T> >(
+                    new GdalBandReader<T>(it->second.first, it->second.second, cacheSize));
         }
 
         /** Sets the nodata value for the given band */
@@ -135,6 +366,22 @@ namespace envire
          */
         std::pair<T, bool> getNoData(std::string const& key) const
         {
+            boost::recursive_mutex::scoped_lock lock(loadMutex.mutex);
+
+            // the nodata value of a band which is not loaded yet is read
+            // from its file, without reading the raster. Mapped bands stay
+            // mapped, their nodata value is restored by unserialize.
+            typename std::map<std::string, std::pair<std::string, int> >::const_iterator lazy =
+                lazyBands.find(key);
+            if (lazy != lazyBands.end() && !nodata.count(key))
+            {
+                GdalBandReader<T> reader(lazy->second.first, lazy->second.second, 1);
+                std::pair<T, bool> value = reader.getNoData();
+                if (!value.second)
+                    return value;
+                const_cast<Grid<T>*>(this)->setNoData(key, value.first);
+            }
+
             typename std::map<std::string, T>::const_iterator it =
                 nodata.find(key);
             if (it == nodata.end())
@@ -196,6 +443,7 @@ namespace envire
          */
 	ArrayType& getGridData( const std::string& key )
 	{
+	    loadBand( key );
 	    ArrayType& data( getData<ArrayType>(key) );
 	    data.resize( boost::extents[cellSizeY][cellSizeX] );
 	    return data;
@@ -204,6 +452,8 @@ namespace envire
          */
 	const ArrayType& getGridData( const std::string& key ) const
 	{
+	    boost::recursive_mutex::scoped_lock lock( loadMutex.mutex );
+	    loadBand( key );
 	    return getData<ArrayType>(key);
 	};
 	
@@ -218,6 +468,9 @@ namespace envire
          */
         T getFromRaster(std::string const& band, size_t xi, size_t yi) const
         {
+            // read mapped bands directly, to avoid copying them
+            if (!mappedBands.empty() && isBandMapped(band))
+                return getMappedGridData(band)[yi][xi];
             return getGridData(band)[yi][xi];
         } 
 
@@ -325,6 +578,10 @@ namespace envire
 	//returns the path of the GTiff image
 	std::string getFullPath(const std::string &path,const std::string &key)
 	{return path+"_"+key+".tiff";};
+
+	//returns the path of the raw band file
+	std::string getRawPath(const std::string &path,const std::string &key)
+	{return path+"_"+key+".raw";};
 	
 	//checks if poBand can be loaded into this
 	void checkBandType(GDALRasterBand  *poBand);
@@ -398,16 +655,44 @@ namespace envire
 	    for (int i = 0; i < count; ++i)
 		layers.push_back( so.read<std::string>(boost::lexical_cast<std::string>(i)) );
 
-	    // there are three cases to differentiate here
-	    // single file access, multi-file access and memory access
-	    if( fso )
+	    // nodata values of raw band files are stored in the scene
+	    for (int i = 0; i < count; ++i)
+	    {
+		std::string nodata_key = "nodata_" + boost::lexical_cast<std::string>(i);
+		if (so.hasKey(nodata_key))
+		    setNoData(layers[i], T(so.read<double>(nodata_key)));
+	    }
+
+	    // there are four cases to differentiate here
+	    // raw file mapping, single file access, multi-file access and
+	    // memory access
+	    if( fso && so.hasKey("raw_bands") && so.read<bool>("raw_bands") )
+	    {
+		for (int i = 0; i < count; ++i)
+		    mapBand(layers[i], getRawPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]));
+	    }
+	    else if( fso )
 	    {
 		std::string single_file = getFullPath(getMapFileName( fso->getMapPath(), getClassName() ),"" );
 		if( singleFile() && fileExists(single_file) )
-		    readGridData(layers, single_file);
+		{
+		    if( isLazyLoading() )
+			for (int i = 0; i < count; ++i)
+			    lazyBands[layers[i]] = std::make_pair(single_file, i + 1);
+		    else
+			readGridData(layers, single_file);
+		}
 		else
+		{
 		    for (int i = 0; i < count; ++i)
-			readGridData(layers[i], getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]));
+		    {
+			std::string path = getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]);
+			if( isLazyLoading() )
+			    lazyBands[layers[i]] = std::make_pair(path, 1);
+			else
+			    readGridData(layers[i], path);
+		    }
+		}
 	    }
 	    else
 	    {
@@ -434,6 +719,13 @@ namespace envire
         
         FileSerialization* fso = dynamic_cast<FileSerialization*>(&so);
 
+        // bands which are not loaded yet need to be read before the files
+        // get overwritten
+        while (!lazyBands.empty())
+            loadBand(lazyBands.begin()->first);
+        while (!mappedBands.empty())
+            loadBand(mappedBands.begin()->first);
+
 	// get layers vector first
 	// base it on the bands and see if there additional layers available
 	std::vector<std::string> layers; 
@@ -445,8 +737,33 @@ namespace envire
 	for( size_t i=0; i<layers.size(); i++ )
 	    so.write(boost::lexical_cast<std::string>(i), layers[i]);
 
-	// differentiate between single file, multi-file and memory serialization
-	if( fso && singleFile() )
+	// differentiate between raw files, single file, multi-file and memory
+	// serialization
+	if( fso && useRawBandFiles() )
+	{
+	    for( size_t i=0; i<layers.size(); i++ )
+	    {
+		// the file may still be mapped by other grids or processes, so
+		// it is replaced instead of being truncated and rewritten
+		std::string path = getRawPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]);
+		std::string tmp_path = path + ".tmp";
+		{
+		    std::ofstream os( tmp_path.c_str(), std::ios::binary );
+		    writeGridData(layers[i], os);
+		    os.close();
+		    if( !os )
+			throw std::runtime_error("failed to write file " + tmp_path);
+		}
+		if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 )
+		    throw std::runtime_error("failed to replace file " + path);
+
+		std::pair<T, bool> no_data = getNoData(layers[i]);
+		if( no_data.second )
+		    so.write("nodata_" + boost::lexical_cast<std::string>(i), (double)no_data.first);
+	    }
+	    so.write("raw_bands", true);
+	}
+	else if( fso && singleFile() )
 	    writeGridData( layers, getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), "") );
 	else
 	    if( fso )
@@ -522,11 +839,22 @@ namespace envire
 	poDriver = GetGDALDriverManager()->GetDriverByName(pszFormat);
 	if( poDriver == NULL )
 	    throw std::runtime_error("GDALDriver not found.");
-        
+
         GDALDataType data_type = getGDALDataTypeOfArray();
+
+	// tiled files allow efficient windowed reads
+	if( getGdalTileSize() > 0 )
+	{
+	    std::string tileSize = boost::lexical_cast<std::string>( getGdalTileSize() );
+	    papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
+	    papszOptions = CSLSetNameValue( papszOptions, "BLOCKXSIZE", tileSize.c_str() );
+	    papszOptions = CSLSetNameValue( papszOptions, "BLOCKYSIZE", tileSize.c_str() );
+	}
+
 	poDstDS = poDriver->Create( path.c_str(), cellSizeX, cellSizeY,
                 keys.size(), data_type, 
 		papszOptions );
+	CSLDestroy( papszOptions );
 
         if (!poDstDS)
             throw std::runtime_error("failed to create file " + path);
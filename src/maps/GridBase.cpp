@@ -113,265 +113,62 @@ bool envire::GridBase::getRectPoints(const base::Pose2D &pose, double sizeX, dou
 }
 
 
-bool envire::GridBase::forEachInRectangles(const base::Pose2D& rectCenter_w, double innerSizeX_w, double innerSizeY_w, boost::function< void (size_t, size_t)> innerCallback, double outerSizeX_w, double outerSizeY_w, boost::function< void (size_t, size_t)> outerCallback) const
+bool envire::GridBase::rasterizeRectangle(const base::Pose2D& pose, double sizeXWorld, double sizeYWorld, RectangleSpans& spans) const
 {
-    double multiplier = 10;
-    envire::GridBase::Position upLeft_g;
-    envire::GridBase::Position upRight_g;
-    envire::GridBase::Position downLeft_g;
-    envire::GridBase::Position downRight_g;
+    const int multiplier = 10;
+    // corners in the order in which they are connected by the edges
+    envire::GridBase::Position corners[4];
     
-    if(!getRectPoints(rectCenter_w, innerSizeX_w, innerSizeY_w, upLeft_g, upRight_g, downLeft_g, downRight_g, multiplier))
+    if(!getRectPoints(pose, sizeXWorld, sizeYWorld, corners[0], corners[1], corners[3], corners[2], multiplier))
         return false;
 
-    envire::GridBase::Position upLeftOut;
-    envire::GridBase::Position upRightOut;
-    envire::GridBase::Position downLeftOut;
-    envire::GridBase::Position downRightOut;
-    
-    if(!getRectPoints(rectCenter_w, outerSizeX_w, outerSizeY_w, upLeftOut, upRightOut, downLeftOut, downRightOut, multiplier))
-        return false;
-
-//     std::cout << "upLeftOut    X " << upLeftOut.x << " Y " << upLeftOut.y << std::endl;
-//     std::cout << "upRightOut   X " << upRightOut.x << " Y " << upRightOut.y << std::endl;
-//     std::cout << "downLeftOut  X " << downLeftOut.x << " Y " << downLeftOut.y << std::endl;
-//     std::cout << "downRightOut X " << downRightOut.x << " Y " << downRightOut.y << std::endl;
-    
-    std::vector<envire::GridBase::Position> leftIn;
-    std::vector<envire::GridBase::Position> rightIn;
-    std::vector<envire::GridBase::Position> leftOut;
-    std::vector<envire::GridBase::Position> rightOut;
-    
-    if(upRight_g.y > downRight_g.y)
-    {
-        //points of left side
-        lineBresenham(upRight_g, upLeft_g, leftIn);
-        lineBresenham(upLeft_g, downLeft_g, leftIn);
-
-        lineBresenham(upRightOut, upLeftOut, leftOut);
-        lineBresenham(upLeftOut, downLeftOut, leftOut);
-
-        //points of right side
-        lineBresenham(upRight_g, downRight_g, rightIn);
-        lineBresenham(downRight_g, downLeft_g, rightIn);
-
-        lineBresenham(upRightOut, downRightOut, rightOut);
-        lineBresenham(downRightOut, downLeftOut, rightOut);
-    }
-    else
+    size_t minY = corners[0].y, maxY = corners[0].y;
+    for(int i = 1; i < 4; i++)
     {
-        //points of left side
-        lineBresenham(downRight_g, upRight_g, leftIn);
-        lineBresenham(upRight_g, upLeft_g, leftIn);
-
-        lineBresenham(downRightOut, upRightOut, leftOut);
-        lineBresenham(upRightOut, upLeftOut, leftOut);
-
-        //points of right side
-        lineBresenham(downRight_g, downLeft_g, rightIn);
-        lineBresenham(downLeft_g, upLeft_g, rightIn);
-
-        lineBresenham(downRightOut, downLeftOut, rightOut);
-        lineBresenham(downLeftOut, upLeftOut, rightOut);
+        minY = std::min(minY, corners[i].y);
+        maxY = std::max(maxY, corners[i].y);
     }
 
-//     std::cout << "Left " << std::endl;
-//     for(std::vector<envire::GridBase::Position>::const_iterator it = leftOut.begin(); it != leftOut.end(); it++ )
-//     {
-//         std::cout << "X " << it->x << " Y " << it->y << std::endl;
-//     }
-//     std::cout << "Right " << std::endl;
-//     for(std::vector<envire::GridBase::Position>::const_iterator it = rightOut.begin(); it != rightOut.end(); it++ )
-//     {
-//         std::cout << "X " << it->x << " Y " << it->y << std::endl;
-//     }
-    
-    std::vector<envire::GridBase::Position>::const_iterator leftInIt = leftIn.begin();
-    std::vector<envire::GridBase::Position>::const_iterator rightInIt = rightIn.begin();
-    std::vector<envire::GridBase::Position>::const_iterator leftOutIt = leftOut.begin();
-    std::vector<envire::GridBase::Position>::const_iterator rightOutIt = rightOut.begin();
+    // collect the min and max sub cell x of the edges for each row 
+    spans.yMin = minY / multiplier;
+    const size_t rows = maxY / multiplier - spans.yMin + 1;
+    spans.xBegin.assign(rows, std::numeric_limits<size_t>::max());
+    spans.xEnd.assign(rows, 0);
 
-    
-    size_t inY;
-    size_t outY;
-    size_t minX, maxX;
-    size_t minXOut, maxXOut;
-    while((leftOutIt != leftOut.end()) && (rightOutIt != rightOut.end()))
+    for(int i = 0; i < 4; i++)
     {
-        if(leftInIt != leftIn.end())
-            inY = leftInIt->y / multiplier;
-        
-        outY = leftOutIt->y / multiplier;
-
-        maxX = 0;
-        minX = std::numeric_limits<size_t>::max();
-        maxXOut = 0;
-        minXOut = std::numeric_limits<size_t>::max();
-
-        while((leftInIt != leftIn.end()) && (((size_t) (leftInIt->y / multiplier)) == outY))
-        {
-            if(minX > leftInIt->x)
-                minX = leftInIt->x;
-            if(maxX < leftInIt->x)
-                maxX = leftInIt->x;
-            
-            leftInIt++;
-        }
-
-        while((rightInIt != rightIn.end()) && (((size_t) (rightInIt->y / multiplier)) == outY))
+        Bresenham line(corners[i], corners[(i + 1) % 4]);
+        int x, y;
+        while(line.getNextPoint(x, y))
         {
-            if(minX > rightInIt->x)
-                minX = rightInIt->x;
-            if(maxX < rightInIt->x)
-                maxX = rightInIt->x;
-            
-            rightInIt++;
-        }
-
-        while((leftOutIt != leftOut.end()) && (((size_t) (leftOutIt->y / multiplier)) == outY))
-        {
-            if(minXOut > leftOutIt->x)
-                minXOut = leftOutIt->x;
-            if(maxXOut < leftOutIt->x)
-                maxXOut = leftOutIt->x;
-            
-            leftOutIt++;
+            const size_t row = y / multiplier - spans.yMin;
+            spans.xBegin[row] = std::min(spans.xBegin[row], (size_t) x);
+            spans.xEnd[row] = std::max(spans.xEnd[row], (size_t) x);
         }
+    }
 
-        while((rightOutIt != rightOut.end()) && (((size_t) (rightOutIt->y / multiplier)) == outY))
+    for(size_t i = 0; i < rows; i++)
+    {
+        if(spans.yMin + i >= cellSizeY || spans.xBegin[i] > spans.xEnd[i])
         {
-            if(minXOut > rightOutIt->x)
-                minXOut = rightOutIt->x;
-            if(maxXOut < rightOutIt->x)
-                maxXOut = rightOutIt->x;
-            
-            rightOutIt++;
-        }
-        
-        minX /= multiplier;
-        maxX /= multiplier;
-        minXOut /= multiplier;
-        maxXOut /= multiplier;
-        
-        if(outY >= cellSizeY)
+            spans.xBegin[i] = spans.xEnd[i] = 0;
             continue;
-        
-        if(inY == outY)
-        {
-            for(size_t x = minXOut; x < minX; x++)
-            {
-                if(x < cellSizeX)
-                    outerCallback(x, outY);
-            }
-            for(size_t x = minX; x <= maxX; x++)
-            {
-                if(x < cellSizeX)
-                    innerCallback(x, outY);
-            }
-            for(size_t x = maxX+1; x <= maxXOut; x++)
-            {
-                if(x < cellSizeX)
-                    outerCallback(x, outY);
-            }
-
         }
-        else
-        {
-            for(size_t x = minXOut; x <= maxXOut; x++)
-            {
-                if(x < cellSizeX)
-                    outerCallback(x, outY);
-            }        
-        }
-        
+        spans.xBegin[i] = std::min(spans.xBegin[i] / multiplier, cellSizeX);
+        spans.xEnd[i] = std::min(spans.xEnd[i] / multiplier + 1, cellSizeX);
     }
     return true;
+}
 
+bool envire::GridBase::forEachInRectangles(const base::Pose2D& rectCenter_w, double innerSizeX_w, double innerSizeY_w, boost::function< void (size_t, size_t)> innerCallback, double outerSizeX_w, double outerSizeY_w, boost::function< void (size_t, size_t)> outerCallback) const
+{
+    typedef boost::function<void (size_t, size_t)> Callback;
+    return forEachInRectangles<Callback, Callback>(rectCenter_w, innerSizeX_w, innerSizeY_w, innerCallback, outerSizeX_w, outerSizeY_w, outerCallback);
 }
 
 bool envire::GridBase::forEachInRectangle(const base::Pose2D& pose, double sizeXWorld, double sizeYWorld, boost::function<void (size_t, size_t) > callbackGrid) const
 {
-//     return forEachInRectangles(pose, 0, 0, callbackGrid, widthWorld, heightWorld, callbackGrid);
-    double multiplier = 10;
-    envire::GridBase::Position ulGrid;
-    envire::GridBase::Position urGrid;
-    envire::GridBase::Position dlGrid;
-    envire::GridBase::Position drGrid;
-    
-    if(!getRectPoints(pose, sizeXWorld, sizeYWorld, ulGrid, urGrid, dlGrid, drGrid, multiplier))
-        return false;
-
-    std::vector<envire::GridBase::Position> left;
-    std::vector<envire::GridBase::Position> right;
-
-    if(urGrid.y > drGrid.y)
-    {
-        //points of left side
-        lineBresenham(urGrid, ulGrid, left);
-        lineBresenham(ulGrid, dlGrid, left);
-
-        //points of right side
-        lineBresenham(urGrid, drGrid, right);
-        lineBresenham(drGrid, dlGrid, right);
-    }
-    else
-    {
-        //points of left side
-        lineBresenham(drGrid, urGrid, left);
-        lineBresenham(urGrid, ulGrid, left);
-
-        //points of right side
-        lineBresenham(drGrid, dlGrid, right);
-        lineBresenham(dlGrid, ulGrid, right);
-    }
-    
-    std::vector<envire::GridBase::Position>::const_iterator leftIt = left.begin();
-    std::vector<envire::GridBase::Position>::const_iterator rightIt = right.begin();
-
-    size_t curY;
-    size_t minX, maxX;
-    while((leftIt != left.end()) && (rightIt != right.end()))
-    {
-        curY = leftIt->y / multiplier;
-
-        maxX = 0;
-        minX = std::numeric_limits<size_t>::max();
-        
-        assert(rightIt->y == leftIt->y);
-        
-        while((leftIt != left.end()) && (((size_t) (leftIt->y / multiplier)) == curY))
-        {
-            if(minX > leftIt->x)
-                minX = leftIt->x;
-            if(maxX < leftIt->x)
-                maxX = leftIt->x;
-            
-            leftIt++;
-        }
-
-        while((rightIt != right.end()) && (((size_t) (rightIt->y / multiplier)) == curY))
-        {
-            if(minX > rightIt->x)
-                minX = rightIt->x;
-            if(maxX < rightIt->x)
-                maxX = rightIt->x;
-            
-            rightIt++;
-        }
-        
-        minX /= multiplier;
-        maxX /= multiplier;
-        
-        if(curY >= cellSizeY)
-            continue;
-
-        for(size_t x = minX; x <= maxX; x++)
-        {
-            if(x < cellSizeX)
-                callbackGrid(x, curY);
-        }        
-    }
-    return true;
+    return forEachInRectangle<boost::function<void (size_t, size_t)> >(pose, sizeXWorld, sizeYWorld, callbackGrid);
 }
 
 
@@ -5,9 +5,50 @@
 #include <envire/Core.hpp>
 #include <base/Pose.hpp>
 #include <boost/function.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <algorithm>
+#include <vector>
 
 namespace envire 
 {
+    namespace detail
+    {
+	template <class F>
+	struct GridRowWorker
+	{
+	    F f;
+	    size_t width;
+	    GridRowWorker( F f, size_t width ) : f(f), width(width) {}
+
+	    void operator()( size_t begin, size_t end )
+	    {
+		for( size_t yi = begin; yi < end; yi++ )
+		    for( size_t xi = 0; xi < width; xi++ )
+			f( xi, yi );
+	    }
+	};
+
+	template <class F>
+	struct GridTileWorker
+	{
+	    F f;
+	    size_t width, height, tileSize, tileCountX;
+	    GridTileWorker( F f, size_t width, size_t height, size_t tileSize )
+		: f(f), width(width), height(height), tileSize(tileSize),
+		tileCountX( (width + tileSize - 1) / tileSize ) {}
+
+	    void operator()( size_t i )
+	    {
+		const size_t tx = i % tileCountX, ty = i / tileCountX;
+		f( Eigen::AlignedBox<int, 2>(
+			    Eigen::Vector2i( tx * tileSize, ty * tileSize ),
+			    Eigen::Vector2i(
+				std::min( (tx + 1) * tileSize, width ) - 1,
+				std::min( (ty + 1) * tileSize, height ) - 1 ) ) );
+	    }
+	};
+    }
+
     /** Base class for all maps that function as regular grids
      *
      * This map offers a common interface for all maps that are regular grids
@@ -140,6 +181,164 @@ namespace envire
         bool forEachInRectangles(const base::Pose2D &rectCenter_w, double innerSizeX_w, double innerSizeY_w, boost::function<void (size_t, size_t)> innerCallback, 
                                                         double outerSizeX_w, double outerSizeY_w, boost::function<void (size_t, size_t)> outerCallback) const;
 
+        /** The cells covered by a rectangle, as computed by
+         * rasterizeRectangle. Row yMin + i covers the cells [xBegin[i],
+         * xEnd[i]), clipped to the grid.
+         *
+         * The buffers are reused when the same instance is passed to
+         * rasterizeRectangle again, so that repeated queries do not allocate.
+         */
+        struct RectangleSpans
+        {
+            size_t yMin;
+            std::vector<size_t> xBegin;
+            std::vector<size_t> xEnd;
+
+            size_t getRowCount() const { return xBegin.size(); }
+        };
+
+        /**
+         * Computes the cells which forEachInRectangle visits, as one run of
+         * cells per row.
+         *
+         * returns true if the given rectangle is inside the grid.
+         *         false otherwise.
+         * */
+        bool rasterizeRectangle(const base::Pose2D &rectCenterWorld, double sizeXWorld, double sizeYWorld, RectangleSpans &spans) const;
+
+        /**
+         * Calls f( yi, xBegin, xEnd ) for each row of cells that is covered
+         * by the given rectangle, with [xBegin, xEnd) being the covered
+         * cells of the row. This allows to process whole rows of a band at
+         * once.
+         *
+         * @param scratch buffers that are reused between calls
+         * */
+        template <class F>
+        bool forEachSpanInRectangle(const base::Pose2D &rectCenterWorld, double sizeXWorld, double sizeYWorld, F f, RectangleSpans &scratch) const
+        {
+            if(!rasterizeRectangle(rectCenterWorld, sizeXWorld, sizeYWorld, scratch))
+                return false;
+            for(size_t i = 0; i < scratch.getRowCount(); i++)
+            {
+                if(scratch.xBegin[i] < scratch.xEnd[i])
+                    f(scratch.yMin + i, scratch.xBegin[i], scratch.xEnd[i]);
+            }
+            return true;
+        }
+
+        template <class F>
+        bool forEachSpanInRectangle(const base::Pose2D &rectCenterWorld, double sizeXWorld, double sizeYWorld, F f) const
+        {
+            RectangleSpans scratch;
+            return forEachSpanInRectangle(rectCenterWorld, sizeXWorld, sizeYWorld, f, scratch);
+        }
+
+        /**
+         * Same as the boost::function version, but calls f( xi, yi )
+         * directly so that it can be inlined.
+         *
+         * @param scratch buffers that are reused between calls
+         * */
+        template <class F>
+        bool forEachInRectangle(const base::Pose2D &rectCenterWorld, double sizeXWorld, double sizeYWorld, F f, RectangleSpans &scratch) const
+        {
+            if(!rasterizeRectangle(rectCenterWorld, sizeXWorld, sizeYWorld, scratch))
+                return false;
+            for(size_t i = 0; i < scratch.getRowCount(); i++)
+            {
+                for(size_t x = scratch.xBegin[i]; x < scratch.xEnd[i]; x++)
+                    f(x, scratch.yMin + i);
+            }
+            return true;
+        }
+
+        template <class F>
+        bool forEachInRectangle(const base::Pose2D &rectCenterWorld, double sizeXWorld, double sizeYWorld, F f) const
+        {
+            RectangleSpans scratch;
+            return forEachInRectangle(rectCenterWorld, sizeXWorld, sizeYWorld, f, scratch);
+        }
+
+        /**
+         * Same as the boost::function version, but calls the callbacks
+         * directly so that they can be inlined.
+         *
+         * @param inner, outer buffers that are reused between calls
+         * */
+        template <class F, class G>
+        bool forEachInRectangles(const base::Pose2D &rectCenter_w, double innerSizeX_w, double innerSizeY_w, F innerCallback,
+                                                        double outerSizeX_w, double outerSizeY_w, G outerCallback,
+                                                        RectangleSpans &inner, RectangleSpans &outer) const
+        {
+            if(!rasterizeRectangle(rectCenter_w, innerSizeX_w, innerSizeY_w, inner)
+                    || !rasterizeRectangle(rectCenter_w, outerSizeX_w, outerSizeY_w, outer))
+                return false;
+
+            for(size_t i = 0; i < outer.getRowCount(); i++)
+            {
+                const size_t y = outer.yMin + i;
+                size_t innerBegin = outer.xEnd[i], innerEnd = outer.xEnd[i];
+                if(y >= inner.yMin && y - inner.yMin < inner.getRowCount()
+                        && inner.xBegin[y - inner.yMin] < inner.xEnd[y - inner.yMin])
+                {
+                    innerBegin = inner.xBegin[y - inner.yMin];
+                    innerEnd = inner.xEnd[y - inner.yMin];
+                }
+
+                for(size_t x = outer.xBegin[i]; x < std::min(innerBegin, outer.xEnd[i]); x++)
+                    outerCallback(x, y);
+                for(size_t x = innerBegin; x < innerEnd; x++)
+                    innerCallback(x, y);
+                for(size_t x = std::max(innerEnd, outer.xBegin[i]); x < outer.xEnd[i]; x++)
+                    outerCallback(x, y);
+            }
+            return true;
+        }
+
+        template <class F, class G>
+        bool forEachInRectangles(const base::Pose2D &rectCenter_w, double innerSizeX_w, double innerSizeY_w, F innerCallback,
+                                                        double outerSizeX_w, double outerSizeY_w, G outerCallback) const
+        {
+            RectangleSpans inner, outer;
+            return forEachInRectangles(rectCenter_w, innerSizeX_w, innerSizeY_w, innerCallback,
+                    outerSizeX_w, outerSizeY_w, outerCallback, inner, outer);
+        }
+
+        /** Calls f( xi, yi ) for each cell of the grid.
+         *
+         * The cells are visited in the storage order of the grid bands (row
+         * by row, see Grid), and the rows are distributed over up to
+         * getParallelThreadCount() threads. f therefore has to be safe to
+         * call concurrently for cells in different rows.
+         */
+        template <class F>
+        void parallelForEachCell( F f ) const
+        {
+            parallelForBlocks( 0, cellSizeY, 1,
+                    detail::GridRowWorker<F>( f, cellSizeX ) );
+        }
+
+        /** Calls f( extents ) for each square tile of tileSize x tileSize
+         * cells, with extents being the CellExtents of the tile.
+         *
+         * The tiles are distributed over up to getParallelThreadCount()
+         * threads. This is meant for operations which access a neighbourhood
+         * around each cell, so that the accessed data stays in the cache
+         * while a tile gets processed.
+         */
+        template <class F>
+        void forEachTile( F f, size_t tileSize = 64 ) const
+        {
+            if( tileSize == 0 )
+                tileSize = 1;
+            const size_t tiles =
+                ((cellSizeX + tileSize - 1) / tileSize) *
+                ((cellSizeY + tileSize - 1) / tileSize);
+            parallelFor( 0, tiles,
+                    detail::GridTileWorker<F>( f, cellSizeX, cellSizeY, tileSize ) );
+        }
+
         /** Converts coordinates from the frame specified by \c frame to the
          * map-local grid coordinates
          *
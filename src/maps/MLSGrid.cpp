@@ -1,4 +1,6 @@
 #include "MLSGrid.hpp"
+#include <envire/tools/ParallelFor.hpp>
+#include <boost/bind.hpp>
 #include <fstream>
 #include <limits>
 #include <algorithm>
@@ -11,9 +13,12 @@ ENVIRONMENT_ITEM_DEF( MLSGrid )
  */
 static SerializationPlugin<MLSGrid> factory("MultiLevelSurfaceGrid");
 
+const size_t MLSGrid::TILE_SIZE;
+
 MLSGrid::MLSGrid()
     : GridBase()
     , cellcount( 0 )
+    , revision( 0 )
 {
     clear();
 }
@@ -22,6 +27,7 @@ MLSGrid::MLSGrid(size_t cellSizeX, size_t cellSizeY, double scalex, double scale
     : GridBase( cellSizeX, cellSizeY, scalex, scaley, offsetx, offsety )
     , cells( cellSizeX, cellSizeY )
     , cellcount( 0 )
+    , revision( 0 )
 {
     clear();
 }
@@ -33,6 +39,8 @@ void MLSGrid::clear()
     if(index) index->reset();
     extents = CellExtents();
     config.useColor = false;
+    resizeTiles();
+    touchAll();
 }
 
 MLSGrid::MLSGrid(const MLSGrid& other)
@@ -41,6 +49,10 @@ MLSGrid::MLSGrid(const MLSGrid& other)
     , config( other.config )
     , cellcount( other.cellcount )
     , extents( other.extents )
+    , revision( other.revision )
+    , tileCountX( other.tileCountX )
+    , tileCountY( other.tileCountY )
+    , tileRevisions( other.tileRevisions )
 {
 }
 
@@ -54,11 +66,46 @@ MLSGrid& MLSGrid::operator=(const MLSGrid& other)
 	extents = other.extents;
 	config = other.config;
 	cellcount = other.cellcount;
+
+	// keep the revision increasing, so that users of this grid
+	// see all cells as modified
+	resizeTiles();
+	revision = std::max( revision, other.revision );
+	touchAll();
     }
 
     return *this;
 }
 
+void MLSGrid::resizeTiles()
+{
+    tileCountX = (cellSizeX + TILE_SIZE - 1) / TILE_SIZE;
+    tileCountY = (cellSizeY + TILE_SIZE - 1) / TILE_SIZE;
+    tileRevisions.resize( tileCountX * tileCountY );
+}
+
+void MLSGrid::touchAll()
+{
+    std::fill( tileRevisions.begin(), tileRevisions.end(), ++revision );
+}
+
+GridBase::CellExtents MLSGrid::getTileExtents( size_t tx, size_t ty ) const
+{
+    return CellExtents( 
+	    Eigen::Vector2i( tx * TILE_SIZE, ty * TILE_SIZE ),
+	    Eigen::Vector2i( 
+		std::min( (tx + 1) * TILE_SIZE, cellSizeX ) - 1, 
+		std::min( (ty + 1) * TILE_SIZE, cellSizeY ) - 1 ) );
+}
+
+void MLSGrid::getModifiedTiles( size_t revision, std::vector<Position>& tiles ) const
+{
+    for( size_t ty = 0; ty < tileCountY; ty++ )
+	for( size_t tx = 0; tx < tileCountX; tx++ )
+	    if( tileRevisions[ty * tileCountX + tx] > revision )
+		tiles.push_back( Position( tx, ty ) );
+}
+
 envire::MLSGrid* MLSGrid::cloneShallow() const
 {
     MLSGrid* res = new MLSGrid( cellSizeX, cellSizeY, scalex, scaley, offsetx, offsety );
@@ -70,27 +117,34 @@ MLSGrid::~MLSGrid()
 {
 }
 
-std::vector< Eigen::Vector3d > MLSGrid::projectPointsOnSurface(double startHeight, const std::vector< GridBase::Position >& gridPoints, const double zOffset)
+/** @return the max z of the patch in the cell which is closest to
+ * lastHeight, or an unset value if the cell is empty
+ */
+static double getClosestMaxZ( MLSGrid::const_iterator cIt, MLSGrid::const_iterator end, double lastHeight )
+{
+    double minDiff = std::numeric_limits< double >::max();
+    double closestZ = base::unset<double>();
+    for(;cIt != end; cIt++)
+    {
+	double diff = fabs(lastHeight - cIt->getMaxZ());
+	if(diff < minDiff)
+	{
+	    minDiff = diff;
+	    closestZ = cIt->getMaxZ();
+	}
+    }
+    return closestZ;
+}
+
+std::vector< Eigen::Vector3d > MLSGrid::projectPointsOnSurface(double startHeight, const std::vector< GridBase::Position >& gridPoints, const double zOffset) const
 {
     // Add z values if available, otherwise 0.
     double lastHeight = startHeight;
     std::vector< Eigen::Vector3d > ret;
+    ret.reserve( gridPoints.size() );
     std::vector< GridBase::Position>::const_iterator it = gridPoints.begin();
     for(; it != gridPoints.end(); ++it) {
-	envire::MLSGrid::iterator cIt = beginCell(it->x, it->y);
-	
-	double minDiff = std::numeric_limits< double >::max();
-	double closestZ = base::unset<double>();
-	for(;cIt != endCell(); cIt++)
-	{
-	    double diff = fabs(lastHeight - cIt->getMaxZ());
-	    if(diff < minDiff)
-	    {
-		minDiff = diff;
-		closestZ = cIt->getMaxZ();
-	    }
-	}
-	
+	double closestZ = getClosestMaxZ( beginCell(it->x, it->y), endCell(), lastHeight );
 	if(!base::isUnset<double>(closestZ))
 	{
 	    lastHeight = closestZ;
@@ -100,7 +154,7 @@ std::vector< Eigen::Vector3d > MLSGrid::projectPointsOnSurface(double startHeigh
     return ret;
 }
 
-base::geometry::Spline3 MLSGrid::projectSplineOnSurface(double startHeight, const base::geometry::Spline3& spline, const double zOffset)
+base::geometry::Spline3 MLSGrid::projectSplineOnSurface(double startHeight, const base::geometry::Spline3& spline, const double zOffset) const
 {
     //sample the spline in a resolution four times higher than the
     //cell size.
@@ -112,20 +166,7 @@ base::geometry::Spline3 MLSGrid::projectSplineOnSurface(double startHeight, cons
 	const Eigen::Vector3d p(*it);
 	if(toGrid(p, x, y))
 	{
-	    envire::MLSGrid::iterator cIt = beginCell(x, y);
-	    
-	    double minDiff = std::numeric_limits< double >::max();
-	    double closestZ = base::unset<double>();
-	    for(;cIt != endCell(); cIt++)
-	    {
-		double diff = fabs(lastHeight - cIt->getMaxZ());
-		if(diff < minDiff)
-		{
-		    minDiff = diff;
-		    closestZ = cIt->getMaxZ();
-		}
-	    }
-	    
+	    double closestZ = getClosestMaxZ( beginCell(x, y), endCell(), lastHeight );
 	    if(!base::isUnset<double>(closestZ))
 	    {
 		lastHeight = closestZ;
@@ -140,6 +181,221 @@ base::geometry::Spline3 MLSGrid::projectSplineOnSurface(double startHeight, cons
     return ret;
 }
 
+namespace
+{
+    const size_t INVALID_CELL = std::numeric_limits<size_t>::max();
+
+    /** cells of a batch of queries, and their processing order */
+    struct BatchCells
+    {
+	/// linear cell index xi + yi * cellSizeX or INVALID_CELL
+	std::vector<size_t> cell;
+	/// position within the cell
+	std::vector<Eigen::Vector2f> mod;
+	/// valid queries ordered by tile
+	std::vector<size_t> order;
+
+	explicit BatchCells( size_t count ) : cell( count ), mod( count ) {}
+    };
+
+    struct MapToCell
+    {
+	const MLSGrid& grid;
+	const Eigen::Vector2d* positions;
+	BatchCells& cells;
+
+	MapToCell( const MLSGrid& grid, const Eigen::Vector2d* positions, BatchCells& cells )
+	    : grid( grid ), positions( positions ), cells( cells ) {}
+
+	void operator()( size_t begin, size_t end ) const
+	{
+	    size_t xi, yi;
+	    double xmod, ymod;
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		if( grid.toGrid( positions[i].x(), positions[i].y(), xi, yi, xmod, ymod ) )
+		{
+		    cells.cell[i] = xi + yi * grid.getCellSizeX();
+		    cells.mod[i] = Eigen::Vector2f( xmod, ymod );
+		}
+		else
+		    cells.cell[i] = INVALID_CELL;
+	    }
+	}
+    };
+
+    struct GridToCell
+    {
+	const MLSGrid& grid;
+	const MLSGrid::Position* positions;
+	BatchCells& cells;
+
+	GridToCell( const MLSGrid& grid, const MLSGrid::Position* positions, BatchCells& cells )
+	    : grid( grid ), positions( positions ), cells( cells ) {}
+
+	void operator()( size_t begin, size_t end ) const
+	{
+	    const Eigen::Vector2f center( grid.getScaleX() * 0.5, grid.getScaleY() * 0.5 );
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		if( grid.contains( positions[i] ) )
+		{
+		    cells.cell[i] = positions[i].x + positions[i].y * grid.getCellSizeX();
+		    cells.mod[i] = center;
+		}
+		else
+		    cells.cell[i] = INVALID_CELL;
+	    }
+	}
+    };
+
+    /** counting sort of the valid queries by the tile of their cell */
+    void sortByTile( const MLSGrid& grid, BatchCells& cells )
+    {
+	const size_t tcx = grid.getTileCountX();
+	const size_t sx = grid.getCellSizeX();
+	std::vector<size_t> start( tcx * grid.getTileCountY() + 1, 0 );
+	std::vector<size_t> tile( cells.cell.size() );
+	for( size_t i = 0; i < cells.cell.size(); i++ )
+	{
+	    const size_t c = cells.cell[i];
+	    if( c == INVALID_CELL )
+		continue;
+	    tile[i] = ( c / sx / MLSGrid::TILE_SIZE ) * tcx + ( c % sx ) / MLSGrid::TILE_SIZE;
+	    start[tile[i] + 1]++;
+	}
+	for( size_t t = 1; t < start.size(); t++ )
+	    start[t] += start[t-1];
+
+	cells.order.resize( start.back() );
+	for( size_t i = 0; i < cells.cell.size(); i++ )
+	    if( cells.cell[i] != INVALID_CELL )
+		cells.order[start[tile[i]]++] = i;
+    }
+
+    template <class Op>
+    struct BatchWorker
+    {
+	const MLSGrid& grid;
+	const BatchCells& cells;
+	const Op& op;
+	boost::mutex& mutex;
+	size_t& found;
+
+	BatchWorker( const MLSGrid& grid, const BatchCells& cells, const Op& op, boost::mutex& mutex, size_t& found )
+	    : grid( grid ), cells( cells ), op( op ), mutex( mutex ), found( found ) {}
+
+	void operator()( size_t begin, size_t end ) const
+	{
+	    const size_t sx = grid.getCellSizeX();
+	    size_t n = 0;
+	    for( size_t k = begin; k < end; k++ )
+	    {
+		const size_t i = cells.order[k];
+		const size_t c = cells.cell[i];
+		if( op( i, grid.beginCell( c % sx, c / sx ), grid.endCell(), cells.mod[i] ) )
+		    n++;
+	    }
+	    boost::mutex::scoped_lock lock( mutex );
+	    found += n;
+	}
+    };
+
+    /** number of queries per parallel work item */
+    const size_t BATCH_BLOCK_SIZE = 4096;
+
+    template <class Op>
+    size_t runBatch( const MLSGrid& grid, BatchCells& cells, const Op& op )
+    {
+	sortByTile( grid, cells );
+
+	boost::mutex mutex;
+	size_t found = 0;
+	parallelForBlocks( 0, cells.order.size(), BATCH_BLOCK_SIZE, 
+		BatchWorker<Op>( grid, cells, op, mutex, found ) );
+	return found;
+    }
+
+    struct SurfaceOp
+    {
+	double *zpos, *zstdev;
+	const SurfacePatch** patches;
+	double sigma_threshold;
+	bool slope;
+
+	bool operator()( size_t i, MLSGrid::const_iterator it, MLSGrid::const_iterator end, const Eigen::Vector2f& mod ) const
+	{
+	    const SurfacePatch patch( zpos[i], zstdev[i] );
+	    for( ; it != end; it++ )
+	    {
+		const SurfacePatch &p(*it);
+		const double interval = sqrt(sq(patch.stdev) + sq(p.stdev)) * sigma_threshold;
+		if( p.distance( patch ) < interval && !p.isNegative() )
+		{
+		    zpos[i] = slope ? p.getHeight( mod ) : p.mean;
+		    zstdev[i] = p.stdev;
+		    if( patches )
+			patches[i] = &p;
+		    return true;
+		}
+	    }
+	    return false;
+	}
+    };
+
+    struct TopOp
+    {
+	double *zpos;
+	const SurfacePatch** patches;
+
+	bool operator()( size_t i, MLSGrid::const_iterator it, MLSGrid::const_iterator end, const Eigen::Vector2f& mod ) const
+	{
+	    MLSGrid::const_iterator top = std::max_element( it, end );
+	    if( top == end )
+		return false;
+	    zpos[i] = top->mean;
+	    if( patches )
+		patches[i] = &(*top);
+	    return true;
+	}
+    };
+}
+
+size_t MLSGrid::get( const Eigen::Vector2d* positions, size_t count, double* zpos, double* zstdev, const SurfacePatch** patches, double sigma_threshold ) const
+{
+    if( patches )
+	std::fill( patches, patches + count, (const SurfacePatch*)NULL );
+
+    BatchCells cells( count );
+    parallelForBlocks( 0, count, BATCH_BLOCK_SIZE, MapToCell( *this, positions, cells ) );
+
+    SurfaceOp op = { zpos, zstdev, patches, sigma_threshold, config.updateModel == MLSConfiguration::SLOPE };
+    return runBatch( *this, cells, op );
+}
+
+size_t MLSGrid::get( const Position* positions, size_t count, double* zpos, double* zstdev, const SurfacePatch** patches, double sigma_threshold ) const
+{
+    if( patches )
+	std::fill( patches, patches + count, (const SurfacePatch*)NULL );
+
+    BatchCells cells( count );
+    parallelForBlocks( 0, count, BATCH_BLOCK_SIZE, GridToCell( *this, positions, cells ) );
+
+    SurfaceOp op = { zpos, zstdev, patches, sigma_threshold, config.updateModel == MLSConfiguration::SLOPE };
+    return runBatch( *this, cells, op );
+}
+
+size_t MLSGrid::getTop( const Eigen::Vector2d* positions, size_t count, double* zpos, const SurfacePatch** patches ) const
+{
+    if( patches )
+	std::fill( patches, patches + count, (const SurfacePatch*)NULL );
+
+    BatchCells cells( count );
+    parallelForBlocks( 0, count, BATCH_BLOCK_SIZE, MapToCell( *this, positions, cells ) );
+
+    TopOp op = { zpos, patches };
+    return runBatch( *this, cells, op );
+}
 
 void MLSGrid::serialize(Serialization& so)
 {
@@ -167,6 +423,8 @@ void MLSGrid::unserialize(Serialization& so)
 	config.useColor = false;
 
     cells.resize( cellSizeX, cellSizeY );
+    resizeTiles();
+    touchAll();
 
     // this is a workaround to make the MLS generatable by 
     // the GridBase::create method, which sets the map_count
@@ -400,12 +658,14 @@ void MLSGrid::insertHead( size_t xi, size_t yi, const SurfacePatch& value )
 {
     cells.insertHead( xi, yi, value );
     addCell( Position( xi, yi ) );
+    touchCell( xi, yi );
 }
 
 void MLSGrid::insertTail( size_t xi, size_t yi, const SurfacePatch& value )
 {
     cells.insertTail( xi, yi, value );
     addCell( Position( xi, yi ) );
+    touchCell( xi, yi );
 }
 
 MLSGrid::iterator MLSGrid::erase( iterator position )
@@ -415,6 +675,14 @@ MLSGrid::iterator MLSGrid::erase( iterator position )
     return res; 
 }
 
+void MLSGrid::clearCell( size_t xi, size_t yi )
+{
+    iterator it = beginCell( xi, yi );
+    while( it != endCell() )
+	it = erase( it );
+    touchCell( xi, yi );
+}
+
 MLSGrid::SurfacePatch* MLSGrid::get(const Position& position, double zpos, double zstdev, double sigma_threshold, bool ignore_negative )
 {
     SurfacePatch tmp(zpos, zstdev);
@@ -480,13 +748,23 @@ void MLSGrid::updateCell( const Position& pos, const SurfacePatch& o )
 }
 
 void MLSGrid::updateCell( size_t xi, size_t yi, const SurfacePatch& co )
+{
+    touchCell( xi, yi );
+    const int change = mergeIntoCell( xi, yi, co );
+    if( change > 0 )
+	addCell( Position( xi, yi ) );
+    else
+	cellcount += change;
+}
+
+int MLSGrid::mergeIntoCell( size_t xi, size_t yi, const SurfacePatch& co )
 {
     typedef std::list<MLSGrid::iterator> iterator_list;
     iterator_list merged;
     // make a copy of the surfacepatch as it may get updated in the merge
     SurfacePatch o( co );
 
-    for(MLSGrid::iterator it = beginCell( xi, yi ); it != endCell(); it++ )
+    for(MLSGrid::iterator it = cells.beginCell( xi, yi ); it != cells.endCell(); it++ )
     {
 	// merge the patches and remember the ones which where merged 
 	if( mergePatch( *it, o ) )
@@ -496,28 +774,30 @@ void MLSGrid::updateCell( size_t xi, size_t yi, const SurfacePatch& co )
     if( merged.empty() )
     {
 	// insert the patch since we didn't merge it with any other
-	insertHead( xi, yi, o );
+	cells.insertHead( xi, yi, o );
+	return 1;
     }
-    else
+
+    // if there is more than one affected patch, merge them until 
+    // there is only one left
+    int erased = 0;
+    while( !merged.empty() )
     {
-	// if there is more than one affected patch, merge them until 
-	// there is only one left
-	while( !merged.empty() )
+	iterator_list::iterator it = ++merged.begin();
+	while( it != merged.end() ) 
 	{
-	    iterator_list::iterator it = ++merged.begin();
-	    while( it != merged.end() ) 
+	    if( mergePatch( **merged.begin(), **it ) )
 	    {
-		if( mergePatch( **merged.begin(), **it ) )
-		{
-		    erase( *it );
-		    it = merged.erase( it );
-		}
-		else
-		    it++;
+		cells.erase( *it );
+		erased++;
+		it = merged.erase( it );
 	    }
-	    merged.pop_front();
+	    else
+		it++;
 	}
+	merged.pop_front();
     }
+    return -erased;
 }
 
 bool MLSGrid::update( const Eigen::Vector2d& pos, const SurfacePatch& patch )
@@ -567,22 +847,277 @@ std::pair<SurfacePatch*, double>
     return std::make_pair( min, dist );
 }
 
-void MLSGrid::merge( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset )
+struct MLSGrid::MergeTask
 {
-    const std::set<Position> *cells;
-    boost::shared_ptr<Index> tmpIndex;
-    if( !other.getIndex() )
+    enum Mode
+    {
+	/// merge each cell of other into the cell containing its center
+	FORWARD,
+	/// merge each cell of other into the cells it overlaps, weighted by area
+	RESAMPLE,
+	/// merge into each cell the cell of other containing its center
+	NEAREST
+    };
+
+    MLSGrid& grid;
+    const MLSGrid& other;
+    /// added to the patches if given, otherwise the patches are kept as
+    /// they are apart from the transformation of their mean
+    const SurfacePatch* offset;
+    Mode mode;
+
+    /// 2d part of the transformation from other to this, and the 2d part
+    /// of the transformation used to look up cells of other
+    Eigen::Matrix2d A, Ainv;
+    Eigen::Vector2d b, binv;
+    /// z offset of the transformation, as a function of x and y, and the
+    /// factor applied to the mean of the patches
+    Eigen::Vector3d zrow;
+    double zscale;
+
+    /// tiles of this grid to process, and the results per tile
+    std::vector<Position> tiles;
+    std::vector<char> modified;
+    std::vector<int> countChange;
+    std::vector<CellExtents> insertedExtents;
+    std::vector< std::vector<Position> > inserted;
+
+    MergeTask( MLSGrid& grid, const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch* offset, Mode mode )
+	: grid( grid ), other( other ), offset( offset ), mode( mode ), zscale( 1.0 )
     {
-        tmpIndex.reset(new Index);
-        other.generateIndex(tmpIndex);
-        cells = &(tmpIndex->cells);
+	if( mode == NEAREST )
+	{
+	    // cells are looked up by their center in this grid, and the z
+	    // offset is taken at that position as well
+	    const Eigen::Affine3d this2other( other2this.inverse() );
+	    Ainv = this2other.linear().topLeftCorner<2,2>();
+	    binv = this2other.translation().head<2>();
+	    zrow << this2other.linear()(2,0), this2other.linear()(2,1), this2other.translation().z();
+	    if( std::abs( Ainv.determinant() ) < 1e-9 )
+		throw std::runtime_error("MLSGrid::merge() grids are perpendicular to each other.");
+	    A = Ainv.inverse();
+	    b = -A * binv;
+	}
+	else
+	{
+	    A = other2this.linear().topLeftCorner<2,2>();
+	    b = other2this.translation().head<2>();
+	    zrow << other2this.linear()(2,0), other2this.linear()(2,1), other2this.translation().z();
+	    if( std::abs( A.determinant() ) < 1e-9 )
+		throw std::runtime_error("MLSGrid::merge() grids are perpendicular to each other.");
+	    Ainv = A.inverse();
+	    binv = -Ainv * b;
+	    if( !offset )
+		zscale = other2this.linear()(2,2);
+	}
+
+	// tiles of this grid covered by the other grid
+	Eigen::AlignedBox<double,2> box;
+	for( int i = 0; i < 4; i++ )
+	{
+	    const Eigen::Vector2d corner( 
+		    other.offsetx + (i & 1) * other.cellSizeX * other.scalex,
+		    other.offsety + (i >> 1) * other.cellSizeY * other.scaley );
+	    box.extend( A * corner + b );
+	}
+	int x0, y0, x1, y1;
+	cellRange( box, grid, x0, y0, x1, y1 );
+	for( int ty = y0 / TILE_SIZE; x0 <= x1 && y0 <= y1 && ty <= (int)(y1 / TILE_SIZE); ty++ )
+	    for( int tx = x0 / TILE_SIZE; tx <= (int)(x1 / TILE_SIZE); tx++ )
+		tiles.push_back( Position( tx, ty ) );
+
+	modified.resize( tiles.size() );
+	countChange.resize( tiles.size() );
+	insertedExtents.resize( tiles.size() );
+	inserted.resize( tiles.size() );
     }
-    else
+
+    /** range of cells of the target covered by the box, expanded by one
+     * cell and clipped to the grid. The range is empty if x0 > x1 or y0 > y1.
+     */
+    static void cellRange( const Eigen::AlignedBox<double,2>& box, const MLSGrid& target, int& x0, int& y0, int& x1, int& y1 )
     {
-        cells = &(other.getIndex()->cells);
+	x0 = std::max( 0.0, floor( (box.min().x() - target.offsetx) / target.scalex ) - 1 );
+	y0 = std::max( 0.0, floor( (box.min().y() - target.offsety) / target.scaley ) - 1 );
+	x1 = std::min( (double)target.cellSizeX - 1, floor( (box.max().x() - target.offsetx) / target.scalex ) + 1 );
+	y1 = std::min( (double)target.cellSizeY - 1, floor( (box.max().y() - target.offsety) / target.scaley ) + 1 );
     }
-    
-    
+
+    /** z offset of the transformation at the given position */
+    double zOffset( const Eigen::Vector2d& p ) const
+    {
+	return zrow.x() * p.x() + zrow.y() * p.y() + zrow.z();
+    }
+
+    /** merges the patches of cell (sx, sy) in other into cell (m, n) of
+     * this grid, with their mean moved by z and the weight of the patches
+     * scaled by weight. */
+    void mergeCell( size_t i, size_t sx, size_t sy, size_t m, size_t n, double z, double weight )
+    {
+	for( MLSGrid::const_iterator cit = other.beginCell( sx, sy ); cit != other.endCell(); cit++ )
+	{
+	    SurfacePatch meas_patch( *cit );
+	    if( offset )
+	    {
+		meas_patch.mean += offset->mean + z;
+		meas_patch.stdev = sqrt( pow( meas_patch.stdev, 2 ) + pow( offset->stdev, 2 ) );
+		meas_patch.update_idx = offset->update_idx;
+	    }
+	    else
+		meas_patch.mean = zscale * meas_patch.mean + z;
+	    if( weight < 1.0 )
+	    {
+		meas_patch.scaleWeight( weight );
+		meas_patch.stdev /= sqrt( weight );
+	    }
+
+	    const int change = grid.mergeIntoCell( m, n, meas_patch );
+	    countChange[i] += change;
+	    if( change > 0 )
+	    {
+		insertedExtents[i].extend( Eigen::Vector2i( m, n ) );
+		if( grid.index )
+		    inserted[i].push_back( Position( m, n ) );
+	    }
+	}
+	modified[i] = true;
+    }
+
+    void processTile( size_t i )
+    {
+	const CellExtents ext = grid.getTileExtents( tiles[i].x, tiles[i].y );
+	if( mode == RESAMPLE )
+	    resampleTile( i, ext );
+	else if( mode == NEAREST )
+	    nearestTile( i, ext );
+	else
+	    forwardTile( i, ext );
+    }
+
+    /** merges all cells of the other grid whose center maps into the tile */
+    void forwardTile( size_t i, const CellExtents& ext )
+    {
+	// area of the tile mapped into the other grid
+	Eigen::AlignedBox<double,2> box;
+	for( int c = 0; c < 4; c++ )
+	{
+	    const Eigen::Vector2d corner(
+		    grid.offsetx + ((c & 1) ? ext.max().x() + 1 : ext.min().x()) * grid.scalex,
+		    grid.offsety + ((c >> 1) ? ext.max().y() + 1 : ext.min().y()) * grid.scaley );
+	    box.extend( Ainv * corner + binv );
+	}
+	int x0, y0, x1, y1;
+	cellRange( box, other, x0, y0, x1, y1 );
+
+	// same order as the index of the other grid, so the result is
+	// the same as merging sequentially
+	for( int sx = x0; sx <= x1; sx++ )
+	{
+	    for( int sy = y0; sy <= y1; sy++ )
+	    {
+		if( other.beginCell( sx, sy ) == other.endCell() )
+		    continue;
+
+		const Eigen::Vector2d c = other.fromGrid( Position( sx, sy ) );
+		const Eigen::Vector2d p = A * c + b;
+		size_t m, n;
+		if( grid.toGrid( p.x(), p.y(), m, n ) && ext.contains( Eigen::Vector2i( m, n ) ) )
+		    mergeCell( i, sx, sy, m, n, zOffset( c ), 1.0 );
+	    }
+	}
+    }
+
+    /** merges into each cell of the tile the cell of the other grid which
+     * contains its center */
+    void nearestTile( size_t i, const CellExtents& ext )
+    {
+	for( int m = ext.min().x(); m <= ext.max().x(); m++ )
+	{
+	    for( int n = ext.min().y(); n <= ext.max().y(); n++ )
+	    {
+		const Eigen::Vector2d p = grid.fromGrid( Position( m, n ) );
+		const Eigen::Vector2d q = Ainv * p + binv;
+		size_t sx, sy;
+		if( other.toGrid( q.x(), q.y(), sx, sy ) && other.beginCell( sx, sy ) != other.endCell() )
+		    mergeCell( i, sx, sy, m, n, zOffset( p ), 1.0 );
+	    }
+	}
+    }
+
+    /** merges all cells of the other grid which overlap a cell of the tile,
+     * weighted by the overlapping area. The area is estimated by sampling
+     * the cell on a regular grid, with at least two samples per cell of the
+     * other grid in each direction. */
+    void resampleTile( size_t i, const CellExtents& ext )
+    {
+	const double ratio = std::max( grid.scalex / other.scalex, grid.scaley / other.scaley );
+	const int ns = std::max( 4, (int)ceil( 2.0 * ratio ) );
+	const double sampleWeight = 1.0 / (ns * ns);
+
+	// linear index of the cell of the other grid for each sample
+	std::vector<size_t> samples;
+	samples.reserve( ns * ns );
+	for( int m = ext.min().x(); m <= ext.max().x(); m++ )
+	{
+	    for( int n = ext.min().y(); n <= ext.max().y(); n++ )
+	    {
+		samples.clear();
+		for( int si = 0; si < ns; si++ )
+		{
+		    for( int sj = 0; sj < ns; sj++ )
+		    {
+			const Eigen::Vector2d p(
+				grid.offsetx + (m + (si + 0.5) / ns) * grid.scalex,
+				grid.offsety + (n + (sj + 0.5) / ns) * grid.scaley );
+			size_t sx, sy;
+			const Eigen::Vector2d q = Ainv * p + binv;
+			if( other.toGrid( q.x(), q.y(), sx, sy ) )
+			    samples.push_back( sx * other.cellSizeY + sy );
+		    }
+		}
+
+		// number of samples per cell, in the order of the other grid
+		std::sort( samples.begin(), samples.end() );
+		for( size_t s = 0; s < samples.size(); )
+		{
+		    size_t e = s;
+		    while( e < samples.size() && samples[e] == samples[s] )
+			e++;
+
+		    const size_t sx = samples[s] / other.cellSizeY;
+		    const size_t sy = samples[s] % other.cellSizeY;
+		    if( other.beginCell( sx, sy ) != other.endCell() )
+			mergeCell( i, sx, sy, m, n, 
+				zOffset( other.fromGrid( Position( sx, sy ) ) ), (e - s) * sampleWeight );
+		    s = e;
+		}
+	    }
+	}
+    }
+};
+
+void MLSGrid::runMergeTask( MergeTask& task )
+{
+    // the tiles are merged in parallel, and only access the storage of
+    // their own tile. The bookkeeping is done afterwards.
+    parallelFor( 0, task.tiles.size(), boost::bind( &MergeTask::processTile, &task, _1 ) );
+
+    for( size_t i = 0; i < task.tiles.size(); i++ )
+    {
+	if( !task.modified[i] )
+	    continue;
+
+	tileRevisions[task.tiles[i].y * tileCountX + task.tiles[i].x] = ++revision;
+	cellcount += task.countChange[i];
+	if( !task.insertedExtents[i].isEmpty() )
+	    extents.extend( task.insertedExtents[i] );
+	if( index )
+	    index->cells.insert( task.inserted[i].begin(), task.inserted[i].end() );
+    }
+}
+
+void MLSGrid::merge( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset, bool resample )
+{
     // need to handle cell color here for the update
     // we need to set the pgrid cell color, such that it matches
     // that of the scanmap for the update. Afterwards, we set it 
@@ -591,36 +1126,52 @@ void MLSGrid::merge( const MLSGrid& other, const Eigen::Affine3d& other2this, co
     bool hadCellColor = config.useColor;
     config.useColor = other.config.useColor;
 
+    MergeTask task( *this, other, other2this, &offset, 
+	    resample ? MergeTask::RESAMPLE : MergeTask::FORWARD );
+    runMergeTask( task );
 
-    // go through the index and merge each cell  
-    for(std::set<Position>::iterator it = cells->begin(); it != cells->end(); it++)
-    {
-	// get center of cell and transform position
-	// to this grid
-	Eigen::Vector3d mappos( Eigen::Vector3d::Zero() );
-	other.fromGrid( it->x, it->y, mappos.x(), mappos.y() );
-	mappos = other2this * mappos;
+    if( hadCellColor )
+	config.useColor = hadCellColor;
+}
 
-	// if it is still valid in this grid get cell position
-	size_t m, n;
-	if( toGrid( mappos.x(), mappos.y(), m, n ) )
+void MLSGrid::mergeTransformed( const MLSGrid& other, const Eigen::Affine3d& other2this, bool reverse )
+{
+    if( reverse )
+    {
+	MergeTask task( *this, other, other2this, NULL, MergeTask::NEAREST );
+	runMergeTask( task );
+    }
+    else if( other2this.linear()(0,2) == 0 && other2this.linear()(1,2) == 0 )
+    {
+	// the target cell of a patch does not depend on its mean, so the
+	// cells can be assigned to the tiles up front
+	MergeTask task( *this, other, other2this, NULL, MergeTask::FORWARD );
+	runMergeTask( task );
+    }
+    else
+    {
+	for( size_t m = 0; m < other.getWidth(); m++ )
 	{
-	    Position pos(m, n);
-	    // iterate through cells in source map
-	    for(envire::MLSGrid::const_iterator cit = other.beginCell(it->x,it->y); cit != other.endCell(); cit++ )
+	    for( size_t n = 0; n < other.getHeight(); n++ )
 	    {
-		SurfacePatch meas_patch( *cit );
-		meas_patch.mean += offset.mean + mappos.z();
-		meas_patch.stdev = sqrt( pow( meas_patch.stdev, 2 ) + pow( offset.stdev, 2 ) );
-		meas_patch.update_idx = offset.update_idx;
+		for( MLSGrid::const_iterator cit = other.beginCell( m, n ); cit != other.endCell(); cit++ )
+		{
+		    SurfacePatch p( *cit );
+
+		    Eigen::Vector3d pos;
+		    pos << other.fromGrid( Position( m, n ) ), p.mean;
+		    const Eigen::Vector3d target_pos = other2this * pos;
 
-		updateCell( pos.x, pos.y, meas_patch );
+		    Position t_pos;
+		    if( toGrid( target_pos.head<2>(), t_pos ) )
+		    {
+			p.mean = target_pos.z();
+			updateCell( t_pos.x, t_pos.y, p );
+		    }
+		}
 	    }
 	}
     }
-
-    if( hadCellColor )
-	config.useColor = hadCellColor;
 }
 
 float MLSGrid::match( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset, size_t sampling, float sigma )
@@ -692,6 +1243,7 @@ void MLSGrid::scalePatchWeights( double scale )
             }
         }
     }
+    touchAll();
 }
 
 std::pair<double, double> MLSGrid::matchHeight( const MLSGrid& other )
@@ -762,5 +1314,6 @@ void MLSGrid::initIndex()
 void MLSGrid::move(int x, int y)
 {
     cells.move(x, y);
+    touchAll();
 }
 
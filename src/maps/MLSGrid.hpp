@@ -40,6 +40,14 @@ namespace envire
      *
      * Merged sets of MLSGrid instances can be managed with the
      * MLSMap map class.
+     *
+     * Copies of a grid share their cell storage with the original until
+     * either of them is modified, at which point only the modified tiles of
+     * TILE_SIZE x TILE_SIZE cells are duplicated (see ListGrid). Copying a
+     * grid is therefore cheap, and a copy can be used as a snapshot by
+     * reader threads, while the original is updated further. Note that
+     * accessing cells through the non-const interface (e.g. the non-const
+     * beginCell or get) counts as a modification.
      */
     class MLSGrid : public GridBase
     {
@@ -103,7 +111,7 @@ namespace envire
 	 * This function expects a spline in world coordinates that
 	 * get's projected on top of the surface of the mls grid.
 	 * */
-	base::geometry::Spline3 projectSplineOnSurface(double startHeight, const base::geometry::Spline3 &spline, const double zOffset = 0.0);
+	base::geometry::Spline3 projectSplineOnSurface(double startHeight, const base::geometry::Spline3 &spline, const double zOffset = 0.0) const;
 
 	/**
 	 * This function expects an array of local 
@@ -111,7 +119,7 @@ namespace envire
 	 * of local grid coordinates with Z positions 
 	 * on top of surface of the mls grid. 
 	 * */
-	std::vector<Eigen::Vector3d> projectPointsOnSurface(double startHeight, const std::vector<Position> &gridPoints, const double zOffset = 0.0);
+	std::vector<Eigen::Vector3d> projectPointsOnSurface(double startHeight, const std::vector<Position> &gridPoints, const double zOffset = 0.0) const;
 	
         /** Returns the iterator on the first registered patch at \c xi and \c
          * yi
@@ -142,8 +150,12 @@ namespace envire
          * the given position
          */
 	void insertTail( size_t xi, size_t yi, const SurfacePatch& value );
-        /** Removes the patch pointed-to by \c position */
+        /** Removes the patch pointed-to by \c position. Since the cell is not
+         * known here, it needs to be marked using touchCell() by the caller.
+         */
 	iterator erase( iterator position );
+        /** Removes all patches of the cell at the given position */
+	void clearCell( size_t xi, size_t yi );
 
         /** Finds a surface patch at \c (position.x, position.y) that matches
          * the Z information contained in \c patch (patch is used to get mean
@@ -159,6 +171,46 @@ namespace envire
 	 * used for backwards compatibility
 	 */
 	SurfacePatch* get( const Eigen::Vector3d& position, double& zpos, double& zstdev );
+
+	/**
+	 * Batched version of get( const Eigen::Vector2d&, double&, double& ).
+	 *
+	 * For each of the count positions, which are given in the map-local
+	 * frame, the patch matching zpos[i] and zstdev[i] is searched. If one
+	 * is found, its height and stdev are written to zpos[i] and
+	 * zstdev[i], otherwise they are left unchanged. The queries are
+	 * grouped by tile for memory locality and processed in parallel. All
+	 * buffers are provided by the caller and hold count elements.
+	 *
+	 * As this method is const, it can be used on snapshots of the grid
+	 * (see class documentation) without duplicating any tiles.
+	 *
+	 * @param patches if not NULL, receives the matching patch for each
+	 *        query or NULL if there is none
+	 * @return the number of queries for which a patch was found
+	 */
+	size_t get( const Eigen::Vector2d* positions, size_t count, double* zpos, double* zstdev, 
+		const SurfacePatch** patches = NULL, double sigma_threshold = 3.0 ) const;
+
+	/** Same as the above for positions given as cell indices. For the SLOPE
+	 * model, the height at the center of the cell is returned.
+	 */
+	size_t get( const Position* positions, size_t count, double* zpos, double* zstdev, 
+		const SurfacePatch** patches = NULL, double sigma_threshold = 3.0 ) const;
+
+	/**
+	 * For each of the count positions in the map-local frame, finds the
+	 * patch with the highest mean in the cell, and writes its mean to
+	 * zpos[i]. zpos[i] is left unchanged for positions outside the grid or
+	 * on empty cells. Like the batched get(), the queries are grouped by
+	 * tile and processed in parallel.
+	 *
+	 * @param patches if not NULL, receives the topmost patch for each
+	 *        query or NULL if there is none
+	 * @return the number of queries for which a patch was found
+	 */
+	size_t getTop( const Eigen::Vector2d* positions, size_t count, double* zpos, 
+		const SurfacePatch** patches = NULL ) const;
 	void updateCell( size_t xi, size_t yi, double mean, double stdev );
 	void updateCell( size_t xi, size_t yi, const SurfacePatch& patch );
 	void updateCell( const Position& pos, const SurfacePatch& patch );
@@ -188,6 +240,46 @@ namespace envire
          */
         void scalePatchWeights( double scale );
 
+	/** 
+	 * Cells are grouped into square tiles of TILE_SIZE x TILE_SIZE cells,
+	 * which are used to keep track of modifications of the grid. Each
+	 * modification increases the revision of the grid, and the tile
+	 * containing the modified cell is stamped with that revision. The
+	 * tiles are the same as the copy-on-write tiles of the cell storage.
+	 */
+	static const size_t TILE_SIZE = ListGrid<SurfacePatch>::TILE_SIZE;
+
+	/** @return the current revision, which is increased with each
+	 * modification of the grid */
+	size_t getRevision() const { return revision; }
+
+	/** Marks the cell as modified. The methods of this class do this
+	 * automatically, but it needs to be called when patches are changed
+	 * through an iterator.
+	 */
+	void touchCell( size_t xi, size_t yi )
+	{
+	    tileRevisions[(yi / TILE_SIZE) * tileCountX + xi / TILE_SIZE] = ++revision;
+	}
+
+	/** Marks all cells of the grid as modified */
+	void touchAll();
+
+	size_t getTileCountX() const { return tileCountX; }
+	size_t getTileCountY() const { return tileCountY; }
+
+	/** @return the revision at which the tile was last modified */
+	size_t getTileRevision( size_t tx, size_t ty ) const { return tileRevisions[ty * tileCountX + tx]; }
+
+	/** @return the cell extents covered by the given tile, with inclusive
+	 * max values */
+	CellExtents getTileExtents( size_t tx, size_t ty ) const;
+
+	/** Adds the positions of all tiles, that have been modified after the
+	 * given revision to tiles.
+	 */
+	void getModifiedTiles( size_t revision, std::vector<Position>& tiles ) const;
+
 	size_t getCellCount() const { return cellcount; }
 	bool empty() const { return cellcount == 0; }
 
@@ -216,12 +308,42 @@ namespace envire
 	 * merge another MLSGrid into this grid applying a transform
 	 * if necessary.
 	 *
+	 * The grid is processed in parallel, one tile at a time. For each
+	 * tile, only the region of the other grid that maps into the tile is
+	 * visited. The result does not depend on the number of threads.
+	 *
 	 * @param other grid to merge into this
 	 * @param other2this transformation from other grid to this grid
 	 * @param offset mean, stdev well be added to the other cells before
 	 *        merging. Also update_idx will be used from offset
+	 * @param resample if false, the patches of each cell of the other grid
+	 *        are merged into the cell containing its transformed center.
+	 *        If true, each cell of this grid receives the patches of all
+	 *        cells of the other grid that overlap it, with their weight
+	 *        scaled by the covered fraction of the cell area. This avoids
+	 *        aliasing when the other grid is rotated or has a different
+	 *        resolution.
+	 */
+	void merge( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset, bool resample = false );
+
+	/** 
+	 * merge another MLSGrid into this grid, transforming the mean of
+	 * each patch together with the center of its cell. The patches keep
+	 * their stdev and update_idx.
+	 *
+	 * If the cell a patch ends up in depends on its mean, because the
+	 * transformation tilts the grid, the patches are merged sequentially.
+	 * Otherwise the grid is processed in parallel as in merge().
+	 *
+	 * @param other grid to merge into this
+	 * @param other2this transformation from other grid to this grid
+	 * @param reverse if false, the patches of each cell of the other grid
+	 *        are merged into the cell containing their transformed position.
+	 *        If true, each cell of this grid receives the patches of the
+	 *        cell of the other grid containing its center, with the mean
+	 *        moved by the height of the center in the other grid.
 	 */
-	void merge( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset );
+	void mergeTransformed( const MLSGrid& other, const Eigen::Affine3d& other2this, bool reverse = false );
 
 	/** 
 	 * see how well the other MLSGrid matches into this one 
@@ -273,6 +395,18 @@ namespace envire
     protected:
 	bool mergePatch( SurfacePatch& p, SurfacePatch& o );
 
+	/** merges the patch into the cell without updating the revision, the
+	 * patch count or the index. This only touches the storage tile of the
+	 * cell, so it can be called concurrently for different tiles.
+	 *
+	 * @return the change in the number of patches of the cell
+	 */
+	int mergeIntoCell( size_t xi, size_t yi, const SurfacePatch& patch );
+
+	/// per tile worker of merge() and mergeTransformed()
+	struct MergeTask;
+	void runMergeTask( MergeTask& task );
+
 	/// configuration of the mls
 	Configuration config;
 
@@ -282,6 +416,12 @@ namespace envire
 	/// optionaly stores information on which grid cells are used
 	boost::shared_ptr<Index> index;
 	CellExtents extents;
+
+	/// modification tracking, see TILE_SIZE
+	size_t revision;
+	size_t tileCountX, tileCountY;
+	std::vector<size_t> tileRevisions;
+	void resizeTiles();
     };
 
     /** For backward compatibility. Use MLSGrid instead. */
@@ -1,6 +1,7 @@
 #include "Core.hpp"
 #include "maps/Pointcloud.hpp"
 #include "tools/PlyFile.hpp"
+#include "tools/PointcloudTextReader.hpp"
 
 #include <fstream>
 
@@ -13,6 +14,53 @@ const std::string Pointcloud::VERTEX_NORMAL = "vertex_normal";
 const std::string Pointcloud::VERTEX_VARIANCE = "vertex_variance";
 const std::string Pointcloud::VERTEX_ATTRIBUTES = "vertex_attributes";
 
+void PointChannels::assign( const std::vector<Eigen::Vector3d>& points )
+{
+    resize( points.size() );
+    for( size_t i = 0; i < points.size(); i++ )
+	set( i, points[i] );
+}
+
+void PointChannels::copyTo( std::vector<Eigen::Vector3d>& points ) const
+{
+    points.resize( size() );
+    for( size_t i = 0; i < points.size(); i++ )
+	points[i] = (*this)[i];
+}
+
+void PointChannels::transform( const Eigen::Affine3d& t )
+{
+    const Eigen::Matrix<float, 3, 4> m( t.matrix().topRows<3>().cast<float>() );
+    const size_t n = size();
+    float *px = n ? &x[0] : NULL, *py = n ? &y[0] : NULL, *pz = n ? &z[0] : NULL;
+    // plain loop over the channels, so that the compiler can vectorize it
+    for( size_t i = 0; i < n; i++ )
+    {
+	const float vx = px[i], vy = py[i], vz = pz[i];
+	px[i] = m(0,0) * vx + m(0,1) * vy + m(0,2) * vz + m(0,3);
+	py[i] = m(1,0) * vx + m(1,1) * vy + m(1,2) * vz + m(1,3);
+	pz[i] = m(2,0) * vx + m(2,1) * vy + m(2,2) * vz + m(2,3);
+    }
+}
+
+Eigen::AlignedBox<double, 3> PointChannels::getExtents() const
+{
+    Eigen::AlignedBox<double, 3> res;
+    if( empty() )
+	return res;
+
+    Eigen::Vector3f min( x[0], y[0], z[0] ), max( min );
+    for( size_t i = 1; i < size(); i++ )
+    {
+	min.x() = std::min( min.x(), x[i] ); max.x() = std::max( max.x(), x[i] );
+	min.y() = std::min( min.y(), y[i] ); max.y() = std::max( max.y(), y[i] );
+	min.z() = std::min( min.z(), z[i] ); max.z() = std::max( max.z(), z[i] );
+    }
+    res.extend( min.cast<double>() );
+    res.extend( max.cast<double>() );
+    return res;
+}
+
 Pointcloud::Pointcloud() : sensor_origin(Eigen::Affine3d::Identity())
 {
 }
@@ -38,6 +86,9 @@ void Pointcloud::serialize(Serialization& so, bool handleMap)
 
     so.write( "sensor_origin", sensor_origin );
 
+    if( vertices.empty() && !channels.empty() )
+	updateVertices();
+
     if(handleMap)
 	writePly( getMapFileName() + ".ply", so.getBinaryOutputStream(getMapFileName() + ".ply") );
 }
@@ -82,44 +133,31 @@ bool Pointcloud::writeText(std::ostream& os)
 
 bool Pointcloud::readText(std::istream& is, int sample, TextFormat format)
 {
-    const int max_line_length = 255;
-    std::vector<Eigen::Vector3d> *color = 0;
-    if(format == XYZR )
-        color = &getVertexData<Eigen::Vector3d>( VERTEX_COLOR );
-    while( !is.eof() )
-    {
-	if( sample == 1 || (rand() % sample == 0) )
-	{
-	    double x, y, z, c;
-	    is >> x >> y >> z;
-	    if( format == XYZR && color )
-	    {
-		is >> c;
-		color->push_back( Eigen::Vector3d::Identity() * c / 255.0 );
-	    }
-	
-	    vertices.push_back( Eigen::Vector3d( x,y,z ) );
-	    is.ignore( max_line_length, '\n' );
-	}
-	else
-	    is.ignore( max_line_length, '\n' );
-        // check for eof bit, to avoid a copy of the last sample
-        is.peek();
-    }
+    PointcloudTextReader reader;
+    reader.setFormat( format );
+    reader.setStride( std::max( sample, 1 ) );
+    reader.read( is, *this );
 
     return true;
 }
 
-Pointcloud* Pointcloud::importCsv(const std::string& file, FrameNode* fn, int sample, TextFormat format)
+Pointcloud* Pointcloud::importCsv(const std::string& file, FrameNode* fn, int sample, TextFormat format, double voxelSize)
 {
-    std::ifstream data(file.c_str());
-    if( data.fail() )  
+    PointcloudTextReader reader;
+    reader.setFormat( format );
+    reader.setStride( std::max( sample, 1 ) );
+    reader.setVoxelSize( voxelSize );
+
+    Pointcloud* pc = new Pointcloud();
+    try
+    {
+	reader.read( file, *pc );
+    }
+    catch( std::runtime_error& )
     {
+	delete pc;
         throw std::runtime_error("Could not open file '" + file + "'.");
     }
-    Pointcloud* pc = new Pointcloud();
-    pc->readText( data, sample, format );
-    data.close();
 
     Environment* env = fn->getEnvironment();
     env->attachItem(pc);
@@ -146,6 +184,16 @@ void Pointcloud::copyFrom( Pointcloud* source, bool transform )
 	for( std::vector<Eigen::Vector3d>::iterator it = source->vertices.begin(); it != source->vertices.end(); it ++ )
 	    vertices.push_back( t * *it );
     }
+
+    channels = source->channels;
+    if( transform && needsTransform )
+	channels.transform( t );
+}
+
+void Pointcloud::copyFrom(const ChunkedBuffer<Eigen::Vector3d>& source)
+{
+    clear();
+    source.copyTo( vertices );
 }
 
 void Pointcloud::copyFrom(const base::samples::Pointcloud& source)
@@ -162,8 +210,21 @@ void Pointcloud::copyFrom(const base::samples::Pointcloud& source)
         colors.push_back(Eigen::Vector3d((*iter)(0),(*iter)(1),(*iter)(2)));
 }
 
+void Pointcloud::updateChannels()
+{
+    channels.assign( vertices );
+}
+
+void Pointcloud::updateVertices()
+{
+    channels.copyTo( vertices );
+}
+
 Pointcloud::Extents Pointcloud::getExtents() const
 {
+    if( vertices.empty() )
+	return channels.getExtents();
+
     //TODO: Implement some sort of caching
     Extents res;
     for(size_t i=0;i<vertices.size();i++)
@@ -4,9 +4,88 @@
 #include <envire/Core.hpp>
 #include <envire/core/Serialization.hpp>
 #include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
 #include <base/samples/Pointcloud.hpp>
+#include <envire/tools/ChunkedBuffer.hpp>
 
 namespace envire {
+    /** Structure-of-arrays storage for 3d points in single precision.
+     *
+     * Each coordinate is kept in its own contiguous and aligned channel. This
+     * takes half the memory of a std::vector<Eigen::Vector3d>, and loops over
+     * a channel can be vectorized by the compiler.
+     */
+    class PointChannels
+    {
+    public:
+	typedef std::vector<float, Eigen::aligned_allocator<float> > Channel;
+
+	Channel x, y, z;
+
+	size_t size() const { return x.size(); }
+	bool empty() const { return x.empty(); }
+
+	void clear() { x.clear(); y.clear(); z.clear(); }
+	void reserve( size_t n ) { x.reserve( n ); y.reserve( n ); z.reserve( n ); }
+	void resize( size_t n ) { x.resize( n ); y.resize( n ); z.resize( n ); }
+
+	void push_back( const Eigen::Vector3d& p )
+	{
+	    x.push_back( p.x() ); y.push_back( p.y() ); z.push_back( p.z() );
+	}
+
+	Eigen::Vector3d operator[]( size_t i ) const
+	{
+	    return Eigen::Vector3d( x[i], y[i], z[i] );
+	}
+
+	void set( size_t i, const Eigen::Vector3d& p )
+	{
+	    x[i] = p.x(); y[i] = p.y(); z[i] = p.z();
+	}
+
+	/** replaces the content with the given points */
+	void assign( const std::vector<Eigen::Vector3d>& points );
+
+	/** writes the points into \c points, which is resized accordingly */
+	void copyTo( std::vector<Eigen::Vector3d>& points ) const;
+
+	/** applies \c t to all points */
+	void transform( const Eigen::Affine3d& t );
+
+	Eigen::AlignedBox<double, 3> getExtents() const;
+    };
+
+    /** Handle to a per vertex attribute of a Pointcloud.
+     *
+     * The handle resolves the attribute key once, so that the string lookup
+     * of Pointcloud::getVertexData is not repeated for every access. It stays
+     * valid until the attribute is removed from the pointcloud, or the
+     * pointcloud is destroyed.
+     */
+    template <class T>
+    class VertexAttribute
+    {
+    public:
+	typedef std::vector<T> array_type;
+
+	VertexAttribute() : data( NULL ) {}
+	explicit VertexAttribute( array_type& data ) : data( &data ) {}
+
+	bool isValid() const { return data; }
+	size_t size() const { return data->size(); }
+
+	T& operator[]( size_t i ) { return (*data)[i]; }
+	const T& operator[]( size_t i ) const { return (*data)[i]; }
+
+	array_type& get() { return *data; }
+	const array_type& get() const { return *data; }
+
+    private:
+	array_type* data;
+    };
+
     class Pointcloud : public Map<3> 
     {
 	ENVIRONMENT_ITEM( Pointcloud )
@@ -34,6 +113,15 @@ namespace envire {
 	 */
 	std::vector<Eigen::Vector3d> vertices;
 
+	/** optional single precision copy of the vertices.
+	 *
+	 * Bulk operations like import or transformation can work on the
+	 * channels only, and create the vertices when they are needed with
+	 * updateVertices(). A pointcloud that only has channels gets its
+	 * vertices updated before it is serialized.
+	 */
+	PointChannels channels;
+
     /** sensor acquisition pose
      */
     Transform sensor_origin;
@@ -41,7 +129,11 @@ namespace envire {
     public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
-	static Pointcloud* importCsv(const std::string& file, FrameNode* fn, int sample = 1, TextFormat = XYZR);
+	/** Reads a text file with one point per line, see PointcloudTextReader.
+	 * Every sample-th line is used, and if voxelSize is not 0, only the
+	 * first point in each voxel of that size is kept.
+	 */
+	static Pointcloud* importCsv(const std::string& file, FrameNode* fn, int sample = 1, TextFormat = XYZR, double voxelSize = 0);
 
 	template <typename T>
 	    std::vector<T>& getVertexData(const std::string& key)
@@ -52,12 +144,22 @@ namespace envire {
 	    return data;
 	};
 
+	/** @return a handle to the vertex data for \c key, which is created if
+	 * it does not exist yet
+	 */
+	template <typename T>
+	    VertexAttribute<T> getVertexAttribute(const std::string& key)
+	{
+	    return VertexAttribute<T>( getVertexData<T>( key ) );
+	}
+
 	void clear()
 	{
 	    vertices.clear();
+	    channels.clear();
 	    if( hasData( VERTEX_COLOR ) ) getVertexData<Eigen::Vector3d>( VERTEX_COLOR ).clear();
 	    if( hasData( VERTEX_NORMAL ) ) getVertexData<Eigen::Vector3d>( VERTEX_NORMAL ).clear();
-	    if( hasData( VERTEX_ATTRIBUTES ) ) getVertexData<attr_flag>( VERTEX_ATTRIBUTES ).clear();
+	    if( hasData( VERTEX_ATTRIBUTES ) ) getVertexData<vertex_attr>( VERTEX_ATTRIBUTES ).clear();
 	    if( hasData( VERTEX_VARIANCE ) ) getVertexData<double>( VERTEX_VARIANCE ).clear();
 	};
 
@@ -67,12 +169,21 @@ namespace envire {
 
 	void copyFrom( Pointcloud* source, bool transform = true );
 	void copyFrom(const base::samples::Pointcloud& source);
+	/** replaces the vertices with the points accumulated in \c source.
+	 * The vertices are sized once, see ChunkedBuffer. */
+	void copyFrom(const ChunkedBuffer<Eigen::Vector3d>& source);
+
+	/** copies the vertices into the channels */
+	void updateChannels();
+	/** copies the channels into the vertices */
+	void updateVertices();
 
 	void serialize(Serialization& so);
 	void serialize(Serialization& so, bool handleMap = true);
         void unserialize(Serialization& so, bool handleMap = true);
 
 	bool writeText(std::ostream& os);
+	/** reads the points from a text stream, using every sample-th line */
 	bool readText(std::istream& is, int sample = 1, TextFormat = XYZR );
 
 	bool writePly(const std::string& filename, std::ostream& os, bool const doublePrecision = true);
@@ -3,6 +3,9 @@
 #include <tools/RadialLookUpTable.hpp>
 #include <tools/BoxLookUpTable.hpp>
 #include <Eigen/Geometry>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 using namespace envire;
 using namespace Eigen;
@@ -148,18 +151,360 @@ const TraversabilityClass& TraversabilityGrid::getWorstTraversabilityClassInRect
     return getTraversabilityClass(curClass);
 }
 
-void TraversabilityGrid::probabilityCallback(size_t x, size_t y, double& worst) const
+bool TraversabilityGrid::FootprintIndex::MaskKey::operator<(const MaskKey& other) const
 {
-    double curProbabilty = getProbability(x, y);
-    if(worst > curProbabilty)
-        worst = curProbabilty; 
+    if(sizeX != other.sizeX)
+        return sizeX < other.sizeX;
+    if(sizeY != other.sizeY)
+        return sizeY < other.sizeY;
+    return heading < other.heading;
 }
 
+TraversabilityGrid::FootprintIndex& TraversabilityGrid::FootprintIndex::operator=(const FootprintIndex& other)
+{
+    headingCount = other.headingCount;
+    clear();
+    return *this;
+}
+
+void TraversabilityGrid::FootprintIndex::clear()
+{
+    width = 0;
+    height = 0;
+    valid = false;
+    orderValid = false;
+    hasDirtyRows = false;
+    tableIndex.clear();
+    prefix.clear();
+    dirtyRows.clear();
+    order.clear();
+    masks.clear();
+}
+
+static void updatePrefixRow(std::vector<std::vector<uint32_t> > &prefix, const std::vector<int> &tableIndex, const uint8_t *row, size_t width, size_t y)
+{
+    const size_t rowStart = y * (width + 1);
+    for(size_t t = 0; t < prefix.size(); t++)
+        prefix[t][rowStart] = 0;
+
+    for(size_t x = 0; x < width; x++)
+    {
+        const size_t i = rowStart + x;
+        for(size_t t = 0; t < prefix.size(); t++)
+            prefix[t][i + 1] = prefix[t][i];
+        prefix[tableIndex[row[x]]][i + 1]++;
+    }
+}
+
+void TraversabilityGrid::updateFootprintIndex() const
+{
+    FootprintIndex &index(footprintIndex);
+    const ArrayType &data(getGridData(TRAVERSABILITY));
+    const size_t width = getCellSizeX();
+    const size_t height = getCellSizeY();
+
+    if(index.valid && index.width == width && index.height == height)
+    {
+        if(!index.hasDirtyRows)
+            return;
+
+        // rows can be updated in place, unless a value without a table
+        // showed up
+        bool needsRebuild = false;
+        for(size_t y = 0; y < height && !needsRebuild; y++)
+        {
+            if(!index.dirtyRows[y])
+                continue;
+            for(size_t x = 0; x < width; x++)
+            {
+                if(index.tableIndex[data[y][x]] < 0)
+                {
+                    needsRebuild = true;
+                    break;
+                }
+            }
+        }
+
+        if(!needsRebuild)
+        {
+            for(size_t y = 0; y < height; y++)
+            {
+                if(index.dirtyRows[y])
+                    updatePrefixRow(index.prefix, index.tableIndex, &data[y][0], width, y);
+            }
+            index.dirtyRows.assign(height, false);
+            index.hasDirtyRows = false;
+            return;
+        }
+    }
+
+    index.width = width;
+    index.height = height;
+    index.tableIndex.assign(std::numeric_limits<uint8_t>::max() + 1, -1);
+    int tableCount = 0;
+    for(size_t y = 0; y < height; y++)
+    {
+        for(size_t x = 0; x < width; x++)
+        {
+            if(index.tableIndex[data[y][x]] < 0)
+                index.tableIndex[data[y][x]] = tableCount++;
+        }
+    }
+
+    index.prefix.assign(tableCount, std::vector<uint32_t>(height * (width + 1)));
+    for(size_t y = 0; y < height; y++)
+        updatePrefixRow(index.prefix, index.tableIndex, &data[y][0], width, y);
+
+    index.dirtyRows.assign(height, false);
+    index.hasDirtyRows = false;
+    index.orderValid = false;
+    index.valid = true;
+}
+
+void TraversabilityGrid::updateFootprintOrder() const
+{
+    FootprintIndex &index(footprintIndex);
+    if(index.orderValid)
+        return;
+
+    // values without a registered class go first, so that the queries fail
+    // on them like getTraversabilityClass does
+    std::vector<std::pair<double, uint8_t> > sorted;
+    for(size_t v = 0; v < index.tableIndex.size(); v++)
+    {
+        if(index.tableIndex[v] < 0)
+            continue;
+        double drivability = -1;
+        if(v < traversabilityClasses.size())
+            drivability = traversabilityClasses[v].getDrivability();
+        sorted.push_back(std::make_pair(drivability, (uint8_t) v));
+    }
+    std::stable_sort(sorted.begin(), sorted.end());
+
+    index.order.clear();
+    for(size_t i = 0; i < sorted.size(); i++)
+        index.order.push_back(sorted[i].second);
+    index.orderValid = true;
+}
+
+bool TraversabilityGrid::getFootprint(const base::Pose2D& pose, double sizeX, double sizeY, const FootprintIndex::Mask*& mask, size_t& xCenter, size_t& yCenter) const
+{
+    if(!toGrid(pose.position.x(), pose.position.y(), xCenter, yCenter))
+        return false;
+
+    FootprintIndex &index(footprintIndex);
+
+    // rectangles are symmetric under a half turn
+    double heading = std::fmod(pose.orientation, M_PI);
+    if(heading < 0)
+        heading += M_PI;
+    FootprintIndex::MaskKey key;
+    key.sizeX = sizeX;
+    key.sizeY = sizeY;
+    key.heading = ((size_t) std::floor(heading / M_PI * index.headingCount + 0.5)) % index.headingCount;
+
+    std::map<FootprintIndex::MaskKey, FootprintIndex::Mask>::iterator it = index.masks.find(key);
+    if(it != index.masks.end())
+    {
+        mask = &it->second;
+        return true;
+    }
+
+    // rasterize the cells whose center is inside of the rectangle
+    FootprintIndex::Mask &newMask(index.masks[key]);
+    const double angle = key.heading * M_PI / index.headingCount;
+    const double c = std::cos(angle), s = std::sin(angle);
+    const double halfX = sizeX / 2.0 + 1e-9, halfY = sizeY / 2.0 + 1e-9;
+    const double radius = std::sqrt(halfX * halfX + halfY * halfY);
+    const int rangeX = std::ceil(radius / getScaleX());
+    const int rangeY = std::ceil(radius / getScaleY());
+    for(int dy = -rangeY; dy <= rangeY; dy++)
+    {
+        FootprintIndex::Span span = { dy, INT_MAX, INT_MIN };
+        for(int dx = -rangeX; dx <= rangeX; dx++)
+        {
+            const double px = dx * getScaleX(), py = dy * getScaleY();
+            if(std::abs(c * px + s * py) <= halfX && std::abs(-s * px + c * py) <= halfY)
+            {
+                span.dxMin = std::min(span.dxMin, dx);
+                span.dxMax = std::max(span.dxMax, dx);
+            }
+        }
+        if(span.dxMin <= span.dxMax)
+            newMask.push_back(span);
+    }
+
+    // a footprint always covers the cell it is centered on
+    if(newMask.empty())
+    {
+        FootprintIndex::Span span = { 0, 0, 0 };
+        newMask.push_back(span);
+    }
+
+    mask = &newMask;
+    return true;
+}
+
+size_t TraversabilityGrid::countInFootprint(size_t table, const FootprintIndex::Mask& mask, size_t xCenter, size_t yCenter) const
+{
+    const FootprintIndex &index(footprintIndex);
+    const uint32_t *prefix = &index.prefix[table][0];
+    const int width = index.width, height = index.height;
+
+    size_t count = 0;
+    for(FootprintIndex::Mask::const_iterator it = mask.begin(); it != mask.end(); it++)
+    {
+        const int y = (int) yCenter + it->dy;
+        if(y < 0 || y >= height)
+            continue;
+        const int x0 = std::max(0, (int) xCenter + it->dxMin);
+        const int x1 = std::min(width - 1, (int) xCenter + it->dxMax);
+        if(x0 > x1)
+            continue;
+        const uint32_t *row = prefix + y * (width + 1);
+        count += row[x1 + 1] - row[x0];
+    }
+    return count;
+}
+
+const TraversabilityClass& TraversabilityGrid::getWorstTraversabilityClassInFootprint(const base::Pose2D& pose, double sizeX, double sizeY) const
+{
+    // the tables and masks are only valid while the lock is held
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+    updateFootprintIndex();
+    updateFootprintOrder();
+
+    const FootprintIndex::Mask *mask;
+    size_t xCenter, yCenter;
+    if(!getFootprint(pose, sizeX, sizeY, mask, xCenter, yCenter))
+        throw std::runtime_error("TraversabilityGrid::Error, footprint is outside of the grid");
+
+    const std::vector<uint8_t> &order(footprintIndex.order);
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        if(countInFootprint(footprintIndex.tableIndex[order[i]], *mask, xCenter, yCenter))
+            return getTraversabilityClass(order[i]);
+    }
+
+    throw std::runtime_error("TraversabilityGrid::Error, terrain class could not be identified");
+}
+
+bool TraversabilityGrid::getClassCountsInFootprint(const base::Pose2D& pose, double sizeX, double sizeY, std::vector<size_t>& counts) const
+{
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+    updateFootprintIndex();
+
+    const FootprintIndex::Mask *mask;
+    size_t xCenter, yCenter;
+    if(!getFootprint(pose, sizeX, sizeY, mask, xCenter, yCenter))
+        return false;
+
+    const std::vector<int> &tableIndex(footprintIndex.tableIndex);
+    counts.assign(tableIndex.size(), 0);
+    for(size_t v = 0; v < tableIndex.size(); v++)
+    {
+        if(tableIndex[v] >= 0)
+            counts[v] = countInFootprint(tableIndex[v], *mask, xCenter, yCenter);
+    }
+    return true;
+}
+
+size_t TraversabilityGrid::getClassCountInBox(uint8_t klass, const CellExtents& box) const
+{
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+    updateFootprintIndex();
+
+    const FootprintIndex &index(footprintIndex);
+    if(index.tableIndex[klass] < 0 || box.isEmpty())
+        return 0;
+
+    const int width = index.width, height = index.height;
+    const int x0 = std::max(0, box.min().x()), x1 = std::min(width - 1, box.max().x());
+    const int y0 = std::max(0, box.min().y()), y1 = std::min(height - 1, box.max().y());
+    if(x0 > x1)
+        return 0;
+
+    const uint32_t *prefix = &index.prefix[index.tableIndex[klass]][0];
+    size_t count = 0;
+    for(int y = y0; y <= y1; y++)
+    {
+        const uint32_t *row = prefix + y * (width + 1);
+        count += row[x1 + 1] - row[x0];
+    }
+    return count;
+}
+
+double TraversabilityGrid::getWorstProbabilityInFootprint(const base::Pose2D& pose, double sizeX, double sizeY) const
+{
+    setProbabilityArray();
+
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+
+    const FootprintIndex::Mask *mask;
+    size_t xCenter, yCenter;
+    if(!getFootprint(pose, sizeX, sizeY, mask, xCenter, yCenter))
+        return 1.0;
+
+    const ArrayType &data(*probabilityArray);
+    const int width = getCellSizeX(), height = getCellSizeY();
+    uint8_t worst = std::numeric_limits<uint8_t>::max();
+    for(FootprintIndex::Mask::const_iterator it = mask->begin(); it != mask->end(); it++)
+    {
+        const int y = (int) yCenter + it->dy;
+        if(y < 0 || y >= height)
+            continue;
+        const int x0 = std::max(0, (int) xCenter + it->dxMin);
+        const int x1 = std::min(width - 1, (int) xCenter + it->dxMax);
+        if(x0 > x1)
+            continue;
+        const uint8_t *row = &data[y][0];
+        worst = std::min(worst, *std::min_element(row + x0, row + x1 + 1));
+    }
+    return ((double) worst) / std::numeric_limits< uint8_t >::max();
+}
+
+void TraversabilityGrid::setFootprintHeadingCount(size_t count)
+{
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+    footprintIndex.headingCount = std::max<size_t>(count, 1);
+    footprintIndex.masks.clear();
+}
+
+void TraversabilityGrid::invalidateFootprintIndex()
+{
+    boost::mutex::scoped_lock lock(footprintIndex.mutex);
+    footprintIndex.valid = false;
+}
+
+/** Keeps the lowest value of the visited row spans */
+struct WorstProbabilityHelper
+{
+    const TraversabilityGrid::ArrayType &data;
+    uint8_t &worst;
+
+    WorstProbabilityHelper(const TraversabilityGrid::ArrayType &data, uint8_t &worst) : data(data), worst(worst)
+    {
+    }
+
+    void operator()(size_t y, size_t xBegin, size_t xEnd) const
+    {
+        const uint8_t *row = &data[y][0];
+        worst = std::min(worst, *std::min_element(row + xBegin, row + xEnd));
+    }
+};
+
 double TraversabilityGrid::getWorstProbabilityInRectangle(const base::Pose2D& pose, double sizeX, double sizeY) const
 {
-    double ret = 1.0;
-    forEachInRectangle(pose, sizeX, sizeY, boost::bind(&TraversabilityGrid::probabilityCallback, this, _1, _2, boost::ref(ret)));
-    return ret;
+    RectangleSpans scratch;
+    return getWorstProbabilityInRectangle(pose, sizeX, sizeY, scratch);
+}
+
+double TraversabilityGrid::getWorstProbabilityInRectangle(const base::Pose2D& pose, double sizeX, double sizeY, RectangleSpans& scratch) const
+{
+    setProbabilityArray();
+    uint8_t worst = std::numeric_limits< uint8_t >::max();
+    forEachSpanInRectangle(pose, sizeX, sizeY, WorstProbabilityHelper(*probabilityArray, worst), scratch);
+    return ((double) worst) / std::numeric_limits< uint8_t >::max();
 }
 
 void TraversabilityGrid::setTraversabilityAndProbability(uint8_t klass, double probability, size_t x, size_t y)
@@ -172,6 +517,12 @@ void TraversabilityGrid::setTraversability(uint8_t klass, size_t x, size_t y)
 {
     setTraversabilityArray();
     (*traversabilityArray)[y][x] = klass;
+
+    if(footprintIndex.valid && y < footprintIndex.dirtyRows.size())
+    {
+        footprintIndex.dirtyRows[y] = true;
+        footprintIndex.hasDirtyRows = true;
+    }
 }
 
 const TraversabilityClass& TraversabilityGrid::getTraversability(size_t x, size_t y) const
@@ -196,6 +547,7 @@ void TraversabilityGrid::setTraversabilityClass(uint8_t num, const Traversabilit
         traversabilityClasses.resize(num + 1);
     
     traversabilityClasses[num] = klass;
+    footprintIndex.orderValid = false;
 }
 
 const TraversabilityClass& TraversabilityGrid::getTraversabilityClass(uint8_t klass) const
@@ -288,6 +640,7 @@ TraversabilityGrid& TraversabilityGrid::operator=(const TraversabilityGrid& othe
     *baseGrid = *obaseGrid;
     
     traversabilityClasses = other.traversabilityClasses;
+    footprintIndex = other.footprintIndex;
     
     traversabilityArray = NULL;
     probabilityArray = NULL;
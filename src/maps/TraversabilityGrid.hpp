@@ -4,6 +4,8 @@
 #include <envire/maps/Grid.hpp>
 #include <base/samples/DistanceImage.hpp>
 #include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
 
 namespace envire
 {  
@@ -134,8 +136,57 @@ private:
     std::vector<TraversabilityClass> traversabilityClasses;
     ArrayType *probabilityArray;
     ArrayType *traversabilityArray;
+
+    /**
+     * Acceleration structures for the footprint queries. They are built on
+     * the first query and updated incrementally afterwards. Copying a grid
+     * does not copy the index, the copy builds its own one when needed.
+     * */
+    struct FootprintIndex
+    {
+        /// cells [dxMin, dxMax] of row dy, relative to the center cell
+        struct Span
+        {
+            int dy, dxMin, dxMax;
+        };
+        typedef std::vector<Span> Mask;
+
+        struct MaskKey
+        {
+            double sizeX, sizeY;
+            size_t heading;
+            bool operator<(const MaskKey &other) const;
+        };
+
+        FootprintIndex() : headingCount(64) { clear(); }
+        FootprintIndex(const FootprintIndex &other) : headingCount(other.headingCount) { clear(); }
+        FootprintIndex &operator=(const FootprintIndex &other);
+
+        void clear();
+
+        size_t headingCount;
+        size_t width, height;
+        bool valid;
+        bool orderValid;
+        /// index into prefix for every cell value, -1 if there is no table
+        std::vector<int> tableIndex;
+        /// per value and row, the count of cells with that value left of x.
+        /// Each row has width + 1 entries.
+        std::vector<std::vector<uint32_t> > prefix;
+        std::vector<bool> dirtyRows;
+        bool hasDirtyRows;
+        /// the values with a table, the least drivable first
+        std::vector<uint8_t> order;
+        std::map<MaskKey, Mask> masks;
+        boost::mutex mutex;
+    };
+    mutable FootprintIndex footprintIndex;
+
+    void updateFootprintIndex() const;
+    void updateFootprintOrder() const;
+    bool getFootprint(const base::Pose2D &pose, double sizeX, double sizeY, const FootprintIndex::Mask *&mask, size_t &xCenter, size_t &yCenter) const;
+    size_t countInFootprint(size_t table, const FootprintIndex::Mask &mask, size_t xCenter, size_t yCenter) const;
     
-    void probabilityCallback(size_t x, size_t y, double &worst) const; 
     void setProbabilityArray() const;
     void setTraversabilityArray() const;
     void setProbabilityArray();
@@ -199,6 +250,8 @@ public:
     void setProbability(double probability, size_t x, size_t y);
     double getProbability(size_t x, size_t y) const;
     double getWorstProbabilityInRectangle(const base::Pose2D &pose, double sizeX, double sizeY) const;
+    /** Same as above, reusing the buffers of @a scratch for the rasterization */
+    double getWorstProbabilityInRectangle(const base::Pose2D &pose, double sizeX, double sizeY, RectangleSpans &scratch) const;
 
     /**
      * Computes the statistic for an oriented rectangle in the grid.
@@ -213,6 +266,54 @@ public:
     void computeStatistic(const base::Pose2D &pose, double sizeX, double sizeY, double borderWidth, TraversabilityStatistic &innerStatistic, TraversabilityStatistic &outerStatistic) const;
 
     const TraversabilityClass &getWorstTraversabilityClassInRectangle(const base::Pose2D &pose, double sizeX, double sizeY) const;
+
+    /**
+     * Returns the least drivable class of the cells that are covered by the
+     * oriented rectangle (footprint) of size sizeX x sizeY at pose.
+     *
+     * Unlike getWorstTraversabilityClassInRectangle, this uses per class
+     * prefix sums of the rows and a cached rasterization of the footprint,
+     * so that a query costs O(sizeY / scaleY) per class that has to be
+     * checked. The footprint is anchored at the center of the cell that
+     * contains pose.position, and its heading is discretized into
+     * setFootprintHeadingCount() buckets over half a turn.
+     *
+     * @throw std::runtime_error if the footprint is outside of the grid
+     * */
+    const TraversabilityClass &getWorstTraversabilityClassInFootprint(const base::Pose2D &pose, double sizeX, double sizeY) const;
+
+    /**
+     * Counts the cells of every value in the footprint, see
+     * getWorstTraversabilityClassInFootprint. counts is indexed by the cell
+     * value. Returns false if the center of the footprint is outside of the
+     * grid.
+     * */
+    bool getClassCountsInFootprint(const base::Pose2D &pose, double sizeX, double sizeY, std::vector<size_t> &counts) const;
+
+    /**
+     * Returns the number of cells with value klass in the axis aligned box
+     * of cells, in O(box height).
+     * */
+    size_t getClassCountInBox(uint8_t klass, const CellExtents &box) const;
+
+    /**
+     * Returns the lowest probability in the footprint, see
+     * getWorstTraversabilityClassInFootprint.
+     * */
+    double getWorstProbabilityInFootprint(const base::Pose2D &pose, double sizeX, double sizeY) const;
+
+    /**
+     * Sets the number of discrete headings over half a turn for which
+     * footprints are rasterized. Default is 64.
+     * */
+    void setFootprintHeadingCount(size_t count);
+
+    /**
+     * Marks the footprint index as outdated. This needs to be called after
+     * writing to the traversability band directly, setTraversability
+     * keeps the index up to date on its own.
+     * */
+    void invalidateFootprintIndex();
     
     virtual void serialize(Serialization& so);
     virtual void unserialize(Serialization& so);
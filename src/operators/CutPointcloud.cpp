@@ -1,9 +1,207 @@
 #include "CutPointcloud.hpp"
+#include <envire/tools/ParallelFor.hpp>
+
+#include <algorithm>
+#include <cmath>
 
 namespace envire {
 
 ENVIRONMENT_ITEM_DEF( CutPointcloud )
 
+namespace
+{
+    const size_t BLOCK_SIZE = 1 << 14;
+
+    /** Grid over the boxes, so that a point only has to be tested against
+     * the excluding boxes that overlap its cell. The including boxes are
+     * intersected into a single box.
+     */
+    class BoxGrid
+    {
+    public:
+        explicit BoxGrid( const std::list<ExclusionBox*>& boxes )
+            : hasInclude( false ), cells( 1 )
+        {
+            std::vector<const Eigen::AlignedBox<double,3>*> excludes;
+            for(std::list<ExclusionBox*>::const_iterator it = boxes.begin(); it != boxes.end(); it++)
+            {
+                if((*it)->includes())
+                {
+                    include = hasInclude ? include.intersection((*it)->box) : (*it)->box;
+                    hasInclude = true;
+                }
+                // empty boxes do not contain any point
+                else if(!(*it)->box.isEmpty())
+                {
+                    excludes.push_back(&(*it)->box);
+                    bounds.extend((*it)->box);
+                }
+            }
+
+            // about two cells per box and axis for evenly spread boxes
+            if(!excludes.empty())
+                cells = std::min(16, 2 * (int)std::ceil(std::pow((double)excludes.size(), 1.0 / 3.0)));
+            const Eigen::Vector3d extents = bounds.sizes();
+            for(int d = 0; d < 3; d++)
+                scale[d] = extents[d] > 0 ? cells / extents[d] : 0;
+
+            // bin the boxes, the boxes of a cell are stored contiguously
+            std::vector<std::vector<size_t> > bins(cells * cells * cells);
+            for(size_t b = 0; b < excludes.size(); b++)
+            {
+                const Eigen::Vector3i lo = cellOf(excludes[b]->min()), hi = cellOf(excludes[b]->max());
+                for(int x = lo.x(); x <= hi.x(); x++)
+                    for(int y = lo.y(); y <= hi.y(); y++)
+                        for(int z = lo.z(); z <= hi.z(); z++)
+                            bins[(x * cells + y) * cells + z].push_back(b);
+            }
+            cellStarts.push_back(0);
+            for(size_t c = 0; c < bins.size(); c++)
+            {
+                for(size_t i = 0; i < bins[c].size(); i++)
+                {
+                    mins.push_back(excludes[bins[c][i]]->min());
+                    maxs.push_back(excludes[bins[c][i]]->max());
+                }
+                cellStarts.push_back(mins.size());
+            }
+        }
+
+        bool isIncluded(const Eigen::Vector3d& p) const
+        {
+            if(hasInclude && !include.contains(p))
+                return false;
+            if(!bounds.contains(p))
+                return true;
+            const Eigen::Vector3i c = cellOf(p);
+            for(size_t i = cellStarts[(c.x() * cells + c.y()) * cells + c.z()],
+                    end = cellStarts[(c.x() * cells + c.y()) * cells + c.z() + 1]; i < end; i++)
+            {
+                if((mins[i].array() <= p.array()).all() && (p.array() <= maxs[i].array()).all())
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        Eigen::Vector3i cellOf(const Eigen::Vector3d& p) const
+        {
+            Eigen::Vector3i c;
+            for(int d = 0; d < 3; d++)
+            {
+                // also 0 for NaN, which unbounded boxes can produce
+                const double cell = std::floor((p[d] - bounds.min()[d]) * scale[d]);
+                c[d] = cell > 0 ? (cell < cells ? (int)cell : cells - 1) : 0;
+            }
+            return c;
+        }
+
+        bool hasInclude;
+        Eigen::AlignedBox<double,3> include;
+        Eigen::AlignedBox<double,3> bounds;
+        int cells;
+        Eigen::Vector3d scale;
+        std::vector<size_t> cellStarts;
+        std::vector<Eigen::Vector3d> mins, maxs;
+    };
+
+    /** marks the points to keep, and counts them per block */
+    struct TestPoints
+    {
+        const BoxGrid& grid;
+        const std::vector<Eigen::Vector3d>& points;
+        std::vector<char>& keep;
+        std::vector<size_t>& counts;
+
+        TestPoints(const BoxGrid& grid, const std::vector<Eigen::Vector3d>& points,
+                std::vector<char>& keep, std::vector<size_t>& counts)
+            : grid(grid), points(points), keep(keep), counts(counts) {}
+
+        void operator()(size_t begin, size_t end)
+        {
+            size_t count = 0;
+            for(size_t i = begin; i < end; i++)
+            {
+                keep[i] = grid.isIncluded(points[i]);
+                count += keep[i];
+            }
+            counts[begin / BLOCK_SIZE] = count;
+        }
+    };
+
+    /** copies the kept points to their position in the target */
+    struct CopyPoints
+    {
+        const std::vector<char>& keep;
+        const std::vector<size_t>& offsets;
+        const Transform& trans;
+        Eigen::Matrix3d rotation;
+
+        const std::vector<Eigen::Vector3d>& sourceVertices;
+        std::vector<Eigen::Vector3d>& targetVertices;
+        const std::vector<Eigen::Vector3d> *sourceNormals, *sourceColors;
+        std::vector<Eigen::Vector3d> *targetNormals, *targetColors;
+        const std::vector<Pointcloud::vertex_attr> *sourceAttributes;
+        std::vector<Pointcloud::vertex_attr> *targetAttributes;
+        const std::vector<double> *sourceVariance;
+        std::vector<double> *targetVariance;
+
+        CopyPoints(const std::vector<char>& keep, const std::vector<size_t>& offsets, const Transform& trans,
+                const std::vector<Eigen::Vector3d>& sourceVertices, std::vector<Eigen::Vector3d>& targetVertices)
+            : keep(keep), offsets(offsets), trans(trans), rotation(trans.linear()),
+            sourceVertices(sourceVertices), targetVertices(targetVertices),
+            sourceNormals(NULL), sourceColors(NULL), targetNormals(NULL), targetColors(NULL),
+            sourceAttributes(NULL), targetAttributes(NULL), sourceVariance(NULL), targetVariance(NULL) {}
+
+        void operator()(size_t begin, size_t end)
+        {
+            size_t n = offsets[begin / BLOCK_SIZE];
+            for(size_t i = begin; i < end; i++)
+            {
+                if(!keep[i])
+                    continue;
+                targetVertices[n] = trans * sourceVertices[i];
+                if(targetNormals)
+                    (*targetNormals)[n] = rotation * (*sourceNormals)[i];
+                if(targetColors)
+                    (*targetColors)[n] = (*sourceColors)[i];
+                if(targetAttributes)
+                    (*targetAttributes)[n] = (*sourceAttributes)[i];
+                if(targetVariance)
+                    (*targetVariance)[n] = (*sourceVariance)[i];
+                n++;
+            }
+        }
+    };
+
+    /** removes the elements which are not kept, preserving the order */
+    template <class T, class A>
+    void compact(std::vector<T, A>& data, const std::vector<char>& keep)
+    {
+        const size_t size = std::min(data.size(), keep.size());
+        size_t n = 0;
+        for(size_t i = 0; i < size; i++)
+        {
+            if(keep[i])
+                data[n++] = data[i];
+        }
+        data.resize(n);
+    }
+
+    /** sets up the copy of the vertex data for \c key, if the source has it
+     * for every vertex */
+    template <class T>
+    void selectData(Pointcloud* source, Pointcloud* target, const std::string& key, size_t size,
+            const std::vector<T>*& sourceData, std::vector<T>*& targetData)
+    {
+        if(!source->hasData(key) || source->getVertexData<T>(key).size() != source->vertices.size())
+            return;
+        sourceData = &source->getVertexData<T>(key);
+        targetData = &target->getVertexData<T>(key);
+        targetData->resize(size);
+    }
+}
+
 CutPointcloud::CutPointcloud() 
     : Operator(1,1)
 {
@@ -71,63 +269,63 @@ bool CutPointcloud::isIncluded(const Eigen::Vector3d &vector)
 bool CutPointcloud::updateAll(){
     Pointcloud* targetcloud = dynamic_cast<envire::Pointcloud*>(env->getOutputs(this).front());
     assert( targetcloud );
-    targetcloud->clear();
 
     Pointcloud* sourcecloud = dynamic_cast<envire::Pointcloud*>(env->getInputs(this).front());
     assert( sourcecloud );
-    assert( sourcecloud != targetcloud );
-
-    // get meta data
-    std::vector<Eigen::Vector3d> *source_vertex_normal_data = NULL;
-    std::vector<Eigen::Vector3d> *source_vertex_color_data = NULL;
-    std::vector<Pointcloud::attr_flag> *source_vertex_attributes_data = NULL;
-    std::vector<double> *source_vertex_variance_data = NULL;
-    std::vector<Eigen::Vector3d> *target_vertex_normal_data = NULL;
-    std::vector<Eigen::Vector3d> *target_vertex_color_data = NULL;
-    std::vector<Pointcloud::attr_flag> *target_vertex_attributes_data = NULL;
-    std::vector<double> *target_vertex_variance_data = NULL;
-    if( sourcecloud->hasData(Pointcloud::VERTEX_NORMAL) )
-    {
-        source_vertex_normal_data = &sourcecloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL );
-        target_vertex_normal_data = &targetcloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL );
-    }
-    if( sourcecloud->hasData(Pointcloud::VERTEX_COLOR) )
-    {
-        source_vertex_color_data = &sourcecloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
-        target_vertex_color_data = &targetcloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
-    }
-    if( sourcecloud->hasData(Pointcloud::VERTEX_ATTRIBUTES) )
+
+    const std::vector<Eigen::Vector3d>& vertices = sourcecloud->vertices;
+    const size_t blocks = (vertices.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<char> keep(vertices.size());
+    std::vector<size_t> offsets(blocks + 1, 0);
+
+    BoxGrid grid(exclusion_boxes);
+    parallelForBlocks(0, vertices.size(), BLOCK_SIZE, TestPoints(grid, vertices, keep, offsets));
+    size_t size = 0;
+    for(size_t b = 0; b <= blocks; b++)
     {
-        source_vertex_attributes_data = &sourcecloud->getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES );
-        target_vertex_attributes_data = &targetcloud->getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES );
+        const size_t count = offsets[b];
+        offsets[b] = size;
+        size += count;
     }
-    if( sourcecloud->hasData(Pointcloud::VERTEX_VARIANCE) )
+
+    if( sourcecloud == targetcloud )
     {
-        source_vertex_variance_data = &sourcecloud->getVertexData<double>( Pointcloud::VERTEX_VARIANCE );
-        target_vertex_variance_data = &targetcloud->getVertexData<double>( Pointcloud::VERTEX_VARIANCE );
+        // vertex data with a differing size is compacted as far as it goes
+        compact(sourcecloud->vertices, keep);
+        if( sourcecloud->channels.size() == keep.size() )
+        {
+            compact(sourcecloud->channels.x, keep);
+            compact(sourcecloud->channels.y, keep);
+            compact(sourcecloud->channels.z, keep);
+        }
+        if( sourcecloud->hasData(Pointcloud::VERTEX_NORMAL) )
+            compact(sourcecloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ), keep);
+        if( sourcecloud->hasData(Pointcloud::VERTEX_COLOR) )
+            compact(sourcecloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ), keep);
+        if( sourcecloud->hasData(Pointcloud::VERTEX_ATTRIBUTES) )
+            compact(sourcecloud->getVertexData<Pointcloud::vertex_attr>( Pointcloud::VERTEX_ATTRIBUTES ), keep);
+        if( sourcecloud->hasData(Pointcloud::VERTEX_VARIANCE) )
+            compact(sourcecloud->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ), keep);
+
+        env->itemModified( targetcloud );
+        return true;
     }
-    
+
     // get transformation
     Transform trans = 
         env->relativeTransform( sourcecloud->getFrameNode(), targetcloud->getFrameNode() );
-    Eigen::Quaterniond normal_rot(trans.linear());
 
-    for (unsigned i = 0; i < sourcecloud->vertices.size(); i++)
-    {
-        if(isIncluded(sourcecloud->vertices[i]))
-        {
-            targetcloud->vertices.push_back(trans * sourcecloud->vertices[i]);
-            
-            if(source_vertex_normal_data && source_vertex_normal_data->size() > i)
-                target_vertex_normal_data->push_back( normal_rot * source_vertex_normal_data->at(i) );
-            if(source_vertex_color_data && source_vertex_color_data->size() > i)
-                target_vertex_color_data->push_back( source_vertex_color_data->at(i) );
-            if(source_vertex_attributes_data && source_vertex_variance_data->size() > i)
-                target_vertex_attributes_data->push_back( source_vertex_attributes_data->at(i) );
-            if(source_vertex_variance_data && source_vertex_variance_data->size() > i)
-                target_vertex_variance_data->push_back( source_vertex_variance_data->at(i) );
-        }
-    }
+    targetcloud->clear();
+    targetcloud->vertices.resize(size);
+    CopyPoints copy(keep, offsets, trans, vertices, targetcloud->vertices);
+    selectData(sourcecloud, targetcloud, Pointcloud::VERTEX_NORMAL, size, copy.sourceNormals, copy.targetNormals);
+    selectData(sourcecloud, targetcloud, Pointcloud::VERTEX_COLOR, size, copy.sourceColors, copy.targetColors);
+    selectData(sourcecloud, targetcloud, Pointcloud::VERTEX_ATTRIBUTES, size, copy.sourceAttributes, copy.targetAttributes);
+    selectData(sourcecloud, targetcloud, Pointcloud::VERTEX_VARIANCE, size, copy.sourceVariance, copy.targetVariance);
+    parallelForBlocks(0, vertices.size(), BLOCK_SIZE, copy);
+
+    if( !sourcecloud->channels.empty() )
+        targetcloud->updateChannels();
 
     env->itemModified( targetcloud );
     return true;
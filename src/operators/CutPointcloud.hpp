@@ -16,6 +16,20 @@ namespace envire {
         bool includes() {return !exclude;};
     };
     
+    /**
+     * Removes the points of a pointcloud which are inside of an excluding
+     * box, or outside of an including box. The vertex data (normals,
+     * colors, attributes and variance) of the remaining points is kept.
+     *
+     * The boxes are binned into a grid for the update, so the cost per
+     * point does not grow with the number of boxes, and the points are
+     * processed in parallel (see ParallelFor.hpp). If the output is the
+     * same pointcloud as the input, the points are removed in place.
+     *
+     * In place, only the vertices, the channels and the vertex data listed
+     * above are compacted. Any other per vertex data of the pointcloud keeps
+     * its old size, and no longer matches the remaining points.
+     */
     class CutPointcloud: public Operator {
 
 	ENVIRONMENT_ITEM( CutPointcloud )
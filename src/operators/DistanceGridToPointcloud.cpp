@@ -2,6 +2,7 @@
 
 #include <envire/maps/Grids.hpp>
 #include <envire/maps/Pointcloud.hpp>
+#include <envire/tools/ParallelFor.hpp>
 
 #include <boost/math/special_functions/fpclassify.hpp>
 
@@ -9,6 +10,103 @@ using namespace envire;
 
 ENVIRONMENT_ITEM_DEF( DistanceGridToPointcloud )
 
+namespace
+{
+    /** only process the cell if the distance value is not NaN or inf */
+    inline bool isValid( float d, double maxDistance )
+    {
+	return boost::math::isnormal( d ) && d < maxDistance;
+    }
+
+    struct CountColumn
+    {
+	const DistanceGrid::ArrayType& distance;
+	size_t height;
+	double maxDistance;
+	std::vector<size_t>& counts;
+
+	CountColumn( const DistanceGrid::ArrayType& distance, size_t height, double maxDistance, std::vector<size_t>& counts )
+	    : distance( distance ), height( height ), maxDistance( maxDistance ), counts( counts ) {}
+
+	void operator()( size_t x )
+	{
+	    size_t count = 0;
+	    for(size_t y=0; y<height; y++)
+		count += isValid( distance[y][x], maxDistance );
+	    counts[x] = count;
+	}
+    };
+
+    struct BackProjectColumn
+    {
+	const DistanceGrid::ArrayType& distance;
+	const std::vector<Eigen::Vector3d>& rays;
+	size_t height;
+	double maxDistance, uncertaintyFactor;
+	Eigen::Matrix3d rotation;
+	Eigen::Vector3d translation;
+	const std::vector<size_t>& offsets;
+
+	std::vector<Eigen::Vector3d>& vertices;
+	std::vector<double>& uncertainty;
+	std::vector<Eigen::Vector3d>* color;
+	const ImageRGB24::ArrayType *ir, *ig, *ib;
+
+	BackProjectColumn( const DistanceGrid::ArrayType& distance, const std::vector<Eigen::Vector3d>& rays,
+		size_t height, double maxDistance, double uncertaintyFactor, const Transform& t,
+		const std::vector<size_t>& offsets, std::vector<Eigen::Vector3d>& vertices,
+		std::vector<double>& uncertainty )
+	    : distance( distance ), rays( rays ), height( height ),
+	    maxDistance( maxDistance ), uncertaintyFactor( uncertaintyFactor ),
+	    rotation( t.linear() ), translation( t.translation() ), offsets( offsets ),
+	    vertices( vertices ), uncertainty( uncertainty ),
+	    color( NULL ), ir( NULL ), ig( NULL ), ib( NULL ) {}
+
+	void operator()( size_t x )
+	{
+	    const double f = 1.0/255.0;
+	    size_t i = offsets[x];
+	    for(size_t y=0; y<height; y++)
+	    {
+		const float d = distance[y][x];
+		if( !isValid( d, maxDistance ) )
+		    continue;
+
+		// scale the ray and transform it to the target
+		vertices[i] = rotation * (rays[x * height + y] * d) + translation;
+		uncertainty[i] = d * uncertaintyFactor;
+
+		// add texture color information if image is there
+		if( color )
+		    (*color)[i] = Eigen::Vector3d( (*ir)[y][x] * f, (*ig)[y][x] * f, (*ib)[y][x] * f );
+		i++;
+	    }
+	}
+    };
+}
+
+void DistanceGridToPointcloud::updateRays( const DistanceGrid& grid )
+{
+    if( !rays.empty() && raysWidth == grid.getWidth() && raysHeight == grid.getHeight()
+	    && raysScaleX == grid.getScaleX() && raysScaleY == grid.getScaleY()
+	    && raysOffsetX == grid.getOffsetX() && raysOffsetY == grid.getOffsetY() )
+	return;
+
+    raysWidth = grid.getWidth();
+    raysHeight = grid.getHeight();
+    raysScaleX = grid.getScaleX();
+    raysScaleY = grid.getScaleY();
+    raysOffsetX = grid.getOffsetX();
+    raysOffsetY = grid.getOffsetY();
+
+    // construct (p_x,p_y,1.0) vectors, stored by column like the points
+    typedef DistanceGrid::Position Position;
+    rays.resize( raysWidth * raysHeight );
+    for(size_t x=0; x<raysWidth; x++)
+	for(size_t y=0; y<raysHeight; y++)
+	    rays[x * raysHeight + y] << grid.fromGrid( Position( x, y ) ), 1.0;
+}
+
 bool DistanceGridToPointcloud::updateAll()
 {
     //if( env->getInputs(this).size() != 1 || env->getOutputs(this).size() != 1 )
@@ -42,57 +140,43 @@ bool DistanceGridToPointcloud::updateAll()
 
     // get relative transform from grid frame to pointcloud frame
     Transform t = distanceGrid.getFrameNode()->relativeTransform( pointcloud.getFrameNode() );
-    bool needsTransform = !t.isApprox( Transform( Transform::Identity() ) );
 
     // the distance grid is a projection of the original pointcloud.
     // in order recover the pointcloud, we need to reverse the projection
+    updateRays( distanceGrid );
 
     DistanceGrid::ArrayType const& distance = distanceGrid.getGridData( DistanceGrid::DISTANCE );
-    std::vector<double>& uncertainty(pointcloud.getVertexData<double>(Pointcloud::VERTEX_VARIANCE));
-    std::vector<Eigen::Vector3d> *color = NULL;
-    if( image )
-	color = &pointcloud.getVertexData<Eigen::Vector3d>(Pointcloud::VERTEX_COLOR);
-
-    // clear target
-    pointcloud.clear();
-    
-    typedef DistanceGrid::Position Position;
-    for(size_t x=0; x<distanceGrid.getWidth(); x++)
+    const size_t width = distanceGrid.getWidth(), height = distanceGrid.getHeight();
+
+    // the points are ordered by column, then by row. Count the points of
+    // each column, to size the target once
+    std::vector<size_t> offsets( width + 1, 0 );
+    parallelFor( 0, width, CountColumn( distance, height, maxDistance, offsets ), 16 );
+    size_t size = 0;
+    for(size_t x=0; x<=width; x++)
     {
-	for(size_t y=0; y<distanceGrid.getHeight(); y++)
-	{
-	    // only process vector if distance value is not NaN or inf
-	    const float d = distance[y][x];
-	    if( boost::math::isnormal( d ) && d < maxDistance ) 
-	    {
-		// construct (p_x,p_y,1.0) vector
-		Eigen::Vector3d r;
-		r << distanceGrid.fromGrid( Position( x, y ) ), 1.0;
-
-		// scale the vector
-		r *= d;
-
-		// only transform to target if needed
-		if( needsTransform )
-		    r = t * r;
-
-		// add point to target pointcloud
-		pointcloud.vertices.push_back( r );
+	const size_t count = offsets[x];
+	offsets[x] = size;
+	size += count;
+    }
 
-		// add uncertainty
-		uncertainty.push_back( d * uncertaintyFactor );
+    // clear target, this keeps the capacity for the next frame
+    pointcloud.clear();
+    pointcloud.vertices.resize( size );
+    std::vector<double>& uncertainty(pointcloud.getVertexData<double>(Pointcloud::VERTEX_VARIANCE));
+    uncertainty.resize( size );
 
-		// add texture color information if image is there
-		if( image )
-		{
-		    // get color value from image
-		    const double f = 1.0/255.0;
-		    Eigen::Vector3d c( (*ir)[y][x] * f, (*ig)[y][x] * f, (*ib)[y][x] * f );
-		    color->push_back( c );
-		}
-	    }
-	}
+    BackProjectColumn backProject( distance, rays, height, maxDistance, uncertaintyFactor, t,
+	    offsets, pointcloud.vertices, uncertainty );
+    if( image )
+    {
+	backProject.color = &pointcloud.getVertexData<Eigen::Vector3d>(Pointcloud::VERTEX_COLOR);
+	backProject.color->resize( size );
+	backProject.ir = ir;
+	backProject.ig = ig;
+	backProject.ib = ib;
     }
+    parallelFor( 0, width, backProject, 16 );
 
     pointcloud.itemModified();
     return true;
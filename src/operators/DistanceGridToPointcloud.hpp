@@ -2,15 +2,29 @@
 #define __ENVIRE_DISTANCEGRIDTOPOINTCLOUD_HPP__
 
 #include <envire/Core.hpp>
+#include <Eigen/Core>
+#include <vector>
 
 namespace envire
 {
+    class DistanceGrid;
+
+    /** Back-projects a DistanceGrid into a Pointcloud, with the colors of
+     * an optional ImageRGB24 input of the same size.
+     *
+     * The ray through each cell only depends on the geometry of the grid,
+     * so the rays are computed once and reused for the following frames
+     * until the geometry changes. The points are ordered by column (x),
+     * then by row (y), and the columns are processed in parallel (see
+     * ParallelFor.hpp).
+     */
     class DistanceGridToPointcloud : public Operator
     {
 	ENVIRONMENT_ITEM( DistanceGridToPointcloud )
 	
     public:
-	DistanceGridToPointcloud() : uncertaintyFactor(0.1), maxDistance(10.0) {};
+	DistanceGridToPointcloud() : uncertaintyFactor(0.1), maxDistance(10.0),
+	    raysWidth(0), raysHeight(0), raysScaleX(0), raysScaleY(0), raysOffsetX(0), raysOffsetY(0) {};
 	void serialize( Serialization& so ) { Operator::serialize( so ); }
 	void unserialize( Serialization& so ) { Operator::unserialize( so ); }
 
@@ -20,8 +34,17 @@ namespace envire
 	void setMaxDistance( double m ) { maxDistance = m; }
 
     private:
+	/** recomputes the rays if the geometry of the grid has changed */
+	void updateRays( const DistanceGrid& grid );
+
 	double uncertaintyFactor;
 	double maxDistance;
+
+	/** the ray (x, y, 1) through each cell, column by column, for the grid
+	 * geometry given by the following members */
+	std::vector<Eigen::Vector3d> rays;
+	size_t raysWidth, raysHeight;
+	double raysScaleX, raysScaleY, raysOffsetX, raysOffsetY;
     };
 }
 
@@ -3,24 +3,378 @@
 
 #include "../core/Operator.hpp"
 #include "../maps/Grid.hpp"
+#include "../tools/ParallelFor.hpp"
+
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <limits>
+#include <vector>
+#include <functional>
+#include <cmath>
 
 namespace envire {
 
-    
+namespace detail
+{
+    /** Sliding window extremum after van Herk and Gil-Werman
+     *
+     * Sets out[i * outStride] to the best (according to Better) of the
+     * values in[j * inStride] with j in [i + lo, i + lo + w) for all i in
+     * [0, m). Values outside of [0, n) are ignored, and identity is the
+     * result for empty windows. It needs about three comparisons per element,
+     * independent of the window size.
+     */
+    template <class Better>
+    void foldExtremum( const double* in, size_t inStride, size_t n, double* out, size_t outStride,
+	    size_t m, long lo, size_t w, double identity, Better better )
+    {
+	// padded input, so that the window of out[i] is p[i, i + w)
+	const size_t len = m + w;
+	std::vector<double> p( len, identity ), g( len ), h( len );
+	for( size_t j = 0; j < len; j++ )
+	{
+	    const long src = (long)j + lo;
+	    if( src >= 0 && src < (long)n )
+		p[j] = in[src * inStride];
+	}
+
+	// best of the block so far, from the left and from the right
+	for( size_t j = 0; j < len; j++ )
+	    g[j] = (j % w == 0) ? p[j] : (better( p[j], g[j-1] ) ? p[j] : g[j-1]);
+	for( size_t j = len; j-- > 0; )
+	    h[j] = (j % w == w - 1 || j == len - 1) ? p[j] : (better( p[j], h[j+1] ) ? p[j] : h[j+1]);
+
+	for( size_t i = 0; i < m; i++ )
+	    out[i * outStride] = better( h[i], g[i + w - 1] ) ? h[i] : g[i + w - 1];
+    }
+
+    /** Input band of FoldOperator. Cells which are NaN, infinite or have
+     * the nodata value are read as NaN. */
+    template <class T>
+    struct FoldInput
+    {
+	const T* data;
+	size_t width;
+	std::pair<T, bool> nodata;
+
+	FoldInput( const T* data, size_t width, std::pair<T, bool> nodata )
+	    : data( data ), width( width ), nodata( nodata ) {}
+
+	void readRow( size_t y, double* v ) const
+	{
+	    const T* in = data + y * width;
+	    for( size_t x = 0; x < width; x++ )
+	    {
+		const double d = in[x];
+		v[x] = (!boost::math::isfinite( d ) || (nodata.second && in[x] == nodata.first)) ?
+		    std::numeric_limits<double>::quiet_NaN() : d;
+	    }
+	}
+    };
+
+    /** Output band of FoldOperator. NaN results are written as empty. */
+    template <class T>
+    struct FoldOutput
+    {
+	T* data;
+	size_t width;
+	T empty;
+
+	FoldOutput( T* data, size_t width, T empty )
+	    : data( data ), width( width ), empty( empty ) {}
+
+	void set( size_t x, size_t y, double v ) const
+	{
+	    data[y * width + x] = boost::math::isnan( v ) ? empty : T( v );
+	}
+    };
+
+    /** Horizontal pass of the separable kernels of FoldOperator, for the
+     * rows of a band. Row r0 + j of the input goes to row j of sum and
+     * weight. */
+    template <class T>
+    struct FoldRows
+    {
+	const FoldInput<T>& input;
+	size_t r0;
+	double* sum;
+	double* weight;
+	int lo;
+	std::vector<double> const& kernel;
+	bool box;
+
+	FoldRows( const FoldInput<T>& input, size_t r0, double* sum, double* weight,
+		int lo, std::vector<double> const& kernel, bool box )
+	    : input( input ), r0( r0 ), sum( sum ), weight( weight ),
+	    lo( lo ), kernel( kernel ), box( box ) {}
+
+	void operator()( size_t j )
+	{
+	    const size_t width = input.width;
+	    std::vector<double> v( width );
+	    input.readRow( r0 + j, &v[0] );
+	    double* s = sum + j * width;
+	    double* c = weight + j * width;
+	    const long w = kernel.size();
+
+	    if( box )
+	    {
+		// running sums over the row, which give the sum over any
+		// window with two lookups
+		std::vector<double> ps( width + 1, 0.0 ), pc( width + 1, 0.0 );
+		for( size_t x = 0; x < width; x++ )
+		{
+		    const bool valid = !boost::math::isnan( v[x] );
+		    ps[x+1] = ps[x] + (valid ? v[x] : 0.0);
+		    pc[x+1] = pc[x] + (valid ? 1.0 : 0.0);
+		}
+		for( size_t x = 0; x < width; x++ )
+		{
+		    const long a = std::max( 0L, (long)x + lo );
+		    const long b = std::min( (long)width, (long)x + lo + w );
+		    s[x] = a < b ? ps[b] - ps[a] : 0.0;
+		    c[x] = a < b ? pc[b] - pc[a] : 0.0;
+		}
+	    }
+	    else
+	    {
+		for( size_t x = 0; x < width; x++ )
+		{
+		    double ws = 0.0, wc = 0.0;
+		    for( long k = 0; k < w; k++ )
+		    {
+			const long xr = (long)x + lo + k;
+			if( xr < 0 || xr >= (long)width || boost::math::isnan( v[xr] ) )
+			    continue;
+			ws += kernel[k] * v[xr];
+			wc += kernel[k];
+		    }
+		    s[x] = ws;
+		    c[x] = wc;
+		}
+	    }
+	}
+    };
+
+    /** Vertical pass of the box kernel, for a block of columns of the
+     * output rows [y0, y1). sum and weight hold the input rows starting at
+     * r0. The window sums are updated with one row added and one removed
+     * per step, with the inner loops running over contiguous memory so that
+     * the compiler can vectorize them.
+     */
+    template <class T>
+    struct FoldBoxColumns
+    {
+	const double* sum;
+	const double* weight;
+	const FoldOutput<T>& out;
+	size_t height, r0, y0, y1;
+	int lo;
+	size_t w;
+
+	FoldBoxColumns( const double* sum, const double* weight, const FoldOutput<T>& out,
+		size_t height, size_t r0, size_t y0, size_t y1, int lo, size_t w )
+	    : sum( sum ), weight( weight ), out( out ),
+	    height( height ), r0( r0 ), y0( y0 ), y1( y1 ), lo( lo ), w( w ) {}
+
+	void operator()( size_t xb, size_t xe )
+	{
+	    const size_t n = xe - xb;
+	    std::vector<double> as( n, 0.0 ), ac( n, 0.0 );
+
+	    // rows in the window of the first output row
+	    for( long r = std::max( 0L, (long)y0 + lo ); r < std::min( (long)height, (long)y0 + lo + (long)w ); r++ )
+		addRow( as, ac, r, xb, n, 1.0 );
+
+	    for( size_t y = y0; y < y1; y++ )
+	    {
+		if( y > y0 )
+		{
+		    const long removed = (long)y - 1 + lo, added = (long)y + lo + (long)w - 1;
+		    if( removed >= 0 && removed < (long)height )
+			addRow( as, ac, removed, xb, n, -1.0 );
+		    if( added >= 0 && added < (long)height )
+			addRow( as, ac, added, xb, n, 1.0 );
+		}
+
+		for( size_t i = 0; i < n; i++ )
+		    out.set( xb + i, y, ac[i] > 0.5 ? as[i] / ac[i] : std::numeric_limits<double>::quiet_NaN() );
+	    }
+	}
+
+	void addRow( std::vector<double>& as, std::vector<double>& ac, long r, size_t xb, size_t n, double f )
+	{
+	    const double* s = sum + (r - r0) * out.width + xb;
+	    const double* c = weight + (r - r0) * out.width + xb;
+	    for( size_t i = 0; i < n; i++ )
+	    {
+		as[i] += f * s[i];
+		ac[i] += f * c[i];
+	    }
+	}
+    };
+
+    /** Vertical pass of the gaussian kernel, for a single output row.
+     * sum and weight hold the input rows starting at r0. */
+    template <class T>
+    struct FoldGaussianRows
+    {
+	const double* sum;
+	const double* weight;
+	const FoldOutput<T>& out;
+	size_t height, r0;
+	int lo;
+	std::vector<double> const& kernel;
+
+	FoldGaussianRows( const double* sum, const double* weight, const FoldOutput<T>& out,
+		size_t height, size_t r0, int lo, std::vector<double> const& kernel )
+	    : sum( sum ), weight( weight ), out( out ),
+	    height( height ), r0( r0 ), lo( lo ), kernel( kernel ) {}
+
+	void operator()( size_t y )
+	{
+	    const size_t width = out.width;
+	    std::vector<double> as( width, 0.0 ), ac( width, 0.0 );
+	    for( size_t k = 0; k < kernel.size(); k++ )
+	    {
+		const long r = (long)y + lo + (long)k;
+		if( r < 0 || r >= (long)height )
+		    continue;
+		const double* s = sum + (r - r0) * width;
+		const double* c = weight + (r - r0) * width;
+		const double f = kernel[k];
+		for( size_t x = 0; x < width; x++ )
+		{
+		    as[x] += f * s[x];
+		    ac[x] += f * c[x];
+		}
+	    }
+
+	    for( size_t x = 0; x < width; x++ )
+		out.set( x, y, ac[x] > 0 ? as[x] / ac[x] : std::numeric_limits<double>::quiet_NaN() );
+	}
+    };
+
+    /** Horizontal pass of the min and max kernels, for the rows of a band.
+     * Row r0 + j of the input goes to row j of rows. */
+    template <class T, class Better>
+    struct FoldExtremumRows
+    {
+	const FoldInput<T>& input;
+	size_t r0;
+	double* rows;
+	int lo;
+	size_t w;
+	double identity;
+
+	FoldExtremumRows( const FoldInput<T>& input, size_t r0, double* rows, int lo, size_t w, double identity )
+	    : input( input ), r0( r0 ), rows( rows ), lo( lo ), w( w ), identity( identity ) {}
+
+	void operator()( size_t j )
+	{
+	    const size_t width = input.width;
+	    std::vector<double> v( width );
+	    input.readRow( r0 + j, &v[0] );
+	    for( size_t x = 0; x < width; x++ )
+		if( boost::math::isnan( v[x] ) )
+		    v[x] = identity;
+	    foldExtremum( &v[0], 1, width, rows + j * width, 1, width, lo, w, identity, Better() );
+	}
+    };
+
+    /** Vertical pass of the min and max kernels, for a single column of
+     * the output rows [y0, y1). rows holds the n input rows starting at
+     * r0. */
+    template <class T, class Better>
+    struct FoldExtremumColumns
+    {
+	const double* rows;
+	const FoldOutput<T>& out;
+	size_t n, r0, y0, y1;
+	int lo;
+	size_t w;
+	double identity;
+
+	FoldExtremumColumns( const double* rows, const FoldOutput<T>& out, size_t n,
+		size_t r0, size_t y0, size_t y1, int lo, size_t w, double identity )
+	    : rows( rows ), out( out ), n( n ), r0( r0 ), y0( y0 ), y1( y1 ),
+	    lo( lo ), w( w ), identity( identity ) {}
+
+	void operator()( size_t x )
+	{
+	    std::vector<double> column( y1 - y0 );
+	    foldExtremum( rows + x, out.width, n, &column[0], 1, column.size(),
+		    (long)y0 - (long)r0 + lo, w, identity, Better() );
+	    for( size_t i = 0; i < column.size(); i++ )
+		out.set( x, y0 + i, column[i] == identity ? std::numeric_limits<double>::quiet_NaN() : column[i] );
+	}
+    };
+}
+
+/**
+ * Smoothes or filters a grid band with a square kernel.
+ *
+ * The kernel covers the cells with offsets [-n, n) in x and y, where n is
+ * half the neighbourhood size, rounded up. Cells which are NaN, infinite or
+ * have the nodata value of the input band are ignored. Output cells without
+ * any valid cell in their neighbourhood are set to the nodata value of the
+ * output band, or the input band if the output band has none, or to NaN.
+ *
+ * All kernels are computed separably, with a cost per cell which (except for
+ * GAUSSIAN) does not depend on the neighbourhood size, and in parallel.
+ */
 template <typename T>
 class FoldOperator: public envire::Operator {
-    
+
 
 
 public:
-    
-    FoldOperator(): neighbourhood(0) {};
-    
+    enum Kernel
+    {
+        /// mean of the neighbourhood, using running sums
+        BOX,
+        /// gaussian weighted mean of the neighbourhood, see setGaussianSigma
+        GAUSSIAN,
+        /// minimum of the neighbourhood (van Herk/Gil-Werman)
+        MIN,
+        /// maximum of the neighbourhood (van Herk/Gil-Werman)
+        MAX
+    };
+
+    FoldOperator(): neighbourhood(0), kernel(BOX), sigma(0), bandHeight(256) {};
+
     void setNeightbourHoodSize(size_t size)
     {
         neighbourhood = size;
     }
-    
+
+    void setKernel(Kernel kernel)
+    {
+        this->kernel = kernel;
+    }
+
+    Kernel getKernel() const { return kernel; }
+
+    /** Sets the standard deviation of the GAUSSIAN kernel in cells. If 0
+     * (the default), a quarter of the neighbourhood size is used.
+     */
+    void setGaussianSigma(double sigma)
+    {
+        this->sigma = sigma;
+    }
+
+    /** Sets the number of rows which are computed at once. The temporary
+     * buffers hold about this many rows plus the neighbourhood size, at 16
+     * bytes per cell. The default is 256.
+     */
+    void setBandHeight(size_t rows)
+    {
+        bandHeight = std::max(rows, (size_t)1);
+    }
+
+    /** Computes the box average for the single cell (xs, ys), directly
+     * from the neighbourhood. updateAll() is a lot faster to process a
+     * whole grid.
+     */
     void fold(const typename Grid< T >::ArrayType &inputData, typename Grid< T >::ArrayType &outputData, size_t xs, size_t ys)
     {
         size_t cnt = 0;
@@ -32,29 +386,29 @@ public:
             {
                 size_t xr = xs + x;
                 size_t yr = ys + y;
-                
+
                 //no negative check needed, will overflow if negative
-                if(xr > maxX || yr > maxY)
+                if(xr >= maxX || yr >= maxY)
                     continue;
-                
+
                 cnt++;
-                
+
                 sum += inputData[yr][xr];
             }
         }
-        
+
         if(cnt)
             sum /= cnt;
-        
+
         outputData[ys][xs] = sum;
     }
-    
+
     virtual bool updateAll()
     {
         envire::Grid<T> *inputGrid = getInput<envire::Grid<T> *>();
         if(!inputGrid)
             throw std::runtime_error("FoldOperator: no input band set, or wrong type");
-    
+
         envire::Grid<T> *outputGrid = getOutput< envire::Grid<T> *>();
         if (!outputGrid)
             throw std::runtime_error("FoldOperator: no output band set, or wrong type");
@@ -62,29 +416,102 @@ public:
         if(inputGrid->getCellSizeX() != outputGrid->getCellSizeX() || inputGrid->getCellSizeY() != outputGrid->getCellSizeY())
             throw std::runtime_error("FoldOperator: Error, grids have different sizes");
 
-        typename envire::Grid<T>::ArrayType &inputData(inputGrid->getGridData());
-        typename envire::Grid<T>::ArrayType &outputData(outputGrid->getGridData());
-
         maxX = inputGrid->getCellSizeX();
         maxY = inputGrid->getCellSizeY();
-        
-        for(size_t y = 0;y < maxY; y++)
+        const size_t cells = maxX * maxY;
+        if(!cells)
+            return true;
+
+        // a mapped input band is read through its mapping. If the input is
+        // also the output, it is copied, as the output gets written band by
+        // band while the input is still needed.
+        const envire::Grid<T>* constInputGrid = inputGrid;
+        boost::const_multi_array_ref<T,2> inputData(constInputGrid->getConstGridData(inputGrid->getBands().front()));
+        std::pair<T, bool> inNoData = inputGrid->getNoData();
+        std::vector<T> inputCopy;
+        const T* in = inputData.data();
+        if(inputGrid == outputGrid)
         {
-            for(size_t x = 0;x < maxX; x++)
+            inputCopy.assign(in, in + cells);
+            in = &inputCopy[0];
+        }
+        const detail::FoldInput<T> input(in, maxX, inNoData);
+
+        // cells without valid neighbours get the nodata value
+        std::pair<T, bool> outNoData = outputGrid->getNoData();
+        if(!outNoData.second && inNoData.second)
+        {
+            outputGrid->setNoData(outputGrid->getBands().front(), inNoData.first);
+            outNoData = inNoData;
+        }
+        const T empty = outNoData.second ? outNoData.first :
+            (std::numeric_limits<T>::has_quiet_NaN ? std::numeric_limits<T>::quiet_NaN() : T());
+        typename envire::Grid<T>::ArrayType &outputData(outputGrid->getGridData());
+        const detail::FoldOutput<T> output(outputData.data(), maxX, empty);
+
+        const int nHalf = ceil(neighbourhood / 2.0);
+        const int lo = -nHalf;
+        const size_t w = 2 * nHalf;
+        if(w == 0)
+        {
+            std::fill(outputData.data(), outputData.data() + cells, empty);
+            return true;
+        }
+
+        std::vector<double> weights(w, 1.0);
+        if(kernel == GAUSSIAN)
+        {
+            const double s = sigma > 0 ? sigma : std::max(neighbourhood / 4.0, 0.5);
+            for(size_t k = 0; k < w; k++)
+                weights[k] = exp(-0.5 * (lo + (double)k) * (lo + (double)k) / (s * s));
+        }
+        const double inf = std::numeric_limits<double>::infinity();
+        const double identity = kernel == MIN ? inf : -inf;
+
+        // the output is computed in bands of rows, so that the temporary
+        // buffers only hold the input rows needed for one band
+        std::vector<double> sum, weight;
+        for(size_t y0 = 0; y0 < maxY; y0 += bandHeight)
+        {
+            const size_t y1 = std::min(maxY, y0 + bandHeight);
+            const size_t r0 = std::max(0L, (long)y0 + lo);
+            const size_t r1 = std::min((long)maxY, (long)y1 - 1 + lo + (long)w);
+            const size_t rowCount = r1 > r0 ? r1 - r0 : 0;
+            sum.resize(rowCount * maxX);
+
+            if(kernel == BOX || kernel == GAUSSIAN)
+            {
+                weight.resize(rowCount * maxX);
+                parallelFor(0, rowCount, detail::FoldRows<T>(input, r0, &sum[0], &weight[0], lo, weights, kernel == BOX));
+                if(kernel == BOX)
+                    parallelForBlocks(0, maxX, 256, detail::FoldBoxColumns<T>(&sum[0], &weight[0], output, maxY, r0, y0, y1, lo, w));
+                else
+                    parallelFor(y0, y1, detail::FoldGaussianRows<T>(&sum[0], &weight[0], output, maxY, r0, lo, weights));
+            }
+            else if(kernel == MIN)
             {
-                fold(inputData, outputData, x, y);
+                parallelFor(0, rowCount, detail::FoldExtremumRows< T, std::less<double> >(input, r0, &sum[0], lo, w, identity));
+                parallelFor(0, maxX, detail::FoldExtremumColumns< T, std::less<double> >(&sum[0], output, rowCount, r0, y0, y1, lo, w, identity));
+            }
+            else
+            {
+                parallelFor(0, rowCount, detail::FoldExtremumRows< T, std::greater<double> >(input, r0, &sum[0], lo, w, identity));
+                parallelFor(0, maxX, detail::FoldExtremumColumns< T, std::greater<double> >(&sum[0], output, rowCount, r0, y0, y1, lo, w, identity));
             }
         }
-        
+
         return true;
     }
-    
-    
+
+
 protected:
     size_t maxX;
     size_t maxY;
 
     size_t neighbourhood;
+    Kernel kernel;
+    double sigma;
+    size_t bandHeight;
 };
 
 
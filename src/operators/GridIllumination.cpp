@@ -1,5 +1,6 @@
 #include "GridIllumination.hpp"
 #include <envire/maps/ElevationGrid.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
 
 using namespace envire;
 using namespace Eigen;
@@ -7,28 +8,34 @@ using namespace Eigen;
 ENVIRONMENT_ITEM_DEF( GridIllumination )
 
 GridIllumination::GridIllumination()
-    : lightSource( base::Vector3d::Zero() ), lightDiameter( 0.0 ), band( ElevationGrid::ILLUMINATION )
+    : lightSource( base::Vector3d::Zero() ), lightDiameter( 0.0 ), lightAngularDiameter( 0.0 ), band( ElevationGrid::ILLUMINATION )
 {
 }
 
-bool GridIllumination::updateAll()
+namespace
 {
-    // get output grid
-    ElevationGrid* grid = getOutput<envire::ElevationGrid*>();
-
-    // and get the array
-    ElevationGrid::ArrayType &harray = grid->getGridData( ElevationGrid::ELEVATION_MAX );
-    ElevationGrid::ArrayType &iarray = grid->getGridData( band );
+    struct IlluminationCell
+    {
+	ElevationGrid const& grid;
+	ElevationGrid::ArrayType const& harray;
+	ElevationGrid::ArrayType& iarray;
+	Vector3d lightSource;
+	double lightDiameter;
+	ElevationGrid::Position lightPos;
+	bool lightInGrid;
 
-    // get the position of the light source
-    ElevationGrid::Position lightPos;
-    bool lightInGrid = grid->toGrid( lightSource, lightPos.x, lightPos.y );
+	IlluminationCell( ElevationGrid const& grid,
+		ElevationGrid::ArrayType const& harray, ElevationGrid::ArrayType& iarray,
+		Vector3d const& lightSource, double lightDiameter )
+	    : grid( grid ), harray( harray ), iarray( iarray ),
+	    lightSource( lightSource ), lightDiameter( lightDiameter )
+	{
+	    lightInGrid = grid.toGrid( lightSource, lightPos.x, lightPos.y );
+	}
 
-    for( size_t x = 0; x < grid->getCellSizeX(); x++ )
-    {
-	for( size_t y = 0; y < grid->getCellSizeY(); y++ )
+	void operator()( size_t x, size_t y )
 	{
-	    Vector3d cell = grid->fromGrid( x, y );
+	    Vector3d cell = grid.fromGrid( x, y );
 	    // get z-value from array
 	    cell.z() = harray[y][x];
 	    Vector3d dir3 = lightSource - cell;
@@ -56,8 +63,8 @@ bool GridIllumination::updateAll()
 		stepy = dir.y() > 0 ? 1 : -1;
 	    // this is the distance along the ray until a new cell is reached
 	    const double 
-		deltax = (dir / dir.x() * grid->getScaleX()).norm(),
-		deltay = (dir / dir.y() * grid->getScaleY()).norm();
+		deltax = (dir / dir.x() * grid.getScaleX()).norm(),
+		deltay = (dir / dir.y() * grid.getScaleY()).norm();
 	    // starting distance until a new cell is reached.
 	    // since we start in the center of the cell, this is half the 
 	    // deltax, and deltay
@@ -81,14 +88,14 @@ bool GridIllumination::updateAll()
 		}
 
 		// see if we are still within bounds
-		if( !(cx >= 0 && cx < grid->getCellSizeX() && cy >= 0 && cy < grid->getCellSizeY()) )
+		if( !(cx >= 0 && cx < grid.getCellSizeX() && cy >= 0 && cy < grid.getCellSizeY()) )
 		    break;
 		// check if we already are on the light-source
 		if( lightInGrid && ElevationGrid::Position(cx, cy) == lightPos )
 		    break;
 
 		// get distance value on x/y plane
-		double dist = (grid->fromGrid( cx, cy ).head<2>() - cell.head<2>()).norm();
+		double dist = (grid.fromGrid( cx, cy ).head<2>() - cell.head<2>()).norm();
 
 		// now get the elevationvalue from the grid relative to the
 		// current cell
@@ -101,8 +108,136 @@ bool GridIllumination::updateAll()
 	    // set the light value in the illumination band
 	    iarray[y][x] = 1.0 - std::min( maxLight, 1.0 );
 	}
+    };
+
+    /** Adds the illumination by a directional light to the illumination
+     * band.
+     *
+     * The grid is covered by digital lines parallel to the light direction,
+     * such that each cell lies on exactly one line, and the lines can be
+     * processed in parallel. Each line is walked starting at the side
+     * facing the light, while keeping the upper convex hull of the terrain
+     * profile walked so far. The horizon of a cell is the tangent from the
+     * cell to that hull, which makes the computation linear in the number
+     * of cells.
+     */
+    struct HorizonSweep
+    {
+	ElevationGrid::ArrayType const& harray;
+	ElevationGrid::ArrayType& iarray;
+	size_t width, height;
+	double scalex, scaley;
+	double weight;
+	// min/max slope of the light
+	double lightMin, lightMax;
+	// unit direction towards the light
+	Vector2d dir;
+	// true if the lines advance along x, with y being the minor axis
+	bool alongX;
+	// change of the minor index per step along the major axis
+	double slope;
+	// true if the light is in the direction of increasing major index
+	bool reverse;
+	long kMin;
+	size_t lineCount;
+
+	HorizonSweep( ElevationGrid const& grid,
+		ElevationGrid::ArrayType const& harray, ElevationGrid::ArrayType& iarray,
+		GridIllumination::LightDirection const& light, double angularDiameter )
+	    : harray( harray ), iarray( iarray ),
+	    width( grid.getCellSizeX() ), height( grid.getCellSizeY() ),
+	    scalex( grid.getScaleX() ), scaley( grid.getScaleY() ),
+	    weight( light.weight ),
+	    lightMin( tan( light.elevation - .5 * angularDiameter ) ),
+	    lightMax( tan( light.elevation + .5 * angularDiameter ) ),
+	    dir( cos( light.azimuth ), sin( light.azimuth ) )
+	{
+	    // direction in cell units
+	    const double cx = dir.x() / scalex, cy = dir.y() / scaley;
+	    alongX = fabs( cx ) >= fabs( cy );
+	    slope = alongX ? cy / cx : cx / cy;
+	    reverse = alongX ? cx > 0 : cy > 0;
+
+	    // range of line offsets which cover the grid
+	    const long major = alongX ? width : height;
+	    const long minor = alongX ? height : width;
+	    const long f0 = 0, f1 = floor( (major - 1) * slope + 0.5 );
+	    kMin = -std::max( f0, f1 );
+	    lineCount = (major && minor) ? (minor - 1) - std::min( f0, f1 ) - kMin + 1 : 0;
+	}
+
+	void operator()( size_t line )
+	{
+	    const long k = kMin + line;
+	    const size_t major = alongX ? width : height;
+	    const size_t minor = alongX ? height : width;
+
+	    // upper convex hull of the profile, as position along the light
+	    // direction and height
+	    std::vector<double> ht, hh;
+	    for( size_t i = 0; i < major; i++ )
+	    {
+		const long a = reverse ? major - 1 - i : i;
+		const long b = k + (long)floor( a * slope + 0.5 );
+		if( b < 0 || b >= (long)minor )
+		    continue;
+
+		const size_t x = alongX ? a : b, y = alongX ? b : a;
+		const double h = harray[y][x];
+		// cells without height neither receive light nor cast shadows
+		if( !boost::math::isfinite( h ) )
+		    continue;
+		const double t = dir.x() * x * scalex + dir.y() * y * scaley;
+
+		// remove the hull points which are below the line from the
+		// current cell to the point before them
+		while( ht.size() >= 2 &&
+			(hh[hh.size()-1] - h) / (ht[ht.size()-1] - t) <=
+			(hh[hh.size()-2] - h) / (ht[ht.size()-2] - t) )
+		{
+		    ht.pop_back();
+		    hh.pop_back();
+		}
+
+		double maxLight = 0.0;
+		if( !ht.empty() )
+		{
+		    const double horizon = (hh.back() - h) / (ht.back() - t);
+		    maxLight = std::max( maxLight, (horizon - lightMin) / (lightMax - lightMin) );
+		}
+		iarray[y][x] += weight * (1.0 - std::min( maxLight, 1.0 ));
+
+		ht.push_back( t );
+		hh.push_back( h );
+	    }
+	}
+    };
+}
+
+bool GridIllumination::updateAll()
+{
+    // get output grid
+    ElevationGrid* grid = getOutput<envire::ElevationGrid*>();
+
+    // and get the arrays
+    ElevationGrid::ArrayType &harray = grid->getGridData( ElevationGrid::ELEVATION_MAX );
+    ElevationGrid::ArrayType &iarray = grid->getGridData( band );
+
+    if( !lightDirections.empty() )
+    {
+	std::fill( iarray.data(), iarray.data() + iarray.num_elements(), 0.0 );
+	for( size_t i = 0; i < lightDirections.size(); i++ )
+	{
+	    HorizonSweep sweep( *grid, harray, iarray, lightDirections[i], lightAngularDiameter );
+	    parallelFor( 0, sweep.lineCount, sweep );
+	}
+	return true;
     }
 
+    // the cells are independent of each other, and can be processed in
+    // parallel
+    grid->parallelForEachCell( IlluminationCell( *grid, harray, iarray, lightSource, lightDiameter ) );
+
     return true;
 }
 
@@ -110,6 +245,13 @@ void GridIllumination::setLightSource( const base::Vector3d& ls, double diameter
 {
     lightSource = ls;
     lightDiameter = diameter;
+    lightDirections.clear();
+}
+
+void GridIllumination::setLightDirections( const std::vector<LightDirection>& lights, double angularDiameter )
+{
+    lightDirections = lights;
+    lightAngularDiameter = angularDiameter;
 }
 
 void GridIllumination::setOutputBand( const std::string& band )
@@ -2,23 +2,63 @@
 #define ENVIRE_GRIDILLUMINATION__
 
 #include <envire/Core.hpp>
+#include <vector>
 
 namespace envire
 {
+/** Computes the illumination of an ElevationGrid
+ *
+ * The light is either a point light source, given by setLightSource, for
+ * which a ray is traced from every cell towards the light, or a set of
+ * directional lights (e.g. the positions of the sun over a day), given by
+ * setLightDirections. Directional lights are computed by sweeping over the
+ * grid along the light direction while keeping track of the horizon, which
+ * takes constant time per cell and light instead of a ray per cell.
+ *
+ * The illumination band contains the visible fraction of the light in
+ * [0, 1], or the weighted sum of the visible fractions of all the
+ * directional lights.
+ */
 class GridIllumination : public Operator
 {
     ENVIRONMENT_ITEM( GridIllumination )
 
 public:
+    /** A light source at infinite distance */
+    struct LightDirection
+    {
+        /// direction of the light in the x/y plane of the grid, measured
+        /// counter-clockwise from the x axis, in radians
+        double azimuth;
+        /// angle of the light above the x/y plane of the grid, in radians
+        double elevation;
+        /// factor for the contribution of this light to the illumination
+        double weight;
+
+        LightDirection( double azimuth = 0.0, double elevation = 0.0, double weight = 1.0 )
+            : azimuth( azimuth ), elevation( elevation ), weight( weight ) {}
+    };
+
     GridIllumination();
     bool updateAll();
 
+    /** Sets a point light source. This clears the directional lights */
     void setLightSource( const base::Vector3d& ls, double diameter = 0.0 );
+
+    /** Sets the directional lights, which are used instead of the point
+     * light source
+     *
+     * @param angularDiameter the apparent diameter of the lights in radians
+     */
+    void setLightDirections( const std::vector<LightDirection>& lights, double angularDiameter = 0.0 );
+
     void setOutputBand( const std::string& band );
 
 private:
     base::Vector3d lightSource;
     double lightDiameter;
+    std::vector<LightDirection> lightDirections;
+    double lightAngularDiameter;
     std::string band;
 };
 }
@@ -109,6 +109,7 @@ void MLSProjection::projectPointcloudWithUncertainty( envire::MultiLevelSurfaceG
 
 		// write the transformed uncertainty back
 		cit->stdev = sqrt(p_var + p.getCovariance()(2,2));
+		t_grid->touchCell( xi, yi );
 	    }
 
 	    // add the patch with the updated uncertainty into the target grid
@@ -64,6 +64,88 @@ static void updateGradient(MLSGrid const& mls,
 }
 
 
+/** Computes the slope angle of a cell by fitting a plane to the top
+ * surfaces in a window around it
+ */
+struct SlopeFit
+{
+    MLSGrid const& mls;
+    boost::multi_array<float,2>& angles;
+    int window_size;
+    uint32_t required_measurements_per_patch;
+
+    SlopeFit(MLSGrid const& mls, boost::multi_array<float,2>& angles,
+            int window_size, uint32_t required_measurements_per_patch)
+        : mls(mls), angles(angles), window_size(window_size)
+        , required_measurements_per_patch(required_measurements_per_patch) {}
+
+    void operator()(size_t x, size_t y)
+    {
+        const size_t width = mls.getWidth();
+        const size_t height = mls.getHeight();
+        if (x == 0 || x >= width - 1 || y == 0 || y >= height - 1)
+        {
+            angles[y][x] = UNKNOWN;
+            return;
+        }
+
+        MLSGrid::const_iterator this_cell = 
+            std::max_element( mls.beginCell(x,y), mls.endCell() );
+        if (this_cell == mls.endCell())
+        {
+            angles[y][x] = UNKNOWN;
+            return;
+        }
+
+        // Patch will be ignored if it does not get enough measurements.
+        if (required_measurements_per_patch > 0 && 
+                this_cell->getMeasurementCount() < required_measurements_per_patch) {
+            angles[y][x] = UNKNOWN;
+            return;
+        }
+
+        numeric::PlaneFitting<double> fitter;
+        int count = 0;
+        double thisHeight = this_cell->mean;
+        for(int xi = -window_size; xi <= window_size; xi++) {
+            for(int yi = -window_size; yi <= window_size; yi++) {
+                //skip onw entry
+                if(xi == 0 && yi == 0)
+                    continue;
+
+                const int rx = x + xi;
+                const int ry = y + yi;
+                
+                if((rx < 0) || (rx >= (int) width) || (ry < 0) || (ry >= (int) height) )
+                    continue;
+                
+                MLSGrid::const_iterator neighbour_cell = 
+                    std::max_element( mls.beginCell(rx,ry), mls.endCell() );
+
+                if( neighbour_cell != mls.endCell() )
+                {
+                    count++;
+                    Vector3d input(xi * mls.getScaleX(), yi * mls.getScaleY(), thisHeight - neighbour_cell->mean);
+                    fitter.update(input);
+                }
+            }
+        }
+
+        fitter.update(Vector3d(0,0,0));
+        
+        if (count < 5)
+        {
+            angles[y][x] = UNKNOWN;
+        }
+        else
+        {
+            Vector3d fit(fitter.getCoeffs());
+            const double divider = sqrt(fit.x() * fit.x() + fit.y() * fit.y() + 1);
+            angles[y][x] = acos(1 / divider);
+        }
+    }
+};
+
 bool MLSSlope::updateAll() 
 {
     // this implementation can handle only one input at the moment
@@ -127,24 +209,19 @@ bool MLSSlope::updateAll()
         BOTTOM_RIGHT = 6,
         TOP_LEFT = 7;
 
-    for(size_t x=1;x<width;x++)
+    for(size_t y=1;y<height-1;y++)
     {
-        for(size_t y=1;y<height-1;y++)
+        for(size_t x=1;x<width;x++)
         {
             MLSGrid::const_iterator this_cell = 
                 std::max_element( mls.beginCell(x,y), mls.endCell() );
             if (this_cell == mls.endCell())
-            {
-                angles[y][x] = UNKNOWN;
                 continue;
-            }
             
             // Patch will be ignored if it does not get enough measurements.
             if (required_measurements_per_patch > 0 && 
-                    this_cell->getMeasurementCount() < required_measurements_per_patch) {
-                angles[y][x] = UNKNOWN;
+                    this_cell->getMeasurementCount() < required_measurements_per_patch)
                 continue;
-            }
             
             updateGradient(mls, use_stddev, angles, diffs, counts, scaley,
                     BOTTOM_CENTER, x, y, TOP_CENTER, x, y + 1,
@@ -158,57 +235,17 @@ bool MLSSlope::updateAll()
             updateGradient(mls, use_stddev, angles, diffs, counts, diagonal_scale,
                     BOTTOM_RIGHT, x, y, TOP_LEFT, x - 1, y + 1,
                     this_cell, required_measurements_per_patch);            
-              
-            numeric::PlaneFitting<double> fitter;
-            int count = 0;
-            double thisHeight = this_cell->mean;
-            for(int xi = -window_size; xi <= window_size; xi++) {
-                for(int yi = -window_size; yi <= window_size; yi++) {
-                    //skip onw entry
-                    if(xi == 0 && yi == 0)
-                        continue;
-
-                    const int rx = x + xi;
-                    const int ry = y + yi;
-                    
-                    if((rx < 0) || (rx >= (int) width) || (ry < 0) || (ry >= (int) height) )
-                        continue;
-                    
-                    MLSGrid::const_iterator neighbour_cell = 
-                        std::max_element( mls.beginCell(rx,ry), mls.endCell() );
-
-                    if( neighbour_cell != mls.endCell() )
-                    {
-                        count++;
-                        Vector3d input(xi * mls.getScaleX(), yi * mls.getScaleY(), thisHeight - neighbour_cell->mean);
-//                         std::cout << x << " " << y << " coords " << input.transpose() << std::endl; 
-                        fitter.update(input);
-                    }
-
-                }
-            }
-
-            
-            fitter.update(Vector3d(0,0,0));
-            
-            if (count < 5)
-            {
-                angles[y][x] = UNKNOWN;
-            }
-            else
-            {
-                Vector3d fit(fitter.getCoeffs());
-                const double divider = sqrt(fit.x() * fit.x() + fit.y() * fit.y() + 1);
-                angles[y][x] = acos(1 / divider);
-            }
-            
         }
     }
 
+    // The slope angles only depend on the MLS, so that the cells can be
+    // processed in parallel
+    mls.parallelForEachCell( SlopeFit( mls, angles, window_size, required_measurements_per_patch ) );
+
     // Right now, the angles grid contains gradients. Convert to angles
-    for(size_t x=1;x<(width - 1);x++)
+    for(size_t y=1;y<(height - 1);y++)
     {
-        for(size_t y=1;y<(height - 1);y++)
+        for(size_t x=1;x<(width - 1);x++)
         {
             int count = counts[y][x];
             if (count < 5)
@@ -237,22 +274,19 @@ bool MLSSlope::updateAll()
                 corrected_max_steps[y][x] = max_step;
         }
     }
-    // ... and mark the remaining of the border as UNKNOWN
+    // ... and mark the remaining of the border as UNKNOWN. The angles are
+    // already handled by SlopeFit
     for(size_t x=0; x < width; ++x)
     {
-        angles[0][x] = UNKNOWN;
         max_steps[0][x] = UNKNOWN;
         corrected_max_steps[0][x] = UNKNOWN;
-        angles[height-1][x] = UNKNOWN;
         max_steps[height-1][x] = UNKNOWN;
         corrected_max_steps[height-1][x] = UNKNOWN;
     }
     for(size_t y=0; y < height; ++y)
     {
-        angles[y][0] = UNKNOWN;
         max_steps[y][0] = UNKNOWN;
         corrected_max_steps[y][0] = UNKNOWN;
-        angles[y][width-1] = UNKNOWN;
         max_steps[y][width-1] = UNKNOWN;
         corrected_max_steps[y][width-1] = UNKNOWN;
     }
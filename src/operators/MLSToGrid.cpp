@@ -1,64 +1,187 @@
 #include "MLSToGrid.hpp"
 #include <envire/maps/MLSGrid.hpp>
 #include <envire/maps/ElevationGrid.hpp>
+#include <envire/tools/ParallelFor.hpp>
 #include <boost/multi_array.hpp>
+#include <limits>
 
 using namespace envire;
 
 ENVIRONMENT_ITEM_DEF( MLSToGrid )
 
+const char* const MLSToGrid::BAND_KEYS[MLSToGrid::BAND_COUNT] = {
+    "out_layer_name", "band_bottom", "band_stdev",
+    "band_patch_count", "band_vertical_extent", "band_clearance" };
+
 MLSToGrid::MLSToGrid()
     : Operator(1, 1)
-    , mOutLayerName(ElevationGrid::ELEVATION) {}
+    , mIncremental(false)
+    , mLastInput(NULL)
+    , mLastOutput(NULL)
+    , mLastRevision(0)
+{
+    mBandNames[TOP] = ElevationGrid::ELEVATION;
+}
 
 MLSToGrid::~MLSToGrid() {}
 
 void MLSToGrid::serialize( Serialization &so )
 {
     Operator::serialize(so);
-    so.write("out_layer_name", mOutLayerName);
+    for( int i = 0; i < BAND_COUNT; i++ )
+    {
+        if( i == TOP || !mBandNames[i].empty() )
+            so.write(BAND_KEYS[i], mBandNames[i]);
+    }
+    so.write("incremental", mIncremental);
 }
 
 void MLSToGrid::unserialize( Serialization &so )
 {
     Operator::unserialize(so);
-    so.read("out_layer_name", mOutLayerName);
+    for( int i = 0; i < BAND_COUNT; i++ )
+    {
+        if( i == TOP || so.hasKey(BAND_KEYS[i]) )
+            so.read(BAND_KEYS[i], mBandNames[i]);
+    }
+    if( so.hasKey("incremental") )
+        so.read("incremental", mIncremental);
 }
 
 void MLSToGrid::setOutput(Grid<double>* map, std::string const& layer_name)
 {
     Operator::setOutput(map);
-    mOutLayerName = layer_name;
+    setBandName(TOP, layer_name);
 }
 
-bool MLSToGrid::updateAll() 
+void MLSToGrid::setBandName(Band band, std::string const& name)
 {
-    Grid<double>& travGrid = *env->getOutput< Grid<double>* >(this);
-    MLSGrid const& mls = *env->getInput< MLSGrid* >(this);
-
-    if( mls.getWidth() != travGrid.getWidth() && mls.getHeight() != travGrid.getHeight() )
-        throw std::runtime_error("mismatching width and/or height between MLSGradient input and output");
-    if( mls.getScaleX() != travGrid.getScaleX() && mls.getScaleY() != travGrid.getScaleY() )
-        throw std::runtime_error("mismatching cell scale between MLSGradient input and output");
+    mBandNames[band] = name;
+    // force a full update
+    mLastInput = NULL;
+}
 
-    // init traversibility grid
-    size_t width = mls.getWidth(); 
-    size_t height = mls.getHeight(); 
+std::string const& MLSToGrid::getBandName(Band band) const
+{
+    return mBandNames[band];
+}
 
-    boost::multi_array<double, 2>& out_data = travGrid.getGridData(mOutLayerName);
+void MLSToGrid::setIncremental(bool incremental)
+{
+    mIncremental = incremental;
+    mLastInput = NULL;
+}
 
-    for(size_t x=0;x<width;x++)
+namespace
+{
+    struct Rasterizer
     {
-        for(size_t y=0;y<height;y++)
+        MLSGrid const& mls;
+        std::vector<GridBase::Position> const& tiles;
+
+        /// output arrays of the enabled bands, NULL for disabled ones
+        double* out[MLSToGrid::BAND_COUNT];
+        /// values for empty cells
+        double empty[MLSToGrid::BAND_COUNT];
+        bool hasEmpty[MLSToGrid::BAND_COUNT];
+
+        Rasterizer( MLSGrid const& mls, std::vector<GridBase::Position> const& tiles )
+            : mls( mls ), tiles( tiles ) {}
+
+        void operator()( size_t i ) const
         {
-            MLSGrid::const_iterator this_cell = 
-                std::max_element( mls.beginCell(x,y), mls.endCell() );
-            if (this_cell == mls.endCell())
-                continue;
+            const GridBase::CellExtents ext = mls.getTileExtents( tiles[i].x, tiles[i].y );
+            const size_t width = mls.getCellSizeX();
+            const double inf = std::numeric_limits<double>::infinity();
+
+            for( int y = ext.min().y(); y <= ext.max().y(); y++ )
+            {
+                for( int x = ext.min().x(); x <= ext.max().x(); x++ )
+                {
+                    double top = -inf, bottom = inf, stdev = 0, ground = inf;
+                    size_t count = 0;
+                    for( MLSGrid::const_iterator it = mls.beginCell( x, y ); it != mls.endCell(); it++ )
+                    {
+                        if( it->isNegative() )
+                            continue;
+                        count++;
+                        if( it->mean > top )
+                        {
+                            top = it->mean;
+                            stdev = it->stdev;
+                        }
+                        bottom = std::min( bottom, it->getMinZ( 0 ) );
+                        ground = std::min( ground, (double)it->mean );
+                    }
 
-            out_data[y][x] = this_cell->mean;
+                    double value[MLSToGrid::BAND_COUNT];
+                    value[MLSToGrid::TOP] = top;
+                    value[MLSToGrid::BOTTOM] = bottom;
+                    value[MLSToGrid::STDEV] = stdev;
+                    value[MLSToGrid::PATCH_COUNT] = count;
+                    value[MLSToGrid::VERTICAL_EXTENT] = top - bottom;
+                    value[MLSToGrid::CLEARANCE] = inf;
+                    if( out[MLSToGrid::CLEARANCE] )
+                    {
+                        // lowest extent of the patches above the ground surface
+                        for( MLSGrid::const_iterator it = mls.beginCell( x, y ); it != mls.endCell(); it++ )
+                        {
+                            if( !it->isNegative() && it->mean > ground )
+                                value[MLSToGrid::CLEARANCE] = std::min(
+                                        value[MLSToGrid::CLEARANCE], std::max( 0.0, it->getMinZ( 0 ) - ground ) );
+                        }
+                    }
+
+                    const size_t idx = y * width + x;
+                    for( int b = 0; b < MLSToGrid::BAND_COUNT; b++ )
+                    {
+                        if( !out[b] )
+                            continue;
+                        if( count || b == MLSToGrid::PATCH_COUNT )
+                            out[b][idx] = value[b];
+                        else if( hasEmpty[b] )
+                            out[b][idx] = empty[b];
+                    }
+                }
+            }
         }
+    };
+}
+
+bool MLSToGrid::updateAll()
+{
+    Grid<double>& travGrid = *env->getOutput< Grid<double>* >(this);
+    MLSGrid const& mls = *env->getInput< MLSGrid* >(this);
+
+    if( mls.getWidth() != travGrid.getWidth() || mls.getHeight() != travGrid.getHeight() )
+        throw std::runtime_error("mismatching width and/or height between MLSToGrid input and output");
+    if( mls.getScaleX() != travGrid.getScaleX() || mls.getScaleY() != travGrid.getScaleY() )
+        throw std::runtime_error("mismatching cell scale between MLSToGrid input and output");
+
+    // select the tiles to rasterize
+    std::vector<GridBase::Position> tiles;
+    if( mIncremental && mLastInput == &mls && mLastOutput == &travGrid )
+        mls.getModifiedTiles( mLastRevision, tiles );
+    else
+        mls.getModifiedTiles( 0, tiles );
+    mLastInput = &mls;
+    mLastOutput = &travGrid;
+    mLastRevision = mls.getRevision();
+
+    Rasterizer rasterizer( mls, tiles );
+    for( int b = 0; b < BAND_COUNT; b++ )
+    {
+        rasterizer.out[b] = NULL;
+        if( mBandNames[b].empty() )
+            continue;
+
+        rasterizer.out[b] = travGrid.getGridData(mBandNames[b]).data();
+        std::pair<double, bool> nodata = travGrid.getNoData(mBandNames[b]);
+        rasterizer.empty[b] = nodata.first;
+        rasterizer.hasEmpty[b] = nodata.second;
     }
 
+    parallelFor( 0, tiles.size(), rasterizer );
+
     return true;
 }
@@ -1,31 +1,82 @@
-#ifndef __ENVIRE__MLS_SLOPE_HPP__
-#define __ENVIRE__MLS_SLOPE_HPP__
+#ifndef __ENVIRE__MLS_TO_GRID_HPP__
+#define __ENVIRE__MLS_TO_GRID_HPP__
 
 #include <envire/Core.hpp>
 #include <envire/maps/Grid.hpp>
 
 namespace envire
 {
-    /** A very stupid and limited MLS-to-grid convertion operator
+    class MLSGrid;
+
+    /** MLS-to-grid conversion operator
+     *
+     * It acts on an MLSGrid and rasterizes it into one or several bands of
+     * a Grid<double>, which needs to have the same size and resolution. All
+     * enabled bands are computed in a single pass over the MLS, which is
+     * processed tile by tile and in parallel. Negative patches are ignored.
+     *
+     * By default, only the TOP band is enabled, using the band name given
+     * to setOutput(). Cells without patches get the nodata value of the
+     * respective band if the output grid defines one, and are left
+     * unchanged otherwise. The PATCH_COUNT band is always written.
      *
-     * It acts on an MLSGrid and updates a Grid<double> with the highest point
-     * in the MLS at this cell
+     * In incremental mode, only the tiles of the MLS which have been
+     * modified since the last update are rasterized (see
+     * MLSGrid::getModifiedTiles).
      */
     class MLSToGrid : public Operator
     {
 	ENVIRONMENT_ITEM( MLSToGrid )
 
-        std::string mOutLayerName;
-
     public:
+        enum Band
+        {
+            /// highest mean of the patches in the cell
+            TOP = 0,
+            /// lowest extent of the patches in the cell
+            BOTTOM,
+            /// stdev of the patch defining TOP
+            STDEV,
+            /// number of patches in the cell
+            PATCH_COUNT,
+            /// difference between TOP and BOTTOM
+            VERTICAL_EXTENT,
+            /// free space between the lowest surface and the next patch
+            /// above it, infinity if there is none
+            CLEARANCE,
+            BAND_COUNT
+        };
+
         MLSToGrid();
         ~MLSToGrid();
 
 	void serialize( Serialization &so );
 	void unserialize( Serialization &so );
 
+        /** Sets the output grid, and the name of the band for TOP */
         void setOutput(Grid<double>* grid, std::string const& name);
+
+        /** Enables the given band, writing it to the band with the given
+         * name of the output grid. An empty name disables the band.
+         */
+        void setBandName(Band band, std::string const& name);
+        std::string const& getBandName(Band band) const;
+
+        void setIncremental(bool incremental);
+        bool isIncremental() const { return mIncremental; }
+
 	bool updateAll();
+
+    private:
+        std::string mBandNames[BAND_COUNT];
+        bool mIncremental;
+
+        /// state of the last update, used in incremental mode
+        MLSGrid const* mLastInput;
+        Grid<double> const* mLastOutput;
+        size_t mLastRevision;
+
+        static const char* const BAND_KEYS[BAND_COUNT];
     };
 }
 
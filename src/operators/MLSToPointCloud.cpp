@@ -39,9 +39,9 @@ bool MLSToPointCloud::updateAll()
 	vertical_distance = 0.1;
     
     // create pointcloud from mls
-    for(size_t x=0;x<mls_grid->getCellSizeX();x++)
+    for(size_t y=0;y<mls_grid->getCellSizeY();y++)
     {
-	for(size_t y=0;y<mls_grid->getCellSizeY();y++)
+	for(size_t x=0;x<mls_grid->getCellSizeX();x++)
 	{
 	    for( MLSGrid::iterator cit = mls_grid->beginCell(x,y); cit != mls_grid->endCell(); cit++ )
 	    {
@@ -16,6 +16,10 @@ public:
 
     bool updateAll();
 
+    /** if set, each output cell takes the patches of the input cell
+     * containing its center, otherwise each input patch is merged into the
+     * output cell containing its position (see MLSGrid::mergeTransformed).
+     */
     void setReverse( bool value ) { reverse = value; }
 
 protected:
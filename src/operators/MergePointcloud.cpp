@@ -6,6 +6,7 @@
  */
 
 #include "MergePointcloud.hpp"
+#include <envire/tools/ParallelFor.hpp>
 #include <Eigen/LU>
 #include <iostream>
 
@@ -14,8 +15,82 @@ namespace envire {
 
 ENVIRONMENT_ITEM_DEF( MergePointcloud )
 
+namespace
+{
+    const size_t BLOCK_SIZE = 1 << 14;
+
+    /** reserves at least size elements, growing the capacity geometrically
+     * so that repeated appends stay linear in the total size */
+    template <class T, class A>
+    void reserveGrowing( std::vector<T, A>& data, size_t size )
+    {
+	if( size > data.capacity() )
+	    data.reserve( std::max( size, 2 * data.capacity() ) );
+    }
+
+    /** transforms the points and normals of one input into its slice of the
+     * output */
+    struct TransformSlice
+    {
+	const std::vector<Eigen::Vector3d>& source;
+	Eigen::Vector3d* target;
+	Eigen::Vector3d* normals;
+	const Transform& trans;
+	Eigen::Matrix3d rotation;
+
+	TransformSlice( const std::vector<Eigen::Vector3d>& source, Eigen::Vector3d* target,
+		Eigen::Vector3d* normals, const Transform& trans )
+	    : source( source ), target( target ), normals( normals ),
+	    trans( trans ), rotation( trans.linear() ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i = begin; i < end; i++ )
+		target[i] = trans * source[i];
+	    if( normals )
+	    {
+		for( size_t i = begin; i < end; i++ )
+		    normals[i] = rotation * normals[i];
+	    }
+	}
+    };
+
+    /** appends the vertex data for \c key of all inputs to the output, if
+     * any of them has it. Missing data, or data which does not match the
+     * number of vertices, is filled with \c fill.
+     *
+     * @return the output data or NULL
+     */
+    template <class T>
+    std::vector<T>* mergeData( Pointcloud* target, size_t targetSize, size_t mergedSize,
+	    const std::vector<Pointcloud*>& clouds, const std::string& key, const T& fill )
+    {
+	bool has = target->hasData( key ) && !target->getVertexData<T>( key ).empty();
+	for( size_t c = 0; c < clouds.size(); c++ )
+	    has = has || clouds[c]->hasData( key );
+	if( !has )
+	    return NULL;
+
+	std::vector<T>& data( target->getVertexData<T>( key ) );
+	reserveGrowing( data, mergedSize );
+	data.resize( targetSize, fill );
+	for( size_t c = 0; c < clouds.size(); c++ )
+	{
+	    Pointcloud* cloud = clouds[c];
+	    if( cloud->hasData( key ) && cloud->getVertexData<T>( key ).size() == cloud->vertices.size() )
+	    {
+		const std::vector<T>& source( cloud->getVertexData<T>( key ) );
+		data.insert( data.end(), source.begin(), source.end() );
+	    }
+	    else
+		data.resize( data.size() + cloud->vertices.size(), fill );
+	}
+	return &data;
+    }
+}
+
 MergePointcloud::MergePointcloud() 
-    : m_clearOutput( true )
+    : m_clearOutput( true ), m_incremental( false )
 {
 }
 
@@ -48,69 +123,76 @@ void MergePointcloud::setClearOutput( bool clear )
     m_clearOutput = clear;
 }
 
+void MergePointcloud::setIncremental( bool incremental )
+{
+    m_incremental = incremental;
+}
+
 bool MergePointcloud::updateAll(){
     Pointcloud* targetcloud = dynamic_cast<envire::Pointcloud*>(*env->getOutputs(this).begin());
     assert( targetcloud );
-    if( m_clearOutput )
+    if( m_clearOutput && !m_incremental )
+    {
 	targetcloud->clear();
+	m_merged.clear();
+    }
 
     std::list<Layer*> inputs = env->getInputs(this);
 
-    // check for additional data 
-    bool hasNormal = false, hasColor = false;
-
+    // collect the clouds to merge
+    std::vector<Pointcloud*> clouds;
     for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ ){
 	Pointcloud* cloud = dynamic_cast<envire::Pointcloud*>(*it);
-	hasNormal = hasNormal || cloud->hasData( Pointcloud::VERTEX_NORMAL );
-	hasColor = hasColor || cloud->hasData( Pointcloud::VERTEX_COLOR );
-
+	assert( cloud );
 	assert( cloud != targetcloud );
-    }
-
-    //for every cloud
-    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ ){
-	Pointcloud* cloud = dynamic_cast<envire::Pointcloud*>(*it);
-	assert(cloud);
-
-	Transform trans = 
-	    env->relativeTransform( cloud->getFrameNode(), targetcloud->getFrameNode() );
 
+	// remember all merged inputs, so that switching to incremental mode
+	// does not add them a second time
+	const bool merged = !m_merged.insert( cloud->getUniqueId() ).second;
+	if( m_incremental && merged )
+	    continue;
+	clouds.push_back( cloud );
+    }
 
-	for (std::vector<Eigen::Vector3d>::iterator p = cloud->vertices.begin();p<cloud->vertices.end();p++)
-	{
-	    targetcloud->vertices.push_back(trans * *p);
-	}
-
-	if( hasNormal )
-	{
-	    if( !cloud->hasData( Pointcloud::VERTEX_NORMAL ) )
-		throw std::runtime_error("merge currently needs to have the same metadata on all inputs");
+    // size the output once
+    const size_t targetSize = targetcloud->vertices.size();
+    size_t mergedSize = targetSize;
+    for( size_t c = 0; c < clouds.size(); c++ )
+	mergedSize += clouds[c]->vertices.size();
 
-	    Eigen::Quaterniond rot(trans.linear());
+    const bool hasChannels = targetSize > 0 && targetcloud->channels.size() == targetSize;
+    reserveGrowing( targetcloud->vertices, mergedSize );
+    targetcloud->vertices.resize( mergedSize );
 
-	    std::vector<Eigen::Vector3d> &source_data( cloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
-	    std::vector<Eigen::Vector3d> &target_data( targetcloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+    std::vector<Eigen::Vector3d>* normals =
+	mergeData( targetcloud, targetSize, mergedSize, clouds, Pointcloud::VERTEX_NORMAL, Eigen::Vector3d( Eigen::Vector3d::Zero() ) );
+    mergeData( targetcloud, targetSize, mergedSize, clouds, Pointcloud::VERTEX_COLOR, Eigen::Vector3d( Eigen::Vector3d::Zero() ) );
+    mergeData( targetcloud, targetSize, mergedSize, clouds, Pointcloud::VERTEX_ATTRIBUTES, Pointcloud::vertex_attr( 0 ) );
+    mergeData( targetcloud, targetSize, mergedSize, clouds, Pointcloud::VERTEX_VARIANCE, 0.0 );
 
-	    //std::cout << source_data.size() << std::endl;
-	    for (std::vector<Eigen::Vector3d>::iterator p = source_data.begin();p!=source_data.end();p++)
-	    {
-		target_data.push_back( rot * *p );
-	    }
-	}
+    //for every cloud
+    size_t offset = targetSize;
+    for( size_t c = 0; c < clouds.size(); c++ ){
+	Pointcloud* cloud = clouds[c];
 
-	if( hasColor )
-	{
-	    if( !cloud->hasData( Pointcloud::VERTEX_COLOR ) )
-		throw std::runtime_error("merge currently needs to have the same metadata on all inputs");
+	Transform trans = 
+	    env->relativeTransform( cloud->getFrameNode(), targetcloud->getFrameNode() );
 
-	    std::vector<Eigen::Vector3d> &source_data( cloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
-	    std::vector<Eigen::Vector3d> &target_data( targetcloud->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+	parallelForBlocks( 0, cloud->vertices.size(), BLOCK_SIZE,
+		TransformSlice( cloud->vertices, &targetcloud->vertices[0] + offset,
+		    normals ? &(*normals)[0] + offset : NULL, trans ) );
+	offset += cloud->vertices.size();
+    }
 
-	    for (std::vector<Eigen::Vector3d>::iterator p = source_data.begin();p!=source_data.end();p++)
-	    {
-		target_data.push_back( *p );
-	    }
-	}
+    // keep the channels of the output in sync, if it had them
+    if( hasChannels )
+    {
+	PointChannels& channels( targetcloud->channels );
+	reserveGrowing( channels.x, mergedSize );
+	reserveGrowing( channels.y, mergedSize );
+	reserveGrowing( channels.z, mergedSize );
+	for( size_t i = targetSize; i < mergedSize; i++ )
+	    channels.push_back( targetcloud->vertices[i] );
     }
 
     env->itemModified( targetcloud );
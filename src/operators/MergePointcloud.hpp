@@ -10,8 +10,17 @@
 
 #include <envire/Core.hpp>
 #include <envire/maps/Pointcloud.hpp>
+#include <set>
 
 namespace envire {
+    /** Merges all input pointclouds into the output pointcloud, in the frame
+     * of the output.
+     *
+     * The vertex data (normals, colors, attributes and variance) is merged
+     * as well. Points of inputs without the data get a default value, which
+     * is zero for all of them. The output is resized once per update, and
+     * the inputs are transformed in parallel (see ParallelFor.hpp).
+     */
     class MergePointcloud: public Operator {
 
 	ENVIRONMENT_ITEM( MergePointcloud )
@@ -28,6 +37,14 @@ namespace envire {
 	 */
 	void setClearOutput( bool clear );
 
+	/** @brief set to true to only append the inputs which have not been
+	 * merged before, without clearing the output. This allows to
+	 * accumulate a map by adding new inputs over time, at a cost which
+	 * only depends on the size of the new inputs. Inputs merged by earlier
+	 * updates in either mode count as merged.
+	 */
+	void setIncremental( bool incremental );
+
     public:
 	void addInput(Pointcloud* pc);
 	void addOutput(Pointcloud* globalpc);
@@ -35,6 +52,9 @@ namespace envire {
 
     protected:
 	bool m_clearOutput;
+	bool m_incremental;
+	/** unique ids of the inputs whose points are in the output */
+	std::set<std::string> m_merged;
     };
 }
 
@@ -0,0 +1,191 @@
+#include "NormalEstimation.hpp"
+#include <envire/tools/ParallelFor.hpp>
+#include <envire/tools/PointGridIndex.hpp>
+
+#include <Eigen/Eigenvalues>
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( NormalEstimation )
+
+namespace
+{
+    /// squared distance and index of a neighbour
+    typedef std::pair<double, size_t> Neighbour;
+
+    struct CollectNeighbours
+    {
+	std::vector<Neighbour>& neighbours;
+
+	explicit CollectNeighbours( std::vector<Neighbour>& neighbours )
+	    : neighbours( neighbours ) {}
+
+	void operator()( size_t index, double squaredDistance )
+	{
+	    neighbours.push_back( Neighbour( squaredDistance, index ) );
+	}
+    };
+
+    struct EstimateNormals
+    {
+	const std::vector<Eigen::Vector3d>& points;
+	const PointGridIndex& index;
+	Eigen::Vector3d viewpoint;
+	double radius;
+	size_t neighbourCount;
+	double maxCurvature, maxAngleGap;
+
+	std::vector<Eigen::Vector3d>& normals;
+	std::vector<Pointcloud::vertex_attr>& attrs;
+
+	EstimateNormals( const std::vector<Eigen::Vector3d>& points, const PointGridIndex& index,
+		const Eigen::Vector3d& viewpoint, double radius, size_t neighbourCount,
+		double maxCurvature, double maxAngleGap,
+		std::vector<Eigen::Vector3d>& normals, std::vector<Pointcloud::vertex_attr>& attrs )
+	    : points( points ), index( index ), viewpoint( viewpoint ), radius( radius ),
+	    neighbourCount( neighbourCount ), maxCurvature( maxCurvature ), maxAngleGap( maxAngleGap ),
+	    normals( normals ), attrs( attrs ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    // scratch space, one per block so that threads do not share it
+	    std::vector<Neighbour> neighbours;
+	    std::vector<double> angles;
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		normals[i] = Eigen::Vector3d::Zero();
+		attrs[i] = 1 << Pointcloud::SCAN_EDGE;
+
+		const Eigen::Vector3d& p( points[i] );
+		if( !boost::math::isfinite( p.squaredNorm() ) )
+		    continue;
+
+		neighbours.clear();
+		CollectNeighbours collect( neighbours );
+		index.forEachInRadius( p, radius, collect );
+		if( neighbourCount > 0 && neighbours.size() > neighbourCount )
+		{
+		    // pairs also compare the index, so the selection is unique
+		    std::nth_element( neighbours.begin(), neighbours.begin() + neighbourCount, neighbours.end() );
+		    neighbours.resize( neighbourCount );
+		}
+		if( neighbours.size() < 3 )
+		    continue;
+
+		Eigen::Vector3d mean( Eigen::Vector3d::Zero() );
+		for( size_t n = 0; n < neighbours.size(); n++ )
+		    mean += points[neighbours[n].second];
+		mean /= neighbours.size();
+
+		Eigen::Matrix3d cov( Eigen::Matrix3d::Zero() );
+		for( size_t n = 0; n < neighbours.size(); n++ )
+		{
+		    const Eigen::Vector3d d( points[neighbours[n].second] - mean );
+		    cov += d * d.transpose();
+		}
+
+		// eigenvalues are sorted in increasing order
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver( cov );
+		const Eigen::Vector3d& lambda( solver.eigenvalues() );
+		const double sum = lambda.sum();
+		if( !(sum > 0) )
+		    continue;
+
+		Eigen::Vector3d normal( solver.eigenvectors().col( 0 ) );
+		if( normal.dot( viewpoint - p ) < 0 )
+		    normal = -normal;
+		normals[i] = normal;
+
+		bool edge = lambda[0] / sum > maxCurvature;
+		if( !edge )
+		{
+		    const Eigen::Vector3d u( solver.eigenvectors().col( 2 ) ), v( normal.cross( u ) );
+		    angles.clear();
+		    for( size_t n = 0; n < neighbours.size(); n++ )
+		    {
+			const Eigen::Vector3d d( points[neighbours[n].second] - p );
+			if( neighbours[n].first > 0 )
+			    angles.push_back( std::atan2( d.dot( v ), d.dot( u ) ) );
+		    }
+		    std::sort( angles.begin(), angles.end() );
+		    double gap = angles.empty() ? 2.0 * M_PI : angles.front() + 2.0 * M_PI - angles.back();
+		    for( size_t n = 1; n < angles.size(); n++ )
+			gap = std::max( gap, angles[n] - angles[n - 1] );
+		    edge = gap > maxAngleGap;
+		}
+		attrs[i] = edge ? (1 << Pointcloud::SCAN_EDGE) : 0;
+	    }
+	}
+    };
+}
+
+NormalEstimation::NormalEstimation()
+    : Operator(1, 1), searchRadius( 0.1 ), neighbourCount( 24 ),
+    maxCurvature( 0.1 ), maxAngleGap( M_PI / 2.0 )
+{
+}
+
+void NormalEstimation::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write("search_radius", searchRadius);
+    so.write("neighbour_count", neighbourCount);
+    so.write("max_curvature", maxCurvature);
+    so.write("max_angle_gap", maxAngleGap);
+}
+
+void NormalEstimation::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    so.read("search_radius", searchRadius);
+    so.read("neighbour_count", neighbourCount);
+    so.read("max_curvature", maxCurvature);
+    so.read("max_angle_gap", maxAngleGap);
+}
+
+void NormalEstimation::addInput( Pointcloud* input )
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("NormalEstimation can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void NormalEstimation::addOutput( Pointcloud* output )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("NormalEstimation can only have one output.");
+
+    Operator::addOutput(output);
+}
+
+bool NormalEstimation::updateAll()
+{
+    Pointcloud* in = getInput<Pointcloud*>();
+    Pointcloud* out = getOutput<Pointcloud*>();
+    assert( in != out );
+
+    out->copyFrom( in );
+    const Transform t = env->relativeTransform( in->getFrameNode(), out->getFrameNode() );
+    out->setSensorOrigin( t * in->getSensorOrigin() );
+
+    const std::vector<Eigen::Vector3d>& points( out->vertices );
+    std::vector<Eigen::Vector3d>& normals( out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+    std::vector<Pointcloud::vertex_attr>& attrs( out->getVertexData<Pointcloud::vertex_attr>( Pointcloud::VERTEX_ATTRIBUTES ) );
+    normals.resize( points.size() );
+    attrs.resize( points.size() );
+
+    PointGridIndex index;
+    index.build( points, searchRadius );
+
+    parallelForBlocks( 0, points.size(), 1024,
+	    EstimateNormals( points, index, out->getSensorOrigin().translation(),
+		searchRadius, neighbourCount, maxCurvature, maxAngleGap, normals, attrs ) );
+
+    env->itemModified( out );
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef ENVIRE_NORMALESTIMATION_HPP__
+#define ENVIRE_NORMALESTIMATION_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+
+namespace envire {
+    /**
+     * Estimates normals and edge flags for unstructured pointclouds.
+     *
+     * The vertices of the input are copied into the frame of the output.
+     * For each vertex, the neighbours within the search radius are found
+     * with a PointGridIndex, and the closest of them up to the neighbour
+     * count are used. The normal is the direction of least variance of the
+     * neighbourhood, oriented towards the sensor origin of the input. It is
+     * stored in VERTEX_NORMAL.
+     *
+     * A vertex gets the edge flag (1 << SCAN_EDGE) in VERTEX_ATTRIBUTES if
+     * - it has less than three neighbours,
+     * - its surface variation exceeds the maximum curvature, or
+     * - its neighbours, projected into the tangent plane, leave a gap in
+     *   direction larger than the maximum angle gap, which is the case at
+     *   the boundary of a surface.
+     *
+     * This makes the output usable with PointcloudEdgeAndNormalAdapter.
+     * The points are processed in parallel (see ParallelFor.hpp).
+     */
+    class NormalEstimation : public Operator
+    {
+	ENVIRONMENT_ITEM( NormalEstimation )
+
+    public:
+	NormalEstimation();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* input );
+	void addOutput( Pointcloud* output );
+
+	bool updateAll();
+
+	/** Sets the radius of the neighbourhood. The default is 0.1. */
+	void setSearchRadius( double radius ) { searchRadius = radius; }
+	double getSearchRadius() const { return searchRadius; }
+
+	/** Sets the maximum number of neighbours, the closest ones are used.
+	 * The default is 24, 0 uses all neighbours within the radius. */
+	void setNeighbourCount( size_t count ) { neighbourCount = count; }
+	size_t getNeighbourCount() const { return neighbourCount; }
+
+	/** Sets the surface variation above which a vertex is an edge. The
+	 * surface variation is the ratio of the smallest eigenvalue of the
+	 * neighbourhood covariance to the sum of all eigenvalues, and is
+	 * between 0 for a plane and 1/3. The default is 0.1. */
+	void setMaxCurvature( double curvature ) { maxCurvature = curvature; }
+	double getMaxCurvature() const { return maxCurvature; }
+
+	/** Sets the angle gap in radians above which a vertex is on a
+	 * boundary. The default is pi/2. */
+	void setMaxAngleGap( double angle ) { maxAngleGap = angle; }
+	double getMaxAngleGap() const { return maxAngleGap; }
+
+    private:
+	double searchRadius;
+	size_t neighbourCount;
+	double maxCurvature;
+	double maxAngleGap;
+    };
+}
+
+#endif
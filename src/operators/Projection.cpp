@@ -1,12 +1,15 @@
 #include "Projection.hpp"
+#include <envire/tools/ParallelFor.hpp>
 #include <stdexcept>
 #include <stdint.h>
 #include <limits>
 #include "boost/multi_array.hpp"
 
+#ifdef ENVIRE_USE_CGAL
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Triangulation_euclidean_traits_xy_3.h>
 #include <CGAL/Delaunay_triangulation_2.h>
+#endif
 
 #include <Eigen/LU>
 
@@ -15,6 +18,176 @@ using namespace std;
 
 ENVIRONMENT_ITEM_DEF( Projection )
 
+namespace
+{
+    const size_t BLOCK_SIZE = 1 << 16;
+    /// number of grid rows that are updated by one task
+    const size_t BAND_ROWS = 16;
+    const size_t INVALID_CELL = std::numeric_limits<size_t>::max();
+
+    /** transforms the points into the grid, and counts the points per
+     * block and band of rows */
+    struct ProjectPoints
+    {
+	const std::vector<Eigen::Vector3d>& points;
+	const Transform& trans;
+	const ElevationGrid& grid;
+	size_t bands;
+	std::vector<size_t>& cells;
+	std::vector<double>& heights;
+	std::vector<size_t>& counts;
+
+	ProjectPoints( const std::vector<Eigen::Vector3d>& points, const Transform& trans, const ElevationGrid& grid,
+		size_t bands, std::vector<size_t>& cells, std::vector<double>& heights, std::vector<size_t>& counts )
+	    : points( points ), trans( trans ), grid( grid ), bands( bands ),
+	    cells( cells ), heights( heights ), counts( counts ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    size_t* count = &counts[begin / BLOCK_SIZE * bands];
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		const Eigen::Vector3d p = trans * points[i];
+		size_t x, y;
+		if( grid.toGrid( p.x(), p.y(), x, y ) )
+		{
+		    cells[i] = y * grid.getCellSizeX() + x;
+		    heights[i] = p.z();
+		    count[y / BAND_ROWS]++;
+		}
+		else
+		    cells[i] = INVALID_CELL;
+	    }
+	}
+    };
+
+    /** sorts the projected points by band, using the offsets of each block
+     * and band */
+    struct SortByBand
+    {
+	const std::vector<size_t>& cells;
+	const std::vector<double>& heights;
+	size_t bands, width;
+	std::vector<size_t>& offsets;
+	std::vector<size_t>& sortedCells;
+	std::vector<double>& sortedHeights;
+
+	SortByBand( const std::vector<size_t>& cells, const std::vector<double>& heights, size_t bands, size_t width,
+		std::vector<size_t>& offsets, std::vector<size_t>& sortedCells, std::vector<double>& sortedHeights )
+	    : cells( cells ), heights( heights ), bands( bands ), width( width ),
+	    offsets( offsets ), sortedCells( sortedCells ), sortedHeights( sortedHeights ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    size_t* offset = &offsets[begin / BLOCK_SIZE * bands];
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		if( cells[i] == INVALID_CELL )
+		    continue;
+		const size_t j = offset[cells[i] / width / BAND_ROWS]++;
+		sortedCells[j] = cells[i];
+		sortedHeights[j] = heights[i];
+	    }
+	}
+    };
+
+    /** updates the minimum and maximum of the cells in a band of rows */
+    struct UpdateBand
+    {
+	const std::vector<size_t>& bandStarts;
+	const std::vector<size_t>& cells;
+	const std::vector<double>& heights;
+	double* elv_min;
+	double* elv_max;
+
+	UpdateBand( const std::vector<size_t>& bandStarts, const std::vector<size_t>& cells,
+		const std::vector<double>& heights, double* elv_min, double* elv_max )
+	    : bandStarts( bandStarts ), cells( cells ), heights( heights ),
+	    elv_min( elv_min ), elv_max( elv_max ) {}
+
+	void operator()( size_t band )
+	{
+	    for( size_t j = bandStarts[band]; j < bandStarts[band + 1]; j++ )
+	    {
+		elv_max[cells[j]] = std::max( elv_max[cells[j]], heights[j] );
+		elv_min[cells[j]] = std::min( elv_min[cells[j]], heights[j] );
+	    }
+	}
+    };
+
+    /** one level of the push-pull pyramid, the weights are between 0 and 1 */
+    struct PyramidLevel
+    {
+	size_t width, height;
+	std::vector<double> values, weights;
+
+	PyramidLevel( size_t width, size_t height )
+	    : width( width ), height( height ), values( width * height, 0 ), weights( width * height, 0 ) {}
+
+	/** bilinear interpolation, clamped at the borders */
+	double sample( double x, double y ) const
+	{
+	    x = std::min( std::max( x, 0.0 ), width - 1.0 );
+	    y = std::min( std::max( y, 0.0 ), height - 1.0 );
+	    const size_t x0 = x, y0 = y;
+	    const size_t x1 = std::min( x0 + 1, width - 1 ), y1 = std::min( y0 + 1, height - 1 );
+	    const double fx = x - x0, fy = y - y0;
+	    return (1 - fy) * ((1 - fx) * values[y0 * width + x0] + fx * values[y0 * width + x1])
+		+ fy * ((1 - fx) * values[y1 * width + x0] + fx * values[y1 * width + x1]);
+	}
+    };
+
+    /** averages 2x2 cells of the finer level into a row of the coarser one */
+    struct Pull
+    {
+	const PyramidLevel& fine;
+	PyramidLevel& coarse;
+
+	Pull( const PyramidLevel& fine, PyramidLevel& coarse ) : fine( fine ), coarse( coarse ) {}
+
+	void operator()( size_t y )
+	{
+	    for( size_t x = 0; x < coarse.width; x++ )
+	    {
+		double value = 0, weight = 0;
+		for( size_t fy = 2 * y; fy < std::min( 2 * y + 2, fine.height ); fy++ )
+		    for( size_t fx = 2 * x; fx < std::min( 2 * x + 2, fine.width ); fx++ )
+		    {
+			const size_t i = fy * fine.width + fx;
+			value += fine.weights[i] * fine.values[i];
+			weight += fine.weights[i];
+		    }
+		const size_t i = y * coarse.width + x;
+		coarse.values[i] = weight > 0 ? value / weight : 0;
+		coarse.weights[i] = std::min( weight, 1.0 );
+	    }
+	}
+    };
+
+    /** blends the interpolated coarser level into the cells of a row of
+     * the finer one, according to their weight */
+    struct Push
+    {
+	PyramidLevel& fine;
+	const PyramidLevel& coarse;
+
+	Push( PyramidLevel& fine, const PyramidLevel& coarse ) : fine( fine ), coarse( coarse ) {}
+
+	void operator()( size_t y )
+	{
+	    for( size_t x = 0; x < fine.width; x++ )
+	    {
+		const size_t i = y * fine.width + x;
+		if( fine.weights[i] >= 1 )
+		    continue;
+		const double c = coarse.sample( (x + 0.5) / 2 - 0.5, (y + 0.5) / 2 - 0.5 );
+		fine.values[i] = fine.weights[i] * fine.values[i] + (1 - fine.weights[i]) * c;
+		fine.weights[i] = 1;
+	    }
+	}
+    };
+}
+
 Projection::Projection()
 {
 }
@@ -45,7 +218,7 @@ void Projection::addOutput( ElevationGrid* grid )
 bool Projection::updateAll() 
 {
     updateElevationMap();
-    interpolateMap(ElevationGrid::ELEVATION_MAX);
+    fillHoles(ElevationGrid::ELEVATION_MAX);
     //updateTraversibilityMap();
 
     return true;
@@ -63,27 +236,116 @@ bool Projection::updateElevationMap()
     std::fill(elv_min.data(), elv_min.data() + elv_min.num_elements(), std::numeric_limits<double>::infinity());
     std::fill(elv_max.data(), elv_max.data() + elv_max.num_elements(), -std::numeric_limits<double>::infinity());
 
+    // the points are projected in parallel, then sorted into bands of rows,
+    // so that each band can be updated by one task without locking
+    const size_t bands = (grid->getCellSizeY() + BAND_ROWS - 1) / BAND_ROWS;
+
     std::list<Layer*> inputs = env->getInputs(this);
     for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
     {
 	Pointcloud* mesh = dynamic_cast<envire::Pointcloud*>(*it);
 
 	FrameNode::TransformType C_m2g = env->relativeTransform( mesh->getFrameNode(), grid->getFrameNode() );
+	const Transform trans = env->getRootNode()->getTransform() * C_m2g;
 
-	std::vector<Eigen::Vector3d>& points(mesh->vertices);
-	
-	for(size_t i=0;i<points.size();i++)
+	const std::vector<Eigen::Vector3d>& points(mesh->vertices);
+	const size_t blocks = (points.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	std::vector<size_t> cells( points.size() );
+	std::vector<double> heights( points.size() );
+	std::vector<size_t> offsets( blocks * bands, 0 );
+	parallelForBlocks( 0, points.size(), BLOCK_SIZE,
+		ProjectPoints( points, trans, *grid, bands, cells, heights, offsets ) );
+
+	// turn the counts into offsets, ordered by band and then block
+	std::vector<size_t> bandStarts( bands + 1, 0 );
+	size_t size = 0;
+	for( size_t band = 0; band < bands; band++ )
 	{
-	    Eigen::Vector3d p = env->getRootNode()->getTransform() * C_m2g * points[i];
+	    bandStarts[band] = size;
+	    for( size_t block = 0; block < blocks; block++ )
+	    {
+		const size_t count = offsets[block * bands + band];
+		offsets[block * bands + band] = size;
+		size += count;
+	    }
+	}
+	bandStarts[bands] = size;
+
+	std::vector<size_t> sortedCells( size );
+	std::vector<double> sortedHeights( size );
+	parallelForBlocks( 0, points.size(), BLOCK_SIZE,
+		SortByBand( cells, heights, bands, grid->getCellSizeX(), offsets, sortedCells, sortedHeights ) );
+
+	parallelFor( 0, bands,
+		UpdateBand( bandStarts, sortedCells, sortedHeights, elv_min.data(), elv_max.data() ) );
+    }
+
+    return true;
+}
+
+bool Projection::fillHoles(const std::string& type)
+{
+    // TODO add checking of connections
+    ElevationGrid* grid = static_cast<envire::ElevationGrid*>(*env->getOutputs(this).begin());
 
-	    size_t x, y;
-	    if( grid->toGrid( p.x(), p.y(), x, y ) )
+    if( !grid->hasData( type ) )
+	return false;
+
+    ElevationGrid::ArrayType& data(grid->getGridData(type));
+    const size_t width = grid->getCellSizeX();
+    const size_t height = grid->getCellSizeY();
+
+    // only fill the bounding box of the cells with data
+    size_t min_x = width, max_x = 0, min_y = height, max_y = 0;
+    for(size_t y=0;y<height;y++)
+    {
+	for(size_t x=0;x<width;x++)
+	{
+	    if( fabs( data[y][x] ) != std::numeric_limits<double>::infinity() )
+	    {
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+	    }
+	}
+    }
+    if( min_x > max_x )
+	return true;
+
+    // pull: build a pyramid of weighted averages up to a single cell
+    std::vector<PyramidLevel> levels;
+    levels.push_back( PyramidLevel( max_x - min_x + 1, max_y - min_y + 1 ) );
+    for(size_t y=min_y;y<=max_y;y++)
+    {
+	for(size_t x=min_x;x<=max_x;x++)
+	{
+	    if( fabs( data[y][x] ) != std::numeric_limits<double>::infinity() )
 	    {
-		elv_max[y][x] = std::max( elv_max[y][x], p.z() );
-		elv_min[y][x] = std::min( elv_min[y][x], p.z() );
+		const size_t i = (y - min_y) * levels[0].width + (x - min_x);
+		levels[0].values[i] = data[y][x];
+		levels[0].weights[i] = 1;
 	    }
 	}
     }
+    while( levels.back().width > 1 || levels.back().height > 1 )
+    {
+	const PyramidLevel& fine( levels.back() );
+	PyramidLevel coarse( (fine.width + 1) / 2, (fine.height + 1) / 2 );
+	parallelFor( 0, coarse.height, Pull( fine, coarse ), 16 );
+	levels.push_back( coarse );
+    }
+
+    // push: fill the cells without full weight from the coarser level
+    for(size_t l=levels.size()-1;l>0;l--)
+	parallelFor( 0, levels[l - 1].height, Push( levels[l - 1], levels[l] ), 16 );
+
+    for(size_t y=min_y;y<=max_y;y++)
+    {
+	for(size_t x=min_x;x<=max_x;x++)
+	    data[y][x] = levels[0].values[(y - min_y) * levels[0].width + (x - min_x)];
+    }
 
     return true;
 }
@@ -96,6 +358,9 @@ bool Projection::interpolateMap(const std::string& type)
     if( !grid->hasData( type ) )
 	return false;
 
+#ifndef ENVIRE_USE_CGAL
+    return fillHoles(type);
+#else
     ElevationGrid::ArrayType& data(grid->getGridData(type));
 
     typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
@@ -162,6 +427,7 @@ bool Projection::interpolateMap(const std::string& type)
     }
 
     return true;
+#endif
 }
 
 // TODO add this to a new operator
@@ -24,8 +24,25 @@ namespace envire {
 	bool updateAll();
 
 	bool updateTraversibilityMap();
+
+	/** Sets the minimum and maximum elevation of each cell from the
+	 * points of the inputs. The points are projected in parallel. */
 	bool updateElevationMap();
+
+	/** Interpolates the cells of the band \c type without data from a
+	 * Delaunay triangulation of the cells with data. Without CGAL, this is
+	 * the same as fillHoles(). */
 	bool interpolateMap(const std::string& type);
+
+	/** Fills the cells of the band \c type without data, within the
+	 * bounding box of the cells with data, using push-pull interpolation.
+	 *
+	 * The cells are averaged into a pyramid of coarser grids, and the
+	 * empty cells are filled from the interpolated coarser levels. This
+	 * gives smooth surfaces over holes at a cost linear in the number of
+	 * cells, and does not need CGAL.
+	 */
+	bool fillHoles(const std::string& type);
     };
 }
 #endif
@@ -1,4 +1,5 @@
 #include "SimpleTraversability.hpp"
+#include <envire/tools/BresenhamLine.hpp>
 #include <base-logging/Logging.hpp>
 #include <sstream>
 
@@ -133,7 +134,9 @@ bool SimpleTraversability::updateAll()
     TraversabilityGrid::ArrayType &probabilityArray(output_layer->getGridData(TraversabilityGrid::PROBABILITY));
     std::fill(probabilityArray.data(), probabilityArray.data() + probabilityArray.num_elements(), 0);  
 
-    boost::multi_array<float, 2> const* inputs[INPUT_COUNT] = { 0, 0 };
+    // mapped input bands are read through their mapping
+    float const* inputs[INPUT_COUNT] = { 0, 0 };
+    size_t input_width[INPUT_COUNT] = { 0, 0 };
     bool has_data = false;
     for (int i = 0; i < INPUT_COUNT; ++i)
     {
@@ -141,7 +144,8 @@ bool SimpleTraversability::updateAll()
         {
             input_layers[i] = getEnvironment()->getItem< Grid<float> >(input_layers_id[i]).get();
             has_data = true;
-            inputs[i] = &(input_layers[i]->getGridData(input_bands[i]));
+            inputs[i] = input_layers[i]->getConstGridData(input_bands[i]).data();
+            input_width[i] = input_layers[i]->getCellSizeX();
 
             std::pair<float, bool> no_data = input_layers[i]->getNoData(input_bands[i]);
             if (no_data.second)
@@ -174,7 +178,7 @@ bool SimpleTraversability::updateAll()
                 if (!inputs[band_idx]) 
                     continue;
 
-                double value = (*inputs[band_idx])[y][x];
+                double value = inputs[band_idx][y * input_width[band_idx] + x];
                 if (value != input_unknown[band_idx])
                 {
                     values[band_idx] = value;
@@ -221,6 +225,8 @@ bool SimpleTraversability::updateAll()
         }
     }
     
+    output_layer->invalidateFootprintIndex();
+
     // perform some post processing if required
     if( conf.min_width > 0 ) 
     {
@@ -284,197 +290,107 @@ bool SimpleTraversability::updateAll()
     return true;
 }
 
-struct RadialLUT
+/** Updates the obstacles of the distance transform to the obstacle cells
+ * of data, resetting it if the map geometry changed */
+static void updateObstacles(DynamicDistanceTransform& transform, GridBase const& map, SimpleTraversability::OutputLayer::ArrayType const& data, double maxDistance)
 {
-    int centerx, centery;
-    unsigned int width, height;
-    boost::multi_array<std::pair<int, int>, 2>  parents;
-    boost::multi_array<bool, 2> in_distance;
-
-    void precompute(double distance, double scalex, double scaley)
-    {
-        double const radius2 = distance * distance;
-
-        width  = 2* ceil(distance / scalex) + 1;
-        height = 2* ceil(distance / scaley) + 1;
-        in_distance.resize(boost::extents[height][width]);
-        std::fill(in_distance.data(), in_distance.data() + in_distance.num_elements(), false);
-        parents.resize(boost::extents[height][width]);
-        std::fill(parents.data(), parents.data() + parents.num_elements(), std::make_pair(-1, -1));
-
-        centerx = width  / 2;
-        centery = height / 2;
-        parents[centery][centerx] = std::make_pair(-1, -1);
-
-        for (unsigned int y = 0; y < height; ++y)
-        {
-            for (unsigned int x = 0; x < width; ++x)
-            {
-                int dx = (centerx - x);
-                int dy = (centery - y);
-                if (dx == 0 && dy == 0) continue;
-
-                double d2 = dx * dx * scalex * scalex + dy * dy * scaley * scaley;
-                in_distance[y][x] = (d2 < radius2);
-                if (abs(dx) > abs(dy))
-                {
-                    int parentx = x + dx / abs(dx);
-                    int parenty = y + rint(static_cast<double>(dy) / abs(dx));
-                    parents[y][x] = std::make_pair(parentx, parenty);
-                }
-                else
-                {
-                    int parentx = x + rint(static_cast<double>(dx) / abs(dy));
-                    int parenty = y + dy / abs(dy);
-                    parents[y][x] = std::make_pair(parentx, parenty);
-                }
-            }
-        }
-    }
+    const size_t width = map.getCellSizeX(), height = map.getCellSizeY();
+    if (transform.getWidth() != width || transform.getHeight() != height
+            || transform.getScaleX() != map.getScaleX() || transform.getScaleY() != map.getScaleY()
+            || transform.getMaxDistance() != maxDistance)
+        transform.reset(width, height, map.getScaleX(), map.getScaleY(), maxDistance);
 
-    void markAllRadius(boost::multi_array<uint8_t, 2>& result, TraversabilityGrid::ArrayType &probabilityArray, int result_width, int result_height, int centerx, int centery, int value)
+    for (size_t y = 0; y < height; ++y)
     {
-        int base_x = centerx - this->centerx;
-        int base_y = centery - this->centery;
-        for (unsigned int y = 0; y < height; ++y)
+        for (size_t x = 0; x < width; ++x)
         {
-            int map_y = base_y + y;
-            if (map_y < 0 || map_y >= result_height)
+            const bool obstacle = (data[y][x] == SimpleTraversability::CLASS_OBSTACLE);
+            if (obstacle == transform.isObstacle(x, y))
                 continue;
-
-            for (unsigned int x = 0; x < width; ++x)
-            {
-                int map_x = base_x + x;
-                if (map_x < 0 || map_x >= result_width)
-                    continue;
-                if (in_distance[y][x] && result[map_y][map_x] == value)
-                {
-//                     LOG_DEBUG("  found cell with value %i (expected %i) at %i %i, marking radius", result[map_y][map_x], value, map_x, map_y);
-                    markSingleRadius(result, probabilityArray, centerx, centery, x, y, value, 255);
-                }
-            }
-        }
-    }
-
-    void markSingleRadius(boost::multi_array<uint8_t, 2>& result, TraversabilityGrid::ArrayType &probabilityArray, int centerx, int centery, int x, int y, int expected_value, int mark_value)
-    {
-        boost::tie(x, y) = parents[y][x];
-        while (x != -1 && y != -1)
-        {
-            int map_x = centerx + x - this->centerx;
-            int map_y = centery + y - this->centery;
-            uint8_t& current = result[map_y][map_x];
-            if (current != expected_value)
-	    {
-		current = mark_value;
-// 		LOG_DEBUG("  marking %i %i", map_x, map_y);
-                probabilityArray[map_y][map_x] = std::numeric_limits<uint8_t>::max();
-	    }
-            boost::tie(x, y) = parents[y][x];
+            if (obstacle)
+                transform.setObstacle(x, y);
+            else
+                transform.removeObstacle(x, y);
         }
     }
-};
+    transform.update();
+}
 
 void SimpleTraversability::growObstacles(OutputLayer& map, std::string const& band_name, double width)
 {
-    const double width_square = pow(width,2);
-    const int 
-	wx = width / map.getScaleX(), 
-	wy = width / map.getScaleY();
-    const double 
-	sx = map.getScaleX(),
-	sy = map.getScaleY();
-
-
-    OutputLayer::ArrayType& orig_data = band_name.empty() ?
+    OutputLayer::ArrayType& data = band_name.empty() ?
         map.getGridData() :
         map.getGridData(output_band);
-
-    OutputLayer::ArrayType data( orig_data );
     TraversabilityGrid::ArrayType &probabilityArray(map.getGridData(TraversabilityGrid::PROBABILITY));
 
+    updateObstacles(clearance, map, data, width);
+
+    // make everything with radius width around the obstacles also an
+    // obstacle
     for (unsigned int y = 0; y < map.getHeight(); ++y)
     {
         for (unsigned int x = 0; x < map.getWidth(); ++x)
         {
-            int value = orig_data[y][x];
-            if (value == CLASS_OBSTACLE)
+            if (data[y][x] != CLASS_OBSTACLE && clearance.getDistance(x, y) < width)
             {
-		// make everything with radius width around the obstacle also
-		// an obstacle
-		for( int oy = -wy; oy <= wy; ++oy )
-		{
-		    for( int ox = -wx; ox <= wx; ++ox )
-		    {
-			const int tx = x+ox;
-			const int ty = y+oy;
-			if( (pow(ox*sx,2) + pow(oy*sy,2) < width_square )
-				&& tx >= 0 && tx < (int)map.getWidth()
-				&& ty >= 0 && ty < (int)map.getHeight() )
-                        {
-			    data[ty][tx] = CLASS_OBSTACLE;
-                            probabilityArray[y][x] = std::numeric_limits< uint8_t >::max();
-                        }
-		    }
-		}
-	    }
-	}
+                data[y][x] = CLASS_OBSTACLE;
+                probabilityArray[y][x] = std::numeric_limits< uint8_t >::max();
+            }
+        }
     }
-
-    std::swap( data, orig_data );
+    map.invalidateFootprintIndex();
 }
 
 void SimpleTraversability::closeNarrowPassages(SimpleTraversability::OutputLayer& map, std::string const& band_name, double min_width)
 {
-    RadialLUT lut;
-    lut.precompute(min_width, map.getScaleX(), map.getScaleY());
-    std::stringstream oss;
-    oss << std::endl;
-    for (unsigned int y = 0; y < lut.height; ++y)
-    {
-        for (unsigned int x = 0; x < lut.width; ++x) {
-            oss << "(" << lut.parents[y][x].first << " " << lut.parents[y][x].second << ") ";
-        }
-        oss << std::endl;
-    }
-    oss << std::endl;
-    for (unsigned int y = 0; y < lut.height; ++y)
-    {
-        for (unsigned int x = 0; x < lut.width; ++x) {
-            oss << "(" << lut.in_distance[y][x] << " ";
-        }
-        oss << std::endl;
-    }
-    LOG_DEBUG(oss.str().c_str());
-
     TraversabilityGrid::ArrayType &probabilityArray(map.getGridData(TraversabilityGrid::PROBABILITY));
 
     OutputLayer::ArrayType& data = band_name.empty() ?
         map.getGridData() :
         map.getGridData(output_band);
-    for (unsigned int y = 0; y < map.getHeight(); ++y)
-    {
-        for (unsigned int x = 0; x < map.getWidth(); ++x)
-        {
-            int value = data[y][x];
-            if (value == CLASS_OBSTACLE)
-            {
-//                 LOG_DEBUG("inspecting around obstacle cell %i %i", x, y);
-                lut.markAllRadius(data, probabilityArray, map.getWidth(), map.getHeight(), x, y, CLASS_OBSTACLE);
-            }
-        }
-    }
 
-    for (size_t y = 0; y < map.getHeight(); ++y)
+    updateObstacles(passages, map, data, min_width);
+
+    // compare each cell with its neighbours, each pair is visited once
+    static const int offsets[4][2] = { {1, 0}, {-1, 1}, {0, 1}, {1, 1} };
+    const int width = map.getWidth(), height = map.getHeight();
+    const double scalex = map.getScaleX(), scaley = map.getScaleY();
+    const double min_width2 = min_width * min_width;
+    for (int y = 0; y < height; ++y)
     {
-        for (size_t x = 0; x < map.getWidth(); ++x)
+        for (int x = 0; x < width; ++x)
         {
-            if (data[y][x] == 255)
+            const size_t site = passages.getNearestObstacle(x, y);
+            if (site == DynamicDistanceTransform::NO_SITE)
+                continue;
+
+            for (int i = 0; i < 4; ++i)
             {
-                data[y][x] = CLASS_OBSTACLE;
-                probabilityArray[y][x] = std::numeric_limits< uint8_t >::max();
+                const int nx = x + offsets[i][0], ny = y + offsets[i][1];
+                if (nx < 0 || nx >= width || ny >= height)
+                    continue;
+
+                const size_t other = passages.getNearestObstacle(nx, ny);
+                if (other == DynamicDistanceTransform::NO_SITE || other == site)
+                    continue;
+
+                const int sx = site % width, sy = site / width;
+                const int ox = other % width, oy = other / width;
+                if (pow((sx - ox) * scalex, 2) + pow((sy - oy) * scaley, 2) >= min_width2)
+                    continue;
+
+                Bresenham line(Eigen::Vector2i(sx, sy), Eigen::Vector2i(ox, oy));
+                int lx, ly;
+                while (line.getNextPoint(lx, ly))
+                {
+                    if (data[ly][lx] != CLASS_OBSTACLE)
+                    {
+                        data[ly][lx] = CLASS_OBSTACLE;
+                        probabilityArray[ly][lx] = std::numeric_limits< uint8_t >::max();
+                    }
+                }
             }
         }
     }
+    map.invalidateFootprintIndex();
 }
-
@@ -5,6 +5,7 @@
 #include <envire/maps/Grid.hpp>
 #include <envire/maps/Grids.hpp>
 #include <envire/maps/TraversabilityGrid.hpp>
+#include <envire/tools/DynamicDistanceTransform.hpp>
 
 namespace envire {
     /** @brief Configuration parameters for the SimpleTraversability operator
@@ -101,6 +102,12 @@ namespace envire {
 
         SimpleTraversabilityConfig conf;
 
+        /** Distances to the obstacles of the classification, kept between
+         * updates so that only changed obstacles have to be propagated */
+        DynamicDistanceTransform passages;
+        /** Distances to the obstacles after closing narrow passages */
+        DynamicDistanceTransform clearance;
+
     public:
         typedef envire::TraversabilityGrid OutputLayer;
 
@@ -124,9 +131,27 @@ namespace envire {
         void setOutput(OutputLayer* grid, std::string const& band_name);
 
         bool updateAll();
+
+        /** Marks passages narrower than min_width as obstacles
+         *
+         * Two obstacle cells closer than min_width whose regions of nearest
+         * cells touch face each other across a passage, and the free cells
+         * on the line between them are marked as obstacles. The regions
+         * are taken from a distance transform which is updated only where
+         * obstacles changed since the last call.
+         */
         void closeNarrowPassages(OutputLayer& map, std::string const& band_name, double min_width);
+
+        /** Marks all cells closer than width to an obstacle as obstacles,
+         * using the clearance kept by getClearance() */
         void growObstacles(OutputLayer& map, std::string const& band_name, double width);
 
+        /** The distance of each cell to the nearest obstacle, as of the last
+         * call to growObstacles. Distances larger than the obstacle
+         * clearance are reported as infinity.
+         */
+        DynamicDistanceTransform const& getClearance() const { return clearance; }
+
         void serialize(envire::Serialization& so);
         void unserialize(envire::Serialization& so);
     };
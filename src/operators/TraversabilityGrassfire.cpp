@@ -1,19 +1,88 @@
 #include "TraversabilityGrassfire.hpp"
 #include <maps/MLSGrid.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <algorithm>
 
 using namespace envire;
 using envire::Grid;
 
 ENVIRONMENT_ITEM_DEF( TraversabilityGrassfire );
 
-int slopeTooHigh = 0;
-int stepTooHigh = 0;
-int totalCnt = 0;
-int drivable = 0;
+const size_t TraversabilityGrassfire::NO_PARENT;
+
+/**
+ * Looks up the best patch for the items of a wavefront. Each call only
+ * writes the results of its own item.
+ * */
+class TraversabilityGrassfire::WavefrontCheck
+{
+    TraversabilityGrassfire &grassfire;
+public:
+    WavefrontCheck(TraversabilityGrassfire &grassfire) : grassfire(grassfire)
+    {
+    }
+
+    void operator()(size_t i) const
+    {
+        const SearchItem &item(grassfire.batch[i]);
+        bool isObstacle;
+        grassfire.batchPatches[i] = grassfire.getNearestPatchWhereRobotFits(item.x, item.y, item.origin->getMean() + item.origin->getStdev(), isObstacle);
+        grassfire.batchObstacles[i] = isObstacle;
+    }
+};
+
+/**
+ * Computes traversability and probability for the rows [begin, end),
+ * either for all cells or for the ones marked in updateMask.
+ * */
+class TraversabilityGrassfire::TraversabilityUpdate
+{
+    TraversabilityGrassfire &grassfire;
+    bool all;
+public:
+    TraversabilityUpdate(TraversabilityGrassfire &grassfire, bool all) : grassfire(grassfire), all(all)
+    {
+    }
+
+    void operator()(size_t begin, size_t end) const
+    {
+        const size_t width = grassfire.mlsGrid->getCellSizeX();
+        for(size_t y = begin; y < end; y++)
+        {
+            for(size_t x = 0; x < width; x++)
+            {
+                if(all || grassfire.updateMask[y * width + x])
+                {
+                    grassfire.setTraversability(x, y);
+                    grassfire.setProbability(x, y);
+                }
+            }
+        }
+    }
+};
+
+TraversabilityGrassfire::TraversabilityGrassfire()
+    : trGrid(NULL)
+    , trData(NULL)
+    , mlsGrid(NULL)
+    , incremental(false)
+    , parallel(false)
+    , hasResult(false)
+    , lastInput(NULL)
+    , lastOutput(NULL)
+    , lastRevision(0)
+{
+}
+
+void TraversabilityGrassfire::setIncremental(bool incremental)
+{
+    this->incremental = incremental;
+    hasResult = false;
+}
 
 void TraversabilityGrassfire::setProbability(size_t x, size_t y)
 {
-    SurfacePatch *currentPatch = bestPatchMap[y][x];
+    const SurfacePatch *currentPatch = bestPatchMap[y][x];
     if(!currentPatch)
     {
         trGrid->setProbability(0.0, x, y);
@@ -36,10 +105,7 @@ void TraversabilityGrassfire::setProbability(size_t x, size_t y)
 
 void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
 {
-    bool debug = false;
-    totalCnt++;
-
-    SurfacePatch *currentPatch = bestPatchMap[y][x];
+    const SurfacePatch *currentPatch = bestPatchMap[y][x];
     if(!currentPatch)
     {
         (*trData)[y][x] = UNKNOWN;
@@ -54,11 +120,6 @@ void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
     const double scaleX =mlsGrid->getScaleX();
     const double scaleY = mlsGrid->getScaleY();
 
-    if(debug)
-    {
-        std::cout << "x " << x << " y " << y << " height " << thisHeight << " mean " << currentPatch->getMean() << " stdev " << currentPatch->getStdev() << std::endl;
-    }
-    
     for(int yi = -1; yi <= 1; yi++)
     {
         for(int xi = -1; xi <= 1; xi++)
@@ -71,43 +132,21 @@ void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
             if(newX < mlsGrid->getCellSizeX() && newY < mlsGrid->getCellSizeY())
             {
 
-                SurfacePatch *neighbourPatch = bestPatchMap[newY][newX];
+                const SurfacePatch *neighbourPatch = bestPatchMap[newY][newX];
                 if(neighbourPatch)
                 {
                     count++;
                     double neighbourHeight = neighbourPatch->getMean() + neighbourPatch->getStdev();
                     
-                    if(debug)
-                    {
-                        std::cout << "Nx " << newX << " Ny " << newY << " height " << neighbourHeight << " mean " << neighbourPatch->getMean() << " stdev " << neighbourPatch->getStdev() << std::endl;
-                    }
-
                     if(fabs(neighbourHeight - thisHeight) > config.maxStepHeight)
                     {
-                        if(debug)
-                        {
-                            std::cout << "Step do hight" << std::endl;
-                        }
-                        stepTooHigh++;
                         (*trData)[y][x] = OBSTACLE;
                         return;
                     }
                     
                     Eigen::Vector3d input(xi * scaleX, yi * scaleY, thisHeight - neighbourHeight);
-                    if(debug)
-                    {
-                        std::cout << "Input to plane fitter " << input.transpose() << std::endl;
-                    }
-
                     fitter.update(input);
                 }
-                else
-                {
-                    if(debug)
-                    {
-                        std::cout << "Nx " << newX << " Ny " << newY << " is unknown " << std::endl;
-                    }
-                }
             }
         }
     }
@@ -116,11 +155,6 @@ void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
             
     if (count < 5)
     {
-        if(debug)
-        {
-            std::cout << "count to small " << count << "Setting patch to unknown " << std::endl;
-        }
-
         (*trData)[y][x] = UNKNOWN;
         return;
     }
@@ -129,19 +163,8 @@ void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
     const double divider = sqrt(fit.x() * fit.x() + fit.y() * fit.y() + 1);
     double slope = acos(1 / divider);
 
-    if(debug)
-    {
-        std::cout << "slope is " << slope << std::endl;
-    }
-
     if(slope > config.maxSlope)
     {
-        if(debug)
-        {
-            std::cout << "slope is to hight " << std::endl;
-        }
-
-        slopeTooHigh++;
         (*trData)[y][x] = OBSTACLE;
         return;
     }
@@ -150,104 +173,215 @@ void TraversabilityGrassfire::setTraversability(size_t x, size_t y)
 
     //-0.00001 to get rid of precision problems...
     (*trData)[y][x] = OBSTACLE + ceil((drivability - 0.00001) * config.numTraversabilityClasses);
-    
-    if(debug)
-    {
-        std::cout << "Setting tr class " << ceil((drivability - 0.00001) * config.numTraversabilityClasses) << std::endl;
-    }
-
-    drivable++;
 }
 
-double TraversabilityGrassfire::getStepHeight(SurfacePatch* from, SurfacePatch* to)
+double TraversabilityGrassfire::getStepHeight(const SurfacePatch* from, const SurfacePatch* to) const
 {
     return fabs((from->getMean() + from->getStdev()) - (to->getMean() + to->getStdev()));
 }
 
-void TraversabilityGrassfire::checkRecursive(size_t x, size_t y, SurfacePatch* origin)
+void TraversabilityGrassfire::addNeighboursToWavefront(size_t x, size_t y, const SurfacePatch* patch, std::vector<SearchItem> &list) const
 {
-    if(visited[y][x])
+    const size_t parent = y * mlsGrid->getCellSizeX() + x;
+    for(int yi = -1; yi <= 1; yi++)
     {
-        return;
+        for(int xi = -1; xi <= 1; xi++)
+        {
+            if(yi == 0 && xi == 0)
+                continue;
+            
+            size_t newX = x + xi;
+            size_t newY = y + yi;
+            if(newX < mlsGrid->getCellSizeX() && newY < mlsGrid->getCellSizeY() && cellState[newY][newX] == UNVISITED)
+            {
+                list.push_back(SearchItem(newX, newY, patch, parent));
+            }
+        }
     }
-    
-    visited[y][x] = true;
-    
-    bool isKnownObstacle;
-    
-    SurfacePatch *bestMatchingPatch = getNearestPatchWhereRobotFits(x, y, origin->getMean() + origin->getStdev(), isKnownObstacle);
+}
+
+void TraversabilityGrassfire::checkWavefront(size_t level)
+{
+    const size_t width = mlsGrid->getCellSizeX();
+
+    //the first item reaching a cell wins, like in a sequential flood 
+    batch.clear();
+    for(std::vector<SearchItem>::const_iterator it = wavefront.begin(); it != wavefront.end(); it++)
+    {
+        if(cellState[it->y][it->x] != UNVISITED)
+            continue;
+        cellState[it->y][it->x] = VISITED;
+        batch.push_back(*it);
+    }
+    wavefront.clear();
+
+    batchPatches.resize(batch.size());
+    batchObstacles.resize(batch.size());
+    WavefrontCheck check(*this);
+    if(parallel)
+        parallelFor(0, batch.size(), check, 64);
+    else
+    {
+        for(size_t i = 0; i < batch.size(); i++)
+            check(i);
+    }
+
+    nextWavefront.clear();
+    for(size_t i = 0; i < batch.size(); i++)
+    {
+        const SearchItem &item(batch[i]);
+        bestPatchMap[item.y][item.x] = batchPatches[i];
+        parentMap[item.y][item.x] = item.parent;
+        levelMap[item.y][item.x] = level;
+        changedCells.push_back(item.y * width + item.x);
+
+        //known obstacles stop the flood
+        if(batchPatches[i] && !batchObstacles[i])
+        {
+            cellState[item.y][item.x] = EXPANDED;
+            addNeighboursToWavefront(item.x, item.y, batchPatches[i], nextWavefront);
+        }
+    }
+}
 
-    if(bestMatchingPatch)
+void TraversabilityGrassfire::flood(std::vector<std::pair<size_t, size_t> > &seeds)
+{
+    std::sort(seeds.begin(), seeds.end());
+    seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+
+    const size_t width = mlsGrid->getCellSizeX();
+    wavefront.clear();
+    size_t nextSeed = 0;
+    size_t level = seeds.empty() ? 0 : seeds.front().first + 1;
+    while(true)
     {
-        if(isKnownObstacle)
+        //the seeds continue the flood at their own distance to the start
+        for(; nextSeed < seeds.size() && seeds[nextSeed].first < level; nextSeed++)
         {
-            bestPatchMap[y][x] = bestMatchingPatch;
-            visited[y][x] = true;
+            const size_t x = seeds[nextSeed].second % width;
+            const size_t y = seeds[nextSeed].second / width;
+            addNeighboursToWavefront(x, y, bestPatchMap[y][x], wavefront);
         }
-        else
+
+        if(wavefront.empty())
         {
-            addNeightboursToSearchList(x, y, bestMatchingPatch);
+            if(nextSeed == seeds.size())
+                break;
+            level = seeds[nextSeed].first + 1;
+            continue;
         }
-    } 
-    else
+
+        checkWavefront(level);
+        wavefront.swap(nextWavefront);
+        level++;
+    }
+}
+
+void TraversabilityGrassfire::resetFlood()
+{
+    const size_t width = mlsGrid->getCellSizeX();
+    const size_t height = mlsGrid->getCellSizeY();
+
+    //make shure temp maps have correct size, they are reused otherwise
+    if(cellState.shape()[0] != height || cellState.shape()[1] != width)
     {
-        bestPatchMap[y][x] = NULL;
+        cellState.resize(boost::extents[height][width]);
+        bestPatchMap.resize(boost::extents[height][width]);
+        parentMap.resize(boost::extents[height][width]);
+        levelMap.resize(boost::extents[height][width]);
     }
-        
+
+    //fill them with defautl values
+    const SurfacePatch *emptyPatch = NULL;
+    //Note passing directly NULL to fill makes the compiler cry....
+    std::fill(bestPatchMap.data(), bestPatchMap.data() + bestPatchMap.num_elements(), emptyPatch);
+    std::fill(cellState.data(), cellState.data() + cellState.num_elements(), (uint8_t) UNVISITED);
+    std::fill(parentMap.data(), parentMap.data() + parentMap.num_elements(), NO_PARENT);
+    std::fill(levelMap.data(), levelMap.data() + levelMap.num_elements(), 0);
 }
 
-void TraversabilityGrassfire::addNeightboursToSearchList(size_t x, size_t y, SurfacePatch* patch)
+void TraversabilityGrassfire::invalidateModifiedCells(std::vector<std::pair<size_t, size_t> > &seeds)
 {
-    bestPatchMap[y][x] = patch;
-    visited[y][x] = true;
+    const size_t width = mlsGrid->getCellSizeX();
+    const size_t height = mlsGrid->getCellSizeY();
 
-    for(int yi = -1; yi <= 1; yi++)
+    std::vector<GridBase::Position> tiles;
+    mlsGrid->getModifiedTiles(lastRevision, tiles);
+
+    std::vector<size_t> invalid;
+    for(std::vector<GridBase::Position>::const_iterator it = tiles.begin(); it != tiles.end(); it++)
     {
-        for(int xi = -1; xi <= 1; xi++)
+        const GridBase::CellExtents extents(mlsGrid->getTileExtents(it->x, it->y));
+        for(int y = extents.min().y(); y <= extents.max().y(); y++)
         {
-            if(yi == 0 && xi == 0)
-                continue;
-            
-            size_t newX = x + xi;
-            size_t newY = y + yi;
-            if(newX < mlsGrid->getCellSizeX() && newY < mlsGrid->getCellSizeY())
+            for(int x = extents.min().x(); x <= extents.max().x(); x++)
             {
-                searchList.push(SearchItem(newX, newY, patch));
+                cellState[y][x] = INVALID;
+                invalid.push_back(y * width + x);
             }
         }
     }
-}
 
+    //cells reached through an invalid cell are invalid as well. As the
+    //parent is always a neighbour, only these have to be checked.
+    std::vector<size_t> stack(invalid);
+    while(!stack.empty())
+    {
+        const size_t cell = stack.back();
+        stack.pop_back();
+        const size_t x = cell % width, y = cell / width;
+        for(int yi = -1; yi <= 1; yi++)
+        {
+            for(int xi = -1; xi <= 1; xi++)
+            {
+                size_t newX = x + xi;
+                size_t newY = y + yi;
+                if(newX < width && newY < height && cellState[newY][newX] != INVALID && parentMap[newY][newX] == cell)
+                {
+                    cellState[newY][newX] = INVALID;
+                    invalid.push_back(newY * width + newX);
+                    stack.push_back(newY * width + newX);
+                }
+            }
+        }
+    }
+
+    for(std::vector<size_t>::const_iterator it = invalid.begin(); it != invalid.end(); it++)
+    {
+        const size_t x = *it % width, y = *it / width;
+        cellState[y][x] = UNVISITED;
+        bestPatchMap[y][x] = NULL;
+        parentMap[y][x] = NO_PARENT;
+        changedCells.push_back(*it);
+    }
 
-bool TraversabilityGrassfire::determineDrivePlane(base::Vector3d startPos, bool searchSourunding)
+    //restart the flood from the remaining cells bordering the invalid ones
+    for(std::vector<size_t>::const_iterator it = invalid.begin(); it != invalid.end(); it++)
+    {
+        const size_t x = *it % width, y = *it / width;
+        for(int yi = -1; yi <= 1; yi++)
+        {
+            for(int xi = -1; xi <= 1; xi++)
+            {
+                size_t newX = x + xi;
+                size_t newY = y + yi;
+                if(newX < width && newY < height && cellState[newY][newX] == EXPANDED)
+                    seeds.push_back(std::make_pair(levelMap[newY][newX], newY * width + newX));
+            }
+        }
+    }
+}
+
+bool TraversabilityGrassfire::findStartPatch(const base::Vector3d &startPos, size_t &correctedStartX, size_t &correctedStartY, const SurfacePatch *&bestMatchingPatch) const
 {
     size_t startX;
     size_t startY;
     if(!mlsGrid->toGrid(startPos, startX, startY, mlsGrid->getEnvironment()->getRootNode()))
         return false;
 
-    
-    //make shure temp maps have correct size
-    bestPatchMap.resize(boost::extents[mlsGrid->getCellSizeY()][mlsGrid->getCellSizeX()]);
-    visited.resize(boost::extents[mlsGrid->getCellSizeY()][mlsGrid->getCellSizeX()]);
-    trData->resize(boost::extents[mlsGrid->getCellSizeY()][mlsGrid->getCellSizeX()]);
-
-    //fill them with defautl values
-    SurfacePatch *emptyPatch = NULL;
-    //Note passing directly NULL to fill makes the compiler cry....
-    std::fill(bestPatchMap.data(), bestPatchMap.data() + bestPatchMap.num_elements(), emptyPatch);
-    std::fill(visited.data(), visited.data() + visited.num_elements(), false);
-    std::fill(trData->data(), trData->data() + trData->num_elements(), UNKNOWN);
-    
-    //init probability with zero
-    TraversabilityGrid::ArrayType *probabilityArray = &(trGrid->getGridData(TraversabilityGrid::PROBABILITY));
-    std::fill(probabilityArray->data(), probabilityArray->data() + probabilityArray->num_elements(), 0);  
-    
     double bestHeightDiff = std::numeric_limits< double >::max();
-    SurfacePatch *bestMatchingPatch = NULL;
+    bestMatchingPatch = NULL;
 
-    size_t correctedStartX = startX;
-    size_t correctedStartY = startY;
     //search the sourounding of the start pos for a start patch
     for(int i = 0; i < 10; i++)
     {
@@ -265,7 +399,7 @@ bool TraversabilityGrassfire::determineDrivePlane(base::Vector3d startPos, bool
                 {
                     bool isObstacle;
                     //look for patch with best height
-                    SurfacePatch *curPatch = getNearestPatchWhereRobotFits(newX, newY, startPos.z(), isObstacle);
+                    const SurfacePatch *curPatch = getNearestPatchWhereRobotFits(newX, newY, startPos.z(), isObstacle);
                     if(curPatch)
                     {
                         double curHeightDiff = fabs(startPos.z() - curPatch->getMean() + curPatch->getStdev());
@@ -285,27 +419,19 @@ bool TraversabilityGrassfire::determineDrivePlane(base::Vector3d startPos, bool
             break;
     }
 
-    if(!bestMatchingPatch)
-    {
-        //we are screwed, can't start the grassfire
-        return false;
-    }
-        
-    //recuse to surounding patches
-    addNeightboursToSearchList(correctedStartX, correctedStartY, bestMatchingPatch);
-    
-    return true;
+    //if there is no patch, we can't start the grassfire
+    return bestMatchingPatch != NULL;
 }
 
-SurfacePatch* TraversabilityGrassfire::getNearestPatchWhereRobotFits(size_t x, size_t y, double height, bool &isObstacle)
+const SurfacePatch* TraversabilityGrassfire::getNearestPatchWhereRobotFits(size_t x, size_t y, double height, bool &isObstacle) const
 {
-    SurfacePatch *bestMatchingPatch = NULL;
+    const SurfacePatch *bestMatchingPatch = NULL;
     double minDistance = std::numeric_limits< double >::max();
     
     isObstacle = true;
     
-    MLSGrid::iterator it = mlsGrid->beginCell(x, y);
-    MLSGrid::iterator itEnd = mlsGrid->endCell();
+    MLSGrid::const_iterator it = mlsGrid->beginCell(x, y);
+    MLSGrid::const_iterator itEnd = mlsGrid->endCell();
     for(; it != itEnd; it++)
     {
         //HACK filter outliers
@@ -360,8 +486,8 @@ SurfacePatch* TraversabilityGrassfire::getNearestPatchWhereRobotFits(size_t x, s
     while(gapTooSmall)
     {
         //now we need to check if there is a blocking patch above this matching patch
-        MLSGrid::iterator hcIt= mlsGrid->beginCell(x, y);
-        MLSGrid::iterator hcItEnd = mlsGrid->endCell();
+        MLSGrid::const_iterator hcIt= mlsGrid->beginCell(x, y);
+        MLSGrid::const_iterator hcItEnd = mlsGrid->endCell();
         
         gapTooSmall = false;
         curFloorHeight = bestMatchingPatch->getMean() + bestMatchingPatch->getStdev();
@@ -401,28 +527,41 @@ void TraversabilityGrassfire::setStartPosition(Eigen::Vector3d startPos)
     this->startPos = startPos;
 }
 
-void TraversabilityGrassfire::computeTraversability()
+void TraversabilityGrassfire::computeTraversability(bool all)
 {
-    size_t maxX = mlsGrid->getCellSizeX();
-    size_t maxY = mlsGrid->getCellSizeY();
-    
-    for(size_t y = 0;y < maxY; y++)
+    const size_t width = mlsGrid->getCellSizeX();
+    const size_t height = mlsGrid->getCellSizeY();
+    if(!width || !height)
+        return;
+
+    if(!all)
     {
-        for(size_t x = 0;x < maxX; x++)
+        //the traversability depends on the patches of the neighbours as well
+        updateMask.assign(width * height, false);
+        for(std::vector<size_t>::const_iterator it = changedCells.begin(); it != changedCells.end(); it++)
         {
-            setTraversability(x, y);
-            setProbability(x, y);
+            const size_t x = *it % width, y = *it / width;
+            for(size_t ny = std::max<size_t>(y, 1) - 1; ny <= std::min(y + 1, height - 1); ny++)
+            {
+                for(size_t nx = std::max<size_t>(x, 1) - 1; nx <= std::min(x + 1, width - 1); nx++)
+                    updateMask[ny * width + nx] = true;
+            }
         }
     }
+
+    TraversabilityUpdate update(*this, all);
+    if(parallel)
+    {
+        //makes the grid set up its band pointers before the threads use them
+        trGrid->getProbability(0, 0);
+        parallelForBlocks(0, height, 1, update);
+    }
+    else
+        update(0, height);
 }
 
 bool envire::TraversabilityGrassfire::updateAll()
 {
-    slopeTooHigh = 0;
-    stepTooHigh = 0;
-    totalCnt = 0;
-    drivable = 0;
-
     mlsGrid = getInput<envire::MLSGrid *>();
     if(!mlsGrid)
         throw std::runtime_error("TraversabilityGrassfire: no input band set");
@@ -443,27 +582,54 @@ bool envire::TraversabilityGrassfire::updateAll()
         trGrid->setTraversabilityClass(OBSTACLE + i, TraversabilityClass(1.0 / numClasses * i));
     }
 
-    if(!determineDrivePlane(startPos))
+    const size_t width = mlsGrid->getCellSizeX();
+    const size_t height = mlsGrid->getCellSizeY();
+    if(trData->shape()[0] != height || trData->shape()[1] != width)
+    {
+        trData->resize(boost::extents[height][width]);
+        hasResult = false;
+    }
+
+    size_t startX, startY;
+    const SurfacePatch *startPatch;
+    if(!findStartPatch(startPos, startX, startY, startPatch))
     {
         std::cout << "TraversabilityGrassfire::Warning, could not find plane robot is driving on" << std::endl;
+        hasResult = false;
         return false;
     }
-    
-    while(!searchList.empty())
+
+    changedCells.clear();
+    std::vector<std::pair<size_t, size_t> > seeds;
+    bool updateAllCells = true;
+    if(incremental && hasResult && lastInput == mlsGrid && lastOutput == trGrid
+            && cellState.shape()[0] == height && cellState.shape()[1] == width)
     {
-        SearchItem next = searchList.front();
-        searchList.pop();
-        
-        checkRecursive(next.x, next.y, next.origin);
-        
+        invalidateModifiedCells(seeds);
+
+        //the last result can only be reused if the robot is still on the
+        //surface that was reached
+        if(cellState[startY][startX] == EXPANDED && bestPatchMap[startY][startX] == startPatch)
+            updateAllCells = false;
     }
-    
-    computeTraversability();
-/*    
-    std::cout << "stepTooHigh " << stepTooHigh << std::endl;
-    std::cout << "slopeTooHigh " << slopeTooHigh << std::endl;
-    std::cout << "totalCnt " << totalCnt << std::endl;
-    std::cout << "drivable " << drivable << std::endl;*/
+
+    if(updateAllCells)
+    {
+        resetFlood();
+        seeds.clear();
+        cellState[startY][startX] = EXPANDED;
+        bestPatchMap[startY][startX] = startPatch;
+        seeds.push_back(std::make_pair((size_t) 0, startY * width + startX));
+    }
+
+    flood(seeds);
+    computeTraversability(updateAllCells);
+    trGrid->invalidateFootprintIndex();
+
+    hasResult = true;
+    lastInput = mlsGrid;
+    lastOutput = trGrid;
+    lastRevision = mlsGrid->getRevision();
         
     return envire::Operator::updateAll();
 }
@@ -7,10 +7,29 @@
 #include <envire/maps/TraversabilityGrid.hpp>
 #include <envire/maps/MLSGrid.hpp>
 #include <envire/maps/MLSPatch.hpp>
-#include <queue>
+#include <vector>
 
 namespace envire {
 
+/**
+ * Computes a TraversabilityGrid from a MLSGrid, by flooding the MLS from the
+ * start position and following the surface the robot can reach.
+ *
+ * The flood is processed wavefront by wavefront, i.e. all cells at the
+ * same distance from the start are checked as one batch. With setParallel,
+ * the cells of a batch are checked in parallel, which gives the same result
+ * as the sequential run.
+ *
+ * In incremental mode, the result of the last update is kept, and only the
+ * cells of the MLS tiles which have been modified since then (see
+ * MLSGrid::getModifiedTiles) are flooded again, together with the cells
+ * which were reached through them. The flood restarts from the unchanged
+ * cells bordering them. A full update is done if the start position is
+ * not on the surface that was reached in the last update, or if input,
+ * output or configuration changed. The result can differ from a full
+ * update in which neighbour a cell was reached from, when several of them
+ * could reach it.
+ */
 class TraversabilityGrassfire: public envire::Operator {
         ENVIRONMENT_ITEM( TraversabilityGrassfire );
 
@@ -33,55 +52,107 @@ public:
         double outliertFilterMaxStdDev;
     };
     
+    TraversabilityGrassfire();
+
     virtual bool updateAll();
 
     void setStartPosition(Eigen::Vector3d startPos);
     void setConfig(const Config &config)
     {
         this->config = config;
+        hasResult = false;
     }
+
+    /**
+     * Enables the incremental mode, see the class documentation
+     * */
+    void setIncremental(bool incremental);
+    bool isIncremental() const { return incremental; }
+
+    /**
+     * Checks the cells of each wavefront in parallel
+     * */
+    void setParallel(bool parallel) { this->parallel = parallel; }
+    bool isParallel() const { return parallel; }
     
 private:
-    SurfacePatch *getNearestPatchWhereRobotFits(size_t x, size_t y, double height, bool& isObstace);
-    void addNeightboursToSearchList(size_t x, size_t y, SurfacePatch *patch);
-    
-    double getStepHeight(SurfacePatch *from, SurfacePatch *to);
-    void markAsObstacle(size_t x, size_t y);
+    const SurfacePatch *getNearestPatchWhereRobotFits(size_t x, size_t y, double height, bool& isObstace) const;
     
-    bool determineDrivePlane();
+    double getStepHeight(const SurfacePatch *from, const SurfacePatch *to) const;
     
     base::Vector3d startPos;
-    base::Vector2d startPos_map;
     Config config;
     envire::TraversabilityGrid *trGrid;
     TraversabilityGrid::ArrayType *trData;
-    MLSGrid *mlsGrid;
-    
-    TraversabilityClass classUnknown;
-    TraversabilityClass classObstacle;
+    const MLSGrid *mlsGrid;
     
     class SearchItem
     {
     public:
-        SearchItem(size_t x, size_t y, envire::SurfacePatch* origin) : x(x), y(y), origin(origin)
+        SearchItem(size_t x, size_t y, const envire::SurfacePatch* origin, size_t parent) : x(x), y(y), origin(origin), parent(parent)
         {
         };
         
         size_t x;
         size_t y;
-        envire::SurfacePatch* origin;
+        const envire::SurfacePatch* origin;
+        /// index of the cell the item was created from
+        size_t parent;
     };
-    
-    std::queue<SearchItem> searchList;
-    
-    boost::multi_array<bool, 2> visited;
-    boost::multi_array<envire::SurfacePatch *, 2> bestPatchMap;
 
-    void computeTraversability();
+    /// checks the items of a wavefront, see checkWavefront
+    class WavefrontCheck;
+    /// computes the output for a range of rows, see computeTraversability
+    class TraversabilityUpdate;
+
+    enum CELLSTATE
+    {
+        UNVISITED = 0,
+        /// visited, but the robot can not continue from here
+        VISITED,
+        /// visited, and the neighbours have been added to the flood
+        EXPANDED,
+        /// needs to be flooded again in an incremental update
+        INVALID
+    };
+
+    static const size_t NO_PARENT = static_cast<size_t>(-1);
+
+    /// per cell state of the flood, reused between updates
+    boost::multi_array<uint8_t, 2> cellState;
+    boost::multi_array<const envire::SurfacePatch *, 2> bestPatchMap;
+    /// index of the cell the patch was reached from
+    boost::multi_array<size_t, 2> parentMap;
+    /// distance in wavefronts from the start cell
+    boost::multi_array<size_t, 2> levelMap;
+
+    /// scratch buffers of the flood
+    std::vector<SearchItem> wavefront;
+    std::vector<SearchItem> nextWavefront;
+    std::vector<SearchItem> batch;
+    std::vector<const SurfacePatch *> batchPatches;
+    std::vector<uint8_t> batchObstacles;
+    /// cells whose best patch was changed in this update
+    std::vector<size_t> changedCells;
+    std::vector<bool> updateMask;
+
+    bool incremental;
+    bool parallel;
+    /// state of the last update, used in incremental mode
+    bool hasResult;
+    const MLSGrid *lastInput;
+    const TraversabilityGrid *lastOutput;
+    size_t lastRevision;
+
+    void computeTraversability(bool all);
     void setTraversability(size_t x, size_t y);
     void setProbability(size_t x, size_t y);
-    void checkRecursive(size_t x, size_t y, envire::SurfacePatch* origin);
-    bool determineDrivePlane(base::Vector3d startPos, bool searchSourunding = true);
+    bool findStartPatch(const base::Vector3d &startPos, size_t &startX, size_t &startY, const SurfacePatch *&startPatch) const;
+    void resetFlood();
+    void invalidateModifiedCells(std::vector<std::pair<size_t, size_t> > &seeds);
+    void addNeighboursToWavefront(size_t x, size_t y, const SurfacePatch *patch, std::vector<SearchItem> &list) const;
+    void checkWavefront(size_t level);
+    void flood(std::vector<std::pair<size_t, size_t> > &seeds);
     
     enum TRCLASSES
     {
@@ -86,6 +86,7 @@ void TraversabilityGrowClasses::growTerrains(TraversabilityGrid& mapIn, Traversa
             }
         }
     }
+    mapOut.invalidateFootprintIndex();
 }
 
 bool envire::TraversabilityGrowClasses::updateAll()
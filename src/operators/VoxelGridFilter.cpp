@@ -0,0 +1,245 @@
+#include "VoxelGridFilter.hpp"
+#include <envire/tools/ParallelFor.hpp>
+#include <envire/tools/PointGridIndex.hpp>
+
+#include <boost/cstdint.hpp>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( VoxelGridFilter )
+
+namespace
+{
+    /** bit mixer of splitmix64, used for the RANDOM mode */
+    boost::uint64_t mix( boost::uint64_t x )
+    {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+    }
+
+    struct TransformPoints
+    {
+	const std::vector<Eigen::Vector3d>& in;
+	std::vector<Eigen::Vector3d>& out;
+	const Transform& t;
+
+	TransformPoints( const std::vector<Eigen::Vector3d>& in, std::vector<Eigen::Vector3d>& out, const Transform& t )
+	    : in( in ), out( out ), t( t ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i = begin; i < end; i++ )
+		out[i] = t * in[i];
+	}
+    };
+
+    /** writes the output point and data of each voxel */
+    struct ReduceVoxels
+    {
+	VoxelGridFilter::Mode mode;
+	boost::uint64_t seed;
+	const std::vector<Eigen::Vector3d>& points;
+	const PointGridIndex& index;
+	Eigen::Matrix3d rotation;
+
+	Pointcloud& out;
+	const std::vector<Eigen::Vector3d> *normalsIn, *colorsIn;
+	const std::vector<double> *varianceIn;
+	const std::vector<Pointcloud::vertex_attr> *attrsIn;
+	std::vector<Eigen::Vector3d> *normalsOut, *colorsOut;
+	std::vector<double> *varianceOut;
+	std::vector<Pointcloud::vertex_attr> *attrsOut;
+
+	ReduceVoxels( VoxelGridFilter::Mode mode, boost::uint64_t seed,
+		const std::vector<Eigen::Vector3d>& points, const PointGridIndex& index,
+		const Eigen::Matrix3d& rotation, Pointcloud& out )
+	    : mode( mode ), seed( seed ), points( points ), index( index ),
+	    rotation( rotation ), out( out ),
+	    normalsIn( NULL ), colorsIn( NULL ), varianceIn( NULL ), attrsIn( NULL ),
+	    normalsOut( NULL ), colorsOut( NULL ), varianceOut( NULL ), attrsOut( NULL ) {}
+
+	void operator()( size_t v )
+	{
+	    const size_t *begin = index.getCellBegin( v ), *end = index.getCellEnd( v );
+	    if( mode != VoxelGridFilter::CENTROID )
+	    {
+		const size_t *pick = begin;
+		if( mode == VoxelGridFilter::RANDOM )
+		    pick += mix( index.getCellKey( v ) ^ seed ) % (end - begin);
+		const size_t i = *pick;
+
+		out.vertices[v] = points[i];
+		if( normalsOut )
+		    (*normalsOut)[v] = rotation * (*normalsIn)[i];
+		if( colorsOut )
+		    (*colorsOut)[v] = (*colorsIn)[i];
+		if( varianceOut )
+		    (*varianceOut)[v] = (*varianceIn)[i];
+		if( attrsOut )
+		    (*attrsOut)[v] = (*attrsIn)[i];
+		return;
+	    }
+
+	    Eigen::Vector3d point( Eigen::Vector3d::Zero() ), normal( Eigen::Vector3d::Zero() ), color( Eigen::Vector3d::Zero() );
+	    double variance = 0;
+	    Pointcloud::vertex_attr attrs = 0;
+	    for( const size_t *it = begin; it != end; ++it )
+	    {
+		const size_t i = *it;
+		point += points[i];
+		if( normalsOut )
+		    normal += (*normalsIn)[i];
+		if( colorsOut )
+		    color += (*colorsIn)[i];
+		if( varianceOut )
+		    variance += (*varianceIn)[i];
+		if( attrsOut )
+		    attrs |= (*attrsIn)[i];
+	    }
+
+	    const double n = end - begin;
+	    out.vertices[v] = point / n;
+	    if( normalsOut )
+	    {
+		// keep the mean direction, opposing normals may cancel out
+		if( normal.norm() > 0 )
+		    normal.normalize();
+		(*normalsOut)[v] = rotation * normal;
+	    }
+	    if( colorsOut )
+		(*colorsOut)[v] = color / n;
+	    if( varianceOut )
+		(*varianceOut)[v] = variance / n;
+	    if( attrsOut )
+		(*attrsOut)[v] = attrs;
+	}
+    };
+
+    template <class T>
+    const std::vector<T>* getInputData( Pointcloud& pc, const std::string& key )
+    {
+	if( !pc.hasData( key ) )
+	    return NULL;
+	const std::vector<T>& data( pc.getVertexData<T>( key ) );
+	if( data.size() != pc.vertices.size() )
+	    throw std::runtime_error("VoxelGridFilter: size of " + key + " does not match the number of vertices.");
+	return &data;
+    }
+}
+
+VoxelGridFilter::VoxelGridFilter()
+    : Operator(1, 1), voxelSize( 0.05 ), mode( CENTROID ), seed( 0 )
+{
+}
+
+void VoxelGridFilter::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write("voxel_size", voxelSize);
+    so.write("mode", static_cast<int>(mode));
+    so.write("seed", seed);
+}
+
+void VoxelGridFilter::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    so.read("voxel_size", voxelSize);
+    int value;
+    so.read("mode", value);
+    mode = static_cast<Mode>(value);
+    so.read("seed", seed);
+}
+
+void VoxelGridFilter::addInput( Pointcloud* input )
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("VoxelGridFilter can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void VoxelGridFilter::addOutput( Pointcloud* output )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("VoxelGridFilter can only have one output.");
+
+    Operator::addOutput(output);
+}
+
+bool VoxelGridFilter::updateAll()
+{
+    if( voxelSize <= 0 )
+	throw std::runtime_error("VoxelGridFilter: the voxel size has to be positive.");
+
+    Pointcloud* in = getInput<Pointcloud*>();
+    Pointcloud* out = getOutput<Pointcloud*>();
+    assert( in != out );
+
+    const std::vector<Eigen::Vector3d>* normalsIn = getInputData<Eigen::Vector3d>( *in, Pointcloud::VERTEX_NORMAL );
+    const std::vector<Eigen::Vector3d>* colorsIn = getInputData<Eigen::Vector3d>( *in, Pointcloud::VERTEX_COLOR );
+    const std::vector<double>* varianceIn = getInputData<double>( *in, Pointcloud::VERTEX_VARIANCE );
+    const std::vector<Pointcloud::vertex_attr>* attrsIn = getInputData<Pointcloud::vertex_attr>( *in, Pointcloud::VERTEX_ATTRIBUTES );
+
+    const size_t blockSize = 1 << 16;
+
+    // voxelize in the frame of the output
+    const Transform t = env->relativeTransform( in->getFrameNode(), out->getFrameNode() );
+    std::vector<Eigen::Vector3d> transformed;
+    const std::vector<Eigen::Vector3d>* points = &in->vertices;
+    if( !t.isApprox( Transform( Transform::Identity() ) ) )
+    {
+	transformed.resize( in->vertices.size() );
+	parallelForBlocks( 0, transformed.size(), blockSize, TransformPoints( in->vertices, transformed, t ) );
+	points = &transformed;
+    }
+
+    PointGridIndex index;
+    index.build( *points, voxelSize );
+    const size_t voxels = index.getCellCount();
+
+    // clear() keeps the keys of the vertex data, the data which the input
+    // does not have is removed below
+    out->clear();
+    out->vertices.resize( voxels );
+
+    ReduceVoxels reduce( mode, mix( seed ), *points, index, t.linear(), *out );
+    if( normalsIn )
+    {
+	reduce.normalsIn = normalsIn;
+	reduce.normalsOut = &out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL );
+	reduce.normalsOut->resize( voxels );
+    }
+    else
+	out->removeData( Pointcloud::VERTEX_NORMAL );
+    if( colorsIn )
+    {
+	reduce.colorsIn = colorsIn;
+	reduce.colorsOut = &out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
+	reduce.colorsOut->resize( voxels );
+    }
+    else
+	out->removeData( Pointcloud::VERTEX_COLOR );
+    if( varianceIn )
+    {
+	reduce.varianceIn = varianceIn;
+	reduce.varianceOut = &out->getVertexData<double>( Pointcloud::VERTEX_VARIANCE );
+	reduce.varianceOut->resize( voxels );
+    }
+    else
+	out->removeData( Pointcloud::VERTEX_VARIANCE );
+    if( attrsIn )
+    {
+	reduce.attrsIn = attrsIn;
+	reduce.attrsOut = &out->getVertexData<Pointcloud::vertex_attr>( Pointcloud::VERTEX_ATTRIBUTES );
+	reduce.attrsOut->resize( voxels );
+    }
+    else
+	out->removeData( Pointcloud::VERTEX_ATTRIBUTES );
+    parallelFor( 0, voxels, reduce, 1024 );
+
+    env->itemModified( out );
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef ENVIRE_VOXELGRIDFILTER_HPP__
+#define ENVIRE_VOXELGRIDFILTER_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+
+namespace envire {
+    /**
+     * Downsamples a pointcloud to one point per cubic voxel.
+     *
+     * The points of the input are transformed into the frame of the output
+     * and sorted by voxel. Each occupied voxel gives one output point, which
+     * depends on the mode, see setMode(). Normals, colors, variances and
+     * vertex attributes of the input are carried over to the output.
+     *
+     * The work is distributed over the threads of parallelFor, and the
+     * result does not depend on the number of threads. Unlike
+     * SimplifyPointcloud, the operator does not need CGAL.
+     */
+    class VoxelGridFilter : public Operator
+    {
+	ENVIRONMENT_ITEM( VoxelGridFilter )
+
+    public:
+	enum Mode
+	{
+	    /// the mean of the points in the voxel, normals are averaged and
+	    /// normalized, the vertex attributes are or'ed
+	    CENTROID,
+	    /// a point of the voxel, chosen pseudo-randomly from the seed and
+	    /// the voxel position
+	    RANDOM,
+	    /// the first point of the voxel in the order of the input
+	    FIRST
+	};
+
+	VoxelGridFilter();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* input );
+	void addOutput( Pointcloud* output );
+
+	bool updateAll();
+
+	/** Sets the edge length of the voxels. The default is 0.05. */
+	void setVoxelSize( double size ) { voxelSize = size; }
+	double getVoxelSize() const { return voxelSize; }
+
+	void setMode( Mode mode ) { this->mode = mode; }
+	Mode getMode() const { return mode; }
+
+	/** Sets the seed for the RANDOM mode */
+	void setSeed( unsigned int seed ) { this->seed = seed; }
+	unsigned int getSeed() const { return seed; }
+
+    private:
+	double voxelSize;
+	Mode mode;
+	unsigned int seed;
+    };
+}
+
+#endif
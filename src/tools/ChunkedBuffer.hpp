@@ -0,0 +1,186 @@
+#ifndef ENVIRE_TOOLS_CHUNKEDBUFFER_HPP__
+#define ENVIRE_TOOLS_CHUNKEDBUFFER_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <iterator>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+
+namespace envire
+{
+    /**
+     * Append-only sequence of elements, stored in chunks of fixed size.
+     *
+     * Appending never moves elements, so their addresses stay valid, and
+     * growing does not copy what is already stored. The oldest chunk can be
+     * dropped in constant time, which makes the buffer usable as a sliding
+     * window over a stream of points. Chunks which are dropped or cleared are
+     * kept in a pool and reused by later appends, until releasePool() is
+     * called.
+     *
+     * The elements can be accessed by index, iterated as one range, or
+     * processed chunk by chunk with getChunk().
+     */
+    template <class T, class Alloc = std::allocator<T> >
+    class ChunkedBuffer : boost::noncopyable
+    {
+    public:
+	typedef T value_type;
+
+	template <class V, class B>
+	class Iterator
+	{
+	public:
+	    typedef std::forward_iterator_tag iterator_category;
+	    typedef T value_type;
+	    typedef std::ptrdiff_t difference_type;
+	    typedef V* pointer;
+	    typedef V& reference;
+
+	    Iterator() : buffer( NULL ), index( 0 ) {}
+	    Iterator( B* buffer, size_t index ) : buffer( buffer ), index( index ) {}
+
+	    V& operator*() const { return (*buffer)[index]; }
+	    V* operator->() const { return &(*buffer)[index]; }
+	    Iterator& operator++() { ++index; return *this; }
+	    Iterator operator++( int ) { Iterator it( *this ); ++index; return it; }
+
+	    bool operator==( const Iterator& other ) const { return index == other.index; }
+	    bool operator!=( const Iterator& other ) const { return index != other.index; }
+
+	private:
+	    B* buffer;
+	    size_t index;
+	};
+
+	typedef Iterator<T, ChunkedBuffer> iterator;
+	typedef Iterator<const T, const ChunkedBuffer> const_iterator;
+
+	/** Creates a buffer with chunks of at least \c chunkSize elements. The
+	 * size is rounded up to a power of two. */
+	explicit ChunkedBuffer( size_t chunkSize = 1 << 16 )
+	    : shift( 0 ), count( 0 )
+	{
+	    while( (size_t(1) << shift) < chunkSize )
+		shift++;
+	    mask = (size_t(1) << shift) - 1;
+	}
+
+	~ChunkedBuffer()
+	{
+	    clear();
+	    releasePool();
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return !count; }
+
+	/** @return the number of elements per chunk */
+	size_t getChunkSize() const { return mask + 1; }
+
+	T& operator[]( size_t i ) { return chunks[i >> shift][i & mask]; }
+	const T& operator[]( size_t i ) const { return chunks[i >> shift][i & mask]; }
+
+	T& back() { return (*this)[count - 1]; }
+	const T& back() const { return (*this)[count - 1]; }
+
+	iterator begin() { return iterator( this, 0 ); }
+	iterator end() { return iterator( this, count ); }
+	const_iterator begin() const { return const_iterator( this, 0 ); }
+	const_iterator end() const { return const_iterator( this, count ); }
+
+	void push_back( const T& value )
+	{
+	    if( count == chunks.size() << shift )
+		chunks.push_back( allocateChunk() );
+	    new( &chunks[count >> shift][count & mask] ) T( value );
+	    count++;
+	}
+
+	/** appends the elements in [first, last) */
+	template <class InputIt>
+	void append( InputIt first, InputIt last )
+	{
+	    for( ; first != last; ++first )
+		push_back( *first );
+	}
+
+	/** @return the number of chunks in use */
+	size_t getChunkCount() const { return chunks.size(); }
+
+	/** the elements of chunk \c c are in [getChunk( c ), getChunk( c ) +
+	 * getChunkFill( c )) */
+	T* getChunk( size_t c ) { return chunks[c]; }
+	const T* getChunk( size_t c ) const { return chunks[c]; }
+	size_t getChunkFill( size_t c ) const
+	{
+	    return std::min( getChunkSize(), count - (c << shift) );
+	}
+
+	/** Removes the oldest chunk, and with it the first getChunkFill( 0 )
+	 * elements. The indices of the remaining elements decrease by that
+	 * number, their addresses stay the same. */
+	void dropFront()
+	{
+	    if( chunks.empty() )
+		return;
+	    const size_t fill = getChunkFill( 0 );
+	    destroy( chunks.front(), fill );
+	    pool.push_back( chunks.front() );
+	    chunks.pop_front();
+	    count -= fill;
+	}
+
+	/** removes all elements, the chunks are kept for reuse */
+	void clear()
+	{
+	    while( !chunks.empty() )
+		dropFront();
+	}
+
+	/** frees the chunks which are not in use */
+	void releasePool()
+	{
+	    for( size_t i = 0; i < pool.size(); i++ )
+		alloc.deallocate( pool[i], getChunkSize() );
+	    pool.clear();
+	}
+
+	/** appends all elements to \c data, which is grown once */
+	template <class A>
+	void copyTo( std::vector<T, A>& data ) const
+	{
+	    data.reserve( data.size() + count );
+	    for( size_t c = 0; c < chunks.size(); c++ )
+		data.insert( data.end(), chunks[c], chunks[c] + getChunkFill( c ) );
+	}
+
+    private:
+	T* allocateChunk()
+	{
+	    if( pool.empty() )
+		return alloc.allocate( getChunkSize() );
+	    T* chunk = pool.back();
+	    pool.pop_back();
+	    return chunk;
+	}
+
+	void destroy( T* chunk, size_t fill )
+	{
+	    for( size_t i = 0; i < fill; i++ )
+		chunk[i].~T();
+	}
+
+	Alloc alloc;
+	size_t shift, mask;
+	size_t count;
+	std::deque<T*> chunks;
+	std::vector<T*> pool;
+    };
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "DynamicDistanceTransform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace envire;
+
+const size_t DynamicDistanceTransform::NO_SITE;
+
+DynamicDistanceTransform::DynamicDistanceTransform()
+    : width(0), height(0), scaleX(1), scaleY(1), maxDistance(0), maxSquaredDistance(0)
+{
+}
+
+void DynamicDistanceTransform::reset( size_t width, size_t height, double scaleX, double scaleY, double maxDistance )
+{
+    this->width = width;
+    this->height = height;
+    this->scaleX = scaleX;
+    this->scaleY = scaleY;
+    this->maxDistance = maxDistance;
+    maxSquaredDistance = maxDistance * maxDistance;
+
+    obstacles.assign( width * height, false );
+    sites.assign( width * height, NO_SITE );
+    squaredDistances.assign( width * height, std::numeric_limits<double>::infinity() );
+    removed.clear();
+    queue = std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> >();
+}
+
+void DynamicDistanceTransform::setObstacle( size_t x, size_t y )
+{
+    const size_t cell = y * width + x;
+    if( obstacles[cell] )
+	return;
+    obstacles[cell] = true;
+    sites[cell] = cell;
+    squaredDistances[cell] = 0;
+    queue.push( QueueItem( 0, cell ) );
+}
+
+void DynamicDistanceTransform::removeObstacle( size_t x, size_t y )
+{
+    const size_t cell = y * width + x;
+    if( !obstacles[cell] )
+	return;
+    obstacles[cell] = false;
+    removed.push_back( cell );
+}
+
+double DynamicDistanceTransform::getSquaredDistance( size_t cell, size_t site ) const
+{
+    const double dx = ((double) (cell % width) - (double) (site % width)) * scaleX;
+    const double dy = ((double) (cell / width) - (double) (site / width)) * scaleY;
+    return dx * dx + dy * dy;
+}
+
+double DynamicDistanceTransform::getDistance( size_t x, size_t y ) const
+{
+    return std::sqrt( squaredDistances[y * width + x] );
+}
+
+void DynamicDistanceTransform::update()
+{
+    // clear the cells of the removed obstacles. All of them are within
+    // the maximum distance of the obstacle.
+    const int rangeX = std::ceil( maxDistance / scaleX );
+    const int rangeY = std::ceil( maxDistance / scaleY );
+    cleared.clear();
+    for( size_t i = 0; i < removed.size(); i++ )
+    {
+	const size_t site = removed[i];
+	// set again in the meantime
+	if( obstacles[site] )
+	    continue;
+
+	const int sx = site % width, sy = site / width;
+	const int x0 = std::max( 0, sx - rangeX ), x1 = std::min( (int) width - 1, sx + rangeX );
+	const int y0 = std::max( 0, sy - rangeY ), y1 = std::min( (int) height - 1, sy + rangeY );
+	for( int y = y0; y <= y1; y++ )
+	{
+	    for( int x = x0; x <= x1; x++ )
+	    {
+		const size_t cell = y * width + x;
+		if( sites[cell] == site )
+		{
+		    sites[cell] = NO_SITE;
+		    squaredDistances[cell] = std::numeric_limits<double>::infinity();
+		    cleared.push_back( cell );
+		}
+	    }
+	}
+    }
+    removed.clear();
+
+    // the remaining sites around the cleared cells have to be propagated
+    // into them again
+    for( size_t i = 0; i < cleared.size(); i++ )
+    {
+	const int cx = cleared[i] % width, cy = cleared[i] / width;
+	for( int y = std::max( 0, cy - 1 ); y <= std::min( (int) height - 1, cy + 1 ); y++ )
+	{
+	    for( int x = std::max( 0, cx - 1 ); x <= std::min( (int) width - 1, cx + 1 ); x++ )
+	    {
+		const size_t cell = y * width + x;
+		if( sites[cell] != NO_SITE )
+		    queue.push( QueueItem( squaredDistances[cell], cell ) );
+	    }
+	}
+    }
+
+    while( !queue.empty() )
+    {
+	const QueueItem item( queue.top() );
+	queue.pop();
+
+	const size_t cell = item.second;
+	const size_t site = sites[cell];
+	// outdated entry
+	if( site == NO_SITE || item.first != squaredDistances[cell] )
+	    continue;
+
+	const int cx = cell % width, cy = cell / width;
+	for( int y = std::max( 0, cy - 1 ); y <= std::min( (int) height - 1, cy + 1 ); y++ )
+	{
+	    for( int x = std::max( 0, cx - 1 ); x <= std::min( (int) width - 1, cx + 1 ); x++ )
+	    {
+		const size_t neighbour = y * width + x;
+		const double d = getSquaredDistance( neighbour, site );
+		if( d < squaredDistances[neighbour] && d <= maxSquaredDistance )
+		{
+		    sites[neighbour] = site;
+		    squaredDistances[neighbour] = d;
+		    queue.push( QueueItem( d, neighbour ) );
+		}
+	    }
+	}
+    }
+}
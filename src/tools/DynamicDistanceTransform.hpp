@@ -0,0 +1,85 @@
+#ifndef ENVIRE_TOOLS_DYNAMICDISTANCETRANSFORM_HPP__
+#define ENVIRE_TOOLS_DYNAMICDISTANCETRANSFORM_HPP__
+
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace envire
+{
+    /**
+     * Euclidean distance transform of a grid of obstacle cells, which can
+     * be updated when obstacles are added or removed.
+     *
+     * For each cell, the nearest obstacle cell (its site) and the distance
+     * to it are kept. Distances are only computed up to a maximum
+     * distance, cells farther away from all obstacles report infinity.
+     *
+     * Changes are collected by setObstacle and removeObstacle, and applied
+     * by update(). Only the cells whose distance changes are visited:
+     * removing an obstacle clears the cells which had it as their site,
+     * and the sites around the cleared or newly added cells are then
+     * propagated outwards in order of increasing distance. As sites are
+     * passed on between neighbouring cells, a cell may end up with a site
+     * that is marginally farther away than the nearest obstacle.
+     */
+    class DynamicDistanceTransform
+    {
+    public:
+	/// returned by getNearestObstacle for cells without a site
+	static const size_t NO_SITE = static_cast<size_t>(-1);
+
+	DynamicDistanceTransform();
+
+	/** Resizes the transform and removes all obstacles
+	 *
+	 * @param scaleX size of a cell in x
+	 * @param scaleY size of a cell in y
+	 * @param maxDistance the largest distance that is computed
+	 */
+	void reset( size_t width, size_t height, double scaleX, double scaleY, double maxDistance );
+
+	size_t getWidth() const { return width; }
+	size_t getHeight() const { return height; }
+	double getScaleX() const { return scaleX; }
+	double getScaleY() const { return scaleY; }
+	double getMaxDistance() const { return maxDistance; }
+
+	void setObstacle( size_t x, size_t y );
+	void removeObstacle( size_t x, size_t y );
+	bool isObstacle( size_t x, size_t y ) const { return obstacles[y * width + x]; }
+
+	/** Applies the changes since the last call to all distances */
+	void update();
+
+	/** @return the distance of the cell to the nearest obstacle, or
+	 * infinity if there is none within the maximum distance */
+	double getDistance( size_t x, size_t y ) const;
+
+	/** @return the index (y * width + x) of the nearest obstacle, or
+	 * NO_SITE if there is none within the maximum distance */
+	size_t getNearestObstacle( size_t x, size_t y ) const { return sites[y * width + x]; }
+
+    private:
+	double getSquaredDistance( size_t cell, size_t site ) const;
+
+	size_t width, height;
+	double scaleX, scaleY;
+	double maxDistance, maxSquaredDistance;
+
+	std::vector<bool> obstacles;
+	std::vector<size_t> sites;
+	std::vector<double> squaredDistances;
+
+	/// obstacles removed since the last update
+	std::vector<size_t> removed;
+	/// cells cleared by the last update
+	std::vector<size_t> cleared;
+
+	typedef std::pair<double, size_t> QueueItem;
+	std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+    };
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef ENVIRE_TOOLS_GDALBANDREADER_HPP__
+#define ENVIRE_TOOLS_GDALBANDREADER_HPP__
+
+#include <envire/maps/GridBase.hpp>
+
+#include <gdal/gdal_priv.h>
+
+#include <boost/multi_array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+
+#include <list>
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <typeinfo>
+
+namespace envire
+{
+
+namespace detail
+{
+    /** @return the GDAL data type matching T */
+    template <class T>
+    GDALDataType gdalDataType()
+    {
+	if(typeid(T) == typeid(uint8_t))
+	    return GDT_Byte;
+	else if(typeid(T) == typeid(int16_t))
+	    return GDT_Int16;
+	else if(typeid(T) == typeid(uint16_t))
+	    return GDT_UInt16;
+	else if(typeid(T) == typeid(int32_t))
+	    return GDT_Int32;
+	else if(typeid(T) == typeid(uint32_t))
+	    return GDT_UInt32;
+	else if(typeid(T) == typeid(float))
+	    return GDT_Float32;
+	else if(typeid(T) == typeid(double))
+	    return GDT_Float64;
+	throw std::runtime_error(std::string("type ") + typeid(T).name() + " is not supported by GDAL");
+    }
+}
+
+/**
+ * Windowed read access to a single band of a GDAL raster file.
+ *
+ * Instead of loading the whole band into memory, the data is read in the
+ * natural blocks of the file (e.g. the tiles of a tiled GeoTIFF, see
+ * BandedGrid::setGdalTileSize) when it is accessed. At most cacheSize blocks
+ * are kept in memory, the least recently used block is dropped first. The
+ * values are converted to T by GDAL, and are indexed in the raster order of
+ * the file.
+ *
+ * The reader is not thread-safe.
+ */
+template <class T>
+class GdalBandReader : boost::noncopyable
+{
+public:
+    /** Opens the band \c band (starting at 1) of the file at \c path
+     *
+     * @throw std::runtime_error if the file or band can not be opened
+     */
+    GdalBandReader( std::string const& path, int band = 1, size_t cacheSize = 64 )
+	: dataset( NULL ), cacheSize( std::max( cacheSize, (size_t)1 ) )
+    {
+	GDALAllRegister();
+	dataset = (GDALDataset *) GDALOpen( path.c_str(), GA_ReadOnly );
+	if( !dataset )
+	    throw std::runtime_error("can not open file " + path);
+
+	poBand = dataset->GetRasterBand( band );
+	if( !poBand )
+	{
+	    GDALClose( dataset );
+	    throw std::runtime_error("can not open band of file " + path);
+	}
+
+	int bx, by;
+	poBand->GetBlockSize( &bx, &by );
+	blockSizeX = bx;
+	blockSizeY = by;
+	width = poBand->GetXSize();
+	height = poBand->GetYSize();
+	blockCountX = (width + blockSizeX - 1) / blockSizeX;
+
+	int has_nodata = 0;
+	double value = poBand->GetNoDataValue( &has_nodata );
+	nodata = std::make_pair( T(value), has_nodata != 0 );
+    }
+
+    ~GdalBandReader()
+    {
+	GDALClose( dataset );
+    }
+
+    size_t getWidth() const { return width; }
+    size_t getHeight() const { return height; }
+    size_t getBlockSizeX() const { return blockSizeX; }
+    size_t getBlockSizeY() const { return blockSizeY; }
+
+    /** Returns the nodata value of the band. The flag is false if the file
+     * does not define one */
+    std::pair<T, bool> getNoData() const { return nodata; }
+
+    /** Returns the value of the cell (xi, yi) */
+    T get( size_t xi, size_t yi )
+    {
+	if( xi >= width || yi >= height )
+	    throw std::out_of_range("cell is out of the raster");
+	Block const& block( getBlock( xi / blockSizeX, yi / blockSizeY ) );
+	return block.data[(yi % blockSizeY) * block.width + xi % blockSizeX];
+    }
+
+    /** Reads the cells within \c window (inclusive) into \c out, which gets
+     * resized to the size of the window. Only the blocks which overlap the
+     * window are read.
+     */
+    void readWindow( GridBase::CellExtents const& window, boost::multi_array<T,2>& out )
+    {
+	if( window.isEmpty() || window.min().minCoeff() < 0
+		|| (size_t)window.max().x() >= width || (size_t)window.max().y() >= height )
+	    throw std::out_of_range("window is out of the raster");
+
+	const size_t x0 = window.min().x(), y0 = window.min().y();
+	const size_t x1 = window.max().x(), y1 = window.max().y();
+	out.resize( boost::extents[y1 - y0 + 1][x1 - x0 + 1] );
+
+	for( size_t by = y0 / blockSizeY; by <= y1 / blockSizeY; by++ )
+	{
+	    for( size_t bx = x0 / blockSizeX; bx <= x1 / blockSizeX; bx++ )
+	    {
+		Block const& block( getBlock( bx, by ) );
+		const size_t
+		    bx0 = std::max( x0, bx * blockSizeX ),
+		    bx1 = std::min( x1, bx * blockSizeX + block.width - 1 ),
+		    by0 = std::max( y0, by * blockSizeY ),
+		    by1 = std::min( y1, by * blockSizeY + block.height - 1 );
+		for( size_t yi = by0; yi <= by1; yi++ )
+		{
+		    const T* src = &block.data[(yi - by * blockSizeY) * block.width + bx0 - bx * blockSizeX];
+		    std::copy( src, src + (bx1 - bx0 + 1), &out[yi - y0][bx0 - x0] );
+		}
+	    }
+	}
+    }
+
+private:
+    struct Block
+    {
+	size_t width, height;
+	std::vector<T> data;
+	std::list<size_t>::iterator lru;
+    };
+
+    Block const& getBlock( size_t bx, size_t by )
+    {
+	const size_t index = by * blockCountX + bx;
+	typename std::map<size_t, Block>::iterator it = blocks.find( index );
+	if( it != blocks.end() )
+	{
+	    // mark as most recently used
+	    lru.splice( lru.begin(), lru, it->second.lru );
+	    return it->second;
+	}
+
+	if( blocks.size() >= cacheSize )
+	{
+	    blocks.erase( lru.back() );
+	    lru.pop_back();
+	}
+
+	Block& block( blocks[index] );
+	block.width = std::min( blockSizeX, width - bx * blockSizeX );
+	block.height = std::min( blockSizeY, height - by * blockSizeY );
+	block.data.resize( block.width * block.height );
+	if( poBand->RasterIO( GF_Read,
+		    bx * blockSizeX, by * blockSizeY, block.width, block.height,
+		    &block.data[0], block.width, block.height,
+		    detail::gdalDataType<T>(), 0, 0 ) != CE_None )
+	{
+	    blocks.erase( index );
+	    throw std::runtime_error("failed to read raster block");
+	}
+	lru.push_front( index );
+	block.lru = lru.begin();
+	return block;
+    }
+
+    GDALDataset *dataset;
+    GDALRasterBand *poBand;
+    size_t width, height;
+    size_t blockSizeX, blockSizeY, blockCountX;
+    std::pair<T, bool> nodata;
+
+    size_t cacheSize;
+    std::map<size_t, Block> blocks;
+    /// block indices, most recently used first
+    std::list<size_t> lru;
+};
+
+}
+
+#endif
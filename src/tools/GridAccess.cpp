@@ -242,6 +242,65 @@ struct MLSAccess::MLSAccessImpl
 	return false;
     }
 
+    size_t getElevation(const Eigen::Vector3d* positions, size_t count, double* zpos, double* zstdev, bool* found )
+    {
+	if( grids.size() == 0 )
+	    grids = env->getItems<MLSGrid>();
+
+	// indices of the positions which still need to be resolved
+	std::vector<size_t> open( count );
+	for( size_t i = 0; i < count; i++ )
+	    open[i] = i;
+	if( found )
+	    std::fill( found, found + count, false );
+
+	std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > local;
+	std::vector<double> lzpos, lzstdev;
+	std::vector<const SurfacePatch*> patches;
+	size_t res = 0;
+	for(std::vector<MLSGrid*>::iterator it = grids.begin();it != grids.end() && !open.empty();it++)
+	{
+	    const MLSGrid* lgrid = *it;
+	    Transform lt =
+		env->relativeTransform( 
+			env->getRootNode(),
+			lgrid->getFrameNode() );
+
+	    const size_t n = open.size();
+	    local.resize( n );
+	    lzpos.resize( n );
+	    lzstdev.resize( n );
+	    patches.resize( n );
+	    for( size_t k = 0; k < n; k++ )
+	    {
+		Eigen::Vector3d v = lt * positions[open[k]];
+		local[k] = v.head<2>();
+		lzpos[k] = v.z();
+		lzstdev[k] = zstdev[open[k]];
+	    }
+
+	    res += lgrid->get( &local[0], n, &lzpos[0], &lzstdev[0], &patches[0] );
+
+	    size_t remaining = 0;
+	    for( size_t k = 0; k < n; k++ )
+	    {
+		const size_t i = open[k];
+		zpos[i] = lzpos[k];
+		zstdev[i] = lzstdev[k];
+		if( patches[k] )
+		{
+		    if( found )
+			found[i] = true;
+		}
+		else
+		    open[remaining++] = i;
+	    }
+	    open.resize( remaining );
+	}
+
+	return res;
+    }
+
 };
 
 MLSAccess::MLSAccess(Environment* env)
@@ -254,3 +313,7 @@ bool MLSAccess::getElevation(Eigen::Vector3d position, double& zpos, double& zst
     return impl->getElevation( position, zpos, zstdev );
 }
 
+size_t MLSAccess::getElevation(const Eigen::Vector3d* positions, size_t count, double* zpos, double* zstdev, bool* found )
+{
+    return impl->getElevation( positions, count, zpos, zstdev, found );
+}
@@ -44,6 +44,18 @@ namespace envire
 
 	bool getElevation(Eigen::Vector3d position, double& zpos, double& zstdev  );
 
+	/** batched version of getElevation() for count positions, with the
+	 * results written to the caller provided buffers zpos and zstdev.
+	 * zstdev is also used as input like in the single point version.
+	 * Each grid of the environment is queried in turn for the positions
+	 * which have not been resolved yet, using MLSGrid's batched get.
+	 *
+	 * @param found if not NULL, receives for each position whether a
+	 *        patch was found. zpos and zstdev are only valid in this case.
+	 * @return the number of positions for which a patch was found
+	 */
+	size_t getElevation(const Eigen::Vector3d* positions, size_t count, double* zpos, double* zstdev, bool* found = NULL );
+
     private:
 	struct MLSAccessImpl;
 	boost::shared_ptr<MLSAccessImpl> impl;
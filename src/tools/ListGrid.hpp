@@ -2,10 +2,11 @@
 #define ENVIRE_TOOLS_LISTGRID_HPP__
 
 #include <algorithm>
-#include <boost/multi_array.hpp>
+#include <vector>
+#include <cstdlib>
+#include <boost/shared_ptr.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/pool/object_pool.hpp>
-#include <boost/array.hpp>
 
 namespace envire
 {
@@ -13,10 +14,32 @@ namespace envire
 /**
  * Implementation of a grid structure, where each grid element is a list.
  * The class is templated for the element type of the list.
+ *
+ * The cells are stored in square tiles of TILE_SIZE x TILE_SIZE cells, each
+ * of which owns the memory of its list elements. Tiles are shared between
+ * copies of a grid and only duplicated when they are modified (copy on
+ * write). This makes copying a grid O(number of tiles), so that copies can
+ * be used as snapshots, which stay unchanged while the original is
+ * modified further. Tiles without any elements are not allocated at all.
+ *
+ * Accessing a cell through the non-const interface counts as a
+ * modification, as the returned iterators allow changing the elements.
+ * Taking a copy invalidates the non-const iterators of the original.
+ *
+ * The reference counting of the tiles is thread-safe. A copy can be read in
+ * one thread while the original is modified in another, as long as the copy
+ * itself is taken in the thread that modifies the original.
  */
 template <class C>
 class ListGrid
 {
+public:
+    /** edge length of the tiles in cells */
+    static const size_t TILE_SIZE = 16;
+
+private:
+    struct Tile;
+
     struct Item : public C
     {
 	Item() {};
@@ -24,6 +47,47 @@ class ListGrid
 
 	Item* next;
 	Item** pthis;
+	Tile* tile;
+    };
+
+    struct Tile
+    {
+	Tile()
+	{
+	    std::fill( cells, cells + TILE_SIZE * TILE_SIZE, (Item*)NULL );
+	}
+
+	Item* create( const C& value )
+	{
+	    Item* n_item = mem_pool.construct( value );
+	    n_item->tile = this;
+	    return n_item;
+	}
+
+	/** appends copies of the items in list to the (empty) cell idx */
+	void copyCell( size_t idx, const Item* list )
+	{
+	    Item** tail = &cells[idx];
+	    for( ; list; list = list->next )
+	    {
+		Item* n_item = create( *list );
+		n_item->pthis = tail;
+		*tail = n_item;
+		tail = &n_item->next;
+	    }
+	    *tail = NULL;
+	}
+
+	Tile* clone() const
+	{
+	    Tile* res = new Tile();
+	    for( size_t i = 0; i < TILE_SIZE * TILE_SIZE; i++ )
+		res->copyCell( i, cells[i] );
+	    return res;
+	}
+
+	Item* cells[TILE_SIZE * TILE_SIZE];
+	boost::object_pool<Item> mem_pool;
     };
 
 public:
@@ -40,17 +104,17 @@ public:
 
 	explicit iterator_base(T* item) : m_item(item) {}
 
-	void increment() 
-	{ 
-	    m_item = m_item->next; 
+	void increment()
+	{
+	    m_item = m_item->next;
 	}
-	bool equal( iterator_base<T,TV> const& other ) const 
-	{ 
-	    return m_item == other.m_item; 
+	bool equal( iterator_base<T,TV> const& other ) const
+	{
+	    return m_item == other.m_item;
 	}
-	TV& dereference() const 
-	{ 
-	    return *m_item; 
+	TV& dereference() const
+	{
+	    return *m_item;
 	}
 
     public:
@@ -64,115 +128,105 @@ public:
     typedef iterator_base<const Item, const C> const_iterator;
 
 public:
-    ListGrid():mem_pool(new boost::object_pool<Item>()){}
+    ListGrid()
+	: sizeX( 0 ), sizeY( 0 ), tilesX( 0 ), tilesY( 0 ) {}
 
     ListGrid( size_t sizeX, size_t sizeY )
-	: cells( boost::extents[sizeX][sizeY]),
-	  mem_pool(new boost::object_pool<Item>())
+	: sizeX( 0 ), sizeY( 0 ), tilesX( 0 ), tilesY( 0 )
     {
+	resize( sizeX, sizeY );
     }
 
-    ~ListGrid(){
-    	delete mem_pool;
-    }
-
+    /** Copies share the tiles with the original, see class documentation */
     ListGrid( const ListGrid<C>& other )
+	: sizeX( other.sizeX ), sizeY( other.sizeY ),
+	tilesX( other.tilesX ), tilesY( other.tilesY ),
+	tiles( other.tiles )
     {
-	// use the assignment operator
-	this->operator=( other );
     }
 
     ListGrid& operator=( const ListGrid<C>& other )
     {
 	if( &other != this )
 	{
-	    // assert same dimension for grids
-	    assert( other.cells.num_dimensions() == cells.num_dimensions() );
-
-	    // test if shape of cells is the same
-	    // and reshape our cell structure if necessary
-	    if( !std::equal( other.cells.shape(), other.cells.shape() + other.cells.num_dimensions(), cells.shape() ) )
-	    {
-		boost::array<typename ArrayType::index, 2> shape;
-		std::copy( other.cells.shape(), other.cells.shape() + 2, shape.begin() ); 
-		cells.resize( shape );
-	    }
-
-	    // clear cell array of this
-	    clear();
-
-	    // and for each cell perform a copy
-	    for(size_t xi=0;xi<cells.shape()[0];xi++)
-	    {
-		for(size_t yi=0;yi<cells.shape()[1];yi++)
-		{
-		    cells[xi][yi] = NULL;
-		    for( const_iterator it = other.beginCell( xi,yi ); it != other.endCell(); it++ )
-			insertTail( xi, yi, *it );
-		}
-	    }
+	    sizeX = other.sizeX;
+	    sizeY = other.sizeY;
+	    tilesX = other.tilesX;
+	    tilesY = other.tilesY;
+	    tiles = other.tiles;
 	}
 
 	return *this;
     }
-    
+
+    size_t getSizeX() const { return sizeX; }
+    size_t getSizeY() const { return sizeY; }
+
     /**
-     * Moves the contents of the grid by 
+     * Moves the contents of the grid by
      * x and y cells. Cells falling of the grid
      * will be discarded. 'New' cells are filled
      * with empty cells.
      * */
     void move(int xd, int yd)
     {
-        if(abs(xd) >= cells.shape()[0] || abs(yd) >= cells.shape()[1] )
+        if( (size_t)abs(xd) >= sizeX || (size_t)abs(yd) >= sizeY )
         {
             clear();
             return;
         }
-        
-        //copy grid to tempgrid
-        ArrayType tmp;
-        boost::array<typename ArrayType::index, 2> shape;
-        std::copy( cells.shape(), cells.shape() + 2, shape.begin() ); 
-        tmp.resize(shape);
 
-        int width = cells.shape()[0];
-        int height = cells.shape()[1];
+        const int ts = TILE_SIZE;
+        if( xd % ts == 0 && yd % ts == 0 )
+        {
+            // tile aligned moves only need to move the tiles
+            const int txd = xd / ts, tyd = yd / ts;
+            std::vector< boost::shared_ptr<Tile> > tmp( tiles.size() );
+            for(int ty = 0; ty < (int)tilesY; ty++)
+            {
+                for(int tx = 0; tx < (int)tilesX; tx++)
+                {
+                    const int newX = tx + txd;
+                    const int newY = ty + tyd;
+                    if(newX >= 0 && newX < (int)tilesX && newY >= 0 && newY < (int)tilesY )
+                        tmp[newY * tilesX + newX] = tiles[ty * tilesX + tx];
+                }
+            }
+            tiles.swap( tmp );
 
-        boost::swap(tmp, cells);
+            // the last row and column of tiles may be partial, so cells
+            // which have been moved beyond the grid need to be removed
+            for(size_t y = 0; y < tilesY * TILE_SIZE; y++)
+                for(size_t x = (y < sizeY ? sizeX : 0); x < tilesX * TILE_SIZE; x++)
+                    clearPadding( x, y );
+            return;
+        }
 
-        for(int x = 0; x < width; x++)
+        ListGrid<C> tmp( sizeX, sizeY );
+        for(int x = 0; x < (int)sizeX; x++)
         {
-            for(int y = 0; y < height; y++)
+            for(int y = 0; y < (int)sizeY; y++)
             {
                 const int newX = x + xd;
                 const int newY = y + yd;
-                if(newX < 0 || newX >= width || newY < 0 || newY >= height )
-                {
-                    //cell moved off the grid
-                    //delete all entries
-                    Item *p = tmp[x][y];
-                    while(p)
-                    {
-                        Item *cur = p;
-                        p = cur->next;
-                        mem_pool->free(cur);
-                    }
-                }
-                else
-                {
-                    cells[newX][newY] = tmp[x][y];
-                }
+                const Item* list = getCell( x, y );
+                if( list && newX >= 0 && newX < (int)sizeX && newY >= 0 && newY < (int)sizeY )
+                    tmp.getTile( newX, newY ).copyCell( cellIndex( newX, newY ), list );
             }
-        }        
+        }
+        tiles.swap( tmp.tiles );
     }
-    
+
     /** resize the grid. This will also clear all content
      */
     void resize( size_t sizeX, size_t sizeY )
     {
-	clear();
-	cells.resize( boost::extents[sizeX][sizeY] );
+	this->sizeX = sizeX;
+	this->sizeY = sizeY;
+	tilesX = (sizeX + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (sizeY + TILE_SIZE - 1) / TILE_SIZE;
+	tiles.clear();
+	tiles.resize( tilesX * tilesY );
     }
 
     /** Returns the iterator on the first registered patch at \c xi and \c
@@ -180,7 +234,10 @@ public:
      */
     iterator beginCell( size_t xi, size_t yi )
     {
-	return iterator( cells[xi][yi] );
+	boost::shared_ptr<Tile>& tile( tiles[tileIndex( xi, yi )] );
+	if( !tile )
+	    return iterator();
+	return iterator( getTile( xi, yi ).cells[cellIndex( xi, yi )] );
     }
 
     /** Returns the first const iterator on the first registered patch at \c
@@ -188,7 +245,7 @@ public:
      */
     const_iterator beginCell( size_t xi, size_t yi ) const
     {
-	return const_iterator( cells[xi][yi] );
+	return const_iterator( getCell( xi, yi ) );
     }
 
     /** Returns the past-the-end iterator for cell iteration */
@@ -207,43 +264,32 @@ public:
      */
     void insertHead( size_t xi, size_t yi, const C& value )
     {
-	Item* n_item = mem_pool->malloc();
-	static_cast<C&>(*n_item).operator=(value);
-	n_item->next = cells[xi][yi];
-	n_item->pthis = &cells[xi][yi];
+	Tile& tile( getTile( xi, yi ) );
+	Item*& head( tile.cells[cellIndex( xi, yi )] );
+
+	Item* n_item = tile.create( value );
+	n_item->next = head;
+	n_item->pthis = &head;
 	if( n_item->next )
 	    n_item->next->pthis = &n_item->next;
 
-	cells[xi][yi] = n_item;
+	head = n_item;
     }
-    
+
     /** Inserts a new surface patch at the end of the patch list at
      * the given position
      */
     void insertTail( size_t xi, size_t yi, const C& value )
     {
-	iterator last, it;
-	last = it = beginCell( xi, yi );
-	while( it != endCell() )
-	{
-	    last = it;
-	    it++;
-	}
+	Tile& tile( getTile( xi, yi ) );
+	Item** tail = &tile.cells[cellIndex( xi, yi )];
+	while( *tail )
+	    tail = &(*tail)->next;
 
-	Item* n_item = mem_pool->malloc();
-	static_cast<C&>(*n_item).operator=(value);
+	Item* n_item = tile.create( value );
 	n_item->next = NULL;
-
-	if( last != endCell() )
-	{
-	    last.m_item->next = n_item;
-	    n_item->pthis = &last.m_item->next;
-	}
-	else
-	{
-	    cells[xi][yi] = n_item;
-	    n_item->pthis = &cells[xi][yi];
-	}
+	n_item->pthis = tail;
+	*tail = n_item;
     }
 
     /** Removes the patch pointed-to by \c position */
@@ -254,29 +300,71 @@ public:
 
 	*p->pthis = p->next;
 	if( p->next )
-	    p->next->pthis = p->pthis; 
+	    p->next->pthis = p->pthis;
 
-	mem_pool->free(p);
+	p->tile->mem_pool.destroy(p);
 
-	return res; 
+	return res;
     }
 
     void clear()
     {
+	// tiles still referenced by copies stay alive
+	std::fill( tiles.begin(), tiles.end(), boost::shared_ptr<Tile>() );
+    }
 
-    	if (mem_pool) delete mem_pool;
-    	mem_pool = new boost::object_pool<Item>();
+protected:
+    size_t tileIndex( size_t xi, size_t yi ) const
+    {
+	return (yi / TILE_SIZE) * tilesX + xi / TILE_SIZE;
+    }
 
-    	memset(cells.origin(), 0,sizeof(Item*)*cells.num_elements());
+    static size_t cellIndex( size_t xi, size_t yi )
+    {
+	return (yi % TILE_SIZE) * TILE_SIZE + xi % TILE_SIZE;
+    }
 
+    const Item* getCell( size_t xi, size_t yi ) const
+    {
+	const Tile* tile = tiles[tileIndex( xi, yi )].get();
+	return tile ? tile->cells[cellIndex( xi, yi )] : NULL;
     }
 
-protected:
-    typedef boost::multi_array<Item*,2> ArrayType; 
-    ArrayType cells;
-    boost::object_pool<Item>* mem_pool;
+    /** @return the tile containing the cell for writing, which is allocated
+     * if it does not exist yet and duplicated if it is shared with a copy
+     */
+    Tile& getTile( size_t xi, size_t yi )
+    {
+	boost::shared_ptr<Tile>& tile( tiles[tileIndex( xi, yi )] );
+	if( !tile )
+	    tile.reset( new Tile() );
+	else if( !tile.unique() )
+	    tile.reset( tile->clone() );
+	return *tile;
+    }
+
+    void clearPadding( size_t xi, size_t yi )
+    {
+	if( !getCell( xi, yi ) )
+	    return;
+	Tile& tile( getTile( xi, yi ) );
+	Item*& head( tile.cells[cellIndex( xi, yi )] );
+	while( head )
+	{
+	    Item* p = head;
+	    head = p->next;
+	    tile.mem_pool.destroy( p );
+	}
+    }
+
+    size_t sizeX, sizeY;
+    size_t tilesX, tilesY;
+    std::vector< boost::shared_ptr<Tile> > tiles;
 };
 
+template <class C>
+const size_t ListGrid<C>::TILE_SIZE;
+
 }
 
 #endif
@@ -0,0 +1,446 @@
+#include "MLSMatcher.hpp"
+#include <envire/tools/ParallelFor.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+
+using namespace envire;
+
+struct MLSMatcher::Source
+{
+    std::vector<SourceCell> cells;
+    std::vector<SurfacePatch> patches;
+    /// rotation center of the source cells
+    Eigen::Vector3d center;
+    /// largest horizontal distance of a cell to the center
+    double range;
+};
+
+struct MLSMatcher::Rotation
+{
+    /// target cell index of each source cell
+    std::vector<Eigen::Vector2i> index;
+    /// height offset of each source cell in the target frame
+    std::vector<float> dz;
+};
+
+struct MLSMatcher::Candidate
+{
+    size_t rotation;
+    int dx, dy;
+    size_t level;
+    float score;
+
+    bool operator<( const Candidate& other ) const
+    {
+	// sorts the candidates by descending score
+	return score > other.score;
+    }
+};
+
+/** Interval of a single patch, taking the matching threshold into account. */
+static void patchInterval( const SurfacePatch& p, float sigma, float& lo, float& hi )
+{
+    hi = p.mean + p.stdev * sigma;
+    lo = p.mean - p.stdev * sigma;
+    if( !p.isHorizontal() )
+	lo -= p.height;
+}
+
+/** Same criteria as used in MLSGrid::get() */
+static bool patchesMatch( const SurfacePatch& target, const SurfacePatch& meas, float sigma )
+{
+    const double interval = sqrt( sq( meas.stdev ) + sq( target.stdev ) ) * sigma;
+    return target.distance( meas ) < interval && !target.isNegative();
+}
+
+MLSMatcher::MLSMatcher( const Configuration& config )
+    : config( config ), target( NULL )
+{
+}
+
+MLSMatcher::MLSMatcher( const MLSGrid& target, const Configuration& config )
+    : config( config ), target( NULL )
+{
+    setTarget( target );
+}
+
+void MLSMatcher::setTarget( const MLSGrid& target )
+{
+    this->target = &target;
+
+    const int width = target.getCellSizeX();
+    const int height = target.getCellSizeY();
+    const size_t levels = std::max( (size_t)1, config.levels );
+
+    pyramid.clear();
+    pyramid.resize( levels );
+
+    // level 0 holds the height interval of each individual cell
+    Level &base( pyramid[0] );
+    base.extent = 1;
+    base.sizeX = width;
+    base.sizeY = height;
+    base.cells.resize( width * height );
+    for( int y = 0; y < height; y++ )
+    {
+	for( int x = 0; x < width; x++ )
+	{
+	    Interval &cell( base.cells[y * width + x] );
+	    for( MLSGrid::const_iterator it = target.beginCell( x, y ); it != target.endCell(); it++ )
+	    {
+		if( it->isNegative() )
+		    continue;
+		Interval p;
+		patchInterval( *it, config.sigma, p.lo, p.hi );
+		p.vertical = !it->isHorizontal();
+		cell.extend( p );
+	    }
+	}
+    }
+
+    // each following level combines four windows of the previous level
+    for( size_t h = 1; h < levels; h++ )
+    {
+	const Level &prev( pyramid[h-1] );
+	Level &level( pyramid[h] );
+	level.extent = prev.extent * 2;
+	level.sizeX = width + level.extent - 1;
+	level.sizeY = height + level.extent - 1;
+	level.cells.resize( level.sizeX * level.sizeY );
+
+	const int s = prev.extent;
+	for( int y = 0; y < level.sizeY; y++ )
+	{
+	    const int wy = y - (level.extent - 1);
+	    for( int x = 0; x < level.sizeX; x++ )
+	    {
+		const int wx = x - (level.extent - 1);
+		Interval &cell( level.cells[y * level.sizeX + x] );
+		const Interval *c;
+		if( (c = prev.get( wx, wy )) ) cell.extend( *c );
+		if( (c = prev.get( wx + s, wy )) ) cell.extend( *c );
+		if( (c = prev.get( wx, wy + s )) ) cell.extend( *c );
+		if( (c = prev.get( wx + s, wy + s )) ) cell.extend( *c );
+	    }
+	}
+    }
+}
+
+void MLSMatcher::buildSource( const MLSGrid& other, const SurfacePatch& offset, Source& source ) const
+{
+    const size_t sampling = std::max( (size_t)1, config.sampling );
+    size_t idx = 0;
+    source.center = Eigen::Vector3d::Zero();
+    for( size_t x = 0; x < other.getCellSizeX(); x++ )
+    {
+	for( size_t y = 0; y < other.getCellSizeY(); y++ )
+	{
+	    MLSGrid::const_iterator it = other.beginCell( x, y );
+	    if( it == other.endCell() || idx++ % sampling != 0 )
+		continue;
+
+	    SourceCell cell;
+	    cell.pos = Eigen::Vector3d::Zero();
+	    other.fromGrid( x, y, cell.pos.x(), cell.pos.y() );
+	    cell.begin = source.patches.size();
+	    for( ; it != other.endCell(); it++ )
+	    {
+		// negative patches represent free space and are not matched
+		if( it->isNegative() )
+		    continue;
+		SurfacePatch meas_patch( *it );
+		meas_patch.mean += offset.mean;
+		meas_patch.stdev = sqrt( sq( meas_patch.stdev ) + sq( offset.stdev ) );
+		source.patches.push_back( meas_patch );
+	    }
+	    cell.end = source.patches.size();
+
+	    if( cell.begin != cell.end )
+	    {
+		source.cells.push_back( cell );
+		source.center += cell.pos;
+	    }
+	}
+    }
+
+    source.range = 0;
+    if( !source.cells.empty() )
+    {
+	source.center /= source.cells.size();
+	for( size_t i = 0; i < source.cells.size(); i++ )
+	    source.range = std::max( source.range, (source.cells[i].pos - source.center).head<2>().norm() );
+    }
+}
+
+void MLSMatcher::buildRotation( const Source& source, const Eigen::Affine3d& transform, Rotation& rotation ) const
+{
+    rotation.index.resize( source.cells.size() );
+    rotation.dz.resize( source.cells.size() );
+
+    const double offsetx = target->getOffsetX(), offsety = target->getOffsetY();
+    const double scalex = target->getScaleX(), scaley = target->getScaleY();
+    for( size_t i = 0; i < source.cells.size(); i++ )
+    {
+	const Eigen::Vector3d pos = transform * source.cells[i].pos;
+	rotation.index[i] = Eigen::Vector2i(
+		floor( (pos.x() - offsetx) / scalex ),
+		floor( (pos.y() - offsety) / scaley ) );
+	rotation.dz[i] = pos.z();
+    }
+}
+
+float MLSMatcher::scoreBound( const Source& source, const Rotation& rotation, const Candidate& candidate ) const
+{
+    const Level &level( pyramid[candidate.level] );
+    size_t match = 0;
+    for( size_t i = 0; i < source.cells.size(); i++ )
+    {
+	const Interval *cell = level.get(
+		rotation.index[i].x() + candidate.dx,
+		rotation.index[i].y() + candidate.dy );
+	if( !cell || cell->empty() )
+	    continue;
+
+	const SourceCell &sc( source.cells[i] );
+	for( size_t p = sc.begin; p < sc.end; p++ )
+	{
+	    const SurfacePatch &patch( source.patches[p] );
+	    // two vertical patches always match
+	    if( !patch.isHorizontal() && cell->vertical )
+	    {
+		++match;
+		break;
+	    }
+	    float lo, hi;
+	    patchInterval( patch, config.sigma, lo, hi );
+	    lo += rotation.dz[i];
+	    hi += rotation.dz[i];
+	    if( lo <= cell->hi && hi >= cell->lo )
+	    {
+		++match;
+		break;
+	    }
+	}
+    }
+    return source.cells.empty() ? 0.0 : (float)match / (float)source.cells.size();
+}
+
+float MLSMatcher::scoreExact( const Source& source, const Rotation& rotation, int dx, int dy ) const
+{
+    const int width = target->getCellSizeX(), height = target->getCellSizeY();
+    size_t match = 0;
+    for( size_t i = 0; i < source.cells.size(); i++ )
+    {
+	const int x = rotation.index[i].x() + dx;
+	const int y = rotation.index[i].y() + dy;
+	if( x < 0 || y < 0 || x >= width || y >= height )
+	    continue;
+
+	const SourceCell &sc( source.cells[i] );
+	bool found = false;
+	for( size_t p = sc.begin; p < sc.end && !found; p++ )
+	{
+	    SurfacePatch meas_patch( source.patches[p] );
+	    meas_patch.mean += rotation.dz[i];
+	    for( MLSGrid::const_iterator it = target->beginCell( x, y ); it != target->endCell(); it++ )
+	    {
+		if( patchesMatch( *it, meas_patch, config.sigma ) )
+		{
+		    found = true;
+		    break;
+		}
+	    }
+	}
+	if( found )
+	    ++match;
+    }
+    return source.cells.empty() ? 0.0 : (float)match / (float)source.cells.size();
+}
+
+/**
+ * Holds the state of a single search, and provides the functors which are
+ * executed in parallel.
+ */
+class MLSMatcher::Search
+{
+public:
+    typedef std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > TransformVector;
+
+    Search( const MLSMatcher& matcher, const Source& source, int windowX, int windowY )
+	: matcher( matcher ), source( source ),
+	windowX( windowX ), windowY( windowY ),
+	bestScore( matcher.config.minScore ), found( false ) {}
+
+    void buildRotation( size_t i, const TransformVector* transforms )
+    {
+	matcher.buildRotation( source, (*transforms)[i], rotations[i] );
+    }
+
+    void scoreCandidate( size_t i )
+    {
+	candidates[i].score = matcher.scoreBound( source, rotations[candidates[i].rotation], candidates[i] );
+    }
+
+    void searchCandidate( size_t i )
+    {
+	search( candidates[i] );
+    }
+
+    float getBestScore()
+    {
+	boost::mutex::scoped_lock lock( mutex );
+	return bestScore;
+    }
+
+    void search( const Candidate& candidate )
+    {
+	if( candidate.score <= getBestScore() )
+	    return;
+
+	if( candidate.level == 0 )
+	{
+	    const float score = matcher.scoreExact( source,
+		    rotations[candidate.rotation], candidate.dx, candidate.dy );
+
+	    boost::mutex::scoped_lock lock( mutex );
+	    if( score > bestScore )
+	    {
+		bestScore = score;
+		best = candidate;
+		found = true;
+	    }
+	    return;
+	}
+
+	// split the window of the candidate into four windows of the next
+	// lower level, and continue with the most promising one
+	const size_t level = candidate.level - 1;
+	const int step = matcher.pyramid[level].extent;
+	std::vector<Candidate> children;
+	for( int dy = candidate.dy; dy < candidate.dy + 2 * step && dy <= windowY; dy += step )
+	{
+	    for( int dx = candidate.dx; dx < candidate.dx + 2 * step && dx <= windowX; dx += step )
+	    {
+		Candidate child;
+		child.rotation = candidate.rotation;
+		child.dx = dx;
+		child.dy = dy;
+		child.level = level;
+		child.score = matcher.scoreBound( source, rotations[child.rotation], child );
+		children.push_back( child );
+	    }
+	}
+	std::sort( children.begin(), children.end() );
+	for( size_t i = 0; i < children.size(); i++ )
+	{
+	    if( children[i].score <= getBestScore() )
+		break;
+	    search( children[i] );
+	}
+    }
+
+    const MLSMatcher& matcher;
+    const Source& source;
+    int windowX, windowY;
+
+    std::vector<Rotation> rotations;
+    std::vector<Candidate> candidates;
+
+    boost::mutex mutex;
+    float bestScore;
+    Candidate best;
+    bool found;
+};
+
+MLSMatcher::Result MLSMatcher::match( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset ) const
+{
+    if( !target )
+	throw std::runtime_error("MLSMatcher::match() no target grid set.");
+
+    Result result;
+    Source source;
+    buildSource( other, offset, source );
+    if( source.cells.empty() )
+	return result;
+
+    // choose the angular step such that the cell furthest away from the
+    // center moves by about one cell
+    double angularStep = config.angularStep;
+    if( angularStep <= 0 )
+    {
+	const double r = std::min( target->getScaleX(), target->getScaleY() );
+	if( source.range > r )
+	    angularStep = acos( 1.0 - sq( r ) / (2.0 * sq( source.range )) );
+	else
+	    angularStep = config.angularWindow > 0 ? config.angularWindow : 1.0;
+    }
+    const int angularSteps = config.angularWindow > 0 ? ceil( config.angularWindow / angularStep ) : 0;
+
+    // the rotations are applied around the center of the source cells
+    Search::TransformVector transforms;
+    for( int i = -angularSteps; i <= angularSteps; i++ )
+    {
+	transforms.push_back( other2this
+		* Eigen::Translation3d( source.center )
+		* Eigen::AngleAxisd( i * angularStep, Eigen::Vector3d::UnitZ() )
+		* Eigen::Translation3d( -source.center ) );
+    }
+
+    const int windowX = ceil( config.linearWindowX / target->getScaleX() );
+    const int windowY = ceil( config.linearWindowY / target->getScaleY() );
+    Search search( *this, source, windowX, windowY );
+    search.rotations.resize( transforms.size() );
+    parallelFor( 0, transforms.size(),
+	    boost::bind( &Search::buildRotation, &search, _1, &transforms ) );
+
+    // generate the candidates for the top level of the pyramid, and start
+    // with the most promising ones
+    const size_t top = pyramid.size() - 1;
+    const int step = pyramid[top].extent;
+    for( size_t r = 0; r < transforms.size(); r++ )
+    {
+	for( int dy = -windowY; dy <= windowY; dy += step )
+	{
+	    for( int dx = -windowX; dx <= windowX; dx += step )
+	    {
+		Candidate c;
+		c.rotation = r;
+		c.dx = dx;
+		c.dy = dy;
+		c.level = top;
+		c.score = 0;
+		search.candidates.push_back( c );
+	    }
+	}
+    }
+    parallelFor( 0, search.candidates.size(),
+	    boost::bind( &Search::scoreCandidate, &search, _1 ), 64 );
+    std::sort( search.candidates.begin(), search.candidates.end() );
+    parallelFor( 0, search.candidates.size(),
+	    boost::bind( &Search::searchCandidate, &search, _1 ) );
+
+    if( search.found )
+    {
+	const Candidate &best( search.best );
+	result.other2this =
+	    Eigen::Translation3d( best.dx * target->getScaleX(), best.dy * target->getScaleY(), 0 )
+	    * transforms[best.rotation];
+	result.score = search.bestScore;
+	result.valid = true;
+    }
+
+    return result;
+}
+
+float MLSMatcher::score( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset ) const
+{
+    if( !target )
+	throw std::runtime_error("MLSMatcher::score() no target grid set.");
+
+    Source source;
+    buildSource( other, offset, source );
+    Rotation rotation;
+    buildRotation( source, other2this, rotation );
+    return scoreExact( source, rotation, 0, 0 );
+}
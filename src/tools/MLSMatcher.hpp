@@ -0,0 +1,167 @@
+#ifndef ENVIRE_TOOLS_MLSMATCHER_HPP__
+#define ENVIRE_TOOLS_MLSMATCHER_HPP__
+
+#include <envire/maps/MLSGrid.hpp>
+#include <vector>
+#include <limits>
+
+namespace envire
+{
+
+/**
+ * Correlative matcher which registers an MLSGrid against a target MLSGrid.
+ *
+ * The matcher searches over (x, y, yaw) around an initial guess and returns
+ * the transform with the highest ratio of matching cells, using the same
+ * patch matching criteria as MLSGrid::match. To make the search fast, the
+ * target grid is preprocessed into a pyramid of max-pooled height intervals.
+ * Level h of the pyramid stores, for each cell, the height interval covered
+ * by the window of 2^h x 2^h cells starting at that cell. This gives an upper
+ * bound on the score of all translations within such a window, which is used
+ * in a branch-and-bound search. Candidates are evaluated in parallel.
+ *
+ * The matcher keeps a reference to the target grid, which needs to stay
+ * valid and unchanged as long as the matcher is used. Call setTarget() again
+ * after the target grid changed.
+ */
+class MLSMatcher
+{
+public:
+    struct Configuration
+    {
+	Configuration()
+	    : levels( 5 ),
+	    linearWindowX( 1.0 ),
+	    linearWindowY( 1.0 ),
+	    angularWindow( M_PI / 6.0 ),
+	    angularStep( 0.0 ),
+	    sigma( 3.0 ),
+	    sampling( 1 ),
+	    minScore( 0.0 ) {}
+
+	/// number of levels of the pyramid, 1 means no pyramid
+	size_t levels;
+	/// half size of the search window along x in the target frame
+	double linearWindowX;
+	/// half size of the search window along y in the target frame
+	double linearWindowY;
+	/// half size of the search window for the yaw angle
+	double angularWindow;
+	/// step size for the yaw angle, 0 for choosing it based on the
+	/// resolution and extents of the matched grid
+	double angularStep;
+	/// sigma threshold for matching two patches
+	float sigma;
+	/// only use every n-th cell of the matched grid
+	size_t sampling;
+	/// solutions with a score below this value are not considered
+	float minScore;
+    };
+
+    struct Result
+    {
+	Result() : other2this( Eigen::Affine3d::Identity() ), score( 0.0 ), valid( false ) {}
+
+	/// best transform from the matched grid to the target grid
+	Eigen::Affine3d other2this;
+	/// ratio of sampled cells which match the target grid
+	float score;
+	/// false if no solution with a score of at least minScore was found
+	bool valid;
+    };
+
+    explicit MLSMatcher( const Configuration& config = Configuration() );
+    MLSMatcher( const MLSGrid& target, const Configuration& config = Configuration() );
+
+    /** Sets the grid to match against and (re-)builds the pyramid */
+    void setTarget( const MLSGrid& target );
+
+    const Configuration& getConfig() const { return config; }
+
+    /** Changing the number of levels requires a call to setTarget() to take
+     * effect.
+     */
+    void setConfig( const Configuration& config ) { this->config = config; }
+
+    /**
+     * Search for the best transform of the other grid into the target
+     * grid within the configured search window around other2this.
+     *
+     * @param other grid to match
+     * @param other2this initial guess for the transformation from other grid
+     *        to the target grid
+     * @param offset mean and stdev will be added to the cells of the other
+     *        grid before matching
+     */
+    Result match( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset = SurfacePatch( 0.0, 0.0 ) ) const;
+
+    /**
+     * @return the score of a single transform, which is the ratio of sampled
+     * cells of the other grid which have a matching patch in the target grid.
+     */
+    float score( const MLSGrid& other, const Eigen::Affine3d& other2this, const SurfacePatch& offset = SurfacePatch( 0.0, 0.0 ) ) const;
+
+private:
+    /** height interval covered by a cell or window of cells */
+    struct Interval
+    {
+	Interval()
+	    : lo( std::numeric_limits<float>::infinity() ),
+	    hi( -std::numeric_limits<float>::infinity() ),
+	    vertical( false ) {}
+
+	bool empty() const { return lo > hi; }
+
+	void extend( const Interval& o )
+	{
+	    lo = std::min( lo, o.lo );
+	    hi = std::max( hi, o.hi );
+	    vertical = vertical || o.vertical;
+	}
+
+	float lo, hi;
+	bool vertical;
+    };
+
+    /** max-pooled version of the target grid for windows of size extent */
+    struct Level
+    {
+	int extent;
+	int sizeX, sizeY;
+	std::vector<Interval> cells;
+
+	/** @return interval of the window starting at cell x, y */
+	const Interval* get( int x, int y ) const
+	{
+	    x += extent - 1;
+	    y += extent - 1;
+	    if( x < 0 || y < 0 || x >= sizeX || y >= sizeY )
+		return NULL;
+	    return &cells[y * sizeX + x];
+	}
+    };
+
+    struct SourceCell
+    {
+	Eigen::Vector3d pos;
+	size_t begin, end;
+    };
+
+    struct Source;
+    struct Rotation;
+    struct Candidate;
+    class Search;
+
+    void buildSource( const MLSGrid& other, const SurfacePatch& offset, Source& source ) const;
+    void buildRotation( const Source& source, const Eigen::Affine3d& transform, Rotation& rotation ) const;
+    float scoreBound( const Source& source, const Rotation& rotation, const Candidate& candidate ) const;
+    float scoreExact( const Source& source, const Rotation& rotation, int dx, int dy ) const;
+
+    Configuration config;
+    const MLSGrid* target;
+    std::vector<Level> pyramid;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "MLSPyramid.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace envire;
+
+MLSPyramid::MLSPyramid( const MLSGrid& base, size_t levels, double lodDistance )
+    : base( &base ), lodDistance( lodDistance ), levelCount( std::max( (size_t)1, levels ) )
+{
+    rebuild();
+}
+
+void MLSPyramid::rebuild()
+{
+    levels.clear();
+    revisions.assign( levelCount - 1, 0 );
+
+    const MLSGrid* prev = base;
+    for( size_t l = 1; l < levelCount; l++ )
+    {
+	MLSGrid::Ptr grid( new MLSGrid(
+		    (prev->getCellSizeX() + 1) / 2, (prev->getCellSizeY() + 1) / 2,
+		    prev->getScaleX() * 2.0, prev->getScaleY() * 2.0,
+		    prev->getOffsetX(), prev->getOffsetY() ) );
+	grid->getConfig() = base->getConfig();
+	if( grid->getConfig().updateModel == MLSConfiguration::SLOPE )
+	    grid->getConfig().updateModel = MLSConfiguration::SUM;
+	levels.push_back( grid );
+	prev = grid.get();
+    }
+
+    update();
+}
+
+void MLSPyramid::update()
+{
+    // recreate the levels if the geometry of the base grid changed
+    if( !levels.empty() &&
+	    (levels[0]->getCellSizeX() != (base->getCellSizeX() + 1) / 2 ||
+	     levels[0]->getCellSizeY() != (base->getCellSizeY() + 1) / 2 ||
+	     levels[0]->getScaleX() != base->getScaleX() * 2.0 ||
+	     levels[0]->getScaleY() != base->getScaleY() * 2.0 ) )
+    {
+	rebuild();
+	return;
+    }
+
+    std::vector<MLSGrid::Position> tiles;
+    for( size_t l = 1; l < levelCount; l++ )
+    {
+	const MLSGrid& child( getLevel( l - 1 ) );
+	const MLSGrid& parent( getLevel( l ) );
+
+	tiles.clear();
+	child.getModifiedTiles( revisions[l-1], tiles );
+	revisions[l-1] = child.getRevision();
+
+	// tile boundaries are even, so the parent cells of different
+	// tiles don't overlap
+	for( size_t t = 0; t < tiles.size(); t++ )
+	{
+	    MLSGrid::CellExtents ext = child.getTileExtents( tiles[t].x, tiles[t].y );
+	    for( size_t py = ext.min().y() / 2; py <= (size_t)ext.max().y() / 2 && py < parent.getCellSizeY(); py++ )
+		for( size_t px = ext.min().x() / 2; px <= (size_t)ext.max().x() / 2 && px < parent.getCellSizeX(); px++ )
+		    updateCell( l, px, py );
+	}
+    }
+}
+
+void MLSPyramid::updateCell( size_t level, size_t px, size_t py )
+{
+    const MLSGrid& child( getLevel( level - 1 ) );
+    MLSGrid& parent( *levels[level - 1] );
+
+    // the merge of patches can not be reverted, so the cell is recomputed
+    // from its children
+    parent.clearCell( px, py );
+    for( size_t cy = 2 * py; cy < 2 * py + 2 && cy < child.getCellSizeY(); cy++ )
+    {
+	for( size_t cx = 2 * px; cx < 2 * px + 2 && cx < child.getCellSizeX(); cx++ )
+	{
+	    for( MLSGrid::const_iterator it = child.beginCell( cx, cy ); it != child.endCell(); it++ )
+		parent.updateCell( px, py, *it );
+	}
+    }
+}
+
+const MLSGrid& MLSPyramid::getLevel( size_t level ) const
+{
+    if( level >= levelCount )
+	throw std::out_of_range("MLSPyramid::getLevel() level out of range.");
+    return level == 0 ? *base : *levels[level - 1];
+}
+
+size_t MLSPyramid::getLevelForResolution( double resolution ) const
+{
+    size_t level = 0;
+    while( level + 1 < levelCount && getLevel( level + 1 ).getScaleX() <= resolution )
+	level++;
+    return level;
+}
+
+size_t MLSPyramid::getLevelForDistance( double distance ) const
+{
+    size_t level = 0;
+    double limit = lodDistance;
+    while( level + 1 < levelCount && distance > limit )
+    {
+	level++;
+	limit *= 2.0;
+    }
+    return level;
+}
+
+const SurfacePatch* MLSPyramid::getTopPatch( const Eigen::Vector2d& position, size_t level ) const
+{
+    const MLSGrid& grid( getLevel( level ) );
+    MLSGrid::Position pos;
+    if( !grid.toGrid( position, pos ) )
+	return NULL;
+
+    MLSGrid::const_iterator it = std::max_element( grid.beginCell( pos ), grid.endCell() );
+    if( it == grid.endCell() )
+	return NULL;
+    return &(*it);
+}
@@ -0,0 +1,89 @@
+#ifndef ENVIRE_TOOLS_MLSPYRAMID_HPP__
+#define ENVIRE_TOOLS_MLSPYRAMID_HPP__
+
+#include <envire/maps/MLSGrid.hpp>
+#include <vector>
+
+namespace envire
+{
+
+/**
+ * Multi-resolution representation of an MLSGrid for level-of-detail
+ * queries.
+ *
+ * Level 0 is the base grid itself. Each following level is an MLSGrid with
+ * half the number of cells along each axis, in which a cell holds the
+ * patches of the corresponding 2x2 cells of the previous level, merged
+ * using the configuration of the base grid. For base grids using the SLOPE
+ * update model, the coarser levels use the SUM model, since the plane
+ * parameters of the patches are relative to their cells.
+ *
+ * The pyramid is maintained incrementally: update() only recomputes the
+ * cells of the coarser levels, which cover tiles of the base grid that have
+ * been modified since the last update (see MLSGrid::getModifiedTiles).
+ *
+ * The base grid needs to outlive the pyramid.
+ */
+class MLSPyramid
+{
+public:
+    /**
+     * @param base the grid at full resolution
+     * @param levels number of levels including the base grid
+     * @param lodDistance distance up to which the base level is
+     *        selected by getLevelForDistance(). Each following level is
+     *        used up to twice the distance of the previous one.
+     */
+    MLSPyramid( const MLSGrid& base, size_t levels = 4, double lodDistance = 5.0 );
+
+    /** Recomputes the cells of all levels, which are affected by
+     * modifications of the base grid since the last call.
+     */
+    void update();
+
+    /** Recreates all levels from scratch */
+    void rebuild();
+
+    size_t getLevelCount() const { return levels.size() + 1; }
+
+    /** @return the grid of the given level, where level 0 is the base grid */
+    const MLSGrid& getLevel( size_t level ) const;
+
+    /** @return the coarsest level whose cell size is not larger than the
+     * given resolution, or 0 if the resolution is finer than the base grid
+     */
+    size_t getLevelForResolution( double resolution ) const;
+
+    /** @return the level to use for a query at the given distance from the
+     * viewer or robot
+     */
+    size_t getLevelForDistance( double distance ) const;
+
+    const MLSGrid& getGridForResolution( double resolution ) const { return getLevel( getLevelForResolution( resolution ) ); }
+    const MLSGrid& getGridForDistance( double distance ) const { return getLevel( getLevelForDistance( distance ) ); }
+
+    /** @return the topmost patch of the given level at the position, which
+     * is given in the frame of the base grid, or NULL if there is none
+     */
+    const SurfacePatch* getTopPatch( const Eigen::Vector2d& position, size_t level ) const;
+
+    void setLodDistance( double distance ) { lodDistance = distance; }
+    double getLodDistance() const { return lodDistance; }
+
+private:
+    void updateCell( size_t level, size_t px, size_t py );
+
+    const MLSGrid* base;
+    double lodDistance;
+    size_t levelCount;
+
+    /// levels 1 to n-1
+    std::vector<MLSGrid::Ptr> levels;
+    /// for each level, the revision up to which it has been propagated to
+    /// the next level
+    std::vector<size_t> revisions;
+};
+
+}
+
+#endif
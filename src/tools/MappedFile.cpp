@@ -0,0 +1,53 @@
+#include "MappedFile.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+using namespace envire;
+
+MappedFile::MappedFile( std::string const& path, Mode mode )
+    : mode( mode ), data( NULL ), size( 0 )
+{
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 )
+	throw std::runtime_error("can not open file " + path + ": " + strerror( errno ));
+
+    struct stat st;
+    if( fstat( fd, &st ) < 0 )
+    {
+	close( fd );
+	throw std::runtime_error("can not stat file " + path + ": " + strerror( errno ));
+    }
+    size = st.st_size;
+
+    // mmap does not accept empty mappings
+    if( size > 0 )
+    {
+	if( mode == READ_ONLY )
+	    data = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+	else
+	    data = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+	if( data == MAP_FAILED )
+	{
+	    data = NULL;
+	    close( fd );
+	    throw std::runtime_error("can not map file " + path + ": " + strerror( errno ));
+	}
+    }
+
+    // the mapping stays valid after the descriptor got closed
+    close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+    if( data )
+	munmap( data, size );
+}
@@ -0,0 +1,50 @@
+#ifndef ENVIRE_TOOLS_MAPPEDFILE_HPP__
+#define ENVIRE_TOOLS_MAPPEDFILE_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <string>
+
+namespace envire
+{
+    /**
+     * A file mapped into memory as a whole.
+     *
+     * Mapping a file is fast regardless of its size, as the data is only
+     * read by the OS when it gets accessed. Read-only mappings of the same
+     * file share the page cache between processes.
+     */
+    class MappedFile : boost::noncopyable
+    {
+    public:
+	enum Mode
+	{
+	    /// the data can only be read
+	    READ_ONLY,
+	    /// the data can be modified, pages get copied when they are
+	    /// written to, and the changes are not written to the file
+	    COPY_ON_WRITE
+	};
+
+	/** Maps the file at \c path
+	 *
+	 * @throw std::runtime_error if the file can not be opened or mapped
+	 */
+	MappedFile( std::string const& path, Mode mode = READ_ONLY );
+	~MappedFile();
+
+	Mode getMode() const { return mode; }
+	size_t getSize() const { return size; }
+
+	const void* getData() const { return data; }
+
+	/** @return the data for modification, or NULL for READ_ONLY mappings */
+	void* getWritableData() { return mode == COPY_ON_WRITE ? data : NULL; }
+
+    private:
+	Mode mode;
+	void* data;
+	size_t size;
+    };
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef ENVIRE_TOOLS_PARALLELFOR_HPP__
+#define ENVIRE_TOOLS_PARALLELFOR_HPP__
+
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/exception_ptr.hpp>
+
+namespace envire
+{
+
+namespace detail
+{
+    inline size_t& parallelThreadCount()
+    {
+	static size_t count = 0;
+	return count;
+    }
+}
+
+/** @return the number of threads the parallel helpers will use at most.
+ * If not set explicitly, this is the number of hardware threads.
+ */
+inline size_t getParallelThreadCount()
+{
+    size_t count = detail::parallelThreadCount();
+    if( !count )
+	count = std::max( 1u, boost::thread::hardware_concurrency() );
+    return count;
+}
+
+/** Sets the maximum number of threads used by the parallel helpers. A value
+ * of 1 runs everything in the calling thread, 0 resets to the number of
+ * hardware threads.
+ */
+inline void setParallelThreadCount( size_t count )
+{
+    detail::parallelThreadCount() = count;
+}
+
+namespace detail
+{
+    template <class F>
+    struct ParallelBlockWorker
+    {
+	F& f;
+	size_t begin, end, blockSize;
+	size_t& next;
+	boost::mutex& mutex;
+	boost::exception_ptr& error;
+
+	ParallelBlockWorker( F& f, size_t begin, size_t end, size_t blockSize,
+		size_t& next, boost::mutex& mutex, boost::exception_ptr& error )
+	    : f(f), begin(begin), end(end), blockSize(blockSize),
+	    next(next), mutex(mutex), error(error) {}
+
+	void operator()()
+	{
+	    while( true )
+	    {
+		size_t block;
+		{
+		    boost::mutex::scoped_lock lock( mutex );
+		    if( next >= end || error )
+			return;
+		    block = next;
+		    next = std::min( end, next + blockSize );
+		}
+
+		try
+		{
+		    f( block, std::min( end, block + blockSize ) );
+		}
+		catch(...)
+		{
+		    boost::mutex::scoped_lock lock( mutex );
+		    if( !error )
+			error = boost::current_exception();
+		    return;
+		}
+	    }
+	}
+    };
+
+    template <class RandomIt, class Compare>
+    struct ParallelSortPart
+    {
+	RandomIt begin;
+	size_t size, partSize;
+	Compare comp;
+
+	ParallelSortPart( RandomIt begin, size_t size, size_t partSize, Compare comp )
+	    : begin(begin), size(size), partSize(partSize), comp(comp) {}
+
+	void operator()( size_t i )
+	{
+	    const size_t b = std::min( size, i * partSize ), e = std::min( size, b + partSize );
+	    std::sort( begin + b, begin + e, comp );
+	}
+    };
+
+    template <class RandomIt, class Compare>
+    struct ParallelMergeParts
+    {
+	RandomIt begin;
+	size_t size, width;
+	Compare comp;
+
+	ParallelMergeParts( RandomIt begin, size_t size, size_t width, Compare comp )
+	    : begin(begin), size(size), width(width), comp(comp) {}
+
+	void operator()( size_t i )
+	{
+	    const size_t b = i * 2 * width;
+	    const size_t m = std::min( size, b + width ), e = std::min( size, b + 2 * width );
+	    std::inplace_merge( begin + b, begin + m, begin + e, comp );
+	}
+    };
+
+    template <class F>
+    struct ParallelIndexAdapter
+    {
+	F& f;
+	explicit ParallelIndexAdapter( F& f ) : f(f) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i = begin; i < end; i++ )
+		f( i );
+	}
+    };
+}
+
+/**
+ * Calls f( blockBegin, blockEnd ) for consecutive blocks of at most
+ * blockSize elements covering [begin, end). The blocks are distributed over
+ * up to getParallelThreadCount() threads, so f has to be safe to call
+ * concurrently for disjoint blocks. The function returns when all blocks
+ * have been processed. An exception thrown by f is rethrown in the calling
+ * thread.
+ */
+template <class F>
+void parallelForBlocks( size_t begin, size_t end, size_t blockSize, F f )
+{
+    if( begin >= end )
+	return;
+    if( blockSize == 0 )
+	blockSize = 1;
+
+    const size_t blocks = (end - begin + blockSize - 1) / blockSize;
+    const size_t threads = std::min( blocks, getParallelThreadCount() );
+    if( threads <= 1 )
+    {
+	for( size_t b = begin; b < end; b += blockSize )
+	    f( b, std::min( end, b + blockSize ) );
+	return;
+    }
+
+    size_t next = begin;
+    boost::mutex mutex;
+    boost::exception_ptr error;
+    detail::ParallelBlockWorker<F> worker( f, begin, end, blockSize, next, mutex, error );
+
+    boost::thread_group group;
+    for( size_t i = 1; i < threads; i++ )
+	group.create_thread( boost::ref( worker ) );
+    // the calling thread takes part in the work as well
+    worker();
+    group.join_all();
+
+    if( error )
+	boost::rethrow_exception( error );
+}
+
+/**
+ * Calls f( i ) for each i in [begin, end), distributed over up to
+ * getParallelThreadCount() threads in blocks of grainSize indices.
+ */
+template <class F>
+void parallelFor( size_t begin, size_t end, F f, size_t grainSize = 1 )
+{
+    detail::ParallelIndexAdapter<F> adapter( f );
+    parallelForBlocks( begin, end, grainSize, adapter );
+}
+
+/**
+ * Sorts [begin, end) with comp like std::sort. The range is split into one
+ * part per thread, the parts are sorted in parallel and then merged
+ * pairwise. Elements which are equivalent under comp may end up in any
+ * order, so comp should define a total order if the result has to be
+ * reproducible.
+ */
+template <class RandomIt, class Compare>
+void parallelSort( RandomIt begin, RandomIt end, Compare comp )
+{
+    const size_t size = end - begin;
+    const size_t threads = getParallelThreadCount();
+    // below this size, the threads cost more than they gain
+    if( threads <= 1 || size < 1 << 14 )
+    {
+	std::sort( begin, end, comp );
+	return;
+    }
+
+    const size_t partSize = (size + threads - 1) / threads;
+    parallelFor( 0, threads, detail::ParallelSortPart<RandomIt, Compare>( begin, size, partSize, comp ) );
+    for( size_t width = partSize; width < size; width *= 2 )
+	parallelFor( 0, (size + 2 * width - 1) / (2 * width),
+		detail::ParallelMergeParts<RandomIt, Compare>( begin, size, width, comp ) );
+}
+
+}
+
+#endif
@@ -1,10 +1,328 @@
 #include "PlyFile.hpp"
 #include <fstream>
+#include <sstream>
+#include <cstring>
 #include <tr1/functional>
 
 using namespace envire;
 using namespace std::tr1::placeholders;
 
+namespace
+{
+    enum PlyType
+    {
+	PLY_INVALID, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+	PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64
+    };
+
+    PlyType parsePlyType( const std::string& name )
+    {
+	if( name == "char" || name == "int8" ) return PLY_INT8;
+	if( name == "uchar" || name == "uint8" ) return PLY_UINT8;
+	if( name == "short" || name == "int16" ) return PLY_INT16;
+	if( name == "ushort" || name == "uint16" ) return PLY_UINT16;
+	if( name == "int" || name == "int32" ) return PLY_INT32;
+	if( name == "uint" || name == "uint32" ) return PLY_UINT32;
+	if( name == "float" || name == "float32" ) return PLY_FLOAT32;
+	if( name == "double" || name == "float64" ) return PLY_FLOAT64;
+	return PLY_INVALID;
+    }
+
+    size_t plyTypeSize( PlyType type )
+    {
+	switch( type )
+	{
+	    case PLY_INT8: case PLY_UINT8: return 1;
+	    case PLY_INT16: case PLY_UINT16: return 2;
+	    case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+	    case PLY_FLOAT64: return 8;
+	    default: return 0;
+	}
+    }
+
+    template <class T>
+    inline double readRaw( const char* p )
+    {
+	T value;
+	memcpy( &value, p, sizeof(T) );
+	return value;
+    }
+
+    /** reads a value in host byte order */
+    inline double readPlyValue( PlyType type, const char* p )
+    {
+	switch( type )
+	{
+	    case PLY_INT8: return readRaw<int8_t>( p );
+	    case PLY_UINT8: return readRaw<uint8_t>( p );
+	    case PLY_INT16: return readRaw<int16_t>( p );
+	    case PLY_UINT16: return readRaw<uint16_t>( p );
+	    case PLY_INT32: return readRaw<int32_t>( p );
+	    case PLY_UINT32: return readRaw<uint32_t>( p );
+	    case PLY_FLOAT32: return readRaw<float>( p );
+	    case PLY_FLOAT64: return readRaw<double>( p );
+	    default: return 0;
+	}
+    }
+
+    struct PlyProperty
+    {
+	std::string name;
+	PlyType type;
+	/// type of the item count for list properties, PLY_INVALID otherwise
+	PlyType countType;
+    };
+
+    struct PlyElement
+    {
+	std::string name;
+	size_t count;
+	std::vector<PlyProperty> properties;
+
+	/** @return the index of the property with the given name or -1 */
+	int find( const std::string& property ) const
+	{
+	    for( size_t i = 0; i < properties.size(); i++ )
+		if( properties[i].name == property )
+		    return i;
+	    return -1;
+	}
+    };
+
+    /** Reads the header up to and including the end_header line.
+     *
+     * @return false if the header can not be parsed
+     */
+    bool readPlyHeader( std::istream& is, std::string& format, std::vector<PlyElement>& elements )
+    {
+	std::string line;
+	if( !std::getline( is, line ) || line.substr( 0, 3 ) != "ply" )
+	    return false;
+
+	while( std::getline( is, line ) )
+	{
+	    if( !line.empty() && line[line.size() - 1] == '\r' )
+		line.erase( line.size() - 1 );
+
+	    std::istringstream ls( line );
+	    std::string keyword;
+	    ls >> keyword;
+	    if( keyword == "end_header" )
+		return !format.empty();
+	    else if( keyword == "format" )
+		ls >> format;
+	    else if( keyword == "element" )
+	    {
+		PlyElement element;
+		if( !(ls >> element.name >> element.count) )
+		    return false;
+		elements.push_back( element );
+	    }
+	    else if( keyword == "property" )
+	    {
+		if( elements.empty() )
+		    return false;
+		PlyProperty property;
+		std::string type;
+		ls >> type;
+		if( type == "list" )
+		{
+		    std::string countType;
+		    ls >> countType >> type;
+		    property.countType = parsePlyType( countType );
+		    if( property.countType == PLY_INVALID )
+			return false;
+		}
+		else
+		    property.countType = PLY_INVALID;
+		property.type = parsePlyType( type );
+		if( property.type == PLY_INVALID || !(ls >> property.name) )
+		    return false;
+		elements.back().properties.push_back( property );
+	    }
+	    else if( keyword != "comment" && keyword != "obj_info" && !keyword.empty() )
+		return false;
+	}
+	return false;
+    }
+
+    /** Buffered access to the binary body of a ply file */
+    class PlyInput
+    {
+    public:
+	explicit PlyInput( std::istream& is )
+	    : is( is ), buffer( 1 << 20 ), pos( 0 ), size( 0 ) {}
+
+	/** @return a pointer to the next n bytes, which are consumed */
+	const char* get( size_t n )
+	{
+	    if( size - pos < n )
+		fill( n );
+	    const char* p = &buffer[pos];
+	    pos += n;
+	    return p;
+	}
+
+	/** copies the next n bytes to dst */
+	void read( void* dst, size_t n )
+	{
+	    const size_t buffered = std::min( n, size - pos );
+	    memcpy( dst, &buffer[0] + pos, buffered );
+	    pos += buffered;
+	    if( n > buffered )
+	    {
+		// large blocks go directly from the stream to the target
+		is.read( static_cast<char*>( dst ) + buffered, n - buffered );
+		if( is.gcount() != std::streamsize( n - buffered ) )
+		    throw std::runtime_error("unexpected end of ply file");
+	    }
+	}
+
+    private:
+	void fill( size_t n )
+	{
+	    std::copy( buffer.begin() + pos, buffer.begin() + size, buffer.begin() );
+	    size -= pos;
+	    pos = 0;
+	    if( buffer.size() < n )
+		buffer.resize( n );
+	    is.read( &buffer[size], buffer.size() - size );
+	    size += is.gcount();
+	    if( size < n )
+		throw std::runtime_error("unexpected end of ply file");
+	}
+
+	std::istream& is;
+	std::vector<char> buffer;
+	size_t pos, size;
+    };
+
+    /** Reads a vertex like element into \c target, which is extended by the
+     * number of elements. The properties named in \c names are used as
+     * components. Other properties are skipped.
+     */
+    void readPlyVectors( PlyInput& in, const PlyElement& element, const char* names[3], bool scale, std::vector<Eigen::Vector3d>& target )
+    {
+	size_t offsets[3];
+	PlyType types[3];
+	size_t recordSize = 0;
+	for( size_t i = 0; i < element.properties.size(); i++ )
+	{
+	    const PlyProperty& property( element.properties[i] );
+	    for( int c = 0; c < 3; c++ )
+	    {
+		if( property.name == names[c] )
+		{
+		    offsets[c] = recordSize;
+		    types[c] = property.type;
+		}
+	    }
+	    recordSize += plyTypeSize( property.type );
+	}
+
+	const size_t base = target.size();
+	target.resize( base + element.count );
+	if( element.count == 0 )
+	    return;
+
+	if( !scale && recordSize == sizeof(Eigen::Vector3d)
+		&& types[0] == PLY_FLOAT64 && types[1] == PLY_FLOAT64 && types[2] == PLY_FLOAT64
+		&& offsets[0] == 0 && offsets[1] == 8 && offsets[2] == 16 )
+	{
+	    // the records have the memory layout of Eigen::Vector3d
+	    in.read( target[base].data(), element.count * recordSize );
+	    return;
+	}
+
+	const double factor = scale ? 1.0 / 255.0 : 1.0;
+	for( size_t i = 0; i < element.count; i++ )
+	{
+	    const char* p = in.get( recordSize );
+	    Eigen::Vector3d& v( target[base + i] );
+	    for( int c = 0; c < 3; c++ )
+		v[c] = readPlyValue( types[c], p + offsets[c] ) * factor;
+	}
+    }
+
+    /** skips an element, or reads the faces if \c faces is given */
+    void readPlyElement( PlyInput& in, const PlyElement& element, std::vector<TriMesh::triangle_t>* faces, size_t vertexCount )
+    {
+	bool fixedSize = true;
+	size_t recordSize = 0;
+	for( size_t i = 0; i < element.properties.size(); i++ )
+	{
+	    fixedSize &= element.properties[i].countType == PLY_INVALID;
+	    recordSize += plyTypeSize( element.properties[i].type );
+	}
+
+	if( fixedSize )
+	{
+	    for( size_t i = 0; i < element.count; i++ )
+		in.get( recordSize );
+	    return;
+	}
+
+	const int indexProperty = element.find( "vertex_index" );
+	for( size_t i = 0; i < element.count; i++ )
+	{
+	    for( size_t j = 0; j < element.properties.size(); j++ )
+	    {
+		const PlyProperty& property( element.properties[j] );
+		if( property.countType == PLY_INVALID )
+		{
+		    in.get( plyTypeSize( property.type ) );
+		    continue;
+		}
+
+		const size_t count = readPlyValue( property.countType, in.get( plyTypeSize( property.countType ) ) );
+		const size_t itemSize = plyTypeSize( property.type );
+		const char* items = in.get( count * itemSize );
+		if( !faces || (int)j != indexProperty )
+		    continue;
+
+		if( count != 3 )
+		    std::cerr << "no support for faces with edgecount different to 3 (is " << count << ")." << std::endl;
+
+		int index[3] = { 0, 0, 0 };
+		for( size_t k = 0; k < count; k++ )
+		{
+		    const double value = readPlyValue( property.type, items + k * itemSize );
+		    if( static_cast<size_t>( value ) >= vertexCount )
+			std::cerr << "vertex_index " << value << " is out of range!" << std::endl;
+		    if( k < 3 )
+			index[k] = value;
+		}
+		faces->push_back( TriMesh::triangle_t( index[0], index[1], index[2] ) );
+	    }
+	}
+    }
+
+    /** writes the vectors as three values of type T each */
+    template <class T>
+    void writePlyVectors( std::ostream& os, const std::vector<Eigen::Vector3d>& v )
+    {
+	// convert in blocks, so that the stream only sees large writes
+	const size_t blockSize = 1 << 14;
+	std::vector<T> buffer;
+	for( size_t i = 0; i < v.size(); i += blockSize )
+	{
+	    const size_t n = std::min( blockSize, v.size() - i );
+	    buffer.resize( n * 3 );
+	    for( size_t j = 0; j < n; j++ )
+		for( int c = 0; c < 3; c++ )
+		    buffer[j * 3 + c] = v[i + j][c];
+	    os.write( reinterpret_cast<const char*>( &buffer[0] ), n * 3 * sizeof(T) );
+	}
+    }
+
+    template <>
+    void writePlyVectors<double>( std::ostream& os, const std::vector<Eigen::Vector3d>& v )
+    {
+	if( !v.empty() )
+	    os.write( reinterpret_cast<const char*>( v[0].data() ), v.size() * sizeof(Eigen::Vector3d) );
+    }
+}
+
 template <typename ScalarType>
 void PlyFile::scalar_property_callback(ScalarType scalar)
 {
@@ -221,29 +539,9 @@ bool PlyFile::serialize(Pointcloud *pointcloud, std::ostream& data , bool const
 
     // write the binary raw data now
     if(doublePrecision)
-    {
-      for(size_t i=0;i<pointcloud->vertices.size();i++)
-      {
-        Eigen::Vector3d &vertex( pointcloud->vertices[i] );
-        data.write( reinterpret_cast<char*>(&vertex.x()), sizeof(double) );
-        data.write( reinterpret_cast<char*>(&vertex.y()), sizeof(double) );
-        data.write( reinterpret_cast<char*>(&vertex.z()), sizeof(double) );
-      }
-    }
+	writePlyVectors<double>( data, pointcloud->vertices );
     else
-    {
-      size_t const vSize = pointcloud->vertices.size();
-      for(size_t i = 0; i != vSize; ++i)
-      {
-        Eigen::Vector3d const &vertex( pointcloud->vertices[i] );
-        float tmp = static_cast<float>(vertex.x());
-        data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-        tmp = static_cast<float>(vertex.y());
-        data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-        tmp = static_cast<float>(vertex.z());
-        data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-      }
-    }
+	writePlyVectors<float>( data, pointcloud->vertices );
 
     if( pointcloud->hasData( Pointcloud::VERTEX_NORMAL ) )
     {
@@ -251,29 +549,9 @@ bool PlyFile::serialize(Pointcloud *pointcloud, std::ostream& data , bool const
 	if( normals.size() != pointcloud->vertices.size() )
 	    throw std::runtime_error("number of normals don't match number of vertices.");
         if(doublePrecision)
-        {
-          for(size_t i=0;i<normals.size();i++)
-          {
-            Eigen::Vector3d &normal( normals[i] );
-            data.write( reinterpret_cast<char*>(&normal.x()), sizeof(double) );
-            data.write( reinterpret_cast<char*>(&normal.y()), sizeof(double) );
-            data.write( reinterpret_cast<char*>(&normal.z()), sizeof(double) );
-          }
-        }
+	    writePlyVectors<double>( data, normals );
         else
-        {
-          size_t const nSize = normals.size();
-          for(size_t i = 0; i != nSize; ++i)
-          {
-            Eigen::Vector3d const &normal( normals[i] );
-            float tmp = static_cast<float>(normal.x());
-            data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-            tmp = static_cast<float>(normal.y());
-            data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-            tmp = static_cast<float>(normal.z());
-            data.write( reinterpret_cast<char*>(&tmp), sizeof(float) );
-          }
-        }
+	    writePlyVectors<float>( data, normals );
     }
 
     if( pointcloud->hasData( Pointcloud::VERTEX_COLOR ) )
@@ -282,33 +560,94 @@ bool PlyFile::serialize(Pointcloud *pointcloud, std::ostream& data , bool const
 	if( colors.size() != pointcloud->vertices.size() )
 	    throw std::runtime_error("number of colors don't match number of vertices.");
 
+	std::vector<unsigned char> buffer( colors.size() * 3 );
 	for(size_t i=0;i<colors.size();i++)
 	{
-	    unsigned char r = colors[i].x()*255; 
-	    unsigned char g = colors[i].y()*255; 
-	    unsigned char b = colors[i].z()*255; 
-	    data.write( reinterpret_cast<char*>(&r), sizeof(unsigned char) );
-	    data.write( reinterpret_cast<char*>(&g), sizeof(unsigned char) );
-	    data.write( reinterpret_cast<char*>(&b), sizeof(unsigned char) );
+	    buffer[i * 3] = colors[i].x()*255; 
+	    buffer[i * 3 + 1] = colors[i].y()*255; 
+	    buffer[i * 3 + 2] = colors[i].z()*255; 
 	}
+	if( !buffer.empty() )
+	    data.write( reinterpret_cast<char*>(&buffer[0]), buffer.size() );
     }
 
     if( trimesh )
     {
+	// one byte for the edge count and three int32 indices per face
+	const size_t faceSize = 1 + 3 * sizeof( int32_t );
+	std::vector<char> buffer( trimesh->faces.size() * faceSize );
 	for(size_t i=0;i<trimesh->faces.size();i++)
 	{
-	    unsigned char trinum = 3;
 	    TriMesh::triangle_t &tri( trimesh->faces[i] );
-	    int32_t e1 = tri.get<0>();
-	    int32_t e2 = tri.get<1>();
-	    int32_t e3 = tri.get<2>();
-	    data.write( reinterpret_cast<char*>(&trinum), sizeof(unsigned char) );
-	    data.write( reinterpret_cast<char*>(&e1), sizeof( int32_t ) );
-	    data.write( reinterpret_cast<char*>(&e2), sizeof( int32_t ) );
-	    data.write( reinterpret_cast<char*>(&e3), sizeof( int32_t ) );
+	    const int32_t e[3] = { tri.get<0>(), tri.get<1>(), tri.get<2>() };
+	    buffer[i * faceSize] = 3;
+	    memcpy( &buffer[i * faceSize + 1], e, sizeof( e ) );
+	}
+	if( !buffer.empty() )
+	    data.write( &buffer[0], buffer.size() );
+    }
+
+    return true;
+}
+
+bool PlyFile::unserializeBinary( std::istream& data )
+{
+    if( ply::host_byte_order != ply::little_endian_byte_order )
+	return false;
+
+    const std::istream::pos_type start = data.tellg();
+    if( start == std::istream::pos_type(-1) )
+	return false;
+
+    std::string format;
+    std::vector<PlyElement> elements;
+    if( !readPlyHeader( data, format, elements ) || format != "binary_little_endian" )
+    {
+	// let the generic parser handle it
+	data.clear();
+	data.seekg( start );
+	return false;
+    }
+
+    const char* xyz[3] = { "x", "y", "z" };
+    const char* rgb[3] = { "red", "green", "blue" };
+
+    // the vector elements need all components as scalar properties
+    for( size_t i = 0; i < elements.size(); i++ )
+    {
+	const PlyElement& element( elements[i] );
+	if( element.name != "vertex" && element.name != "normal" && element.name != "color" )
+	    continue;
+
+	bool supported = true;
+	const char** names = element.name == "color" ? rgb : xyz;
+	for( int c = 0; c < 3; c++ )
+	    supported &= element.find( names[c] ) >= 0;
+	for( size_t j = 0; j < element.properties.size(); j++ )
+	    supported &= element.properties[j].countType == PLY_INVALID;
+
+	if( !supported )
+	{
+	    data.clear();
+	    data.seekg( start );
+	    return false;
 	}
     }
 
+    PlyInput in( data );
+    for( size_t i = 0; i < elements.size(); i++ )
+    {
+	const PlyElement& element( elements[i] );
+	if( element.name == "vertex" )
+	    readPlyVectors( in, element, xyz, false, pco_->vertices );
+	else if( element.name == "normal" )
+	    readPlyVectors( in, element, xyz, false, pco_->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+	else if( element.name == "color" )
+	    readPlyVectors( in, element, rgb, true, pco_->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+	else
+	    readPlyElement( in, element, (element.name == "face" && tmo_) ? &tmo_->faces : NULL, pco_->vertices.size() );
+    }
+
     return true;
 }
 
@@ -316,6 +655,10 @@ bool PlyFile::unserialize( Pointcloud *pointcloud , std::istream& data )
 {
     pco_ = pointcloud;
     tmo_ = dynamic_cast<TriMesh*>(pointcloud);
+
+    // binary little endian files are read in bulk without the callbacks
+    if( unserializeBinary( data ) )
+	return true;
     
     ply::ply_parser::flags_type ply_parser_flags = 0;
     ply::ply_parser ply_parser(ply_parser_flags);
@@ -28,6 +28,11 @@ namespace envire
 	TriMesh* tmo_;
 
     private:
+	/** reads binary little endian files directly into the pointcloud
+	 * @return false if the format of \c data is not supported
+	 */
+	bool unserializeBinary( std::istream& data );
+
 	void info_callback(const std::string& filename, std::size_t line_number, const std::string& message);
 	void warning_callback(const std::string& filename, std::size_t line_number, const std::string& message);
 	void error_callback(const std::string& filename, std::size_t line_number, const std::string& message);
@@ -0,0 +1,178 @@
+#include "PointGridIndex.hpp"
+#include "ParallelFor.hpp"
+
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <functional>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    /// number of bits per axis in the packed cell key
+    const int KEY_BITS = 21;
+    const boost::uint64_t KEY_MASK = (boost::uint64_t(1) << KEY_BITS) - 1;
+    /// key of points with invalid coordinates, which sorts after all cells
+    const boost::uint64_t INVALID_KEY = std::numeric_limits<boost::uint64_t>::max();
+
+    const size_t BLOCK_SIZE = 1 << 16;
+
+    struct CellEntry
+    {
+	boost::uint64_t key;
+	size_t index;
+
+	bool operator<( const CellEntry& other ) const
+	{
+	    return key < other.key || (key == other.key && index < other.index);
+	}
+    };
+
+    bool isFinite( const Eigen::Vector3d& p )
+    {
+	return boost::math::isfinite( p.x() ) && boost::math::isfinite( p.y() ) && boost::math::isfinite( p.z() );
+    }
+
+    struct ComputeBounds
+    {
+	const std::vector<Eigen::Vector3d>& points;
+	std::vector<Eigen::Vector3d>& mins;
+	std::vector<Eigen::Vector3d>& maxs;
+
+	ComputeBounds( const std::vector<Eigen::Vector3d>& points,
+		std::vector<Eigen::Vector3d>& mins, std::vector<Eigen::Vector3d>& maxs )
+	    : points( points ), mins( mins ), maxs( maxs ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    Eigen::Vector3d& min( mins[begin / BLOCK_SIZE] );
+	    Eigen::Vector3d& max( maxs[begin / BLOCK_SIZE] );
+	    for( size_t i = begin; i < end; i++ )
+	    {
+		if( !isFinite( points[i] ) )
+		    continue;
+		min = min.cwiseMin( points[i] );
+		max = max.cwiseMax( points[i] );
+	    }
+	}
+    };
+}
+
+struct PointGridIndex::ComputeKeys
+{
+    const PointGridIndex& index;
+    const std::vector<Eigen::Vector3d>& points;
+    std::vector<CellEntry>& entries;
+
+    ComputeKeys( const PointGridIndex& index, const std::vector<Eigen::Vector3d>& points,
+	    std::vector<CellEntry>& entries )
+	: index( index ), points( points ), entries( entries ) {}
+
+    void operator()( size_t begin, size_t end )
+    {
+	for( size_t i = begin; i < end; i++ )
+	{
+	    entries[i].index = i;
+	    if( !isFinite( points[i] ) )
+	    {
+		entries[i].key = INVALID_KEY;
+		continue;
+	    }
+	    // the cells of finite points are in [0, KEY_MASK), see build()
+	    const Eigen::Vector3d cell( index.toCell( points[i] ) );
+	    boost::uint64_t key = 0;
+	    for( int d = 0; d < 3; d++ )
+		key = (key << KEY_BITS) | boost::uint64_t( cell[d] );
+	    entries[i].key = key;
+	}
+    }
+};
+
+PointGridIndex::PointGridIndex()
+    : points( NULL ), cellSize( 1.0 ), scale( 1.0 ), firstCell( Eigen::Vector3d::Zero() )
+{
+}
+
+void PointGridIndex::build( const std::vector<Eigen::Vector3d>& points, double cellSize )
+{
+    if( cellSize <= 0 )
+	throw std::runtime_error("PointGridIndex: the cell size has to be positive.");
+
+    this->points = &points;
+    this->cellSize = cellSize;
+    scale = 1.0 / cellSize;
+    const size_t size = points.size();
+
+    const size_t blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<Eigen::Vector3d>
+	mins( blocks, Eigen::Vector3d::Constant( std::numeric_limits<double>::infinity() ) ),
+	maxs( blocks, Eigen::Vector3d::Constant( -std::numeric_limits<double>::infinity() ) );
+    parallelForBlocks( 0, size, BLOCK_SIZE, ComputeBounds( points, mins, maxs ) );
+    Eigen::Vector3d min( Eigen::Vector3d::Constant( std::numeric_limits<double>::infinity() ) ),
+	max( -min );
+    for( size_t b = 0; b < blocks; b++ )
+    {
+	min = min.cwiseMin( mins[b] );
+	max = max.cwiseMax( maxs[b] );
+    }
+
+    // the cells are aligned to multiples of the cell size. The cell
+    // coordinates are rounded the same way for all points, so no point is in
+    // a cell before the one of the minimum.
+    firstCell.setZero();
+    if( isFinite( min ) )
+    {
+	firstCell = toCell( min );
+	if( toCell( max ).maxCoeff() >= KEY_MASK )
+	    throw std::runtime_error("PointGridIndex: the cell size is too small for the extents of the points.");
+    }
+
+    std::vector<CellEntry> entries( size );
+    parallelForBlocks( 0, size, BLOCK_SIZE, ComputeKeys( *this, points, entries ) );
+    parallelSort( entries.begin(), entries.end(), std::less<CellEntry>() );
+
+    // the points with invalid coordinates are sorted to the end
+    size_t valid = size;
+    while( valid > 0 && entries[valid - 1].key == INVALID_KEY )
+	valid--;
+
+    cellKeys.clear();
+    cellStarts.clear();
+    indices.resize( valid );
+    for( size_t i = 0; i < valid; i++ )
+    {
+	if( i == 0 || entries[i].key != entries[i - 1].key )
+	{
+	    cellKeys.push_back( entries[i].key );
+	    cellStarts.push_back( i );
+	}
+	indices[i] = entries[i].index;
+    }
+    cellStarts.push_back( valid );
+}
+
+size_t PointGridIndex::findCell( const Eigen::Vector3d& p ) const
+{
+    return findCellAt( toCell( p ) );
+}
+
+size_t PointGridIndex::findCellAt( const Eigen::Vector3d& cell ) const
+{
+    boost::uint64_t key = 0;
+    for( int d = 0; d < 3; d++ )
+    {
+	// also false for NaN
+	if( !(cell[d] >= 0 && cell[d] <= KEY_MASK) )
+	    return getCellCount();
+	key = (key << KEY_BITS) | boost::uint64_t( cell[d] );
+    }
+
+    std::vector<boost::uint64_t>::const_iterator it =
+	std::lower_bound( cellKeys.begin(), cellKeys.end(), key );
+    if( it == cellKeys.end() || *it != key )
+	return getCellCount();
+    return it - cellKeys.begin();
+}
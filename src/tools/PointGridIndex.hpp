@@ -0,0 +1,111 @@
+#ifndef ENVIRE_TOOLS_POINTGRIDINDEX_HPP__
+#define ENVIRE_TOOLS_POINTGRIDINDEX_HPP__
+
+#include <Eigen/Core>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+namespace envire
+{
+    /**
+     * Spatial index of a point set in a uniform grid of cubic cells.
+     *
+     * The points are sorted by cell, so the points of a cell are stored
+     * contiguously, in ascending order of their index. Only occupied cells
+     * are stored. The cells are aligned to multiples of the cell size, and
+     * are ordered by x, then y, then z coordinate. Building is done in
+     * parallel (see ParallelFor.hpp), and the result does not depend on the
+     * number of threads.
+     *
+     * The index refers to the point vector it was built from, which has to
+     * stay unchanged while the index is used.
+     */
+    class PointGridIndex
+    {
+    public:
+	PointGridIndex();
+
+	/** Builds the index for \c points. Points with non-finite coordinates
+	 * are not added.
+	 *
+	 * @throw std::runtime_error if the cell size is not positive, or too
+	 * small for the extents of the points
+	 */
+	void build( const std::vector<Eigen::Vector3d>& points, double cellSize );
+
+	double getCellSize() const { return cellSize; }
+
+	/** @return the number of occupied cells */
+	size_t getCellCount() const { return cellKeys.size(); }
+
+	/** the indices of the points in cell \c cell are in
+	 * [getCellBegin( cell ), getCellEnd( cell )) */
+	const size_t* getCellBegin( size_t cell ) const { return &indices[0] + cellStarts[cell]; }
+	const size_t* getCellEnd( size_t cell ) const { return &indices[0] + cellStarts[cell + 1]; }
+
+	/** @return a key which identifies the cell */
+	boost::uint64_t getCellKey( size_t cell ) const { return cellKeys[cell]; }
+
+	/** @return the index of the cell that contains \c p, or getCellCount()
+	 * if no point of the index is in that cell
+	 */
+	size_t findCell( const Eigen::Vector3d& p ) const;
+
+	/** Calls f( index, squaredDistance ) for all points within \c radius
+	 * of \c p. The radius must not exceed the cell size.
+	 */
+	template <class F>
+	void forEachInRadius( const Eigen::Vector3d& p, double radius, F& f ) const
+	{
+	    const Eigen::Vector3d c( toCell( p ) );
+	    const double squaredRadius = radius * radius;
+	    for( int dx = -1; dx <= 1; dx++ )
+		for( int dy = -1; dy <= 1; dy++ )
+		    for( int dz = -1; dz <= 1; dz++ )
+		    {
+			const size_t cell = findCellAt( Eigen::Vector3d( c.x() + dx, c.y() + dy, c.z() + dz ) );
+			if( cell == getCellCount() )
+			    continue;
+			for( const size_t *it = getCellBegin( cell ), *end = getCellEnd( cell ); it != end; ++it )
+			{
+			    const double d = ((*points)[*it] - p).squaredNorm();
+			    if( d <= squaredRadius )
+				f( *it, d );
+			}
+		    }
+	}
+
+    private:
+	struct ComputeKeys;
+
+	/** @return the cell of \c p, relative to the first cell of the index.
+	 * The coordinates are whole numbers. Building and the queries both
+	 * use this, so that a point is always looked up in the cell it was
+	 * sorted into.
+	 */
+	Eigen::Vector3d toCell( const Eigen::Vector3d& p ) const
+	{
+	    return Eigen::Vector3d(
+		    std::floor( p.x() * scale ) - firstCell.x(),
+		    std::floor( p.y() * scale ) - firstCell.y(),
+		    std::floor( p.z() * scale ) - firstCell.z() );
+	}
+
+	/** like findCell, for a cell as returned by toCell */
+	size_t findCellAt( const Eigen::Vector3d& cell ) const;
+
+	const std::vector<Eigen::Vector3d>* points;
+	double cellSize;
+	double scale;
+	/// the cell of the minimum of the points, in multiples of the cell size
+	Eigen::Vector3d firstCell;
+
+	std::vector<boost::uint64_t> cellKeys;
+	std::vector<size_t> cellStarts;
+	std::vector<size_t> indices;
+    };
+}
+
+#endif
@@ -0,0 +1,417 @@
+#include "PointcloudTextReader.hpp"
+#include "MappedFile.hpp"
+#include "ParallelFor.hpp"
+
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/cstdint.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    // powers of ten which are exactly representable as double
+    const double exactPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    inline bool isSeparator( char c )
+    {
+	return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+    }
+
+    inline bool isDigit( char c )
+    {
+	return c >= '0' && c <= '9';
+    }
+
+    /** Parses the number at p, which has to be followed by a separator or
+     * the end of the line. On success p is moved behind the number.
+     */
+    bool parseNumber( const char*& p, const char* end, double& value )
+    {
+	const char* s = p;
+	bool negative = false;
+	if( s != end && (*s == '-' || *s == '+') )
+	    negative = (*s++ == '-');
+
+	boost::uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool valid = false;
+	for( ; s != end && isDigit( *s ); s++, valid = true )
+	{
+	    if( digits < 19 )
+	    {
+		mantissa = mantissa * 10 + (*s - '0');
+		if( mantissa )
+		    digits++;
+	    }
+	    else
+		exponent++;
+	}
+	if( s != end && *s == '.' )
+	{
+	    for( s++; s != end && isDigit( *s ); s++, valid = true )
+	    {
+		if( digits < 19 )
+		{
+		    mantissa = mantissa * 10 + (*s - '0');
+		    if( mantissa )
+			digits++;
+		    exponent--;
+		}
+	    }
+	}
+	if( !valid )
+	    return false;
+
+	if( s != end && (*s == 'e' || *s == 'E') )
+	{
+	    const char* e = s + 1;
+	    bool negativeExp = false;
+	    if( e != end && (*e == '-' || *e == '+') )
+		negativeExp = (*e++ == '-');
+	    if( e != end && isDigit( *e ) )
+	    {
+		int exp = 0;
+		for( ; e != end && isDigit( *e ); e++ )
+		    exp = std::min( exp * 10 + (*e - '0'), 100000 );
+		exponent += negativeExp ? -exp : exp;
+		s = e;
+	    }
+	}
+	if( s != end && !isSeparator( *s ) )
+	    return false;
+
+	if( mantissa < (boost::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22 )
+	{
+	    // both operands are exact, so the result is correctly rounded
+	    value = exponent >= 0 ?
+		mantissa * exactPow10[exponent] : mantissa / exactPow10[-exponent];
+	    if( negative )
+		value = -value;
+	}
+	else
+	{
+	    const std::string token( p, s );
+	    value = strtod( token.c_str(), NULL );
+	}
+	p = s;
+	return true;
+    }
+
+    /** parses up to \c max numbers from the line [p, end)
+     * @return the number of values that were read
+     */
+    int parseLine( const char* p, const char* end, double* values, int max )
+    {
+	int count = 0;
+	while( count < max )
+	{
+	    while( p != end && isSeparator( *p ) )
+		p++;
+	    if( p == end || !parseNumber( p, end, values[count] ) )
+		break;
+	    count++;
+	}
+	return count;
+    }
+
+    struct VoxelKey
+    {
+	boost::int64_t x, y, z;
+
+	VoxelKey( const Eigen::Vector3d& p, double size )
+	    : x( std::floor( p.x() / size ) ),
+	    y( std::floor( p.y() / size ) ),
+	    z( std::floor( p.z() / size ) ) {}
+
+	bool operator==( const VoxelKey& other ) const
+	{
+	    return x == other.x && y == other.y && z == other.z;
+	}
+    };
+
+    std::size_t hash_value( const VoxelKey& key )
+    {
+	std::size_t seed = 0;
+	boost::hash_combine( seed, key.x );
+	boost::hash_combine( seed, key.y );
+	boost::hash_combine( seed, key.z );
+	return seed;
+    }
+
+    typedef boost::unordered_set<VoxelKey> VoxelSet;
+
+    struct Chunk
+    {
+	const char *begin, *end;
+	size_t firstLine;
+	std::vector<Eigen::Vector3d> points;
+	std::vector<double> remission;
+
+	Chunk( const char* begin, const char* end )
+	    : begin( begin ), end( end ), firstLine( 0 ) {}
+
+	/** removes the points for which keep is false */
+	void filter( const std::vector<bool>& keep )
+	{
+	    size_t j = 0;
+	    for( size_t i = 0; i < points.size(); i++ )
+	    {
+		if( !keep[i] )
+		    continue;
+		points[j] = points[i];
+		if( !remission.empty() )
+		    remission[j] = remission[i];
+		j++;
+	    }
+	    points.resize( j );
+	    if( !remission.empty() )
+		remission.resize( j );
+	}
+    };
+
+    struct CountLines
+    {
+	std::vector<Chunk>& chunks;
+	std::vector<size_t>& counts;
+
+	CountLines( std::vector<Chunk>& chunks, std::vector<size_t>& counts )
+	    : chunks( chunks ), counts( counts ) {}
+
+	void operator()( size_t i )
+	{
+	    counts[i] = std::count( chunks[i].begin, chunks[i].end, '\n' );
+	}
+    };
+
+    struct ParseChunk
+    {
+	std::vector<Chunk>& chunks;
+	size_t stride;
+	bool remission;
+	double voxelSize;
+
+	ParseChunk( std::vector<Chunk>& chunks, size_t stride, bool remission, double voxelSize )
+	    : chunks( chunks ), stride( stride ), remission( remission ), voxelSize( voxelSize ) {}
+
+	void operator()( size_t i )
+	{
+	    Chunk& chunk( chunks[i] );
+	    const char* p = chunk.begin;
+	    size_t line = chunk.firstLine;
+	    double values[4];
+	    while( p < chunk.end )
+	    {
+		const char* nl = static_cast<const char*>( memchr( p, '\n', chunk.end - p ) );
+		const char* lineEnd = nl ? nl : chunk.end;
+		if( line % stride == 0 )
+		{
+		    const int count = parseLine( p, lineEnd, values, remission ? 4 : 3 );
+		    if( count >= 3 )
+		    {
+			chunk.points.push_back( Eigen::Vector3d( values[0], values[1], values[2] ) );
+			if( remission )
+			    chunk.remission.push_back( count > 3 ? values[3] : 0.0 );
+		    }
+		}
+		p = lineEnd + 1;
+		line++;
+	    }
+
+	    // drop the duplicates within the chunk here, so that the
+	    // sequential pass over all chunks has less to do
+	    if( voxelSize > 0 )
+	    {
+		VoxelSet voxels;
+		std::vector<bool> keep( chunk.points.size() );
+		for( size_t j = 0; j < chunk.points.size(); j++ )
+		    keep[j] = voxels.insert( VoxelKey( chunk.points[j], voxelSize ) ).second;
+		chunk.filter( keep );
+	    }
+	}
+    };
+
+    struct StoreChunk
+    {
+	std::vector<Chunk>& chunks;
+	std::vector<size_t>& offsets;
+	Pointcloud& pc;
+	bool useChannels;
+	std::vector<Eigen::Vector3d>* colors;
+
+	StoreChunk( std::vector<Chunk>& chunks, std::vector<size_t>& offsets,
+		Pointcloud& pc, bool useChannels, std::vector<Eigen::Vector3d>* colors )
+	    : chunks( chunks ), offsets( offsets ), pc( pc ), useChannels( useChannels ), colors( colors ) {}
+
+	void operator()( size_t i )
+	{
+	    Chunk& chunk( chunks[i] );
+	    const size_t offset = offsets[i];
+	    for( size_t j = 0; j < chunk.points.size(); j++ )
+	    {
+		if( useChannels )
+		    pc.channels.set( offset + j, chunk.points[j] );
+		else
+		    pc.vertices[offset + j] = chunk.points[j];
+	    }
+	    if( colors )
+	    {
+		for( size_t j = 0; j < chunk.remission.size(); j++ )
+		    (*colors)[offset + j] = Eigen::Vector3d::Identity() * chunk.remission[j] / 255.0;
+	    }
+
+	    // free the memory of the chunk early
+	    std::vector<Eigen::Vector3d>().swap( chunk.points );
+	    std::vector<double>().swap( chunk.remission );
+	}
+    };
+
+    /** Appends the points in [begin, end) to pc. \c line is the index of
+     * the first line of the text in the whole input, and is moved behind
+     * the last line. \c voxels holds the voxels which already have a point.
+     */
+    size_t readText( const PointcloudTextReader& reader, const char* begin, const char* end,
+	    Pointcloud& pc, size_t& line, VoxelSet& voxels )
+    {
+	const size_t chunkSize = reader.getChunkSize();
+	const size_t stride = reader.getStride();
+	const double voxelSize = reader.getVoxelSize();
+	const bool useChannels = reader.getUseChannels();
+
+	// split the input into chunks which end at a line break
+	std::vector<Chunk> chunks;
+	for( const char* p = begin; p < end; )
+	{
+	    const char* e = p + std::min( chunkSize, size_t(end - p) );
+	    if( e < end )
+	    {
+		const char* nl = static_cast<const char*>( memchr( e, '\n', end - e ) );
+		e = nl ? nl + 1 : end;
+	    }
+	    chunks.push_back( Chunk( p, e ) );
+	    p = e;
+	}
+	if( chunks.empty() )
+	    return 0;
+
+	// the stride is applied to the line index in the whole input, so the
+	// lines before each chunk need to be known
+	if( stride > 1 )
+	{
+	    std::vector<size_t> counts( chunks.size() );
+	    parallelFor( 0, chunks.size(), CountLines( chunks, counts ) );
+	    chunks[0].firstLine = line;
+	    for( size_t i = 1; i < chunks.size(); i++ )
+		chunks[i].firstLine = chunks[i-1].firstLine + counts[i-1];
+	    line = chunks.back().firstLine + counts.back();
+	}
+
+	const bool remission = reader.getFormat() == Pointcloud::XYZR;
+	parallelFor( 0, chunks.size(), ParseChunk( chunks, stride, remission, voxelSize ) );
+
+	// keep the first point of each voxel in the order of the input
+	if( voxelSize > 0 )
+	{
+	    for( size_t i = 0; i < chunks.size(); i++ )
+	    {
+		std::vector<bool> keep( chunks[i].points.size() );
+		for( size_t j = 0; j < chunks[i].points.size(); j++ )
+		    keep[j] = voxels.insert( VoxelKey( chunks[i].points[j], voxelSize ) ).second;
+		chunks[i].filter( keep );
+	    }
+	}
+
+	const size_t base = useChannels ? pc.channels.size() : pc.vertices.size();
+	std::vector<size_t> offsets( chunks.size() );
+	size_t count = 0;
+	for( size_t i = 0; i < chunks.size(); i++ )
+	{
+	    offsets[i] = base + count;
+	    count += chunks[i].points.size();
+	}
+
+	if( useChannels )
+	    pc.channels.resize( base + count );
+	else
+	    pc.vertices.resize( base + count );
+
+	std::vector<Eigen::Vector3d>* colors = NULL;
+	if( remission )
+	{
+	    colors = &pc.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
+	    colors->resize( base + count, Eigen::Vector3d::Zero() );
+	}
+
+	parallelFor( 0, chunks.size(), StoreChunk( chunks, offsets, pc, useChannels, colors ) );
+
+	return count;
+    }
+}
+
+PointcloudTextReader::PointcloudTextReader()
+    : format( Pointcloud::XYZR ), stride( 1 ), voxelSize( 0 ),
+    chunkSize( 4 << 20 ), useChannels( false )
+{
+}
+
+void PointcloudTextReader::setStride( size_t stride )
+{
+    this->stride = std::max( stride, (size_t)1 );
+}
+
+void PointcloudTextReader::setChunkSize( size_t size )
+{
+    chunkSize = std::max( size, (size_t)1 );
+}
+
+size_t PointcloudTextReader::read( std::string const& path, Pointcloud& pc ) const
+{
+    const MappedFile file( path );
+    const char* data = static_cast<const char*>( file.getData() );
+    return read( data, data + file.getSize(), pc );
+}
+
+size_t PointcloudTextReader::read( const char* begin, const char* end, Pointcloud& pc ) const
+{
+    size_t line = 0;
+    VoxelSet voxels;
+    return readText( *this, begin, end, pc, line, voxels );
+}
+
+size_t PointcloudTextReader::read( std::istream& is, Pointcloud& pc ) const
+{
+    // read blocks which give each thread a chunk, and carry the incomplete
+    // last line of a block over to the next one
+    std::vector<char> buffer( chunkSize * getParallelThreadCount() );
+    size_t filled = 0, line = 0, count = 0;
+    VoxelSet voxels;
+    while( is )
+    {
+	if( filled == buffer.size() )
+	    buffer.resize( buffer.size() * 2 );
+	is.read( &buffer[filled], buffer.size() - filled );
+	filled += is.gcount();
+
+	const char* begin = &buffer[0];
+	const char* end = begin + filled;
+	if( is )
+	{
+	    // only pass on complete lines
+	    while( end != begin && end[-1] != '\n' )
+		end--;
+	    if( end == begin )
+		continue;
+	}
+
+	count += readText( *this, begin, end, pc, line, voxels );
+	filled = std::copy( end, begin + filled, buffer.begin() ) - buffer.begin();
+    }
+    return count;
+}
@@ -0,0 +1,87 @@
+#ifndef ENVIRE_TOOLS_POINTCLOUDTEXTREADER_HPP__
+#define ENVIRE_TOOLS_POINTCLOUDTEXTREADER_HPP__
+
+#include <envire/maps/Pointcloud.hpp>
+
+#include <string>
+#include <istream>
+
+namespace envire
+{
+    /**
+     * Reads point clouds from text files with one point per line.
+     *
+     * A line holds the x, y and z coordinates, and for the XYZR format a
+     * remission value, separated by whitespace, commas or semicolons. Further
+     * values on a line are ignored, and lines which do not start with three
+     * numbers (e.g. headers or comments) are skipped.
+     *
+     * Files are memory mapped and split into chunks at line boundaries. The
+     * chunks are parsed in parallel (see setParallelThreadCount()), and the
+     * result does not depend on the number of threads. The points can be
+     * subsampled while parsing, either by keeping every n-th line, or by
+     * keeping the first point of each voxel.
+     */
+    class PointcloudTextReader
+    {
+    public:
+	PointcloudTextReader();
+
+	void setFormat( Pointcloud::TextFormat format ) { this->format = format; }
+	Pointcloud::TextFormat getFormat() const { return format; }
+
+	/** Only keep the lines whose index (starting at 0) is a multiple of
+	 * \c stride. The default of 1 keeps all lines.
+	 */
+	void setStride( size_t stride );
+	size_t getStride() const { return stride; }
+
+	/** Only keep the first point in each cubic voxel of the given size.
+	 * A size of 0 (the default) disables the voxel filter. It is applied
+	 * after the stride.
+	 */
+	void setVoxelSize( double size ) { voxelSize = size; }
+	double getVoxelSize() const { return voxelSize; }
+
+	/** Size in bytes of the chunks the input is split into */
+	void setChunkSize( size_t size );
+	size_t getChunkSize() const { return chunkSize; }
+
+	/** If set, the points are written into Pointcloud::channels instead of
+	 * Pointcloud::vertices. Default is false.
+	 */
+	void setUseChannels( bool use ) { useChannels = use; }
+	bool getUseChannels() const { return useChannels; }
+
+	/** Appends the points of the file at \c path to \c pc
+	 *
+	 * @return the number of points that were added
+	 * @throw std::runtime_error if the file can not be opened
+	 */
+	size_t read( std::string const& path, Pointcloud& pc ) const;
+
+	/** Appends the points in the text [begin, end) to \c pc
+	 *
+	 * @return the number of points that were added
+	 */
+	size_t read( const char* begin, const char* end, Pointcloud& pc ) const;
+
+	/** Appends the points read from \c is to \c pc
+	 *
+	 * The stream is read in blocks of getChunkSize() bytes for each
+	 * thread, so that the whole text does not need to be held in memory.
+	 *
+	 * @return the number of points that were added
+	 */
+	size_t read( std::istream& is, Pointcloud& pc ) const;
+
+    private:
+	Pointcloud::TextFormat format;
+	size_t stride;
+	double voxelSize;
+	size_t chunkSize;
+	bool useChannels;
+    };
+}
+
+#endif
@@ -14,10 +14,19 @@
 #include <boost/scoped_ptr.hpp>
 
 #include "envire/tools/GridAccess.hpp"
+#include "envire/tools/PointcloudTextReader.hpp"
+#include "envire/tools/PointGridIndex.hpp"
+#include "envire/operators/VoxelGridFilter.hpp"
+#include "envire/operators/NormalEstimation.hpp"
+#include "envire/operators/CutPointcloud.hpp"
+#include "envire/operators/MergePointcloud.hpp"
 #include "envire/maps/Grids.hpp"
 #include "envire/maps/ElevationGrid.hpp"
 
 #include "base/TimeMark.hpp"
+
+#include <sstream>
+#include <limits>
    
 using namespace envire;
 using namespace std;
@@ -366,5 +375,311 @@ BOOST_AUTO_TEST_CASE( env_metadata )
     BOOST_CHECK( vec.front() == base::Vector3d::Zero() );
 }
 
+BOOST_AUTO_TEST_CASE( pointcloud_channels ) 
+{
+    Pointcloud::Ptr pc = new Pointcloud();
+    for(int i=0;i<100;i++)
+	pc->vertices.push_back( Eigen::Vector3d::Random() );
+
+    pc->updateChannels();
+    BOOST_CHECK_EQUAL( pc->channels.size(), pc->vertices.size() );
+
+    Eigen::Affine3d t( Eigen::AngleAxisd( 0.5, Eigen::Vector3d::UnitZ() ) );
+    t.translation() = Eigen::Vector3d( 1.0, 2.0, 3.0 );
+    pc->channels.transform( t );
+    std::vector<Eigen::Vector3d> orig( pc->vertices );
+    pc->updateVertices();
+    for(size_t i=0;i<orig.size();i++)
+	BOOST_CHECK( (pc->vertices[i] - t * orig[i]).norm() < 1e-5 );
+
+    VertexAttribute<double> var = pc->getVertexAttribute<double>( Pointcloud::VERTEX_VARIANCE );
+    BOOST_CHECK( var.isValid() );
+    var.get().resize( pc->vertices.size(), 1.0 );
+    BOOST_CHECK_EQUAL( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), pc->vertices.size() );
+
+    pc->clear();
+    BOOST_CHECK( pc->channels.empty() );
+}
+
+BOOST_AUTO_TEST_CASE( pointcloud_read_text ) 
+{
+    std::stringstream ss;
+    ss << "# x y z r" << std::endl;
+    for(int i=0;i<1000;i++)
+	ss << i * 0.5 << " " << i << "," << 0.25 * i << " " << i % 256 << std::endl;
+
+    Pointcloud::Ptr pc = new Pointcloud();
+    pc->readText( ss, 10, Pointcloud::XYZR );
+    // the header line counts, so every 10th point starting at 9 is used
+    BOOST_REQUIRE_EQUAL( pc->vertices.size(), 100u );
+    BOOST_CHECK_EQUAL( pc->vertices[1], Eigen::Vector3d( 9.5, 19, 4.75 ) );
+    BOOST_CHECK_EQUAL( pc->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ).size(), 100u );
+
+    PointcloudTextReader reader;
+    reader.setFormat( Pointcloud::XYZ );
+    reader.setVoxelSize( 50.0 );
+    reader.setChunkSize( 100 );
+    const std::string text( ss.str() );
+    Pointcloud::Ptr pc2 = new Pointcloud();
+    BOOST_CHECK_EQUAL( reader.read( text.data(), text.data() + text.size(), *pc2 ), 20u );
+    BOOST_CHECK_EQUAL( pc2->vertices[1], Eigen::Vector3d( 25, 50, 12.5 ) );
+
+    // streams are read in blocks, the stride and the voxels carry over
+    // from one block to the next
+    reader.setStride( 3 );
+    Pointcloud::Ptr pc3 = new Pointcloud();
+    Pointcloud::Ptr pc4 = new Pointcloud();
+    std::istringstream is( text );
+    BOOST_CHECK_EQUAL( reader.read( is, *pc3 ), reader.read( text.data(), text.data() + text.size(), *pc4 ) );
+    BOOST_CHECK( pc3->vertices == pc4->vertices );
+}
+
+struct CountInRadius
+{
+    size_t count;
+    CountInRadius() : count( 0 ) {}
+    void operator()( size_t index, double squaredDistance ) { count++; }
+};
+
+BOOST_AUTO_TEST_CASE( point_grid_index ) 
+{
+    // 681.4 * 10 rounds to 6814, but 6814 * 0.1 rounds to a value above
+    // 681.4, so the cell of the minimum can not be computed from the
+    // coordinates of its corner
+    std::vector<Eigen::Vector3d> points;
+    points.push_back( Eigen::Vector3d( 681.4, 0, 0 ) );
+    points.push_back( Eigen::Vector3d( 681.45, 0, 0 ) );
+    points.push_back( Eigen::Vector3d( 681.55, 0, 0 ) );
+
+    PointGridIndex index;
+    index.build( points, 0.1 );
+    BOOST_REQUIRE_EQUAL( index.getCellCount(), 2u );
+    for( size_t i = 0; i < points.size(); i++ )
+    {
+	const size_t cell = index.findCell( points[i] );
+	BOOST_REQUIRE( cell < index.getCellCount() );
+	BOOST_CHECK( std::find( index.getCellBegin( cell ), index.getCellEnd( cell ), i ) != index.getCellEnd( cell ) );
+    }
+
+    CountInRadius inRadius;
+    index.forEachInRadius( points[0], 0.1, inRadius );
+    BOOST_CHECK_EQUAL( inRadius.count, 2u );
+}
+
+BOOST_AUTO_TEST_CASE( voxel_grid_filter ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Pointcloud *pc = new Pointcloud();
+    std::vector<Eigen::Vector3d> &colors( pc->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+    // two points in each voxel of a 10x10x1 grid with 1.0 spacing
+    for(int x=0;x<10;x++)
+	for(int y=0;y<10;y++)
+	{
+	    pc->vertices.push_back( Eigen::Vector3d( x + 0.25, y + 0.25, 0.5 ) );
+	    pc->vertices.push_back( Eigen::Vector3d( x + 0.75, y + 0.75, 0.5 ) );
+	    colors.push_back( Eigen::Vector3d( 0, 0, 0 ) );
+	    colors.push_back( Eigen::Vector3d( 1.0, 1.0, 1.0 ) );
+	}
+    pc->vertices.push_back( Eigen::Vector3d( std::numeric_limits<double>::quiet_NaN(), 0, 0 ) );
+    colors.push_back( Eigen::Vector3d( 0, 0, 0 ) );
+
+    Pointcloud *out = new Pointcloud();
+    env->attachItem( pc );
+    env->attachItem( out );
+    env->setFrameNode( pc, env->getRootNode() );
+    env->setFrameNode( out, env->getRootNode() );
+
+    VoxelGridFilter *filter = new VoxelGridFilter();
+    env->attachItem( filter );
+    filter->addInput( pc );
+    filter->addOutput( out );
+    filter->setVoxelSize( 1.0 );
+    filter->updateAll();
+
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 100u );
+    BOOST_CHECK( (out->vertices[0] - Eigen::Vector3d( 0.5, 0.5, 0.5 )).norm() < 1e-9 );
+    BOOST_CHECK( (out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR )[0] - Eigen::Vector3d::Constant( 0.5 )).norm() < 1e-9 );
+
+    filter->setMode( VoxelGridFilter::FIRST );
+    filter->updateAll();
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 100u );
+    BOOST_CHECK_EQUAL( out->vertices[0], pc->vertices[0] );
+
+    // data from an earlier run which the input no longer has is removed
+    pc->removeData( Pointcloud::VERTEX_COLOR );
+    filter->updateAll();
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 100u );
+    BOOST_CHECK( !out->hasData( Pointcloud::VERTEX_COLOR ) );
+}
+
+BOOST_AUTO_TEST_CASE( normal_estimation ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Pointcloud *pc = new Pointcloud();
+    // planar 11x11 grid with 0.05 spacing, seen from above
+    for(int x=0;x<11;x++)
+	for(int y=0;y<11;y++)
+	    pc->vertices.push_back( Eigen::Vector3d( x * 0.05, y * 0.05, 0 ) );
+    pc->setSensorOrigin( Eigen::Affine3d( Eigen::Translation3d( 0.25, 0.25, 1.0 ) ) );
+
+    Pointcloud *out = new Pointcloud();
+    env->attachItem( pc );
+    env->attachItem( out );
+    env->setFrameNode( pc, env->getRootNode() );
+    env->setFrameNode( out, env->getRootNode() );
+
+    NormalEstimation *ne = new NormalEstimation();
+    env->attachItem( ne );
+    ne->addInput( pc );
+    ne->addOutput( out );
+    ne->setSearchRadius( 0.08 );
+    ne->setNeighbourCount( 0 );
+    ne->updateAll();
+
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), pc->vertices.size() );
+    const std::vector<Eigen::Vector3d> &normals( out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+    const std::vector<Pointcloud::vertex_attr> &attrs( out->getVertexData<Pointcloud::vertex_attr>( Pointcloud::VERTEX_ATTRIBUTES ) );
+    const Pointcloud::vertex_attr edge = 1 << Pointcloud::SCAN_EDGE;
+
+    // interior point
+    BOOST_CHECK( (normals[5 * 11 + 5] - Eigen::Vector3d::UnitZ()).norm() < 1e-9 );
+    BOOST_CHECK_EQUAL( attrs[5 * 11 + 5], 0 );
+    // corner and side of the grid
+    BOOST_CHECK_EQUAL( attrs[0], edge );
+    BOOST_CHECK_EQUAL( attrs[5], edge );
+    BOOST_CHECK( normals[5].z() > 0.99 );
+}
+
+BOOST_AUTO_TEST_CASE( cut_pointcloud ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Pointcloud *pc = new Pointcloud();
+    std::vector<double> &variance( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+    for(int x=0;x<10;x++)
+    {
+	pc->vertices.push_back( Eigen::Vector3d( x + 0.5, 0.5, 0.5 ) );
+	variance.push_back( x );
+    }
+
+    Pointcloud *out = new Pointcloud();
+    env->attachItem( pc );
+    env->attachItem( out );
+    env->setFrameNode( pc, env->getRootNode() );
+    env->setFrameNode( out, env->getRootNode() );
+
+    // keep x in [0,8], without [2,4]
+    ExclusionBox include, exclude;
+    include.exclude = false;
+    include.box = Eigen::AlignedBox<double,3>( Eigen::Vector3d( 0, 0, 0 ), Eigen::Vector3d( 8, 1, 1 ) );
+    exclude.box = Eigen::AlignedBox<double,3>( Eigen::Vector3d( 2, 0, 0 ), Eigen::Vector3d( 4, 1, 1 ) );
+
+    CutPointcloud *cut = new CutPointcloud();
+    env->attachItem( cut );
+    cut->addInput( pc );
+    cut->addOutput( out );
+    cut->addBox( &include );
+    cut->addBox( &exclude );
+    cut->updateAll();
+
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 6u );
+    BOOST_CHECK_EQUAL( out->vertices[2].x(), 4.5 );
+    BOOST_CHECK_EQUAL( out->getVertexData<double>( Pointcloud::VERTEX_VARIANCE )[2], 4 );
+
+    // in place
+    CutPointcloud *inplace = new CutPointcloud();
+    env->attachItem( inplace );
+    inplace->addInput( pc );
+    inplace->addOutput( pc );
+    inplace->addBox( &exclude );
+    inplace->updateAll();
+
+    BOOST_REQUIRE_EQUAL( pc->vertices.size(), 8u );
+    BOOST_REQUIRE_EQUAL( variance.size(), 8u );
+    BOOST_CHECK_EQUAL( pc->vertices[2].x(), 4.5 );
+    BOOST_CHECK_EQUAL( variance[2], 4 );
+}
+
+BOOST_AUTO_TEST_CASE( merge_pointcloud ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Pointcloud *pc1 = new Pointcloud(), *pc2 = new Pointcloud(), *out = new Pointcloud();
+    pc1->vertices.push_back( Eigen::Vector3d( 1, 0, 0 ) );
+    pc1->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ).push_back( Eigen::Vector3d::UnitX() );
+    pc2->vertices.push_back( Eigen::Vector3d( 2, 0, 0 ) );
+    pc2->vertices.push_back( Eigen::Vector3d( 3, 0, 0 ) );
+
+    FrameNode *fn = new FrameNode();
+    fn->setTransform( Eigen::Affine3d( Eigen::Translation3d( 0.0, 1.0, 0.0 ) ) );
+    env->addChild( env->getRootNode(), fn );
+    env->attachItem( pc1 );
+    env->attachItem( pc2 );
+    env->attachItem( out );
+    env->setFrameNode( pc1, fn );
+    env->setFrameNode( pc2, env->getRootNode() );
+    env->setFrameNode( out, env->getRootNode() );
+
+    MergePointcloud *merge = new MergePointcloud();
+    env->attachItem( merge );
+    merge->addInput( pc1 );
+    merge->addInput( pc2 );
+    merge->addOutput( out );
+    merge->updateAll();
+
+    // the second input has no normals, which are filled with zero
+    const std::vector<Eigen::Vector3d> &normals( out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 3u );
+    BOOST_REQUIRE_EQUAL( normals.size(), 3u );
+    BOOST_CHECK( out->vertices[0].isApprox( Eigen::Vector3d( 1, 1, 0 ) ) );
+    BOOST_CHECK_EQUAL( normals[0], Eigen::Vector3d::UnitX() );
+    BOOST_CHECK_EQUAL( normals[2], Eigen::Vector3d::Zero() );
+
+    // only new inputs are appended, the ones of the full merge are known
+    merge->setIncremental( true );
+    merge->updateAll();
+    BOOST_CHECK_EQUAL( out->vertices.size(), 3u );
+    merge->updateAll();
+    BOOST_CHECK_EQUAL( out->vertices.size(), 3u );
+
+    Pointcloud *pc3 = new Pointcloud();
+    pc3->vertices.push_back( Eigen::Vector3d( 4, 0, 0 ) );
+    env->attachItem( pc3 );
+    env->setFrameNode( pc3, env->getRootNode() );
+    merge->addInput( pc3 );
+    merge->updateAll();
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 4u );
+    BOOST_CHECK_EQUAL( normals.size(), 4u );
+    BOOST_CHECK_EQUAL( out->vertices[3], Eigen::Vector3d( 4, 0, 0 ) );
+
+    // a full merge starts over
+    merge->setIncremental( false );
+    merge->updateAll();
+    BOOST_CHECK_EQUAL( out->vertices.size(), 4u );
+}
+
+BOOST_AUTO_TEST_CASE( chunked_buffer ) 
+{
+    ChunkedBuffer<Eigen::Vector3d> buffer( 100 );
+    BOOST_CHECK_EQUAL( buffer.getChunkSize(), 128u );
+
+    for(int i=0;i<300;i++)
+	buffer.push_back( Eigen::Vector3d( i, 0, 0 ) );
+    const Eigen::Vector3d *p = &buffer[200];
+    for(int i=300;i<1000;i++)
+	buffer.push_back( Eigen::Vector3d( i, 0, 0 ) );
+    BOOST_CHECK_EQUAL( p, &buffer[200] );
+    BOOST_CHECK_EQUAL( buffer.getChunkCount(), 8u );
+
+    // sliding window
+    buffer.dropFront();
+    BOOST_REQUIRE_EQUAL( buffer.size(), 1000u - 128u );
+    BOOST_CHECK_EQUAL( buffer[0].x(), 128 );
+    BOOST_CHECK_EQUAL( p, &buffer[200 - 128] );
+
+    Pointcloud pc;
+    pc.copyFrom( buffer );
+    BOOST_REQUIRE_EQUAL( pc.vertices.size(), buffer.size() );
+    BOOST_CHECK( std::equal( buffer.begin(), buffer.end(), pc.vertices.begin() ) );
+}
+
 // EOF
 //
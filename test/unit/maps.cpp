@@ -6,6 +6,14 @@
 #include <envire/maps/ElevationGrid.hpp>
 #include <envire/tools/VoxelTraversal.hpp>
 #include <envire/tools/BoxLookUpTable.hpp>
+#include <envire/tools/BresenhamLine.hpp>
+#include <envire/operators/Fold.hpp>
+#include <envire/operators/GridIllumination.hpp>
+#include <envire/operators/SimpleTraversability.hpp>
+#include <envire/operators/Projection.hpp>
+#include <envire/operators/DistanceGridToPointcloud.hpp>
+#include <envire/tools/DynamicDistanceTransform.hpp>
+#include <limits>
 
 using namespace envire;
 using namespace Eigen;
@@ -25,6 +33,279 @@ BOOST_AUTO_TEST_CASE( test_elevationgrid )
 
 }
 
+struct FillCell
+{
+    Grid<int>::ArrayType& data;
+    FillCell( Grid<int>::ArrayType& data ) : data( data ) {}
+    void operator()( size_t x, size_t y ) { data[y][x] += y * 100 + x; }
+};
+
+struct FillTile
+{
+    Grid<int>::ArrayType& data;
+    FillTile( Grid<int>::ArrayType& data ) : data( data ) {}
+    void operator()( const GridBase::CellExtents& ext )
+    {
+	for( int y = ext.min().y(); y <= ext.max().y(); y++ )
+	    for( int x = ext.min().x(); x <= ext.max().x(); x++ )
+		data[y][x] += 1;
+    }
+};
+
+BOOST_AUTO_TEST_CASE( test_grid_iteration )
+{
+    Grid<int> grid( 37, 21, 0.1, 0.1 );
+    Grid<int>::ArrayType& data = grid.getGridData();
+    std::fill( data.data(), data.data() + data.num_elements(), 0 );
+
+    grid.parallelForEachCell( FillCell( data ) );
+    // each cell is visited exactly once by both
+    grid.forEachTile( FillTile( data ), 8 );
+
+    for( size_t y = 0; y < 21; y++ )
+	for( size_t x = 0; x < 37; x++ )
+	    BOOST_CHECK_EQUAL( data[y][x], (int)(y * 100 + x + 1) );
+}
+
+BOOST_AUTO_TEST_CASE( test_fold )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Grid<double>* input = new Grid<double>( 30, 20, 0.1, 0.1 );
+    Grid<double>* output = new Grid<double>( 30, 20, 0.1, 0.1 );
+    env->attachItem( input );
+    env->attachItem( output );
+
+    Grid<double>::ArrayType& in = input->getGridData();
+    for( size_t y = 0; y < 20; y++ )
+	for( size_t x = 0; x < 30; x++ )
+	    in[y][x] = (x * 7 + y * 13) % 11;
+
+    DoubleFoldOperator* fold = new DoubleFoldOperator();
+    env->attachItem( fold );
+    fold->addInput( input );
+    fold->addOutput( output );
+    fold->setNeightbourHoodSize( 5 );
+    fold->updateAll();
+
+    // compare with the direct computation of single cells
+    Grid<double>::ArrayType& out = output->getGridData();
+    Grid<double>::ArrayType expected( boost::extents[20][30] );
+    for( size_t y = 0; y < 20; y++ )
+	for( size_t x = 0; x < 30; x++ )
+	{
+	    fold->fold( in, expected, x, y );
+	    BOOST_CHECK_CLOSE( out[y][x], expected[y][x], 1e-6 );
+	}
+
+    // nodata cells are ignored
+    input->setNoData( -1.0 );
+    in[10][10] = -1.0;
+    fold->setNeightbourHoodSize( 2 );
+    fold->setKernel( DoubleFoldOperator::MIN );
+    fold->updateAll();
+    BOOST_CHECK_EQUAL( out[10][10], std::min( std::min( in[9][9], in[9][10] ), in[10][9] ) );
+    BOOST_CHECK_EQUAL( out[0][0], in[0][0] );
+
+    // the result does not depend on the number of rows computed at once
+    fold->setKernel( DoubleFoldOperator::GAUSSIAN );
+    fold->setNeightbourHoodSize( 6 );
+    fold->updateAll();
+    Grid<double>::ArrayType whole( out );
+    fold->setBandHeight( 3 );
+    fold->updateAll();
+    for( size_t y = 0; y < 20; y++ )
+	for( size_t x = 0; x < 30; x++ )
+	    BOOST_CHECK_EQUAL( out[y][x], whole[y][x] );
+}
+
+BOOST_AUTO_TEST_CASE( test_illumination_sweep )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    ElevationGrid* grid = new ElevationGrid( 20, 20, 1.0, 1.0 );
+    env->attachItem( grid );
+
+    // flat ground with a wall of height 5 at x = 10
+    ElevationGrid::ArrayType& h = grid->getGridData( ElevationGrid::ELEVATION_MAX );
+    std::fill( h.data(), h.data() + h.num_elements(), 0.0 );
+    for( size_t y = 0; y < 20; y++ )
+	h[y][10] = 5.0;
+
+    GridIllumination* op = new GridIllumination();
+    env->attachItem( op );
+    op->addOutput( grid );
+
+    // light at 45 degrees from +x and -x, each for half of the time
+    std::vector<GridIllumination::LightDirection> lights;
+    lights.push_back( GridIllumination::LightDirection( 0.0, M_PI / 4, 0.5 ) );
+    lights.push_back( GridIllumination::LightDirection( M_PI, M_PI / 4, 0.5 ) );
+    op->setLightDirections( lights );
+    op->updateAll();
+
+    ElevationGrid::ArrayType& light = grid->getGridData( ElevationGrid::ILLUMINATION );
+    BOOST_CHECK_CLOSE( light[7][4], 1.0, 1e-6 );
+    BOOST_CHECK_CLOSE( light[7][8], 0.5, 1e-6 );
+    BOOST_CHECK_CLOSE( light[7][10], 1.0, 1e-6 );
+    BOOST_CHECK_CLOSE( light[7][12], 0.5, 1e-6 );
+    BOOST_CHECK_CLOSE( light[7][16], 1.0, 1e-6 );
+}
+
+BOOST_AUTO_TEST_CASE( test_projection_fill_holes )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    ElevationGrid* grid = new ElevationGrid( 20, 20, 1.0, 1.0 );
+    Pointcloud* pc = new Pointcloud();
+    env->attachItem( grid );
+    env->attachItem( pc );
+    env->setFrameNode( grid, env->getRootNode() );
+    env->setFrameNode( pc, env->getRootNode() );
+
+    // two points per cell on a plane of height 2, with a hole in the middle
+    for( size_t y = 0; y < 20; y++ )
+	for( size_t x = 0; x < 20; x++ )
+	{
+	    if( x >= 8 && x < 12 && y >= 8 && y < 12 )
+		continue;
+	    pc->vertices.push_back( Eigen::Vector3d( x + 0.5, y + 0.5, 2.0 ) );
+	    pc->vertices.push_back( Eigen::Vector3d( x + 0.5, y + 0.5, 1.0 ) );
+	}
+    pc->vertices.push_back( Eigen::Vector3d( -5.0, 5.0, 10.0 ) );
+
+    Projection* proj = new Projection();
+    env->attachItem( proj );
+    proj->addInput( pc );
+    proj->addOutput( grid );
+    proj->updateAll();
+
+    ElevationGrid::ArrayType& elv_min = grid->getGridData( ElevationGrid::ELEVATION_MIN );
+    ElevationGrid::ArrayType& elv_max = grid->getGridData( ElevationGrid::ELEVATION_MAX );
+    BOOST_CHECK_EQUAL( elv_min[3][4], 1.0 );
+    BOOST_CHECK_EQUAL( elv_max[3][4], 2.0 );
+    BOOST_CHECK_EQUAL( elv_max[5][0], 2.0 );
+    // the hole is filled in the maximum
+    BOOST_CHECK_CLOSE( elv_max[10][10], 2.0, 1e-6 );
+    BOOST_CHECK_EQUAL( elv_min[10][10], std::numeric_limits<double>::infinity() );
+}
+
+BOOST_AUTO_TEST_CASE( test_distance_grid_to_pointcloud )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    DistanceGrid* grid = new DistanceGrid( 4, 3, 0.1, 0.1, -0.2, -0.15 );
+    Pointcloud* pc = new Pointcloud();
+    env->attachItem( grid );
+    env->attachItem( pc );
+    env->setFrameNode( grid, env->getRootNode() );
+    env->setFrameNode( pc, env->getRootNode() );
+
+    DistanceGrid::ArrayType& distance = grid->getGridData( DistanceGrid::DISTANCE );
+    std::fill( distance.data(), distance.data() + distance.num_elements(), 2.0f );
+    distance[0][0] = std::numeric_limits<float>::quiet_NaN();
+    distance[2][3] = 20.0f;
+
+    DistanceGridToPointcloud* op = new DistanceGridToPointcloud();
+    env->attachItem( op );
+    op->addInput( grid );
+    op->addOutput( pc );
+    op->updateAll();
+
+    BOOST_REQUIRE_EQUAL( pc->vertices.size(), 10u );
+    BOOST_CHECK_EQUAL( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), 10u );
+    // the points are ordered by column, so the first one is in cell (0, 1)
+    // and the second one in cell (0, 2)
+    Eigen::Vector3d ray( grid->fromGrid( 0, 1 ).x(), grid->fromGrid( 0, 1 ).y(), 1.0 );
+    BOOST_CHECK( pc->vertices[0].isApprox( ray * 2.0 ) );
+    ray = Eigen::Vector3d( grid->fromGrid( 0, 2 ).x(), grid->fromGrid( 0, 2 ).y(), 1.0 );
+    BOOST_CHECK( pc->vertices[1].isApprox( ray * 2.0 ) );
+
+    // the rays are reused for the next frame
+    distance[0][0] = 1.0f;
+    op->updateAll();
+    BOOST_REQUIRE_EQUAL( pc->vertices.size(), 11u );
+    ray = Eigen::Vector3d( grid->fromGrid( 0, 0 ).x(), grid->fromGrid( 0, 0 ).y(), 1.0 );
+    BOOST_CHECK( pc->vertices[0].isApprox( ray ) );
+}
+
+BOOST_AUTO_TEST_CASE( test_dynamic_distance_transform )
+{
+    const int width = 30, height = 20;
+    const double scalex = 0.1, scaley = 0.15, maxDistance = 1.0;
+    DynamicDistanceTransform dt;
+    dt.reset( width, height, scalex, scaley, maxDistance );
+    std::vector<bool> obstacles( width * height, false );
+
+    srand( 1 );
+    for( int step = 0; step < 50; step++ )
+    {
+	for( int i = 0; i < 5; i++ )
+	{
+	    const int x = rand() % width, y = rand() % height;
+	    obstacles[y * width + x] = (step < 5 || rand() % 2);
+	    if( obstacles[y * width + x] )
+		dt.setObstacle( x, y );
+	    else
+		dt.removeObstacle( x, y );
+	}
+	dt.update();
+
+	for( int y = 0; y < height; y++ )
+	{
+	    for( int x = 0; x < width; x++ )
+	    {
+		double expected = std::numeric_limits<double>::infinity();
+		for( int o = 0; o < width * height; o++ )
+		{
+		    if( obstacles[o] )
+			expected = std::min( expected, std::sqrt(
+				    pow( (x - o % width) * scalex, 2 ) + pow( (y - o / width) * scaley, 2 ) ) );
+		}
+		if( expected > maxDistance )
+		    expected = std::numeric_limits<double>::infinity();
+
+		BOOST_REQUIRE_EQUAL( dt.isObstacle( x, y ), obstacles[y * width + x] );
+		if( expected == std::numeric_limits<double>::infinity() )
+		    BOOST_REQUIRE( dt.getDistance( x, y ) == expected );
+		else
+		    BOOST_REQUIRE_CLOSE( dt.getDistance( x, y ), expected, 1e-6 );
+	    }
+	}
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_close_narrow_passages )
+{
+    TraversabilityGrid map( 30, 30, 0.1, 0.1 );
+    TraversabilityGrid::ArrayType &data( map.getGridData( TraversabilityGrid::TRAVERSABILITY ) );
+    SimpleTraversability op;
+
+    // a wall with a passage of 2 cells and one of 8 cells
+    for( int step = 0; step < 2; step++ )
+    {
+	std::fill( data.data(), data.data() + data.num_elements(), SimpleTraversability::CUSTOM_CLASSES );
+	for( int x = 0; x < 30; x++ )
+	{
+	    const bool narrow = (x == 5 || x == 6), wide = (x >= 15 && x < 23);
+	    if( !narrow && !wide )
+		data[15][x] = SimpleTraversability::CLASS_OBSTACLE;
+	}
+	// the second run only differs by one obstacle cell
+	if( step == 1 )
+	    data[3][3] = SimpleTraversability::CLASS_OBSTACLE;
+
+	op.closeNarrowPassages( map, "", 0.5 );
+	BOOST_CHECK_EQUAL( data[15][5], SimpleTraversability::CLASS_OBSTACLE );
+	BOOST_CHECK_EQUAL( data[15][6], SimpleTraversability::CLASS_OBSTACLE );
+	for( int x = 15; x < 23; x++ )
+	    BOOST_CHECK_EQUAL( data[15][x], SimpleTraversability::CUSTOM_CLASSES );
+	BOOST_CHECK_EQUAL( data[10][5], SimpleTraversability::CUSTOM_CLASSES );
+
+	op.growObstacles( map, "", 0.25 );
+	BOOST_CHECK_EQUAL( data[13][10], SimpleTraversability::CLASS_OBSTACLE );
+	BOOST_CHECK_EQUAL( data[12][10], SimpleTraversability::CUSTOM_CLASSES );
+	BOOST_CHECK_EQUAL( data[15][19], SimpleTraversability::CUSTOM_CLASSES );
+	BOOST_CHECK_CLOSE( op.getClearance().getDistance( 10, 13 ), 0.2, 1e-6 );
+	BOOST_CHECK( op.getClearance().getDistance( 19, 15 ) == std::numeric_limits<double>::infinity() );
+    }
+}
+
 BOOST_AUTO_TEST_CASE( test_voxeltraversal )
 {
     ElevationGrid grid( 3, 3, 0.5, 0.5 );
@@ -196,6 +477,230 @@ BOOST_AUTO_TEST_CASE( test_forEachInRects )
     printMap(tr);  
 }
 
+struct SpanCollector
+{
+    TraversabilityGrid::ArrayType &data;
+    SpanCollector(TraversabilityGrid::ArrayType &data) : data(data) {}
+    void operator()(size_t y, size_t xBegin, size_t xEnd) const
+    {
+        BOOST_REQUIRE( xBegin < xEnd );
+        for(size_t x = xBegin; x < xEnd; x++)
+            data[y][x] += 1;
+    }
+};
+
+struct CellCollector
+{
+    TraversabilityGrid::ArrayType &data;
+    uint8_t val;
+    CellCollector(TraversabilityGrid::ArrayType &data, uint8_t val) : data(data), val(val) {}
+    void operator()(size_t x, size_t y) const { data[y][x] += val; }
+};
+
+BOOST_AUTO_TEST_CASE( test_forEachSpanInRect )
+{
+    TraversabilityGrid tr(40, 40, 0.12, 0.12);
+    TraversabilityGrid::ArrayType &data(tr.getGridData(TraversabilityGrid::TRAVERSABILITY));
+    GridBase::RectangleSpans scratch;
+
+    for(int angle = 0; angle < 180; angle += 15)
+    {
+        base::Pose2D p(Eigen::Vector2d(2.4, 2.3), angle * M_PI / 180.0);
+        std::fill(data.data(), data.data() + data.num_elements(), 0);
+
+        // spans and cells have to cover the same cells exactly once
+        BOOST_REQUIRE( tr.forEachSpanInRectangle(p, 1.0, 0.6, SpanCollector(data), scratch) );
+        BOOST_REQUIRE( tr.forEachInRectangle(p, 1.0, 0.6, CellCollector(data, 2)) );
+        size_t covered = 0;
+        for(size_t y = 0; y < tr.getCellSizeY(); y++)
+        {
+            for(size_t x = 0; x < tr.getCellSizeX(); x++)
+            {
+                BOOST_REQUIRE( data[y][x] == 0 || data[y][x] == 3 );
+                if(data[y][x] == 3)
+                    covered++;
+            }
+        }
+        BOOST_CHECK( covered > 0 );
+
+        // inner and outer cells are disjoint and the outer rectangle
+        // contains the inner one
+        std::fill(data.data(), data.data() + data.num_elements(), 0);
+        BOOST_REQUIRE( tr.forEachInRectangles(p, 1.0, 0.6, CellCollector(data, 1), 1.6, 1.2, CellCollector(data, 4)) );
+        size_t inner = 0;
+        for(size_t y = 0; y < tr.getCellSizeY(); y++)
+        {
+            for(size_t x = 0; x < tr.getCellSizeX(); x++)
+            {
+                BOOST_REQUIRE( data[y][x] == 0 || data[y][x] == 1 || data[y][x] == 4 );
+                if(data[y][x] == 1)
+                    inner++;
+            }
+        }
+        BOOST_CHECK_EQUAL( inner, covered );
+    }
+
+    // rectangles leaving the grid are rejected
+    base::Pose2D outside(Eigen::Vector2d(0.1, 0.1), 0);
+    BOOST_CHECK( !tr.forEachSpanInRectangle(outside, 1.0, 0.6, SpanCollector(data), scratch) );
+}
+
+/** The per cell rasterization forEachInRectangle used before it was
+ * based on rasterizeRectangle */
+static void referenceRectangleCells(const GridBase &grid, const base::Pose2D &pose, double sizeX, double sizeY, TraversabilityGrid::ArrayType &data)
+{
+    const int multiplier = 10;
+    GridBase::Position ul, ur, dl, dr;
+    BOOST_REQUIRE( grid.getRectPoints(pose, sizeX, sizeY, ul, ur, dl, dr, multiplier) );
+
+    std::vector<GridBase::Position> left, right;
+    if(ur.y > dr.y)
+    {
+        lineBresenham(ur, ul, left);
+        lineBresenham(ul, dl, left);
+        lineBresenham(ur, dr, right);
+        lineBresenham(dr, dl, right);
+    }
+    else
+    {
+        lineBresenham(dr, ur, left);
+        lineBresenham(ur, ul, left);
+        lineBresenham(dr, dl, right);
+        lineBresenham(dl, ul, right);
+    }
+
+    std::vector<GridBase::Position>::const_iterator leftIt = left.begin(), rightIt = right.begin();
+    while(leftIt != left.end() && rightIt != right.end())
+    {
+        const size_t y = leftIt->y / multiplier;
+        size_t minX = std::numeric_limits<size_t>::max(), maxX = 0;
+        for(; leftIt != left.end() && leftIt->y / multiplier == y; leftIt++)
+        {
+            minX = std::min(minX, leftIt->x);
+            maxX = std::max(maxX, leftIt->x);
+        }
+        for(; rightIt != right.end() && rightIt->y / multiplier == y; rightIt++)
+        {
+            minX = std::min(minX, rightIt->x);
+            maxX = std::max(maxX, rightIt->x);
+        }
+        if(y >= grid.getCellSizeY())
+            continue;
+        for(size_t x = minX / multiplier; x <= maxX / multiplier; x++)
+        {
+            if(x < grid.getCellSizeX())
+                data[y][x] += 1;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_forEachInRect_reference )
+{
+    TraversabilityGrid tr(40, 40, 0.12, 0.12);
+    TraversabilityGrid::ArrayType &data(tr.getGridData(TraversabilityGrid::TRAVERSABILITY));
+    TraversabilityGrid::ArrayType expected(boost::extents[40][40]);
+    GridBase::RectangleSpans scratch;
+
+    TraversabilityGrid::ArrayType &probability(tr.getGridData(TraversabilityGrid::PROBABILITY));
+    for(size_t y = 0; y < tr.getCellSizeY(); y++)
+        for(size_t x = 0; x < tr.getCellSizeX(); x++)
+            probability[y][x] = (x * 7 + y * 13) % 200 + 50;
+
+    // the same scratch is reused for rectangles of different sizes
+    for(int angle = -180; angle < 180; angle += 10)
+    {
+        for(int size = 1; size <= 3; size++)
+        {
+            base::Pose2D p(Eigen::Vector2d(2.41 + 0.03 * size, 2.33), angle * M_PI / 180.0);
+            const double sizeX = 0.4 * size, sizeY = 0.25 * size + 0.1;
+
+            std::fill(data.data(), data.data() + data.num_elements(), 0);
+            std::fill(expected.data(), expected.data() + expected.num_elements(), 0);
+            referenceRectangleCells(tr, p, sizeX, sizeY, expected);
+            BOOST_REQUIRE( tr.forEachInRectangle(p, sizeX, sizeY, CellCollector(data, 1), scratch) );
+            BOOST_REQUIRE( expected == data );
+
+            uint8_t worst = std::numeric_limits<uint8_t>::max();
+            for(size_t y = 0; y < tr.getCellSizeY(); y++)
+                for(size_t x = 0; x < tr.getCellSizeX(); x++)
+                    if(expected[y][x])
+                        worst = std::min(worst, probability[y][x]);
+            BOOST_CHECK_CLOSE( tr.getWorstProbabilityInRectangle(p, sizeX, sizeY, scratch), worst / 255.0, 1e-9 );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_traversability_footprint )
+{
+    TraversabilityGrid tr(40, 40, 0.1, 0.1);
+    tr.setTraversabilityClass(0, TraversabilityClass(0.5));
+    uint8_t free, obstacle;
+    BOOST_REQUIRE( tr.registerNewTraversabilityClass(free, TraversabilityClass(1.0)) );
+    BOOST_REQUIRE( tr.registerNewTraversabilityClass(obstacle, TraversabilityClass(0.0)) );
+
+    for(size_t y = 0; y < tr.getCellSizeY(); y++)
+        for(size_t x = 0; x < tr.getCellSizeX(); x++)
+            tr.setTraversability(free, x, y);
+
+    BOOST_CHECK_EQUAL( tr.getClassCountInBox(free, GridBase::CellExtents(Eigen::Vector2i(0, 0), Eigen::Vector2i(9, 4))), 50 );
+
+    // 11 x 7 cell centers are inside of the footprint
+    base::Pose2D p(Eigen::Vector2d(2.05, 2.05), 0);
+    std::vector<size_t> counts;
+    BOOST_REQUIRE( tr.getClassCountsInFootprint(p, 1.0, 0.6, counts) );
+    BOOST_CHECK_EQUAL( counts[free], 77 );
+    BOOST_CHECK_EQUAL( counts[obstacle], 0 );
+    BOOST_CHECK_EQUAL( tr.getWorstTraversabilityClassInFootprint(p, 1.0, 0.6).getDrivability(), 1.0 );
+
+    // the index follows setTraversability
+    tr.setTraversability(obstacle, 24, 20);
+    BOOST_CHECK_EQUAL( tr.getWorstTraversabilityClassInFootprint(p, 1.0, 0.6).getDrivability(), 0.0 );
+    BOOST_CHECK_EQUAL( tr.getClassCountInBox(obstacle, GridBase::CellExtents(Eigen::Vector2i(0, 0), Eigen::Vector2i(39, 39))), 1 );
+
+    // turned by 90 degrees the footprint does not reach the obstacle
+    p.orientation = M_PI / 2;
+    BOOST_CHECK_EQUAL( tr.getWorstTraversabilityClassInFootprint(p, 1.0, 0.6).getDrivability(), 1.0 );
+    p.orientation = -M_PI / 2;
+    BOOST_CHECK_EQUAL( tr.getWorstTraversabilityClassInFootprint(p, 1.0, 0.6).getDrivability(), 1.0 );
+
+    // direct writes need an explicit invalidation
+    tr.getGridData(TraversabilityGrid::TRAVERSABILITY)[23][20] = obstacle;
+    tr.invalidateFootprintIndex();
+    BOOST_CHECK_EQUAL( tr.getWorstTraversabilityClassInFootprint(p, 1.0, 0.6).getDrivability(), 0.0 );
+
+    tr.setProbability(1.0, 0, 0);
+    TraversabilityGrid::ArrayType &probability(tr.getGridData(TraversabilityGrid::PROBABILITY));
+    std::fill(probability.data(), probability.data() + probability.num_elements(), 255);
+    probability[20][21] = 51;
+    BOOST_CHECK_CLOSE( tr.getWorstProbabilityInFootprint(p, 1.0, 0.6), 0.2, 1e-6 );
+    BOOST_CHECK_EQUAL( tr.getWorstProbabilityInFootprint(p, 0.1, 0.1), 1.0 );
+}
+
+BOOST_AUTO_TEST_CASE( test_traversability_footprint_after_update )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Grid<float>* slope = new Grid<float>( 20, 20, 0.1, 0.1 );
+    TraversabilityGrid* tr = new TraversabilityGrid( 20, 20, 0.1, 0.1 );
+    env->attachItem( slope );
+    env->attachItem( tr );
+    Grid<float>::ArrayType& s( slope->getGridData( "slope" ) );
+    std::fill( s.data(), s.data() + s.num_elements(), 0.0f );
+
+    SimpleTraversability* op = new SimpleTraversability( 0.5, 2, 0, 0 );
+    env->attachItem( op );
+    op->setSlope( slope, "slope" );
+    op->setOutput( tr, TraversabilityGrid::TRAVERSABILITY );
+    op->updateAll();
+
+    base::Pose2D p( Eigen::Vector2d( 1.05, 1.05 ), 0 );
+    BOOST_CHECK_EQUAL( tr->getWorstTraversabilityClassInFootprint( p, 0.5, 0.5 ).getDrivability(), 1.0 );
+
+    // rerunning the operator updates the footprint queries
+    s[10][11] = 1.0;
+    op->updateAll();
+    BOOST_CHECK_EQUAL( tr->getWorstTraversabilityClassInFootprint( p, 0.5, 0.5 ).getDrivability(), 0.0 );
+}
+
 class DistanceHelper
 {
 public:
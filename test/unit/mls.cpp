@@ -7,8 +7,12 @@
 #include "envire/maps/MLSGrid.hpp"
 #include "envire/operators/MLSProjection.hpp"
 #include "envire/operators/MergeMLS.hpp"
+#include "envire/operators/MLSToGrid.hpp"
+#include "envire/operators/TraversabilityGrassfire.hpp"
 
 #include "envire/tools/ListGrid.hpp"
+#include "envire/tools/MLSMatcher.hpp"
+#include "envire/tools/MLSPyramid.hpp"
 
 #include <base/TimeMark.hpp>
 
@@ -244,3 +248,416 @@ BOOST_AUTO_TEST_CASE( mls_patch )
 }
 
 
+BOOST_AUTO_TEST_CASE( mls_matcher )
+{
+    // target grid with a non-symmetric height structure
+    MLSGrid target( 100, 100, 0.1, 0.1 );
+    MLSGrid source( 40, 40, 0.1, 0.1 );
+    const int sx = 23, sy = 31;
+    for( size_t m=0; m<100; m++ )
+    {
+	for( size_t n=0; n<100; n++ )
+	{
+	    double h = sin(m*0.3) * cos(n*0.17) + 0.01 * m;
+	    target.insertHead( m, n, MLSGrid::SurfacePatch( h, 0.02 ) );
+	    if( m >= (size_t)sx && m < (size_t)sx+40 && n >= (size_t)sy && n < (size_t)sy+40 )
+		source.insertHead( m-sx, n-sy, MLSGrid::SurfacePatch( h, 0.02 ) );
+	}
+    }
+
+    // the true transform is a shift of (sx, sy) cells, start with an offset
+    const Eigen::Affine3d truth( Eigen::Translation3d( sx * 0.1, sy * 0.1, 0 ) );
+    const Eigen::Affine3d initial( Eigen::Translation3d( sx * 0.1 + 0.42, sy * 0.1 - 0.33, 0 ) );
+
+    MLSMatcher::Configuration config;
+    config.linearWindowX = 0.6;
+    config.linearWindowY = 0.6;
+    config.angularWindow = 0.1;
+    config.sigma = 1.0;
+    MLSMatcher matcher( target, config );
+
+    BOOST_CHECK_CLOSE( matcher.score( source, truth ), 1.0, 1e-3 );
+    BOOST_CHECK( matcher.score( source, initial ) < 0.5 );
+
+    MLSMatcher::Result result = matcher.match( source, initial );
+    BOOST_CHECK( result.valid );
+    BOOST_CHECK_CLOSE( result.score, 1.0, 1e-3 );
+    BOOST_CHECK( (result.other2this.translation() - truth.translation()).norm() < 0.05 );
+}
+
+BOOST_AUTO_TEST_CASE( mls_pyramid )
+{
+    MLSGrid grid( 50, 50, 0.1, 0.1 );
+    for( size_t m=0; m<50; m++ )
+	for( size_t n=0; n<50; n++ )
+	    grid.updateCell( m, n, MLSGrid::SurfacePatch( 1.0, 0.1 ) );
+
+    MLSPyramid pyramid( grid, 3, 2.0 );
+    BOOST_CHECK_EQUAL( pyramid.getLevelCount(), 3 );
+    BOOST_CHECK_EQUAL( pyramid.getLevel( 1 ).getCellSizeX(), 25 );
+    BOOST_CHECK_EQUAL( pyramid.getLevel( 2 ).getCellSizeX(), 13 );
+    BOOST_CHECK_CLOSE( pyramid.getLevel( 2 ).getScaleX(), 0.4, 1e-6 );
+
+    BOOST_CHECK_EQUAL( pyramid.getLevelForDistance( 1.0 ), 0 );
+    BOOST_CHECK_EQUAL( pyramid.getLevelForDistance( 3.0 ), 1 );
+    BOOST_CHECK_EQUAL( pyramid.getLevelForDistance( 100.0 ), 2 );
+    BOOST_CHECK_EQUAL( pyramid.getLevelForResolution( 0.25 ), 1 );
+
+    const SurfacePatch* p = pyramid.getTopPatch( Eigen::Vector2d( 2.5, 2.5 ), 2 );
+    BOOST_REQUIRE( p );
+    BOOST_CHECK_CLOSE( p->mean, 1.0, 1e-3 );
+
+    // a change in the base grid only needs to be propagated once
+    const size_t rev1 = pyramid.getLevel( 1 ).getRevision();
+    grid.clearCell( 10, 10 );
+    grid.updateCell( 10, 10, MLSGrid::SurfacePatch( 3.0, 0.1 ) );
+    pyramid.update();
+    BOOST_CHECK( pyramid.getLevel( 1 ).getRevision() > rev1 );
+
+    p = pyramid.getTopPatch( Eigen::Vector2d( 1.05, 1.05 ), 2 );
+    BOOST_REQUIRE( p );
+    BOOST_CHECK_CLOSE( p->mean, 3.0, 1e-3 );
+    p = pyramid.getTopPatch( Eigen::Vector2d( 3.05, 3.05 ), 2 );
+    BOOST_REQUIRE( p );
+    BOOST_CHECK_CLOSE( p->mean, 1.0, 1e-3 );
+
+    const size_t rev2 = pyramid.getLevel( 1 ).getRevision();
+    pyramid.update();
+    BOOST_CHECK_EQUAL( pyramid.getLevel( 1 ).getRevision(), rev2 );
+}
+
+BOOST_AUTO_TEST_CASE( mls_snapshot )
+{
+    MLSGrid grid( 40, 40, 0.1, 0.1 );
+    for( size_t m=0; m<40; m++ )
+	for( size_t n=0; n<40; n++ )
+	    grid.insertHead( m, n, MLSGrid::SurfacePatch( m + n, 0.1 ) );
+
+    // the copy shares the storage and keeps the old state
+    const MLSGrid snapshot( grid );
+    grid.clearCell( 3, 4 );
+    grid.insertHead( 3, 4, MLSGrid::SurfacePatch( 100.0, 0.1 ) );
+    grid.insertTail( 3, 4, MLSGrid::SurfacePatch( 200.0, 0.1 ) );
+    grid.beginCell( 30, 30 )->mean = 50.0;
+
+    BOOST_CHECK_CLOSE( snapshot.beginCell( 3, 4 )->mean, 7.0, 1e-3 );
+    BOOST_CHECK( ++snapshot.beginCell( 3, 4 ) == snapshot.endCell() );
+    BOOST_CHECK_CLOSE( snapshot.beginCell( 30, 30 )->mean, 60.0, 1e-3 );
+    BOOST_CHECK_CLOSE( grid.beginCell( 3, 4 )->mean, 100.0, 1e-3 );
+    BOOST_CHECK_CLOSE( (++grid.beginCell( 3, 4 ))->mean, 200.0, 1e-3 );
+    BOOST_CHECK_CLOSE( grid.beginCell( 30, 30 )->mean, 50.0, 1e-3 );
+
+    // moves by whole tiles and by single cells
+    MLSGrid moved( snapshot );
+    moved.move( MLSGrid::TILE_SIZE, 0 );
+    BOOST_CHECK_CLOSE( moved.beginCell( 3 + MLSGrid::TILE_SIZE, 4 )->mean, 7.0, 1e-3 );
+    BOOST_CHECK( moved.beginCell( 3, 4 ) == moved.endCell() );
+    moved.move( -(int)MLSGrid::TILE_SIZE - 1, 2 );
+    BOOST_CHECK_CLOSE( moved.beginCell( 2, 6 )->mean, 7.0, 1e-3 );
+    BOOST_CHECK( moved.beginCell( 39, 6 ) == moved.endCell() );
+    moved.move( 0, -(int)MLSGrid::TILE_SIZE );
+    moved.move( 0, MLSGrid::TILE_SIZE );
+    BOOST_CHECK( moved.beginCell( 2, 6 ) == moved.endCell() );
+    BOOST_CHECK_CLOSE( moved.beginCell( 2, 16 + 6 )->mean, 23.0, 1e-3 );
+}
+
+BOOST_AUTO_TEST_CASE( mls_batch_query )
+{
+    MLSGrid grid( 50, 50, 0.1, 0.1 );
+    for( size_t m=0; m<50; m++ )
+    {
+	for( size_t n=0; n<50; n++ )
+	{
+	    grid.insertHead( m, n, MLSGrid::SurfacePatch( m * 0.1, 0.05 ) );
+	    grid.insertHead( m, n, MLSGrid::SurfacePatch( 10.0 + n * 0.1, 0.05 ) );
+	}
+    }
+
+    // compare the batched queries against the single point versions
+    const size_t count = 5000;
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > positions( count );
+    std::vector<double> zpos( count ), zstdev( count, 0.1 ), top( count, -1.0 );
+    std::vector<const SurfacePatch*> patches( count );
+    for( size_t i=0; i<count; i++ )
+    {
+	positions[i] = Eigen::Vector2d( (i * 7919 % 600) * 0.01 - 0.5, (i * 104729 % 600) * 0.01 - 0.5 );
+	zpos[i] = i % 2 ? positions[i].x() : 10.0 + positions[i].y();
+    }
+    std::vector<double> zquery( zpos );
+
+    const size_t found = grid.get( &positions[0], count, &zpos[0], &zstdev[0], &patches[0] );
+    const size_t foundTop = grid.getTop( &positions[0], count, &top[0] );
+    BOOST_CHECK_EQUAL( found, foundTop );
+
+    size_t expected = 0;
+    for( size_t i=0; i<count; i++ )
+    {
+	double z = zquery[i], stdev = 0.1;
+	SurfacePatch* p = grid.get( positions[i], z, stdev );
+	BOOST_CHECK( p == patches[i] );
+	if( p )
+	{
+	    expected++;
+	    BOOST_CHECK_CLOSE( zpos[i], z, 1e-6 );
+	    MLSGrid::Position pos;
+	    grid.toGrid( positions[i], pos );
+	    BOOST_CHECK_CLOSE( top[i], 10.0 + pos.y * 0.1, 1e-4 );
+	}
+	else
+	{
+	    BOOST_CHECK_EQUAL( top[i], -1.0 );
+	}
+    }
+    BOOST_CHECK_EQUAL( found, expected );
+}
+
+BOOST_AUTO_TEST_CASE( mls_parallel_merge )
+{
+    MLSGrid source( 60, 60, 0.1, 0.1 );
+    for( size_t m=0; m<60; m++ )
+	for( size_t n=0; n<60; n++ )
+	    source.insertHead( m, n, MLSGrid::SurfacePatch( sin(m*0.2) + cos(n*0.1), 0.05 ) );
+
+    const Eigen::Affine3d other2this( 
+	    Eigen::Translation3d( 4.0, 1.5, 0.2 ) * Eigen::AngleAxisd( 0.4, Eigen::Vector3d::UnitZ() ) );
+    const SurfacePatch offset( 0.1, 0.01 );
+
+    // sequential reference, merging each source cell into the cell
+    // containing its transformed center
+    MLSGrid reference( 80, 80, 0.1, 0.1 );
+    for( size_t m=0; m<60; m++ )
+    {
+	for( size_t n=0; n<60; n++ )
+	{
+	    Eigen::Vector3d pos( Eigen::Vector3d::Zero() );
+	    source.fromGrid( m, n, pos.x(), pos.y() );
+	    pos = other2this * pos;
+	    size_t xi, yi;
+	    if( reference.toGrid( pos.x(), pos.y(), xi, yi ) )
+	    {
+		SurfacePatch p( *source.beginCell( m, n ) );
+		p.mean += offset.mean + pos.z();
+		p.stdev = sqrt( pow( p.stdev, 2 ) + pow( offset.stdev, 2 ) );
+		reference.updateCell( xi, yi, p );
+	    }
+	}
+    }
+
+    MLSGrid merged( 80, 80, 0.1, 0.1 );
+    merged.merge( source, other2this, offset );
+    BOOST_CHECK_EQUAL( merged.getCellCount(), reference.getCellCount() );
+    const MLSGrid &cm( merged ), &cr( reference );
+    for( size_t m=0; m<80; m++ )
+    {
+	for( size_t n=0; n<80; n++ )
+	{
+	    MLSGrid::const_iterator a = cm.beginCell( m, n ), b = cr.beginCell( m, n );
+	    for( ; a != cm.endCell() && b != cr.endCell(); a++, b++ )
+		BOOST_CHECK_CLOSE( a->mean, b->mean, 1e-4 );
+	    BOOST_CHECK( a == cm.endCell() && b == cr.endCell() );
+	}
+    }
+
+    // resampling a coarser grid with constant height fills all covered
+    // cells with that height
+    MLSGrid coarse( 10, 10, 0.4, 0.4 );
+    for( size_t m=0; m<10; m++ )
+	for( size_t n=0; n<10; n++ )
+	    coarse.insertHead( m, n, MLSGrid::SurfacePatch( 2.0, 0.05 ) );
+
+    MLSGrid fine( 40, 40, 0.1, 0.1 );
+    fine.merge( coarse, Eigen::Affine3d::Identity(), SurfacePatch( 0.0, 0.0 ), true );
+    BOOST_CHECK_EQUAL( fine.getCellCount(), 40 * 40 );
+    BOOST_CHECK_CLOSE( fine.beginCell( 17, 23 )->mean, 2.0, 1e-4 );
+
+    // a coarse target cell receives every cell of a fine source grid
+    MLSGrid sparse( 100, 100, 0.01, 0.01 );
+    sparse.insertHead( 1, 1, MLSGrid::SurfacePatch( 1.0, 0.05 ) );
+    MLSGrid single( 1, 1, 1.0, 1.0 );
+    single.merge( sparse, Eigen::Affine3d::Identity(), SurfacePatch( 0.0, 0.0 ), true );
+    BOOST_CHECK_EQUAL( single.getCellCount(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( mls_merge_transformed )
+{
+    MLSGrid source( 40, 40, 0.1, 0.1 );
+    for( size_t m=0; m<40; m++ )
+    {
+	for( size_t n=0; n<40; n++ )
+	{
+	    MLSGrid::SurfacePatch p( sin(m*0.2) + cos(n*0.1), 0.05 );
+	    p.update_idx = 3;
+	    source.insertHead( m, n, p );
+	}
+    }
+
+    // tilted and rotated about z, the latter is merged in parallel
+    const Eigen::Affine3d transforms[] = {
+	Eigen::Affine3d( Eigen::Translation3d( 1.0, 0.5, 0.2 ) * Eigen::AngleAxisd( 0.3, Eigen::Vector3d::UnitX() ) ),
+	Eigen::Affine3d( Eigen::Translation3d( 1.0, 0.5, 0.2 ) * Eigen::AngleAxisd( 0.4, Eigen::Vector3d::UnitZ() ) ) };
+
+    for( int t=0; t<2; t++ )
+    {
+	// each patch is transformed with the center of its cell
+	MLSGrid reference( 60, 60, 0.1, 0.1 );
+	for( size_t m=0; m<40; m++ )
+	{
+	    for( size_t n=0; n<40; n++ )
+	    {
+		SurfacePatch p( *source.beginCell( m, n ) );
+		Eigen::Vector3d pos;
+		source.fromGrid( m, n, pos.x(), pos.y() );
+		pos.z() = p.mean;
+		pos = transforms[t] * pos;
+		size_t xi, yi;
+		if( reference.toGrid( pos.x(), pos.y(), xi, yi ) )
+		{
+		    p.mean = pos.z();
+		    reference.updateCell( xi, yi, p );
+		}
+	    }
+	}
+
+	MLSGrid merged( 60, 60, 0.1, 0.1 );
+	merged.mergeTransformed( source, transforms[t] );
+	BOOST_CHECK_EQUAL( merged.getCellCount(), reference.getCellCount() );
+	const MLSGrid &cm( merged ), &cr( reference );
+	for( size_t m=0; m<60; m++ )
+	{
+	    for( size_t n=0; n<60; n++ )
+	    {
+		MLSGrid::const_iterator a = cm.beginCell( m, n ), b = cr.beginCell( m, n );
+		for( ; a != cm.endCell() && b != cr.endCell(); a++, b++ )
+		{
+		    BOOST_CHECK_CLOSE( a->mean, b->mean, 1e-4 );
+		    BOOST_CHECK_EQUAL( a->update_idx, 3u );
+		}
+		BOOST_CHECK( a == cm.endCell() && b == cr.endCell() );
+	    }
+	}
+    }
+
+    // in reverse, each cell takes the source cell containing its center
+    MLSGrid coarse( 10, 10, 0.4, 0.4 );
+    coarse.mergeTransformed( source, Eigen::Affine3d( Eigen::Translation3d( 0.05, 0.05, 0.5 ) ), true );
+    BOOST_CHECK_EQUAL( coarse.getCellCount(), 100 );
+    BOOST_CHECK_CLOSE( coarse.beginCell( 3, 7 )->mean, source.beginCell( 13, 29 )->mean - 0.5, 1e-4 );
+    BOOST_CHECK_EQUAL( coarse.beginCell( 3, 7 )->update_idx, 3u );
+}
+
+BOOST_AUTO_TEST_CASE( mls_to_grid )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    MLSGrid *mls = new MLSGrid( 40, 40, 0.1, 0.1 );
+    env->attachItem( mls );
+    Grid<double> *grid = new Grid<double>( 40, 40, 0.1, 0.1 );
+    env->attachItem( grid );
+
+    // ground with an overhang in the upper half of the grid
+    for( size_t m=0; m<40; m++ )
+    {
+	for( size_t n=0; n<40; n++ )
+	{
+	    mls->insertHead( m, n, MLSGrid::SurfacePatch( 0.5, 0.1 ) );
+	    if( n >= 20 )
+		mls->insertHead( m, n, MLSGrid::SurfacePatch( 2.5, 0.2, 0.5, SurfacePatch::VERTICAL ) );
+	}
+    }
+
+    MLSToGrid *op = new MLSToGrid();
+    env->attachItem( op );
+    op->setInput( mls );
+    op->setOutput( grid, "top" );
+    op->setBandName( MLSToGrid::BOTTOM, "bottom" );
+    op->setBandName( MLSToGrid::STDEV, "stdev" );
+    op->setBandName( MLSToGrid::PATCH_COUNT, "count" );
+    op->setBandName( MLSToGrid::VERTICAL_EXTENT, "extent" );
+    op->setBandName( MLSToGrid::CLEARANCE, "clearance" );
+    op->setIncremental( true );
+    op->updateAll();
+
+    BOOST_CHECK_CLOSE( grid->getGridData( "top" )[5][3], 0.5, 1e-6 );
+    BOOST_CHECK_CLOSE( grid->getGridData( "top" )[25][3], 2.5, 1e-6 );
+    BOOST_CHECK_CLOSE( grid->getGridData( "stdev" )[25][3], 0.2, 1e-4 );
+    BOOST_CHECK_CLOSE( grid->getGridData( "bottom" )[25][3], 0.5, 1e-6 );
+    BOOST_CHECK_EQUAL( grid->getGridData( "count" )[25][3], 2 );
+    BOOST_CHECK_CLOSE( grid->getGridData( "extent" )[25][3], 2.0, 1e-6 );
+    BOOST_CHECK_CLOSE( grid->getGridData( "clearance" )[25][3], 1.5, 1e-6 );
+    BOOST_CHECK( grid->getGridData( "clearance" )[5][3] == std::numeric_limits<double>::infinity() );
+
+    // only the modified tile is rasterized again
+    grid->getGridData( "top" )[5][30] = -1.0;
+    grid->setNoData( "top", -10.0 );
+    mls->clearCell( 3, 5 );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( grid->getGridData( "top" )[5][3], -10.0 );
+    BOOST_CHECK_EQUAL( grid->getGridData( "count" )[5][3], 0 );
+    BOOST_CHECK_EQUAL( grid->getGridData( "top" )[5][30], -1.0 );
+}
+
+static void setGround( MLSGrid *mls, size_t xBegin, size_t xEnd, double height )
+{
+    for( size_t m=xBegin; m<xEnd; m++ )
+    {
+	for( size_t n=0; n<40; n++ )
+	{
+	    mls->clearCell( m, n );
+	    mls->insertHead( m, n, MLSGrid::SurfacePatch( height, 0.01 ) );
+	}
+    }
+}
+
+BOOST_AUTO_TEST_CASE( traversability_grassfire_incremental )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    MLSGrid *mls = new MLSGrid( 40, 40, 0.1, 0.1 );
+    env->attachItem( mls );
+    setGround( mls, 0, 40, 0.0 );
+
+    TraversabilityGrassfire::Config config;
+    config.maxStepHeight = 0.2;
+    config.maxSlope = 0.5;
+    config.robotHeight = 0.5;
+    config.numTraversabilityClasses = 10;
+
+    // an incremental and parallel operator, and one doing full updates
+    TraversabilityGrid *grids[2];
+    TraversabilityGrassfire *ops[2];
+    for( int i=0; i<2; i++ )
+    {
+	grids[i] = new TraversabilityGrid( 40, 40, 0.1, 0.1 );
+	env->attachItem( grids[i] );
+	ops[i] = new TraversabilityGrassfire();
+	env->attachItem( ops[i] );
+	ops[i]->setInput( mls );
+	ops[i]->setOutput( grids[i] );
+	ops[i]->setConfig( config );
+	ops[i]->setStartPosition( Eigen::Vector3d( 0.55, 0.55, 0.0 ) );
+    }
+    ops[0]->setIncremental( true );
+    ops[0]->setParallel( true );
+
+    for( int step=0; step<3; step++ )
+    {
+	if( step == 1 )
+	    // a wall the robot can not pass
+	    setGround( mls, 20, 22, 1.0 );
+	else if( step == 2 )
+	    setGround( mls, 20, 22, 0.0 );
+
+	BOOST_REQUIRE( ops[0]->updateAll() );
+	BOOST_REQUIRE( ops[1]->updateAll() );
+
+	TraversabilityGrid::ArrayType const& inc( grids[0]->getGridData( TraversabilityGrid::TRAVERSABILITY ) );
+	TraversabilityGrid::ArrayType const& full( grids[1]->getGridData( TraversabilityGrid::TRAVERSABILITY ) );
+	BOOST_REQUIRE( std::equal( inc.data(), inc.data() + inc.num_elements(), full.data() ) );
+
+	BOOST_CHECK( inc[10][10] > 1 );
+	if( step == 1 )
+	    BOOST_CHECK_EQUAL( inc[10][30], 0 );
+	else
+	    BOOST_CHECK( inc[10][30] > 1 );
+    }
+}
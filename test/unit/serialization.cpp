@@ -7,6 +7,10 @@
 
 #include "envire/maps/MLSGrid.hpp"
 #include "envire/maps/Grids.hpp"
+#include "envire/maps/TriMesh.hpp"
+#include "envire/tools/PlyFile.hpp"
+
+#include <sstream>
 
 using namespace envire;
 
@@ -275,4 +279,147 @@ BOOST_AUTO_TEST_CASE( ImageRGB24_serialization )
     BOOST_CHECK_EQUAL(dg2->getFromRaster( ImageRGB24::B, 20, 1 ), 30 );
 }
 
+BOOST_AUTO_TEST_CASE( Grid_lazy_serialization ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    Grid<double>* grid = new Grid<double>( 100, 80, 0.1, 0.1 );
+    for( size_t y = 0; y < 80; y++ )
+        for( size_t x = 0; x < 100; x++ )
+            grid->getFromRaster( "height", x, y ) = y * 1000 + x;
+    grid->setNoData( "height", -1.0 );
+    env->setFrameNode( grid, env->getRootNode() );
+
+    BandedGrid::setGdalTileSize( 32 );
+    env->serialize(serialization_test_path);
+    BandedGrid::setGdalTileSize( 0 );
+
+    BandedGrid::setLazyLoading( true );
+    boost::scoped_ptr<Environment> env2(Environment::unserialize(serialization_test_path));
+    BandedGrid::setLazyLoading( false );
+    Grid<double>* grid2 = env2->getItems< Grid<double> >().front();
+
+    BOOST_CHECK( grid2->hasBand( "height" ) );
+    BOOST_CHECK( !grid2->isBandLoaded( "height" ) );
+
+    // windowed access does not load the band
+    boost::shared_ptr< GdalBandReader<double> > reader = grid2->openBandReader( "height", 2 );
+    BOOST_CHECK_EQUAL( reader->getBlockSizeX(), 32u );
+    BOOST_CHECK_EQUAL( reader->get( 99, 79 ), 79099 );
+    boost::multi_array<double,2> window;
+    reader->readWindow( GridBase::CellExtents( Eigen::Vector2i( 30, 10 ), Eigen::Vector2i( 70, 40 ) ), window );
+    BOOST_CHECK_EQUAL( window.shape()[0], 31u );
+    BOOST_CHECK_EQUAL( window.shape()[1], 41u );
+    BOOST_CHECK_EQUAL( window[0][0], 10030 );
+    BOOST_CHECK_EQUAL( window[30][40], 40070 );
+    BOOST_CHECK( !grid2->isBandLoaded( "height" ) );
+
+    // the nodata value is read from the file without loading the band
+    BOOST_CHECK( grid2->getNoData( "height" ).second );
+    BOOST_CHECK_EQUAL( grid2->getNoData( "height" ).first, -1.0 );
+    BOOST_CHECK( !grid2->isBandLoaded( "height" ) );
+
+    // the first access loads the whole band
+    BOOST_CHECK_EQUAL( grid2->getFromRaster( "height", 12, 34 ), 34012 );
+    BOOST_CHECK( grid2->isBandLoaded( "height" ) );
+    BOOST_CHECK_EQUAL( grid2->getNoData( "height" ).first, -1.0 );
+}
+
+BOOST_AUTO_TEST_CASE( Grid_raw_band_serialization ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    Grid<float>* grid = new Grid<float>( 60, 40, 0.1, 0.1 );
+    for( size_t y = 0; y < 40; y++ )
+        for( size_t x = 0; x < 60; x++ )
+            grid->getFromRaster( "height", x, y ) = y * 100 + x;
+    grid->setNoData( "height", -1.0 );
+    env->setFrameNode( grid, env->getRootNode() );
+
+    BandedGrid::setRawBandFiles( true );
+    env->serialize(serialization_test_path);
+    BandedGrid::setRawBandFiles( false );
+
+    BandedGrid::setRawBandMapping( MappedFile::COPY_ON_WRITE );
+    boost::scoped_ptr<Environment> env2(Environment::unserialize(serialization_test_path));
+    BandedGrid::setRawBandMapping( MappedFile::READ_ONLY );
+    Grid<float>* grid2 = env2->getItems< Grid<float> >().front();
+
+    BOOST_CHECK( grid2->hasBand( "height" ) );
+    BOOST_CHECK( grid2->isBandMapped( "height" ) );
+    BOOST_CHECK_EQUAL( grid2->getNoData( "height" ).first, -1.0 );
+    BOOST_CHECK( grid2->isBandMapped( "height" ) );
+
+    // reads and copy-on-write modifications do not copy the band
+    BOOST_CHECK_EQUAL( static_cast<Grid<float> const*>( grid2 )->getFromRaster( "height", 12, 34 ), 3412 );
+    grid2->getWritableMappedGridData( "height" )[34][12] = 5;
+    BOOST_CHECK( grid2->isBandMapped( "height" ) );
+
+    // accessing the array copies the band into memory
+    BOOST_CHECK_EQUAL( grid2->getGridData( "height" )[34][12], 5 );
+    BOOST_CHECK_EQUAL( grid2->getGridData( "height" )[39][59], 3959 );
+    BOOST_CHECK( !grid2->isBandMapped( "height" ) );
+
+    // serializing again replaces the files, so existing mappings keep
+    // the previous data
+    boost::scoped_ptr<Environment> env3(Environment::unserialize(serialization_test_path));
+    Grid<float> const* grid3 = env3->getItems< Grid<float> >().front();
+    grid->getFromRaster( "height", 12, 34 ) = 7;
+    BandedGrid::setRawBandFiles( true );
+    env->serialize(serialization_test_path);
+    BandedGrid::setRawBandFiles( false );
+    BOOST_CHECK( grid3->isBandMapped( "height" ) );
+    BOOST_CHECK_EQUAL( grid3->getConstGridData( "height" )[34][12], 3412 );
+}
+
+BOOST_AUTO_TEST_CASE( TriMesh_ply_serialization )
+{
+    TriMesh::Ptr mesh = new TriMesh();
+    std::vector<Eigen::Vector3d> &colors( mesh->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+    for( int i = 0; i < 1000; i++ )
+    {
+	mesh->vertices.push_back( Eigen::Vector3d( i, i * 0.5, -i ) );
+	colors.push_back( Eigen::Vector3d( 1.0, 0, 0 ) );
+    }
+    mesh->faces.push_back( TriMesh::triangle_t( 0, 1, 2 ) );
+    mesh->faces.push_back( TriMesh::triangle_t( 997, 998, 999 ) );
+
+    for( int doublePrecision = 0; doublePrecision < 2; doublePrecision++ )
+    {
+	std::stringstream ss;
+	PlyFile( "mesh.ply" ).serialize( mesh.get(), ss, doublePrecision );
+
+	TriMesh::Ptr mesh2 = new TriMesh();
+	BOOST_CHECK( PlyFile( "mesh.ply" ).unserialize( mesh2.get(), ss ) );
+	BOOST_REQUIRE_EQUAL( mesh2->vertices.size(), mesh->vertices.size() );
+	BOOST_CHECK_EQUAL( mesh2->vertices[999], mesh->vertices[999] );
+	BOOST_CHECK_EQUAL( mesh2->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR )[10], Eigen::Vector3d( 1.0, 0, 0 ) );
+	BOOST_REQUIRE_EQUAL( mesh2->faces.size(), 2u );
+	BOOST_CHECK( mesh2->faces[1] == mesh->faces[1] );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( Pointcloud_ply_field_order )
+{
+    // the vertex fields are not in x, y, z order and the colors are
+    // doubles, so neither element can be copied as a whole
+    std::stringstream ss;
+    ss << "ply\nformat binary_little_endian 1.0\n"
+	<< "element vertex 2\nproperty double z\nproperty double y\nproperty double x\n"
+	<< "element color 2\nproperty double red\nproperty double green\nproperty double blue\n"
+	<< "end_header\n";
+    const double values[12] = { 3, 2, 1, 6, 5, 4, 255, 0, 51, 0, 102, 255 };
+    ss.write( reinterpret_cast<const char*>( values ), sizeof( values ) );
+
+    Pointcloud::Ptr pc = new Pointcloud();
+    BOOST_CHECK( PlyFile( "pc.ply" ).unserialize( pc.get(), ss ) );
+    BOOST_REQUIRE_EQUAL( pc->vertices.size(), 2u );
+    BOOST_CHECK_EQUAL( pc->vertices[0], Eigen::Vector3d( 1, 2, 3 ) );
+    BOOST_CHECK_EQUAL( pc->vertices[1], Eigen::Vector3d( 4, 5, 6 ) );
+    const std::vector<Eigen::Vector3d>& colors( pc->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+    BOOST_REQUIRE_EQUAL( colors.size(), 2u );
+    BOOST_CHECK( (colors[0] - Eigen::Vector3d( 1.0, 0, 0.2 )).norm() < 1e-9 );
+    BOOST_CHECK( (colors[1] - Eigen::Vector3d( 0, 0.4, 1.0 )).norm() < 1e-9 );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
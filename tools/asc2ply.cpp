@@ -1,5 +1,6 @@
 #include "envire/Core.hpp"
 #include "envire/maps/Pointcloud.hpp"
+#include "envire/tools/PointcloudTextReader.hpp"
 #ifdef ENVIRE_USE_CGAL
 #include "envire/operators/SimplifyPointcloud.hpp"
 #endif
@@ -41,12 +42,19 @@ int main( int argc, char* argv[] )
     Pointcloud::Ptr pc = new Pointcloud();
     env.attachItem( pc.get() );
     env.setFrameNode( pc.get(), env.getRootNode() );
-    ifstream asc( asc_file.c_str() );
-    pc->readText( asc, sampling, Pointcloud::XYZR );
 
+    PointcloudTextReader reader;
+    reader.setFormat( Pointcloud::XYZR );
+    reader.setStride( std::max( sampling, 1 ) );
+#ifndef ENVIRE_USE_CGAL
+    // without CGAL, subsample to the cell size while reading
+    reader.setVoxelSize( cell_size );
+#endif
+    reader.read( asc_file, *pc );
+
+#ifdef ENVIRE_USE_CGAL
     if( cell_size > 0 )
     {
-#ifdef ENVIRE_USE_CGAL
 	Pointcloud::Ptr pc_simp = new Pointcloud();
 	env.attachItem( pc_simp.get() );
 	env.setFrameNode( pc_simp.get(), env.getRootNode() );
@@ -60,10 +68,8 @@ int main( int argc, char* argv[] )
 	spc->updateAll();
 
 	pc = pc_simp;
-#else
-	std::cout << "ignoring cell_size parameter since CGAL is not compiled in." << std::endl;
-#endif
     }
+#endif
 
     ofstream ply( ply_file.c_str() );
     pc->writePly( ply_file, ply );
@@ -26,36 +26,31 @@ int main( int argc, char* argv[] )
     
     // get trajectory
     std::ifstream file( argv[2] );
-    
-    while( !file.eof() )
+    std::vector<Eigen::Vector3d> trajectory;
+    double x,y,z;
+    while( file >> x >> y >> z )
+	trajectory.push_back( Eigen::Vector3d( x, y, z ) );
+
+    // query the top patch for all points of the trajectory at once
+    // for each of the grids
+    const size_t count = trajectory.size();
+    std::vector<double> tops( count * items.size(), -1e9 );
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > mp( count );
+    for( size_t m = 0; m < items.size() && count > 0; m++ )
+    {
+	MLSGrid *mls = items[m];
+
+	// points in map
+	for( size_t i = 0; i < count; i++ )
+	    mp[i] = mls->toMap( trajectory[i] ).head<2>();
+
+	mls->getTop( &mp[0], count, &tops[m * count] );
+    }
+
+    for( size_t i = 0; i < count; i++ )
     {
-	double x,y,z;
-	file >> x >> y >> z; 
-	Eigen::Vector3d p( x, y, z );
-
-	for( std::vector<MLSGrid*>::iterator it=items.begin(); it != items.end(); it++ )
-	{
-	    MLSGrid *mls = *it;
-	    double top = -1e9;
-
-	    // point in map
-	    Eigen::Vector3d mp = mls->toMap( p );
-	    MLSGrid::Position pos;
-	    if( mls->toGrid( mp.head<2>(), pos ) )
-	    {
-		MLSGrid::iterator gi = mls->beginCell( pos.x, pos.y );
-		while( gi != mls->endCell() )
-		{
-		    if( gi->mean > top )
-		    {
-			top = gi->mean;
-		    }
-		    gi++;
-		}
-	    }
-
-	    std::cout << top << " ";
-	}
+	for( size_t m = 0; m < items.size(); m++ )
+	    std::cout << tops[m * count + i] << " ";
 	std::cout << std::endl;
     }
 }